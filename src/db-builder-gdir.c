@@ -18,15 +18,44 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <string.h>
+#include <glib/gstdio.h>
+
 #include "db-builder.h"
 #include "db-builder-gdir.h"
+#include "dmapd-playlist.h"
 
 #include <libdmapsharing/dmap.h>
 
-/*
+/* Playlists are read after the walk, when locations holds the ID of each
+ * file seen, so most entries resolve without asking the media DB.
+ *
+ * With more than one job, new files' records are created by a pool of
+ * threads and added to the DB by the walking thread as they arrive.
+ * Directory containers hold their new files as pending locations, which
+ * keeps directory order, and are added once the pool is done.
+ */
 struct DbBuilderGDirPrivate {
+	GHashTable *locations; /* URI -> ID; NULL unless building containers. */
+	GSList *playlists;     /* Paths, most recent first.                   */
+	guint jobs;
+	GThreadPool *pool;     /* NULL unless jobs > 1.                       */
+	GAsyncQueue *created;  /* Of job_t, from the pool.                    */
+	guint outstanding;     /* Jobs not yet taken from created.            */
+	GSList *containers;    /* Waiting for the pool, most recent first.    */
+	DMAPRecordFactory *factory;
+};
+
+typedef struct {
+	gchar *path;
+	gchar *location;
+	DMAPRecord *record;    /* NULL if the file could not be read.         */
+} job_t;
+
+enum {
+	PROP_0,
+	PROP_JOBS
 };
-*/
 
 static void
 db_builder_gdir_set_property (GObject *object,
@@ -34,7 +63,16 @@ db_builder_gdir_set_property (GObject *object,
                                  const GValue *value,
                                  GParamSpec *pspec)
 {
-        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+	DbBuilderGDir *builder = DB_BUILDER_GDIR (object);
+
+	switch (prop_id) {
+	case PROP_JOBS:
+		builder->priv->jobs = g_value_get_uint (value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
 }
 
 static void
@@ -43,7 +81,104 @@ db_builder_gdir_get_property (GObject *object,
                                  GValue *value,
                                  GParamSpec *pspec)
 {
-        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+	DbBuilderGDir *builder = DB_BUILDER_GDIR (object);
+
+	switch (prop_id) {
+	case PROP_JOBS:
+		g_value_set_uint (value, builder->priv->jobs);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		break;
+	}
+}
+
+/* Runs in the pool. */
+static void
+create_record (job_t *job, DbBuilderGDirPrivate *priv)
+{
+	job->record = dmap_record_factory_create (priv->factory, job->path);
+	g_async_queue_push (priv->created, job);
+}
+
+/* Like the add_path of DmapdDMAPDbGHashTable, skips unacceptable formats. */
+static gboolean
+acceptable (DMAPDb *db, DMAPRecord *record)
+{
+	gboolean fnval = TRUE;
+	gchar *format = NULL;
+	GSList *acceptable_formats = NULL;
+
+	g_object_get (db, "acceptable-formats", &acceptable_formats, NULL);
+
+	if (NULL != acceptable_formats) {
+		g_object_get (record, "format", &format, NULL);
+		fnval = NULL != format
+		     && NULL != g_slist_find_custom (acceptable_formats, format, (GCompareFunc) strcmp);
+	}
+
+	g_free (format);
+
+	return fnval;
+}
+
+static void
+add_created (DbBuilderGDirPrivate *priv, DMAPDb *db, job_t *job)
+{
+	guint id = 0;
+
+	if (NULL != job->record && acceptable (db, job->record)) {
+		id = dmap_db_add (db, job->record);
+	}
+
+	if (id) {
+		g_debug ("Done processing %s with id. %u (record #%u).", job->path, id, dmap_db_count (db));
+		if (NULL != priv->locations) {
+			g_hash_table_insert (priv->locations, job->location, GUINT_TO_POINTER (id));
+			job->location = NULL;
+		}
+	} else {
+		g_debug ("Skipped %s", job->path);
+	}
+
+	if (NULL != job->record) {
+		g_object_unref (job->record);
+	}
+
+	g_free (job->location);
+	g_free (job->path);
+	g_free (job);
+}
+
+/* Adds the records the pool has created; with wait, all of them. */
+static void
+drain (DbBuilderGDirPrivate *priv, DMAPDb *db, gboolean wait)
+{
+	job_t *job;
+
+	while (priv->outstanding > 0) {
+		job = wait ? g_async_queue_pop (priv->created) : g_async_queue_try_pop (priv->created);
+		if (NULL == job) {
+			break;
+		}
+
+		priv->outstanding--;
+		add_created (priv, db, job);
+	}
+}
+
+static void
+add_container (DMAPContainerDb *container_db, DMAPContainerRecord *record)
+{
+	gchar *name = NULL;
+
+	if (dmap_container_record_get_entry_count (record) > 0) {
+		dmap_container_db_add (container_db, record);
+	} else {
+		g_object_get (record, "name", &name, NULL);
+		g_warning ("Container %s is empty, skipping", name);
+		g_free (name);
+	}
 }
 
 static gint
@@ -53,6 +188,104 @@ add_file_to_db (const char *path,
 	return dmap_db_add_path (db, path);
 }
 
+static void
+add_playlist (DbBuilderGDirPrivate *priv,
+	      const gchar *path,
+	      DMAPDb *db,
+	      DmapdDMAPContainerDb *container_db)
+{
+	guint i, id;
+	gchar *dot;
+	GStatBuf buf;
+	gint mtime = 0;
+	guint64 filesize = 0;
+	gchar *name = NULL;
+	GError *error = NULL;
+	GPtrArray *uris = NULL;
+	DMAPContainerRecord *record = NULL;
+	gchar *location = g_filename_to_uri (path, NULL, NULL);
+
+	if (0 == g_stat (path, &buf)) {
+		mtime = buf.st_mtime;
+		filesize = buf.st_size;
+	}
+
+	/* A stored playlist with the same mtime and size is not read again. */
+	record = dmapd_dmap_container_db_lookup_by_location (container_db, location);
+	if (NULL != record) {
+		gint stored_mtime = 0;
+		guint64 stored_filesize = 0;
+
+		g_object_get (record, "mtime", &stored_mtime, "filesize", &stored_filesize, NULL);
+		g_object_unref (record);
+		record = NULL;
+
+		if (0 != mtime && stored_mtime == mtime && stored_filesize == filesize) {
+			g_debug ("Playlist %s is unchanged", path);
+			goto _done;
+		}
+	}
+
+	uris = dmapd_playlist_parse (path, &error);
+	if (NULL == uris) {
+		g_warning ("Could not read playlist %s: %s", path, error->message);
+		g_error_free (error);
+		goto _done;
+	}
+
+	if (0 == uris->len) {
+		g_warning ("Playlist %s is empty, skipping", path);
+		goto _done;
+	}
+
+	name = g_path_get_basename (path);
+	if (NULL != (dot = strrchr (name, '.'))) {
+		*dot = 0x00;
+	}
+
+	id = dmapd_dmap_container_db_assign_id (container_db, location);
+	record = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD,
+	                                              "id", id,
+	                                              "name", name,
+	                                              "location", location,
+	                                              "mtime", mtime,
+	                                              "filesize", filesize,
+	                                              "ordered", TRUE,
+	                                              "full-db", db,
+	                                              NULL));
+
+	for (i = 0; i < uris->len; i++) {
+		const gchar *uri = g_ptr_array_index (uris, i);
+		guint entry_id = GPOINTER_TO_UINT (g_hash_table_lookup (priv->locations, uri));
+
+		/* NOTE: entries outside this walk wait until a client asks. */
+		if (0 != entry_id) {
+			dmap_container_record_add_entry (record, NULL, entry_id);
+		} else {
+			dmapd_dmap_container_record_add_pending (DMAPD_DMAP_CONTAINER_RECORD (record), uri);
+		}
+	}
+
+	g_debug ("Done processing playlist %s with id. %u (%u entries pending).",
+	          path,
+	          id,
+	          dmapd_dmap_container_record_get_pending_count (DMAPD_DMAP_CONTAINER_RECORD (record)));
+
+	dmap_container_db_add (DMAP_CONTAINER_DB (container_db), record);
+
+_done:
+	if (NULL != record) {
+		g_object_unref (record);
+	}
+
+	if (NULL != uris) {
+		g_ptr_array_free (uris, TRUE);
+	}
+
+	g_free (name);
+	g_free (location);
+}
+
 static void
 db_builder_gdir_build_db_starting_at (DbBuilder *builder, 
 				      const char *dir,
@@ -60,10 +293,23 @@ db_builder_gdir_build_db_starting_at (DbBuilder *builder,
 				      DMAPContainerDb *container_db, // NULL if we don't want directory containers.
 				      DMAPContainerRecord *container_record)
 {
+	GSList *l;
 	GError *error = NULL;
+	DbBuilderGDirPrivate *priv = DB_BUILDER_GDIR (builder)->priv;
+	gboolean top = NULL == container_record;
 
 	GDir *d = g_dir_open (dir, 0, &error);
 
+	if (top && NULL != container_db) {
+		priv->locations = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	}
+
+	if (top && priv->jobs > 1) {
+		g_object_get (db, "record-factory", &priv->factory, NULL);
+		priv->created = g_async_queue_new ();
+		priv->pool = g_thread_pool_new ((GFunc) create_record, priv, priv->jobs, FALSE, NULL);
+	}
+
 	if (error != NULL) {
 		g_warning ("%s", error->message);
 	} else {
@@ -73,26 +319,52 @@ db_builder_gdir_build_db_starting_at (DbBuilder *builder,
 			gchar *path = g_strdup_printf ("%s/%s", dir, entry);
 
 			if (g_file_test (path, G_FILE_TEST_IS_DIR)) {
-				DMAPContainerRecord *record = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD, "name", entry, "full-db", db, NULL));
-				db_builder_gdir_build_db_starting_at (builder, path, db, container_db, record);
+				guint container_id = 0;
+				gchar *location = g_filename_to_uri (path, NULL, NULL);
+				DMAPContainerRecord *record;
+
 				if (NULL != container_db) {
-					if (dmap_container_record_get_entry_count (record) > 0) {
-						dmap_container_db_add (container_db, record);
-					} else {
-						g_warning ("Container %s is empty, skipping", entry);
-					}
+					container_id = dmapd_dmap_container_db_assign_id (DMAPD_DMAP_CONTAINER_DB (container_db), location);
+				}
+
+				record = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD, "id", container_id, "name", entry, "location", location, "full-db", db, NULL));
+				g_free (location);
+				db_builder_gdir_build_db_starting_at (builder, path, db, container_db, record);
+				if (NULL != container_db && NULL != priv->pool) {
+					priv->containers = g_slist_prepend (priv->containers, record);
+					record = NULL;
+				} else if (NULL != container_db) {
+					add_container (container_db, record);
+				}
+
+				if (NULL != record) {
+					g_object_unref (record);
 				}
-				g_object_unref (record);
+			} else if (NULL != priv->locations && dmapd_playlist_is_playlist (path)) {
+				priv->playlists = g_slist_prepend (priv->playlists, path);
+				continue;
 			} else {
 				gchar *location;
 				guint id = 0;
 
 				location = g_filename_to_uri (path, NULL, NULL);
-				// FIXME: very expensive for BDB module:
 				id = dmap_db_lookup_id_by_location (db, location);
-				g_free (location);
 
-				if (! id) {
+				if (! id && NULL != priv->pool) {
+					job_t *job = g_new0 (job_t, 1);
+
+					if (container_record) {
+						dmapd_dmap_container_record_add_pending (DMAPD_DMAP_CONTAINER_RECORD (container_record), location);
+					}
+
+					job->path = path;
+					job->location = location;
+					priv->outstanding++;
+					g_thread_pool_push (priv->pool, job, NULL);
+
+					drain (priv, db, FALSE);
+					continue;
+				} else if (! id) {
 					id = add_file_to_db (path, db);
 					g_debug ("Done processing %s with id. %u (record #%u).", path, id, dmap_db_count (db));
 				} else {
@@ -103,21 +375,58 @@ db_builder_gdir_build_db_starting_at (DbBuilder *builder,
 					if (container_record) {
 						dmap_container_record_add_entry (container_record, NULL, id);
 					}
+					if (priv->locations) {
+						g_hash_table_insert (priv->locations, location, GUINT_TO_POINTER (id));
+						location = NULL;
+					}
 				} else {
 					g_debug ("Skipped %s", path);
 				}
+
+				g_free (location);
 			}
 			g_free (path);
 		}
 		
 		g_dir_close (d);
 	}
+
+	if (top && NULL != priv->pool) {
+		drain (priv, db, TRUE);
+
+		g_thread_pool_free (priv->pool, FALSE, TRUE);
+		priv->pool = NULL;
+		g_async_queue_unref (priv->created);
+		priv->created = NULL;
+
+		/* NOTE: counting resolves the containers' pending entries. */
+		priv->containers = g_slist_reverse (priv->containers);
+		for (l = priv->containers; l; l = l->next) {
+			add_container (container_db, l->data);
+		}
+
+		g_slist_free_full (priv->containers, g_object_unref);
+		priv->containers = NULL;
+	}
+
+	if (top && NULL != priv->locations) {
+		priv->playlists = g_slist_reverse (priv->playlists);
+		for (l = priv->playlists; l; l = l->next) {
+			add_playlist (priv, l->data, db, DMAPD_DMAP_CONTAINER_DB (container_db));
+		}
+
+		g_slist_free_full (priv->playlists, g_free);
+		priv->playlists = NULL;
+		g_hash_table_destroy (priv->locations);
+		priv->locations = NULL;
+	}
 }
 
 static void
 db_builder_gdir_init (DbBuilderGDir *builder)
 {
-        /* builder->priv = DB_BUILDER_GDIR_GET_PRIVATE (builder); */
+        builder->priv = DB_BUILDER_GDIR_GET_PRIVATE (builder);
+	builder->priv->jobs = 1;
 }
 
 static void
@@ -136,13 +445,23 @@ static void db_builder_gdir_class_init (DbBuilderGDirClass *klass)
 	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 	DbBuilderClass *db_builder_class = DB_BUILDER_CLASS (klass);
 
-        /* g_type_class_add_private (klass, sizeof (DbBuilderGDirPrivate)); */
+        g_type_class_add_private (klass, sizeof (DbBuilderGDirPrivate));
 
         gobject_class->set_property = db_builder_gdir_set_property;
         gobject_class->get_property = db_builder_gdir_get_property;
         gobject_class->finalize     = db_builder_gdir_finalize;
 
 	db_builder_class->build_db_starting_at = db_builder_gdir_build_db_starting_at;
+
+	/* NOTE: the record factory must be safe to use from several threads. */
+	g_object_class_install_property (gobject_class, PROP_JOBS,
+					 g_param_spec_uint ("jobs",
+							    "Jobs",
+							    "Number of threads that read new files",
+							    1,
+							    G_MAXUINT,
+							    1,
+							    G_PARAM_READWRITE));
 }
 
 static void db_builder_gdir_register_type (GTypeModule *module);
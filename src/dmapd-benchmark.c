@@ -0,0 +1,507 @@
+/*   FILE: dmapd-benchmark.c -- Offline benchmarks for dmapd components
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <libdmapsharing/dmap.h>
+
+#include "util.h"
+#include "dmapd-dmap-db.h"
+#include "dmapd-daap-record.h"
+#include "dmapd-daap-record-factory.h"
+#include "dmapd-dmap-container-record.h"
+#include "dmapd-dmap-db-ghashtable.h"
+#include "dmapd-dpap-record.h"
+#include "dmapd-chunk-stream.h"
+#include "dmapd-file-stream.h"
+#include "photo-meta-reader.h"
+
+#define STREAM_READ_SIZE (64 * 1024) /* As a server might send at once. */
+
+static gchar *module_dir = NULL;
+static gchar *scratch_dir = NULL;
+static gchar *db_modules = NULL;
+static gint record_count = 10000;
+static gint container_entries = 0;
+static gchar *photo_modules = NULL;
+static gchar *photo_dir = NULL;
+static gint resize_width = 1024;
+static gchar *stream_file = NULL;
+static gchar *chunk_sizes = "0,256,1024,4096";
+
+static GOptionEntry entries[] = {
+	{ "db-modules", 'd', 0, G_OPTION_ARG_STRING, &db_modules, "Comma-separated database modules to benchmark, e.g., ghashtable,disk,bdb,sqlite", NULL },
+	{ "count", 'n', 0, G_OPTION_ARG_INT, &record_count, "Number of records to use; default is 10000", NULL },
+	{ "container-entries", 'c', 0, G_OPTION_ARG_INT, &container_entries, "Number of entries for the container benchmark, e.g., 50000", NULL },
+	{ "scratch-dir", 's', 0, G_OPTION_ARG_FILENAME, &scratch_dir, "Directory for generated media and databases; default is a new temporary directory", NULL },
+	{ "photo-modules", 'p', 0, G_OPTION_ARG_STRING, &photo_modules, "Comma-separated photograph reader modules to benchmark, e.g., vips,graphicsmagick", NULL },
+	{ "photo-dir", 'P', 0, G_OPTION_ARG_FILENAME, &photo_dir, "Directory of photographs for the photograph reader benchmark", NULL },
+	{ "resize-width", 'w', 0, G_OPTION_ARG_INT, &resize_width, "Width photographs are resized to; default is 1024", NULL },
+	{ "stream-file", 'f', 0, G_OPTION_ARG_FILENAME, &stream_file, "Local file to read for the streaming benchmark, e.g., a large video", NULL },
+	{ "chunk-sizes", 'k', 0, G_OPTION_ARG_STRING, &chunk_sizes, "Comma-separated chunk sizes in KB for the streaming benchmark; 0 reads directly; default is 0,256,1024,4096", NULL },
+	{ NULL }
+};
+
+static void
+report (const gchar *module, const gchar *operation, GTimer *timer, guint n)
+{
+	gdouble elapsed = g_timer_elapsed (timer, NULL);
+
+	g_print ("%-12s %-24s %10.3f s %12.0f ops/s\n",
+	          module,
+	          operation,
+	          elapsed,
+	          elapsed > 0 ? n / elapsed : 0);
+}
+
+/* Synthetic media files, each with unique content and so a unique hash. */
+static GPtrArray *
+make_records (const gchar *dir, guint n)
+{
+	guint i;
+	GPtrArray *records = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_mkdir_with_parents (dir, 0755);
+
+	for (i = 0; i < n; i++) {
+		gchar *path, *uri, *contents, *title, *artist, *album, *genre;
+		guchar hash[DMAP_HASH_SIZE];
+		GByteArray *hash_array;
+		DMAPRecord *record;
+
+		path     = g_strdup_printf ("%s/%08u.mp3", dir, i);
+		contents = g_strdup_printf ("dmapd-benchmark %u", i);
+		g_file_set_contents (path, contents, -1, NULL);
+
+		uri = g_filename_to_uri (path, NULL, NULL);
+		g_assert (dmapd_util_hash_file (uri, hash));
+		hash_array = g_byte_array_sized_new (DMAP_HASH_SIZE);
+		g_byte_array_append (hash_array, hash, DMAP_HASH_SIZE);
+
+		title  = g_strdup_printf ("Title %u", i);
+		artist = g_strdup_printf ("Artist %u", i % 1000);
+		album  = g_strdup_printf ("Album %u", i % 5000);
+		genre  = g_strdup_printf ("Genre %u", i % 20);
+
+		record = DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD,
+		                                    "location", uri,
+		                                    "hash", hash_array,
+		                                    "title", title,
+		                                    "songalbum", album,
+		                                    "songartist", artist,
+		                                    "songgenre", genre,
+		                                    "format", "mp3",
+		                                    "filesize", (guint64) strlen (contents),
+		                                    "duration", 180,
+		                                    "track", i % 12 + 1,
+		                                    "year", 1960 + i % 60,
+		                                    "disc", 1,
+		                                    "bitrate", 128,
+		                                    NULL));
+		g_ptr_array_add (records, record);
+
+		g_byte_array_unref (hash_array);
+		g_free (path);
+		g_free (uri);
+		g_free (contents);
+		g_free (title);
+		g_free (artist);
+		g_free (album);
+		g_free (genre);
+	}
+
+	return records;
+}
+
+static void
+count_record (gpointer id, DMAPRecord *record, guint *n)
+{
+	(*n)++;
+}
+
+static DMAPDb *
+open_db (const gchar *module, const gchar *dir, DMAPRecordFactory *factory)
+{
+	return DMAP_DB (object_from_module (TYPE_DMAPD_DMAP_DB,
+	                                    module_dir,
+	                                    module,
+	                                    "db-dir",
+	                                    dir,
+	                                    "record-factory",
+	                                    factory,
+	                                    NULL));
+}
+
+static void
+benchmark_db (const gchar *module, GPtrArray *records)
+{
+	guint i, n;
+	guint *ids;
+	gchar *dir;
+	DMAPDb *db;
+	GTimer *timer;
+	DMAPRecordFactory *factory;
+	DmapdDMAPDbQuery query = { "songgenre", "Genre 7", "year", FALSE, 0 };
+
+	dir = g_strdup_printf ("%s/%s", scratch_dir, module);
+	g_mkdir_with_parents (dir, 0755);
+
+	factory = DMAP_RECORD_FACTORY (g_object_new (TYPE_DMAPD_DAAP_RECORD_FACTORY, NULL));
+	timer = g_timer_new ();
+	ids = g_new0 (guint, records->len);
+
+	if (NULL == (db = open_db (module, dir, factory))) {
+		g_warning ("Could not load database module %s; skipping", module);
+		goto _done;
+	}
+
+	g_timer_start (timer);
+	for (i = 0; i < records->len; i++) {
+		ids[i] = dmap_db_add (db, g_ptr_array_index (records, i));
+	}
+	report (module, "add", timer, records->len);
+
+	g_timer_start (timer);
+	for (i = 0; i < records->len; i++) {
+		gchar *location = NULL;
+		g_object_get (g_ptr_array_index (records, i), "location", &location, NULL);
+		if (dmap_db_lookup_id_by_location (db, location) != ids[i]) {
+			g_warning ("%s: wrong ID for %s", module, location);
+		}
+		g_free (location);
+	}
+	report (module, "lookup_id_by_location", timer, records->len);
+
+	g_timer_start (timer);
+	for (i = 0; i < records->len; i++) {
+		DMAPRecord *record = dmap_db_lookup_by_id (db, ids[i]);
+		if (NULL != record) {
+			g_object_unref (record);
+		}
+	}
+	report (module, "lookup_by_id", timer, records->len);
+
+	n = 0;
+	g_timer_start (timer);
+	dmap_db_foreach (db, (GHFunc) count_record, &n);
+	report (module, "foreach", timer, n);
+
+	n = 0;
+	g_timer_start (timer);
+	dmapd_dmap_db_query (db, &query, (GHFunc) count_record, &n);
+	report (module, "query genre by year", timer, n);
+
+	g_object_unref (db);
+
+	g_timer_start (timer);
+	db = open_db (module, dir, factory);
+	report (module, "reopen", timer, 1);
+	g_print ("%-12s %-24s %10" G_GINT64_FORMAT " records\n", module, "after reopen", dmap_db_count (db));
+	g_object_unref (db);
+
+_done:
+	g_free (ids);
+	g_free (dir);
+	g_timer_destroy (timer);
+	g_object_unref (factory);
+}
+
+static void
+benchmark_container (guint n)
+{
+	guint i;
+	guint count = 0;
+	guint *ids;
+	GSList *list = NULL;
+	DMAPDb *db, *entries;
+	GTimer *timer;
+	DMAPContainerRecord *container;
+
+	/* Records need not be backed by files; nothing is stored. */
+	db = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+	ids = g_new (guint, n);
+	for (i = 0; i < n; i++) {
+		gchar *uri = g_strdup_printf ("file:///dmapd-benchmark/%08u.mp3", i);
+		DMAPRecord *record = DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD,
+		                                                "location", uri,
+		                                                "disc", (gint) (n - i) % 3 + 1,
+		                                                "track", (gint) (n - i) % 20 + 1,
+		                                                NULL));
+		ids[i] = dmap_db_add (db, record);
+		g_object_unref (record);
+		g_free (uri);
+	}
+
+	timer = g_timer_new ();
+
+	/* The former container representation, for comparison: */
+	g_timer_start (timer);
+	for (i = 0; i < n; i++) {
+		list = g_slist_append (list, GUINT_TO_POINTER (ids[i]));
+	}
+	count = g_slist_length (list);
+	report ("container", "GSList append", timer, count);
+	g_slist_free (list);
+
+	container = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD,
+	                                                 "name", "benchmark",
+	                                                 "full-db", db,
+	                                                 NULL));
+
+	g_timer_start (timer);
+	for (i = 0; i < n; i++) {
+		dmap_container_record_add_entry (container, NULL, ids[i]);
+	}
+	count = dmap_container_record_get_entry_count (container);
+	report ("container", "add_entry", timer, count);
+
+	g_timer_start (timer);
+	dmapd_dmap_container_record_sort_entries (DMAPD_DMAP_CONTAINER_RECORD (container));
+	report ("container", "sort by disc and track", timer, n);
+
+	count = 0;
+	g_timer_start (timer);
+	entries = dmap_container_record_get_entries (container);
+	dmap_db_foreach (entries, (GHFunc) count_record, &count);
+	g_object_unref (entries);
+	report ("container", "get_entries and foreach", timer, count);
+
+	g_object_unref (container);
+	g_object_unref (db);
+	g_timer_destroy (timer);
+	g_free (ids);
+}
+
+/* Reads each photograph in dir, as the gdir builder would, then resizes
+ * each as for a hires request. Run one module per process to compare
+ * peak memory.
+ */
+static void
+benchmark_photo (const gchar *module, const gchar *dir)
+{
+	GDir *d;
+	guint n = 0, failed = 0;
+	const gchar *entry;
+	GTimer *timer;
+	GPtrArray *paths;
+	struct rusage usage;
+	GError *error = NULL;
+	PhotoMetaReader *reader;
+
+	timer = g_timer_new ();
+	paths = g_ptr_array_new_with_free_func (g_free);
+
+	reader = PHOTO_META_READER (object_from_module (TYPE_PHOTO_META_READER, module_dir, module, NULL));
+	if (NULL == reader) {
+		g_warning ("Could not load photograph reader module %s; skipping", module);
+		goto _done;
+	}
+
+	/* NOTE: readers initialize their libraries here; the group is theirs. */
+	(void) photo_meta_reader_get_option_group (reader);
+
+	d = g_dir_open (dir, 0, &error);
+	if (NULL == d) {
+		g_error ("Could not open %s: %s", dir, error->message);
+	}
+
+	while ((entry = g_dir_read_name (d))) {
+		gchar *path = g_build_filename (dir, entry, NULL);
+		if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+			g_ptr_array_add (paths, path);
+		} else {
+			g_free (path);
+		}
+	}
+	g_dir_close (d);
+
+	g_timer_start (timer);
+	for (n = 0; n < paths->len; n++) {
+		DmapdDPAPRecord *record = dmapd_dpap_record_new (g_ptr_array_index (paths, n), reader, NULL);
+		if (NULL == record) {
+			failed++;
+		} else {
+			g_object_unref (record);
+		}
+	}
+	report (module, "read with thumbnail", timer, paths->len);
+
+	g_timer_start (timer);
+	for (n = 0; n < paths->len; n++) {
+		GByteArray *resized = photo_meta_reader_resize (reader, g_ptr_array_index (paths, n), resize_width);
+		if (NULL != resized) {
+			g_byte_array_unref (resized);
+		}
+	}
+	report (module, "resize", timer, paths->len);
+
+	getrusage (RUSAGE_SELF, &usage);
+	g_print ("%-12s %-24s %10u of %u\n", module, "unreadable", failed, paths->len);
+	g_print ("%-12s %-24s %10ld KB\n", module, "peak resident set", usage.ru_maxrss);
+
+	g_object_unref (reader);
+
+_done:
+	g_ptr_array_free (paths, TRUE);
+	g_timer_destroy (timer);
+}
+
+/* Reads path as a record would be served, through chunks of chunk_kb KB.
+ * The first run warms the page cache; drop it between runs, or list the
+ * first size twice, to compare sizes fairly.
+ */
+static void
+benchmark_stream (const gchar *path, guint chunk_kb)
+{
+	gssize n;
+	guint64 total = 0;
+	gdouble elapsed;
+	gchar *uri, *operation;
+	guint8 *buf;
+	GTimer *timer;
+	GError *error = NULL;
+	GInputStream *stream;
+
+	uri = g_filename_to_uri (path, NULL, &error);
+	if (NULL == uri) {
+		g_error ("Could not convert %s to URI: %s", path, error->message);
+	}
+
+	operation = 0 == chunk_kb ? g_strdup ("read directly") : g_strdup_printf ("read in %u KB chunks", chunk_kb);
+	buf = g_malloc (STREAM_READ_SIZE);
+	timer = g_timer_new ();
+
+	stream = dmapd_file_stream_open (uri, &error);
+	if (NULL == stream) {
+		g_error ("Could not open %s: %s", path, error->message);
+	}
+
+	if (chunk_kb > 0) {
+		GInputStream *file = stream;
+		stream = dmapd_chunk_stream_new (file, (gsize) chunk_kb * 1024);
+		g_object_unref (file);
+	}
+
+	while ((n = g_input_stream_read (stream, buf, STREAM_READ_SIZE, NULL, &error)) > 0) {
+		total += n;
+	}
+
+	if (n < 0) {
+		g_warning ("Error reading %s: %s", path, error->message);
+		g_clear_error (&error);
+	}
+
+	g_input_stream_close (stream, NULL, NULL);
+	elapsed = g_timer_elapsed (timer, NULL);
+
+	g_print ("%-12s %-24s %10.3f s %9.1f MB/s\n",
+	          "stream",
+	          operation,
+	          elapsed,
+	          elapsed > 0 ? total / elapsed / (1024 * 1024) : 0);
+
+	g_object_unref (stream);
+	g_timer_destroy (timer);
+	g_free (buf);
+	g_free (operation);
+	g_free (uri);
+}
+
+int
+main (int argc, char *argv[])
+{
+	gint i;
+	gchar *media_dir;
+	gchar **modules;
+	GPtrArray *records;
+	GError *error = NULL;
+	GOptionContext *context;
+
+	context = g_option_context_new ("-d MODULES | -p MODULES -P DIR | -f FILE: benchmark dmapd components");
+	g_option_context_add_main_entries (context, entries, NULL);
+	if (! g_option_context_parse (context, &argc, &argv, &error)) {
+		g_error ("Option parsing failed: %s", error->message);
+	}
+
+	module_dir = getenv ("DMAPD_MODULEDIR");
+	module_dir = module_dir ? module_dir : DEFAULT_MODULEDIR;
+
+	if (NULL == scratch_dir) {
+		scratch_dir = g_dir_make_tmp ("dmapd-benchmark-XXXXXX", &error);
+		if (NULL == scratch_dir) {
+			g_error ("Could not create scratch directory: %s", error->message);
+		}
+	}
+
+	stringleton_init ();
+
+	if (NULL != db_modules) {
+		media_dir = g_strdup_printf ("%s/media", scratch_dir);
+		records = make_records (media_dir, record_count);
+
+		modules = g_strsplit (db_modules, ",", -1);
+		for (i = 0; modules[i]; i++) {
+			benchmark_db (modules[i], records);
+		}
+
+		g_strfreev (modules);
+		g_ptr_array_free (records, TRUE);
+		g_free (media_dir);
+	}
+
+	if (container_entries > 0) {
+		benchmark_container (container_entries);
+	}
+
+	if (NULL != photo_modules) {
+		if (NULL == photo_dir) {
+			g_error ("--photo-modules requires --photo-dir");
+		}
+
+		modules = g_strsplit (photo_modules, ",", -1);
+		for (i = 0; modules[i]; i++) {
+			benchmark_photo (modules[i], photo_dir);
+		}
+
+		g_strfreev (modules);
+	}
+
+	if (NULL != stream_file) {
+		gchar **sizes = g_strsplit (chunk_sizes, ",", -1);
+		for (i = 0; sizes[i]; i++) {
+			benchmark_stream (stream_file, (guint) g_ascii_strtoull (sizes[i], NULL, 10));
+		}
+
+		g_strfreev (sizes);
+	}
+
+	g_print ("Scratch files are in %s\n", scratch_dir);
+
+	stringleton_deinit ();
+	g_option_context_free (context);
+
+	return 0;
+}
@@ -0,0 +1,367 @@
+/*   FILE: dmapd-chunk-stream.c -- read ahead in large chunks on a worker
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "dmapd-chunk-stream.h"
+
+/* NOTE: the worker owns next while filling; everything else is guarded
+ * by lock.
+ */
+struct DmapdChunkStreamPrivate {
+	gsize chunk_size;
+	GMutex lock;
+	GCond filled;
+	guint8 *current;      /* Being read from the stream. */
+	gsize current_len;
+	gsize current_pos;
+	guint8 *next;         /* Read ahead from base. */
+	gsize next_len;
+	gboolean next_ready;
+	gboolean filling;
+	gboolean eof;         /* Base has no more after next. */
+	GError *error;        /* From reading ahead, for the next read. */
+	goffset position;
+};
+
+static void dmapd_chunk_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (DmapdChunkStream, dmapd_chunk_stream, G_TYPE_FILTER_INPUT_STREAM,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE, dmapd_chunk_stream_seekable_iface_init))
+
+static GInputStream *
+base_stream (DmapdChunkStream *stream)
+{
+	return g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (stream));
+}
+
+/* Runs on a worker, holding a reference to stream. */
+static void
+fill (DmapdChunkStream *stream, gpointer user_data)
+{
+	gsize n = 0;
+	gboolean eof = FALSE;
+	GError *error = NULL;
+	DmapdChunkStreamPrivate *priv = stream->priv;
+
+	while (n < priv->chunk_size) {
+		gssize got = g_input_stream_read (base_stream (stream), priv->next + n, priv->chunk_size - n, NULL, &error);
+
+		if (got <= 0) {
+			eof = 0 == got;
+			break;
+		}
+
+		n += got;
+	}
+
+	g_mutex_lock (&priv->lock);
+	priv->next_len = n;
+	priv->next_ready = TRUE;
+	priv->eof = eof;
+	priv->error = error;
+	priv->filling = FALSE;
+	g_cond_broadcast (&priv->filled);
+	g_mutex_unlock (&priv->lock);
+
+	g_object_unref (stream);
+}
+
+static GThreadPool *
+read_ahead_pool (void)
+{
+	static gsize pool = 0;
+
+	/* NOTE: fills wait on the disk, not the processor; do not limit them. */
+	if (g_once_init_enter (&pool)) {
+		g_once_init_leave (&pool, (gsize) g_thread_pool_new ((GFunc) fill, NULL, -1, FALSE, NULL));
+	}
+
+	return (GThreadPool *) pool;
+}
+
+/* NOTE: must hold priv->lock. */
+static void
+start_fill (DmapdChunkStream *stream)
+{
+	stream->priv->filling = TRUE;
+	g_thread_pool_push (read_ahead_pool (), g_object_ref (stream), NULL);
+}
+
+/* NOTE: must hold priv->lock. */
+static void
+wait_for_fill (DmapdChunkStreamPrivate *priv)
+{
+	while (priv->filling) {
+		g_cond_wait (&priv->filled, &priv->lock);
+	}
+}
+
+static gssize
+dmapd_chunk_stream_read (GInputStream *_stream,
+			 void *buffer,
+			 gsize count,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	gssize fnval = 0;
+	DmapdChunkStream *stream = DMAPD_CHUNK_STREAM (_stream);
+	DmapdChunkStreamPrivate *priv = stream->priv;
+
+	g_mutex_lock (&priv->lock);
+
+	if (priv->current_pos == priv->current_len) {
+		guint8 *drained = priv->current;
+
+		if (! priv->filling && ! priv->next_ready && ! priv->eof && NULL == priv->error) {
+			start_fill (stream);
+		}
+
+		wait_for_fill (priv);
+
+		/* NOTE: data read before an error are returned before it. */
+		if (! priv->next_ready || 0 == priv->next_len) {
+			priv->next_ready = FALSE;
+			if (NULL != priv->error) {
+				g_propagate_error (error, priv->error);
+				priv->error = NULL;
+				fnval = -1;
+			}
+			goto _done;
+		}
+
+		priv->current = priv->next;
+		priv->current_len = priv->next_len;
+		priv->current_pos = 0;
+		priv->next = drained;
+		priv->next_ready = FALSE;
+
+		/* NOTE: read the chunk after this one while this one is sent. */
+		if (! priv->eof && NULL == priv->error) {
+			start_fill (stream);
+		}
+	}
+
+	fnval = MIN (count, priv->current_len - priv->current_pos);
+	memcpy (buffer, priv->current + priv->current_pos, fnval);
+	priv->current_pos += fnval;
+	priv->position += fnval;
+
+_done:
+	g_mutex_unlock (&priv->lock);
+
+	return fnval;
+}
+
+/* NOTE: GFilterInputStream would skip base, past what was read ahead. */
+static gssize
+dmapd_chunk_stream_skip (GInputStream *_stream,
+			 gsize count,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	gssize fnval = 0;
+	guint8 *discard;
+	DmapdChunkStreamPrivate *priv = DMAPD_CHUNK_STREAM (_stream)->priv;
+
+	g_mutex_lock (&priv->lock);
+	if (priv->current_pos < priv->current_len) {
+		fnval = MIN (count, priv->current_len - priv->current_pos);
+		priv->current_pos += fnval;
+		priv->position += fnval;
+	}
+	g_mutex_unlock (&priv->lock);
+
+	if (0 == fnval && count > 0) {
+		discard = g_malloc (MIN (count, priv->chunk_size));
+		fnval = dmapd_chunk_stream_read (_stream, discard, MIN (count, priv->chunk_size), cancellable, error);
+		g_free (discard);
+	}
+
+	return fnval;
+}
+
+static gboolean
+dmapd_chunk_stream_close (GInputStream *_stream,
+			  GCancellable *cancellable,
+			  GError **error)
+{
+	DmapdChunkStreamPrivate *priv = DMAPD_CHUNK_STREAM (_stream)->priv;
+
+	g_mutex_lock (&priv->lock);
+	wait_for_fill (priv);
+	g_mutex_unlock (&priv->lock);
+
+	return G_INPUT_STREAM_CLASS (dmapd_chunk_stream_parent_class)->close_fn (_stream, cancellable, error);
+}
+
+static goffset
+dmapd_chunk_stream_tell (GSeekable *seekable)
+{
+	goffset fnval;
+	DmapdChunkStreamPrivate *priv = DMAPD_CHUNK_STREAM (seekable)->priv;
+
+	g_mutex_lock (&priv->lock);
+	fnval = priv->position;
+	g_mutex_unlock (&priv->lock);
+
+	return fnval;
+}
+
+static gboolean
+dmapd_chunk_stream_can_seek (GSeekable *seekable)
+{
+	GInputStream *base = base_stream (DMAPD_CHUNK_STREAM (seekable));
+
+	return G_IS_SEEKABLE (base) && g_seekable_can_seek (G_SEEKABLE (base));
+}
+
+static gboolean
+dmapd_chunk_stream_seek (GSeekable *seekable,
+			 goffset offset,
+			 GSeekType type,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	goffset target = offset;
+	gboolean fnval = FALSE;
+	DmapdChunkStream *stream = DMAPD_CHUNK_STREAM (seekable);
+	DmapdChunkStreamPrivate *priv = stream->priv;
+
+	if (! dmapd_chunk_stream_can_seek (seekable)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Base stream cannot seek");
+		return FALSE;
+	}
+
+	g_mutex_lock (&priv->lock);
+	wait_for_fill (priv);
+
+	if (G_SEEK_CUR == type) {
+		target = priv->position + offset;
+	} else if (G_SEEK_SET != type) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Chunk streams seek only from the start or the current position");
+		goto _done;
+	}
+
+	/* NOTE: read ahead of position, so seek from it rather than base's. */
+	if (! g_seekable_seek (G_SEEKABLE (base_stream (stream)), target, G_SEEK_SET, cancellable, error)) {
+		goto _done;
+	}
+
+	priv->current_len = priv->current_pos = 0;
+	priv->next_ready = FALSE;
+	priv->eof = FALSE;
+	g_clear_error (&priv->error);
+	priv->position = target;
+
+	fnval = TRUE;
+
+_done:
+	g_mutex_unlock (&priv->lock);
+
+	return fnval;
+}
+
+static gboolean
+dmapd_chunk_stream_can_truncate (GSeekable *seekable)
+{
+	return FALSE;
+}
+
+static gboolean
+dmapd_chunk_stream_truncate (GSeekable *seekable,
+			     goffset offset,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Chunk streams cannot be truncated");
+
+	return FALSE;
+}
+
+GInputStream *
+dmapd_chunk_stream_new (GInputStream *base, gsize chunk_size)
+{
+	GInputStream *fnval;
+	DmapdChunkStreamPrivate *priv;
+
+	fnval = G_INPUT_STREAM (g_object_new (TYPE_DMAPD_CHUNK_STREAM, "base-stream", base, NULL));
+	priv = DMAPD_CHUNK_STREAM (fnval)->priv;
+
+	priv->chunk_size = CLAMP (chunk_size, DMAPD_CHUNK_STREAM_MIN_SIZE, DMAPD_CHUNK_STREAM_MAX_SIZE);
+	priv->current = g_malloc (priv->chunk_size);
+	priv->next = g_malloc (priv->chunk_size);
+
+	if (G_IS_SEEKABLE (base)) {
+		priv->position = g_seekable_tell (G_SEEKABLE (base));
+	}
+
+	return fnval;
+}
+
+static void
+dmapd_chunk_stream_init (DmapdChunkStream *stream)
+{
+	stream->priv = DMAPD_CHUNK_STREAM_GET_PRIVATE (stream);
+
+	g_mutex_init (&stream->priv->lock);
+	g_cond_init (&stream->priv->filled);
+}
+
+static void
+dmapd_chunk_stream_finalize (GObject *object)
+{
+	DmapdChunkStreamPrivate *priv = DMAPD_CHUNK_STREAM (object)->priv;
+
+	/* NOTE: a fill holds a reference, so none is running now. */
+	g_free (priv->current);
+	g_free (priv->next);
+	g_clear_error (&priv->error);
+	g_mutex_clear (&priv->lock);
+	g_cond_clear (&priv->filled);
+
+	G_OBJECT_CLASS (dmapd_chunk_stream_parent_class)->finalize (object);
+}
+
+static void
+dmapd_chunk_stream_class_init (DmapdChunkStreamClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DmapdChunkStreamPrivate));
+
+	gobject_class->finalize = dmapd_chunk_stream_finalize;
+	input_stream_class->read_fn = dmapd_chunk_stream_read;
+	input_stream_class->skip = dmapd_chunk_stream_skip;
+	input_stream_class->close_fn = dmapd_chunk_stream_close;
+}
+
+static void
+dmapd_chunk_stream_seekable_iface_init (GSeekableIface *iface)
+{
+	iface->tell         = dmapd_chunk_stream_tell;
+	iface->can_seek     = dmapd_chunk_stream_can_seek;
+	iface->seek         = dmapd_chunk_stream_seek;
+	iface->can_truncate = dmapd_chunk_stream_can_truncate;
+	iface->truncate_fn  = dmapd_chunk_stream_truncate;
+}
@@ -0,0 +1,64 @@
+/*   FILE: dmapd-chunk-stream.h -- read ahead in large chunks on a worker
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_CHUNK_STREAM
+#define __DMAPD_CHUNK_STREAM
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define TYPE_DMAPD_CHUNK_STREAM         (dmapd_chunk_stream_get_type ())
+#define DMAPD_CHUNK_STREAM(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), TYPE_DMAPD_CHUNK_STREAM, DmapdChunkStream))
+#define DMAPD_CHUNK_STREAM_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), TYPE_DMAPD_CHUNK_STREAM, DmapdChunkStreamClass))
+#define IS_DMAPD_CHUNK_STREAM(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), TYPE_DMAPD_CHUNK_STREAM))
+#define IS_DMAPD_CHUNK_STREAM_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), TYPE_DMAPD_CHUNK_STREAM))
+#define DMAPD_CHUNK_STREAM_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), TYPE_DMAPD_CHUNK_STREAM, DmapdChunkStreamClass))
+#define DMAPD_CHUNK_STREAM_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), TYPE_DMAPD_CHUNK_STREAM, DmapdChunkStreamPrivate))
+
+#define DMAPD_CHUNK_STREAM_MIN_SIZE (4 * 1024)
+#define DMAPD_CHUNK_STREAM_MAX_SIZE (16 * 1024 * 1024)
+
+typedef struct DmapdChunkStreamPrivate DmapdChunkStreamPrivate;
+
+typedef struct {
+	GFilterInputStream parent;
+	DmapdChunkStreamPrivate *priv;
+} DmapdChunkStream;
+
+typedef struct {
+	GFilterInputStreamClass parent;
+} DmapdChunkStreamClass;
+
+GType         dmapd_chunk_stream_get_type (void);
+
+/* Returns a stream over base that reads base chunk_size bytes at a time,
+ * clamped to the limits above. While one chunk is read from the stream,
+ * a worker thread reads the next, so that the disk and the network stay
+ * busy together. Seeks if base does. Holds two chunks in memory.
+ */
+GInputStream *dmapd_chunk_stream_new      (GInputStream *base,
+					   gsize chunk_size);
+
+#endif /* __DMAPD_CHUNK_STREAM */
+
+G_END_DECLS
@@ -25,11 +25,17 @@
 #include <string.h>
 
 #include "dmapd-daap-record.h"
+#include "dmapd-chunk-stream.h"
+#include "dmapd-file-stream.h"
 #include "av-meta-reader.h"
 #include "util.h"
 
 static const char *unknown = "Unknown";
 
+static DmapdDAAPRecordReadFilter read_filter = NULL;
+static gpointer read_filter_data = NULL;
+static gsize chunk_size = 0;
+
 struct DmapdDAAPRecordPrivate {
 	char *location;
 	GByteArray *hash;
@@ -255,14 +261,35 @@ gboolean dmapd_daap_record_itunes_compat (DAAPRecord *record)
 		return FALSE;
 }
 
+void dmapd_daap_record_set_read_filter (DmapdDAAPRecordReadFilter filter, gpointer user_data)
+{
+	read_filter = filter;
+	read_filter_data = user_data;
+}
+
+void dmapd_daap_record_set_chunk_size (gsize size)
+{
+	chunk_size = size;
+}
+
 GInputStream *dmapd_daap_record_read (DAAPRecord *record, GError **error)
 {
-	GFile *file;
 	GInputStream *fnval = NULL;
 
-	file = g_file_new_for_uri (DMAPD_DAAP_RECORD (record)->priv->location);
-	g_assert (file);
-	fnval = G_INPUT_STREAM (g_file_read (file, NULL, error));
+	fnval = dmapd_file_stream_open (DMAPD_DAAP_RECORD (record)->priv->location, error);
+
+	if (NULL != fnval && NULL != read_filter) {
+		fnval = read_filter (record, fnval, read_filter_data);
+	}
+
+	/* NOTE: outermost, so that a filter seeking while it parses the
+	 * file does not discard what was read ahead.
+	 */
+	if (NULL != fnval && chunk_size > 0) {
+		GInputStream *filtered = fnval;
+		fnval = dmapd_chunk_stream_new (filtered, chunk_size);
+		g_object_unref (filtered);
+	}
 
 	return fnval;
 }
@@ -57,6 +57,22 @@ gboolean      dmapd_daap_record_itunes_compat   (DAAPRecord *record);
 GInputStream *dmapd_daap_record_read            (DAAPRecord *record,
 						 GError **err);
 
+typedef GInputStream *(*DmapdDAAPRecordReadFilter) (DAAPRecord *record,
+						    GInputStream *stream,
+						    gpointer user_data);
+
+/* Sets a function called each time any record is read, from whichever
+ * thread reads it. It takes the stream read and returns the stream to
+ * use in its place, which may be the same.
+ */
+void          dmapd_daap_record_set_read_filter (DmapdDAAPRecordReadFilter filter,
+						 gpointer user_data);
+
+/* Sets the size of the chunks in which records are read ahead as they
+ * are served, or 0, the default, to read them directly.
+ */
+void          dmapd_daap_record_set_chunk_size  (gsize chunk_size);
+
 #endif /* __DMAPD_DAAP_RECORD */
 
 G_END_DECLS
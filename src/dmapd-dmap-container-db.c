@@ -18,22 +18,75 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <string.h>
 #include <glib.h>
 
+#include "dmapd-id-map.h"
+#include "dmapd-dmap-db.h"
+#include "dmapd-dmap-db-ghashtable.h"
 #include "dmapd-dmap-container-db.h"
 #include "dmapd-dmap-container-record.h"
+#include "dmapd-dmap-smart-container-record.h"
 
+/* Containers are records in a DMAPDb, the store, keyed by location. The
+ * index maps the IDs clients know containers by to the store's IDs.
+ * Each container is read from the store once and then kept, and is
+ * written through to the store when added again. Smart containers are
+ * derived from the media database, so they are only kept in memory.
+ */
 struct DmapdDMAPContainerDbPrivate {
-	GHashTable *db;
+	DMAPDb *store;
+	GHashTable *index;
+	GHashTable *live;            /* ID -> container read or added. */
+	gchar *db_dir;
+	DmapdIdMap *ids;
+	gboolean sort_entries;
+
+	GHashTable *smart;           /* ID -> smart container.       */
+	DmapdSmartIndex *smart_index;
+	DMAPDb *media_db;            /* Source of smart_index.       */
+	gulong changed_handler;
+};
+
+enum {
+	PROP_0,
+	PROP_DB_DIR,
+	PROP_STORE,
+	PROP_SORT_ENTRIES
 };
 
 DMAPContainerRecord *
 dmapd_dmap_container_db_lookup_by_id (DMAPContainerDb *db, guint id)
 {
-	DMAPContainerRecord *record;
-	record = g_hash_table_lookup (DMAPD_DMAP_CONTAINER_DB (db)->priv->db, GUINT_TO_POINTER (id));
-	g_object_ref (record);
-	return record;
+	guint store_id;
+	DMAPRecord *record = NULL;
+	DmapdDMAPContainerDbPrivate *priv = DMAPD_DMAP_CONTAINER_DB (db)->priv;
+
+	record = g_hash_table_lookup (priv->smart, GUINT_TO_POINTER (id));
+	if (NULL != record) {
+		g_object_ref (record);
+		goto _done;
+	}
+
+	record = g_hash_table_lookup (priv->live, GUINT_TO_POINTER (id));
+	if (NULL != record) {
+		g_object_ref (record);
+		goto _done;
+	}
+
+	store_id = GPOINTER_TO_UINT (g_hash_table_lookup (priv->index, GUINT_TO_POINTER (id)));
+	if (0 == store_id) {
+		g_warning ("No container with ID %u", id);
+		goto _done;
+	}
+
+	record = dmap_db_lookup_by_id (priv->store, store_id);
+	if (NULL != record) {
+		g_hash_table_insert (priv->live, GUINT_TO_POINTER (id), g_object_ref (record));
+	}
+
+_done:
+	return record ? DMAP_CONTAINER_RECORD (record) : NULL;
 }
 
 void
@@ -43,51 +96,168 @@ dmapd_dmap_container_db_foreach (DMAPContainerDb *db,
 					     gpointer user_data),
 					     gpointer data)
 {
-	g_hash_table_foreach (DMAPD_DMAP_CONTAINER_DB (db)->priv->db, (GHFunc) fn, data);
+	GHashTableIter iter;
+	gpointer id;
+	DmapdDMAPContainerDbPrivate *priv = DMAPD_DMAP_CONTAINER_DB (db)->priv;
+
+	g_hash_table_iter_init (&iter, priv->index);
+	while (g_hash_table_iter_next (&iter, &id, NULL)) {
+		DMAPContainerRecord *record = dmapd_dmap_container_db_lookup_by_id (db, GPOINTER_TO_UINT (id));
+		if (NULL != record) {
+			fn (id, record, data);
+			g_object_unref (record);
+		}
+	}
+
+	g_hash_table_foreach (priv->smart, (GHFunc) fn, data);
 }
 
 gint64
 dmapd_dmap_container_db_count (DMAPContainerDb *db)
 {
-	return g_hash_table_size (DMAPD_DMAP_CONTAINER_DB (db)->priv->db);
+	DmapdDMAPContainerDbPrivate *priv = DMAPD_DMAP_CONTAINER_DB (db)->priv;
+
+	return g_hash_table_size (priv->index) + g_hash_table_size (priv->smart);
+}
+
+static gboolean
+same_record (DMAPRecord *a, DMAPRecord *b)
+{
+	gboolean fnval;
+	GByteArray *blob_a = dmap_record_to_blob (a);
+	GByteArray *blob_b = dmap_record_to_blob (b);
+
+	fnval = blob_a->len == blob_b->len
+	     && ! memcmp (blob_a->data, blob_b->data, blob_a->len);
+
+	g_byte_array_unref (blob_a);
+	g_byte_array_unref (blob_b);
+
+	return fnval;
 }
 
 void
 dmapd_dmap_container_db_add (DMAPContainerDb *db, DMAPContainerRecord *record)
 {
-        guint id = dmap_container_record_get_id (record);
-	g_object_ref (record);
-	g_hash_table_insert (DMAPD_DMAP_CONTAINER_DB (db)->priv->db, GUINT_TO_POINTER (id), record);
+	guint store_id;
+	gboolean ordered = FALSE;
+	gchar *location = NULL;
+	DMAPRecord *stored = NULL;
+	DmapdDMAPContainerDbPrivate *priv = DMAPD_DMAP_CONTAINER_DB (db)->priv;
+	guint id = dmap_container_record_get_id (record);
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL == location) {
+		g_warning ("Container %u has no location, skipping", id);
+		goto _done;
+	}
+
+	g_object_get (record, "ordered", &ordered, NULL);
+	if (priv->sort_entries && ! ordered) {
+		dmapd_dmap_container_record_sort_entries (DMAPD_DMAP_CONTAINER_RECORD (record));
+	}
+
+	store_id = dmap_db_lookup_id_by_location (priv->store, location);
+	if (0 == store_id) {
+		store_id = dmap_db_add (priv->store, DMAP_RECORD (record));
+	} else {
+		/* Do not rewrite containers that did not change. */
+		stored = dmap_db_lookup_by_id (priv->store, store_id);
+		if (NULL == stored || ! same_record (stored, DMAP_RECORD (record))) {
+			dmap_db_add_with_id (priv->store, DMAP_RECORD (record), store_id);
+		}
+	}
+
+	g_hash_table_insert (priv->index, GUINT_TO_POINTER (id), GUINT_TO_POINTER (store_id));
+	g_hash_table_insert (priv->live, GUINT_TO_POINTER (id), g_object_ref (record));
+
+_done:
+	if (NULL != stored) {
+		g_object_unref (stored);
+	}
+
+	g_free (location);
 }
 
-static void
-dmapd_dmap_container_db_init (DmapdDMAPContainerDb *db)
+DMAPContainerRecord *
+dmapd_dmap_container_db_lookup_by_location (DmapdDMAPContainerDb *db, const gchar *location)
 {
-	db->priv = DMAPD_DMAP_CONTAINER_DB_GET_PRIVATE (db);
-	db->priv->db = g_hash_table_new_full (g_direct_hash,
-					      g_direct_equal,
-					      NULL,
-					      g_object_unref);
+	guint store_id;
+	DMAPRecord *record = NULL;
+	guint id = dmapd_id_map_lookup (db->priv->ids, location);
+
+	/* NOTE: hand out the container kept, if any, so there is one copy. */
+	if (0 != id && g_hash_table_contains (db->priv->index, GUINT_TO_POINTER (id))) {
+		record = DMAP_RECORD (dmapd_dmap_container_db_lookup_by_id (DMAP_CONTAINER_DB (db), id));
+		goto _done;
+	}
+
+	store_id = dmap_db_lookup_id_by_location (db->priv->store, location);
+	if (0 != store_id) {
+		record = dmap_db_lookup_by_id (db->priv->store, store_id);
+	}
+
+_done:
+	return record ? DMAP_CONTAINER_RECORD (record) : NULL;
 }
 
-static void
-dmapd_dmap_container_db_finalize (GObject *object)
+guint
+dmapd_dmap_container_db_assign_id (DmapdDMAPContainerDb *db, const gchar *location)
 {
-        DmapdDMAPContainerDb *db = DMAPD_DMAP_CONTAINER_DB (object);
+	return dmapd_id_map_assign (db->priv->ids, location);
+}
 
-	g_debug ("Finalizing DmapdDMAPContainerDb (%d records)", g_hash_table_size (db->priv->db));
+static void
+media_changed (DMAPDb *media_db, guint id, guint change, DmapdDMAPContainerDb *db)
+{
+	DMAPRecord *record;
 
-	g_hash_table_destroy (db->priv->db);
+	if (DMAPD_DMAP_DB_CHANGE_DELETED == change) {
+		dmapd_smart_index_remove (db->priv->smart_index, id);
+	} else if (NULL != (record = dmap_db_lookup_by_id (media_db, id))) {
+		dmapd_smart_index_update (db->priv->smart_index, id, record);
+		g_object_unref (record);
+	}
 }
 
 static void
-dmapd_dmap_container_db_class_init (DmapdDMAPContainerDbClass *klass)
+index_record (gpointer id, DMAPRecord *record, DmapdSmartIndex *smart_index)
 {
-	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	dmapd_smart_index_update (smart_index, GPOINTER_TO_UINT (id), record);
+}
 
-        object_class->finalize = dmapd_dmap_container_db_finalize;
+void
+dmapd_dmap_container_db_add_smart (DmapdDMAPContainerDb *db,
+				   DMAPDb *media_db,
+				   const gchar *name,
+				   const DmapdSmartRule *rule)
+{
+	guint id;
+	gchar *key;
+	DMAPContainerRecord *record;
+	DmapdDMAPContainerDbPrivate *priv = db->priv;
 
-        g_type_class_add_private (klass, sizeof (DmapdDMAPContainerDbPrivate));
+	if (NULL == priv->smart_index) {
+		priv->smart_index = dmapd_smart_index_new ();
+		priv->media_db = g_object_ref (media_db);
+
+		/* One pass builds the indexes; changes keep them current. */
+		dmap_db_foreach (media_db, (GHFunc) index_record, priv->smart_index);
+		priv->changed_handler = g_signal_connect (media_db,
+		                                          "changed",
+		                                          G_CALLBACK (media_changed),
+		                                          db);
+	}
+
+	g_assert (media_db == priv->media_db);
+
+	/* NOTE: keys are not URIs, so they never clash with directories. */
+	key = g_strdup_printf ("dmapd-smart:%s", name);
+	id = dmapd_id_map_assign (priv->ids, key);
+	g_free (key);
+
+	record = dmapd_dmap_smart_container_record_new (id, name, rule, priv->smart_index, media_db);
+	g_hash_table_insert (priv->smart, GUINT_TO_POINTER (id), record);
 }
 
 static void
@@ -107,6 +277,201 @@ G_DEFINE_TYPE_WITH_CODE (DmapdDMAPContainerDb, dmapd_dmap_container_db, G_TYPE_O
 			 G_IMPLEMENT_INTERFACE (DMAP_TYPE_CONTAINER_DB,
 						dmapd_dmap_container_db_interface_init))
 
+static void
+dmapd_dmap_container_db_set_property (GObject *object,
+				      guint prop_id,
+				      const GValue *value,
+				      GParamSpec *pspec)
+{
+	DmapdDMAPContainerDb *db = DMAPD_DMAP_CONTAINER_DB (object);
+
+	switch (prop_id) {
+		case PROP_DB_DIR:
+			g_free (db->priv->db_dir);
+			db->priv->db_dir = g_value_dup_string (value);
+			break;
+		case PROP_STORE:
+			if (db->priv->store)
+				g_object_unref (db->priv->store);
+			db->priv->store = g_value_get_pointer (value);
+			if (db->priv->store)
+				g_object_ref (db->priv->store);
+			break;
+		case PROP_SORT_ENTRIES:
+			db->priv->sort_entries = g_value_get_boolean (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+dmapd_dmap_container_db_get_property (GObject *object,
+				      guint prop_id,
+				      GValue *value,
+				      GParamSpec *pspec)
+{
+	DmapdDMAPContainerDb *db = DMAPD_DMAP_CONTAINER_DB (object);
+
+	switch (prop_id) {
+		case PROP_DB_DIR:
+			g_value_set_static_string (value, db->priv->db_dir);
+			break;
+		case PROP_STORE:
+			g_value_set_pointer (value, db->priv->store);
+			break;
+		case PROP_SORT_ENTRIES:
+			g_value_set_boolean (value, db->priv->sort_entries);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+typedef struct {
+	GHashTable *index;
+	GSList *stale;
+} index_data_t;
+
+static void
+index_container (gpointer store_id, DMAPContainerRecord *record, index_data_t *data)
+{
+	gchar *path = NULL;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL != location) {
+		path = g_filename_from_uri (location, NULL, NULL);
+	}
+
+	/* NOTE: some stores return records that failed set_from_blob. */
+	if (NULL == path || ! g_file_test (path, G_FILE_TEST_EXISTS)) {
+		data->stale = g_slist_prepend (data->stale, store_id);
+	} else {
+		g_hash_table_insert (data->index,
+		                     GUINT_TO_POINTER (dmap_container_record_get_id (record)),
+		                     store_id);
+	}
+
+	g_free (location);
+	g_free (path);
+}
+
+static GObject *
+dmapd_dmap_container_db_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
+{
+	GSList *l;
+	GObject *object;
+	gchar *ids_path = NULL;
+	index_data_t index_data;
+	DmapdDMAPContainerDb *db;
+
+	object = G_OBJECT_CLASS (dmapd_dmap_container_db_parent_class)->constructor (type, n_construct_params, construct_params);
+	db = DMAPD_DMAP_CONTAINER_DB (object);
+
+	if (db->priv->db_dir) {
+		ids_path = g_strdup_printf ("%s/container-ids", db->priv->db_dir);
+	}
+
+	db->priv->ids = dmapd_id_map_new (ids_path, DMAPD_ID_MAP_FIRST_CONTAINER_ID, 1);
+
+	if (NULL == db->priv->store) {
+		db->priv->store = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+	}
+
+	index_data.index = db->priv->index;
+	index_data.stale = NULL;
+	dmap_db_foreach (db->priv->store, (GHFunc) index_container, &index_data);
+
+	for (l = index_data.stale; l; l = l->next) {
+		g_debug ("Removing stale container %u", GPOINTER_TO_UINT (l->data));
+		dmapd_dmap_db_remove (db->priv->store, GPOINTER_TO_UINT (l->data));
+	}
+
+	g_debug ("Loaded %u containers", g_hash_table_size (db->priv->index));
+
+	g_slist_free (index_data.stale);
+	g_free (ids_path);
+
+	return object;
+}
+
+static void
+dmapd_dmap_container_db_init (DmapdDMAPContainerDb *db)
+{
+	db->priv = DMAPD_DMAP_CONTAINER_DB_GET_PRIVATE (db);
+	db->priv->index = g_hash_table_new (g_direct_hash, g_direct_equal);
+	db->priv->live = g_hash_table_new_full (g_direct_hash,
+						g_direct_equal,
+						NULL,
+						g_object_unref);
+	db->priv->smart = g_hash_table_new_full (g_direct_hash,
+						 g_direct_equal,
+						 NULL,
+						 g_object_unref);
+}
+
+static void
+dmapd_dmap_container_db_finalize (GObject *object)
+{
+        DmapdDMAPContainerDb *db = DMAPD_DMAP_CONTAINER_DB (object);
+
+	g_debug ("Finalizing DmapdDMAPContainerDb (%d records)", g_hash_table_size (db->priv->index));
+
+	g_hash_table_destroy (db->priv->index);
+	g_hash_table_destroy (db->priv->live);
+	g_object_unref (db->priv->store);
+
+	if (NULL != db->priv->media_db) {
+		g_signal_handler_disconnect (db->priv->media_db, db->priv->changed_handler);
+		g_object_unref (db->priv->media_db);
+	}
+
+	g_hash_table_destroy (db->priv->smart);
+	dmapd_smart_index_free (db->priv->smart_index);
+	dmapd_id_map_free (db->priv->ids);
+	g_free (db->priv->db_dir);
+}
+
+static void
+dmapd_dmap_container_db_class_init (DmapdDMAPContainerDbClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = dmapd_dmap_container_db_finalize;
+	object_class->constructor = dmapd_dmap_container_db_constructor;
+	object_class->set_property = dmapd_dmap_container_db_set_property;
+	object_class->get_property = dmapd_dmap_container_db_get_property;
+
+        g_type_class_add_private (klass, sizeof (DmapdDMAPContainerDbPrivate));
+
+	/* NOTE: container IDs are saved here; NULL keeps them in memory. */
+	g_object_class_install_property (object_class, PROP_DB_DIR,
+					 g_param_spec_string ("db-dir",
+							      "Directory for container IDs",
+							      "Directory for container IDs",
+							      NULL,
+							      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	/* NOTE: a DmapdDMAPDb whose record factory creates
+	 * DmapdDMAPContainerRecords; NULL keeps containers in memory.
+	 */
+	g_object_class_install_property (object_class, PROP_STORE,
+					 g_param_spec_pointer ("store",
+							       "Container record DB",
+							       "Container record DB",
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	g_object_class_install_property (object_class, PROP_SORT_ENTRIES,
+					 g_param_spec_boolean ("sort-entries",
+							       "Sort entries",
+							       "Order entries by disc and track as containers are added",
+							       FALSE,
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+}
+
 DmapdDMAPContainerDb *
 dmapd_dmap_container_db_new (void)
 {
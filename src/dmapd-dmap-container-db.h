@@ -23,6 +23,8 @@
 
 #include <libdmapsharing/dmap.h>
 
+#include "dmapd-smart-index.h"
+
 G_BEGIN_DECLS
 
 #define TYPE_DMAPD_DMAP_CONTAINER_DB         (dmapd_dmap_container_db_get_type ())
@@ -67,6 +69,21 @@ gint64      dmapd_dmap_container_db_count (DMAPContainerDb *db);
 
 void dmapd_dmap_container_db_add (DMAPContainerDb *db, DMAPContainerRecord *record);
 
+/* Returns the stored container for a directory or playlist, or NULL. */
+DMAPContainerRecord *dmapd_dmap_container_db_lookup_by_location (DmapdDMAPContainerDb *db, const gchar *location);
+
+/* Returns the ID for the container at location, the same one each run. */
+guint dmapd_dmap_container_db_assign_id (DmapdDMAPContainerDb *db, const gchar *location);
+
+/* Adds a container of the records in media_db that match rule. Every
+ * smart container must use the same media_db, which must be a
+ * DmapdDMAPDb; its changes are followed from then on.
+ */
+void dmapd_dmap_container_db_add_smart (DmapdDMAPContainerDb *db,
+					DMAPDb *media_db,
+					const gchar *name,
+					const DmapdSmartRule *rule);
+
 #endif /* __DMAPD_DMAP_CONTAINER_DB */
 
 G_END_DECLS
@@ -0,0 +1,114 @@
+/*
+ * DmapdDMAPContainerRecord factory class
+ *
+ * Copyright (C) 2013 W. Michael Petullo <mike@flyn.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "dmapd-dmap-container-record-factory.h"
+#include "dmapd-dmap-container-record.h"
+
+struct DmapdDMAPContainerRecordFactoryPrivate {
+	DMAPDb *full_db;
+};
+
+enum {
+	PROP_0,
+	PROP_FULL_DB
+};
+
+static void
+dmapd_dmap_container_record_factory_set_property (GObject *object,
+						  guint prop_id,
+						  const GValue *value,
+						  GParamSpec *pspec)
+{
+	DmapdDMAPContainerRecordFactory *factory = DMAPD_DMAP_CONTAINER_RECORD_FACTORY (object);
+
+	switch (prop_id) {
+		case PROP_FULL_DB:
+			factory->priv->full_db = DMAP_DB (g_value_get_pointer (value));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+dmapd_dmap_container_record_factory_get_property (GObject *object,
+						  guint prop_id,
+						  GValue *value,
+						  GParamSpec *pspec)
+{
+	DmapdDMAPContainerRecordFactory *factory = DMAPD_DMAP_CONTAINER_RECORD_FACTORY (object);
+
+	switch (prop_id) {
+		case PROP_FULL_DB:
+			g_value_set_pointer (value, factory->priv->full_db);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+DMAPRecord *
+dmapd_dmap_container_record_factory_create (DMAPRecordFactory *factory,
+					    gpointer user_data)
+{
+	return DMAP_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD,
+					  "full-db", DMAPD_DMAP_CONTAINER_RECORD_FACTORY (factory)->priv->full_db,
+					  NULL));
+}
+
+static void
+dmapd_dmap_container_record_factory_init (DmapdDMAPContainerRecordFactory *factory)
+{
+	factory->priv = DMAPD_DMAP_CONTAINER_RECORD_FACTORY_GET_PRIVATE (factory);
+}
+
+static void
+dmapd_dmap_container_record_factory_class_init (DmapdDMAPContainerRecordFactoryClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DmapdDMAPContainerRecordFactoryPrivate));
+
+	gobject_class->set_property = dmapd_dmap_container_record_factory_set_property;
+	gobject_class->get_property = dmapd_dmap_container_record_factory_get_property;
+
+	g_object_class_install_property (gobject_class, PROP_FULL_DB,
+					 g_param_spec_pointer ("full-db",
+							       "Full Media DB",
+							       "Full Media DB",
+							       G_PARAM_READWRITE |
+							       G_PARAM_CONSTRUCT_ONLY));
+}
+
+static void
+dmapd_dmap_container_record_factory_interface_init (gpointer iface, gpointer data)
+{
+	DMAPRecordFactoryIface *factory = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (factory) == DMAP_TYPE_RECORD_FACTORY);
+
+	factory->create = dmapd_dmap_container_record_factory_create;
+}
+
+G_DEFINE_TYPE_WITH_CODE (DmapdDMAPContainerRecordFactory, dmapd_dmap_container_record_factory, G_TYPE_OBJECT, 
+			 G_IMPLEMENT_INTERFACE (DMAP_TYPE_RECORD_FACTORY,
+					        dmapd_dmap_container_record_factory_interface_init))
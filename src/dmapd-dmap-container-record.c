@@ -18,38 +18,50 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
-/* FIXME: this uses the GHashTable database even when DmapdDMAPDb uses the
- * BDB.
- */
-
+#include <config.h>
+#include <string.h>
 #include <libdmapsharing/dmap.h>
 
 #include "dmapd-dmap-container-record.h"
-#include "dmapd-dmap-db-ghashtable.h"
+#include "dmapd-dmap-db-view.h"
+#include "util.h"
 
 enum {
 	PROP_0,
 	PROP_NAME,
-	PROP_FULL_DB
+	PROP_FULL_DB,
+	PROP_ID,
+	PROP_LOCATION,
+	PROP_MTIME,
+	PROP_FILESIZE,
+	PROP_ORDERED
 };
 
-/* Media ID's start at max and go down.
- * Container ID's start at 1 and go up.
- * 1 is reserved for the primary container.
- */
-static gint nextid = 2;
-
 struct DmapdDMAPContainerRecordPrivate {
-	gint id;
+	guint id;
 	char *name;
-	GSList *entries;
+	char *location;
+	GArray *entries; /* Of guint32. */
+	GArray *pending; /* Of pending_t. */
 	DMAPDb *full_db;
+	gint mtime;
+	guint64 filesize;
+	gboolean ordered;
 };
 
-struct DBPair {
-	DMAPDb *src;
-	DMAPDb *dest;
-};
+/* A playlist entry that was not in full_db when the playlist was read.
+ * Its place in entries holds 0 until it is resolved.
+ */
+typedef struct {
+	guint32 position;
+	gchar *location;
+} pending_t;
+
+typedef struct {
+	guint32 id;
+	gint disc;
+	gint track;
+} sort_key_t;
 
 static void
 dmapd_dmap_container_record_set_property (GObject *object,
@@ -69,6 +81,22 @@ dmapd_dmap_container_record_set_property (GObject *object,
 				g_object_unref (record->priv->full_db);
 			record->priv->full_db = DMAP_DB (g_value_get_pointer (value));
 			break;
+		case PROP_ID:
+			record->priv->id = g_value_get_uint (value);
+			break;
+		case PROP_LOCATION:
+			g_free (record->priv->location);
+			record->priv->location = g_value_dup_string (value);
+			break;
+		case PROP_MTIME:
+			record->priv->mtime = g_value_get_int (value);
+			break;
+		case PROP_FILESIZE:
+			record->priv->filesize = g_value_get_uint64 (value);
+			break;
+		case PROP_ORDERED:
+			record->priv->ordered = g_value_get_boolean (value);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -90,6 +118,21 @@ dmapd_dmap_container_record_get_property (GObject *object,
 		case PROP_FULL_DB:
 			g_value_set_pointer (value, record->priv->full_db);
 			break;
+		case PROP_ID:
+			g_value_set_uint (value, record->priv->id);
+			break;
+		case PROP_LOCATION:
+			g_value_set_static_string (value, record->priv->location);
+			break;
+		case PROP_MTIME:
+			g_value_set_int (value, record->priv->mtime);
+			break;
+		case PROP_FILESIZE:
+			g_value_set_uint64 (value, record->priv->filesize);
+			break;
+		case PROP_ORDERED:
+			g_value_set_boolean (value, record->priv->ordered);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -109,50 +152,312 @@ dmapd_dmap_container_record_add_entry (DMAPContainerRecord *container_record,
 {
 	DmapdDMAPContainerRecordPrivate *priv = 
 		DMAPD_DMAP_CONTAINER_RECORD (container_record)->priv;
-	priv->entries = g_slist_append (priv->entries, GUINT_TO_POINTER (id));
+	guint32 entry = id;
+
+	g_array_append_val (priv->entries, entry);
 }
 
-static guint64
-dmapd_dmap_container_record_get_entry_count (DMAPContainerRecord *record)
+void
+dmapd_dmap_container_record_add_pending (DmapdDMAPContainerRecord *record,
+					 const gchar *location)
 {
-	return g_slist_length
-		(DMAPD_DMAP_CONTAINER_RECORD (record)->priv->entries);
+	pending_t pending;
+	guint32 entry = 0;
+
+	pending.position = record->priv->entries->len;
+	pending.location = g_strdup (location);
+
+	g_array_append_val (record->priv->entries, entry);
+	g_array_append_val (record->priv->pending, pending);
+}
+
+guint
+dmapd_dmap_container_record_get_pending_count (DmapdDMAPContainerRecord *record)
+{
+	return record->priv->pending->len;
 }
 
+/* Looks up each pending entry in full_db, then drops those that are still
+ * unknown. This happens once, the first time the entries are needed.
+ */
 static void
-add_to_db (void *item, struct DBPair *pair)
+resolve_pending (DmapdDMAPContainerRecordPrivate *priv)
+{
+	guint i, j;
+
+	if (0 == priv->pending->len || NULL == priv->full_db) {
+		goto _done;
+	}
+
+	for (i = 0; i < priv->pending->len; i++) {
+		pending_t *pending = &g_array_index (priv->pending, pending_t, i);
+		guint id = dmap_db_lookup_id_by_location (priv->full_db, pending->location);
+
+		if (0 == id) {
+			g_debug ("Playlist %s names unknown %s", priv->location, pending->location);
+		}
+
+		g_array_index (priv->entries, guint32, pending->position) = id;
+		g_free (pending->location);
+	}
+
+	g_array_set_size (priv->pending, 0);
+
+	for (i = j = 0; i < priv->entries->len; i++) {
+		guint32 id = g_array_index (priv->entries, guint32, i);
+		if (0 != id) {
+			g_array_index (priv->entries, guint32, j++) = id;
+		}
+	}
+
+	g_array_set_size (priv->entries, j);
+
+_done:
+	return;
+}
+
+static guint64
+dmapd_dmap_container_record_get_entry_count (DMAPContainerRecord *record)
 {
-	DMAPRecord *record = dmap_db_lookup_by_id (pair->src,
-						   GPOINTER_TO_UINT (item));
-	g_debug ("Adding record %u to container DB", GPOINTER_TO_UINT (item));
-	dmap_db_add_with_id (pair->dest,
-			     record,
-			     GPOINTER_TO_UINT (item));
+	DmapdDMAPContainerRecordPrivate *priv = DMAPD_DMAP_CONTAINER_RECORD (record)->priv;
+
+	resolve_pending (priv);
+
+	return priv->entries->len;
 }
 
 static DMAPDb *
 dmapd_dmap_container_record_get_entries (DMAPContainerRecord *record)
 {
-	struct DBPair pair;
+	DmapdDMAPContainerRecordPrivate *priv = DMAPD_DMAP_CONTAINER_RECORD (record)->priv;
+
+	resolve_pending (priv);
+
+	return dmapd_dmap_db_view_new (priv->full_db, priv->entries, G_OBJECT (record));
+}
+
+static gint
+compare_sort_keys (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const sort_key_t *ka = a, *kb = b;
+
+	if (ka->disc != kb->disc) {
+		return ka->disc < kb->disc ? -1 : 1;
+	} else if (ka->track != kb->track) {
+		return ka->track < kb->track ? -1 : 1;
+	} else {
+		return 0;
+	}
+}
+
+void
+dmapd_dmap_container_record_sort_entries (DmapdDMAPContainerRecord *record)
+{
+	guint i;
+	sort_key_t *keys;
+	DmapdDMAPContainerRecordPrivate *priv = record->priv;
+
+	resolve_pending (priv);
+
+	if (priv->entries->len < 2 || NULL == priv->full_db) {
+		goto _done;
+	}
+
+	/* Fetch each record once, then sort on the extracted keys. */
+	keys = g_new (sort_key_t, priv->entries->len);
+	for (i = 0; i < priv->entries->len; i++) {
+		DMAPRecord *entry;
+
+		keys[i].id = g_array_index (priv->entries, guint32, i);
+		keys[i].disc = 0;
+		keys[i].track = 0;
+
+		entry = dmap_db_lookup_by_id (priv->full_db, keys[i].id);
+		if (NULL != entry) {
+			if (g_object_class_find_property (G_OBJECT_GET_CLASS (entry), "disc")
+			 && g_object_class_find_property (G_OBJECT_GET_CLASS (entry), "track")) {
+				g_object_get (entry, "disc", &keys[i].disc, "track", &keys[i].track, NULL);
+			}
+			g_object_unref (entry);
+		}
+	}
+
+	/* NOTE: g_qsort_with_data is stable, so ties keep directory order. */
+	g_qsort_with_data (keys, priv->entries->len, sizeof (sort_key_t), compare_sort_keys, NULL);
+
+	for (i = 0; i < priv->entries->len; i++) {
+		g_array_index (priv->entries, guint32, i) = keys[i].id;
+	}
+
+	g_free (keys);
+
+_done:
+	return;
+}
+
+static GByteArray *
+dmapd_dmap_container_record_to_blob (DMAPRecord *record)
+{
+	/* FIXME: not endian safe, like dmapd_daap_record_to_blob. */
+
+	DmapdDMAPContainerRecordPrivate *priv = DMAPD_DMAP_CONTAINER_RECORD (record)->priv;
+	GByteArray *blob = g_byte_array_new ();
+	guint i;
+
+	g_assert (priv->location);
+	g_assert (priv->name);
+
+	blob_add_string (blob, VERSION);
+	blob_add_string (blob, priv->location);
+	blob_add_string (blob, priv->name);
+
+	/* NOTE: unlike media records, the blob holds the ID; it is the one
+	 * clients know the container by, not the database's key.
+	 */
+	blob_add_atomic (blob, (const guint8 *) &(priv->id), sizeof (priv->id));
+	blob_add_atomic (blob, (const guint8 *) &(priv->entries->len), sizeof (priv->entries->len));
+	g_byte_array_append (blob, (const guint8 *) priv->entries->data, priv->entries->len * sizeof (guint32));
+
+	/* Playlists keep their stamp, their order and any entries not yet
+	 * resolved.
+	 */
+	blob_add_atomic (blob, (const guint8 *) &(priv->mtime), sizeof (priv->mtime));
+	blob_add_atomic (blob, (const guint8 *) &(priv->filesize), sizeof (priv->filesize));
+	blob_add_atomic (blob, (const guint8 *) &(priv->ordered), sizeof (priv->ordered));
+	blob_add_atomic (blob, (const guint8 *) &(priv->pending->len), sizeof (priv->pending->len));
+	for (i = 0; i < priv->pending->len; i++) {
+		pending_t *pending = &g_array_index (priv->pending, pending_t, i);
+		blob_add_atomic (blob, (const guint8 *) &(pending->position), sizeof (pending->position));
+		blob_add_string (blob, pending->location);
+	}
+
+	return blob;
+}
+
+static gboolean
+dmapd_dmap_container_record_set_from_blob (DMAPRecord *_record, GByteArray *blob)
+{
+	gboolean fnval = FALSE;
+	DmapdDMAPContainerRecordPrivate *priv = DMAPD_DMAP_CONTAINER_RECORD (_record)->priv;
+	guint8 *ptr = blob->data;
+	guint8 *end = blob->data + blob->len;
+	gchar *version, *location, *name, *path = NULL;
+	guint id, len, n_pending, i;
+	gint mtime;
+	guint64 filesize;
+	gboolean ordered;
+	guint8 *entries;
+	GArray *pending_entries = g_array_new (FALSE, FALSE, sizeof (pending_t));
+
+	version = (char *) ptr;
+	ptr += strlen (version) + 1;
+	if (strcmp (version, VERSION)) {
+		g_warning ("Cache written by wrong dmapd version");
+		goto _done;
+	}
+
+	location = (char *) ptr;
+	ptr += strlen (location) + 1;
+
+	name = (char *) ptr;
+	ptr += strlen (name) + 1;
+
+	if (ptr + sizeof (id) + sizeof (len) > end) {
+		g_warning ("Truncated container record for %s", location);
+		goto _done;
+	}
+
+	id = *(guint *) ptr;
+	ptr += sizeof (id);
+
+	len = *(guint *) ptr;
+	ptr += sizeof (len);
+
+	entries = ptr;
+	ptr += (gsize) len * sizeof (guint32);
+
+	if (ptr + sizeof (mtime) + sizeof (filesize) + sizeof (ordered) + sizeof (n_pending) > end) {
+		g_warning ("Truncated container record for %s", location);
+		goto _done;
+	}
 
-	pair.src  = DMAPD_DMAP_CONTAINER_RECORD (record)->priv->full_db;
-	pair.dest = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+	mtime = *(gint *) ptr;
+	ptr += sizeof (mtime);
 
-	g_assert (DMAPD_DMAP_CONTAINER_RECORD (record)->priv->entries != NULL);
+	filesize = *(guint64 *) ptr;
+	ptr += sizeof (filesize);
 
-	g_slist_foreach (DMAPD_DMAP_CONTAINER_RECORD (record)->priv->entries,
-			 (GFunc) add_to_db,
-			 &pair);
-	
-	return pair.dest;
+	ordered = *(gboolean *) ptr;
+	ptr += sizeof (ordered);
+
+	n_pending = *(guint *) ptr;
+	ptr += sizeof (n_pending);
+
+	/* A directory or playlist that is gone leaves a stale container. */
+	path = g_filename_from_uri (location, NULL, NULL);
+	if (NULL == path || ! g_file_test (path, G_FILE_TEST_EXISTS)) {
+		g_debug ("Container source %s is gone", location);
+		goto _done;
+	}
+
+	for (i = 0; i < n_pending; i++) {
+		pending_t pending;
+		gchar *pending_location;
+
+		if (ptr + sizeof (pending.position) >= end) {
+			g_warning ("Truncated container record for %s", location);
+			goto _done;
+		}
+
+		pending.position = *(guint32 *) ptr;
+		ptr += sizeof (pending.position);
+
+		pending_location = (gchar *) ptr;
+		ptr += strlen (pending_location) + 1;
+
+		if (ptr > end || pending.position >= len) {
+			g_warning ("Bad container record for %s", location);
+			goto _done;
+		}
+
+		pending.location = g_strdup (pending_location);
+		g_array_append_val (pending_entries, pending);
+	}
+
+	g_free (priv->location);
+	priv->location = g_strdup (location);
+	g_free (priv->name);
+	priv->name = g_strdup (name);
+	priv->id = id;
+
+	priv->mtime = mtime;
+	priv->filesize = filesize;
+	priv->ordered = ordered;
+
+	g_array_set_size (priv->entries, 0);
+	g_array_append_vals (priv->entries, entries, len);
+
+	g_array_append_vals (priv->pending, pending_entries->data, pending_entries->len);
+	g_array_set_size (pending_entries, 0);
+
+	fnval = TRUE;
+
+_done:
+	for (i = 0; i < pending_entries->len; i++) {
+		g_free (g_array_index (pending_entries, pending_t, i).location);
+	}
+	g_array_free (pending_entries, TRUE);
+	g_free (path);
+
+	return fnval;
 }
 
 static void
 dmapd_dmap_container_record_init (DmapdDMAPContainerRecord *record)
 {
 	record->priv = DMAPD_DMAP_CONTAINER_RECORD_GET_PRIVATE (record);
-	record->priv->id = nextid++;
-	record->priv->entries = NULL;
+	record->priv->entries = g_array_new (FALSE, FALSE, sizeof (guint32));
+	record->priv->pending = g_array_new (FALSE, FALSE, sizeof (pending_t));
 	record->priv->full_db = NULL;
 }
 
@@ -160,12 +465,19 @@ static void
 dmapd_dmap_container_record_finalize (GObject *object)
 {
         DmapdDMAPContainerRecord *db = DMAPD_DMAP_CONTAINER_RECORD (object);
+	guint i;
 
-	g_debug ("Finalizing DmapdDMAPContainerRecord (%u records)", g_slist_length (db->priv->entries));
+	g_debug ("Finalizing DmapdDMAPContainerRecord (%u records)", db->priv->entries->len);
 
 	g_free (db->priv->name);
+	g_free (db->priv->location);
 
-	g_slist_free (db->priv->entries);
+	g_array_free (db->priv->entries, TRUE);
+
+	for (i = 0; i < db->priv->pending->len; i++) {
+		g_free (g_array_index (db->priv->pending, pending_t, i).location);
+	}
+	g_array_free (db->priv->pending, TRUE);
 
 	// G_OBJECT_CLASS (dmapd_dmap_container_record_parent_class)->finalize (object);
 }
@@ -189,6 +501,50 @@ dmapd_dmap_container_record_class_init (DmapdDMAPContainerRecordClass *klass)
 					  			"Full Media DB",
 					  			"Full Media DB",
 								G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	/* NOTE: see dmapd_dmap_container_db_assign_id (). */
+	g_object_class_install_property  (gobject_class, PROP_ID,
+					  g_param_spec_uint ("id",
+							     "Container ID",
+							     "Container ID",
+							     0,
+							     G_MAXINT,
+							     0,
+							     G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	/* NOTE: the directory or playlist URI; containers are stored by location. */
+	g_object_class_install_property (gobject_class, PROP_LOCATION,
+					 g_param_spec_string ("location",
+							      "Container location",
+							      "Container location",
+							      NULL,
+							      G_PARAM_READWRITE));
+
+	/* NOTE: a playlist's mtime and size tell whether it changed. */
+	g_object_class_install_property (gobject_class, PROP_MTIME,
+					 g_param_spec_int ("mtime",
+							   "Playlist modification time",
+							   "Playlist modification time",
+							   0,
+							   G_MAXINT,
+							   0,
+							   G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PROP_FILESIZE,
+					 g_param_spec_uint64 ("filesize",
+							      "Playlist size",
+							      "Playlist size",
+							      0,
+							      G_MAXUINT64,
+							      0,
+							      G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PROP_ORDERED,
+					 g_param_spec_boolean ("ordered",
+							       "Ordered",
+							       "Entries are in a meaningful order and must not be sorted",
+							       FALSE,
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
 
 static void
@@ -204,6 +560,19 @@ dmapd_dmap_container_record_interface_init (gpointer iface, gpointer data)
 	dmap_container_record->get_entries = dmapd_dmap_container_record_get_entries;
 }
 
+static void
+dmapd_dmap_container_record_dmap_iface_init (gpointer iface, gpointer data)
+{
+	DMAPRecordIface *dmap_record = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_record) == DMAP_TYPE_RECORD);
+
+	dmap_record->to_blob = dmapd_dmap_container_record_to_blob;
+	dmap_record->set_from_blob = dmapd_dmap_container_record_set_from_blob;
+}
+
 G_DEFINE_TYPE_WITH_CODE (DmapdDMAPContainerRecord, dmapd_dmap_container_record, G_TYPE_OBJECT, 
 			G_IMPLEMENT_INTERFACE (DMAP_TYPE_CONTAINER_RECORD,
-					       dmapd_dmap_container_record_interface_init))
+					       dmapd_dmap_container_record_interface_init)
+			G_IMPLEMENT_INTERFACE (DMAP_TYPE_RECORD,
+					       dmapd_dmap_container_record_dmap_iface_init))
@@ -58,6 +58,18 @@ typedef struct {
 
 GType dmapd_dmap_container_record_get_type (void);
 
+/* Orders the entries by disc, then track number. */
+void dmapd_dmap_container_record_sort_entries (DmapdDMAPContainerRecord *record);
+
+/* Appends an entry for the media at location, which is looked up in the
+ * full DB only when the entries are first needed. Unknown entries are
+ * dropped then.
+ */
+void dmapd_dmap_container_record_add_pending (DmapdDMAPContainerRecord *record,
+					      const gchar *location);
+
+guint dmapd_dmap_container_record_get_pending_count (DmapdDMAPContainerRecord *record);
+
 #endif /* __DMAPD_DMAP_CONTAINER_RECORD */
 
 G_END_DECLS
@@ -27,22 +27,183 @@
 #include "dmapd-dmap-db-bdb.h"
 
 const gchar *DB_FILENAME = "dmapd.db";
+static const gchar *LOCATION_DB_FILENAME = "dmapd-location.db";
+static const gchar *META_DB_FILENAME = "dmapd-meta.db";
+static const gchar *NEXTID_KEY = "nextid";
 
-/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
-static guint nextid = G_MAXINT; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
+#define DEFAULT_CACHE_SIZE (1 * 1024 * 1024)
+#define DEFAULT_BATCH_SIZE 1000
 
 struct DmapdDMAPDbBDBPrivate {
 	DB_ENV *env;
 	DB *db;
+	DB *location_db;
+	DB *meta_db;
+	DB_TXN *txn;
+	guint txn_puts;
+	guint batch_size;
+	/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
+	guint nextid; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
+	gint64 count; /* Counted when opened, then kept as records are put and deleted. */
 };
 
-static DMAPRecord *
-dmapd_dmap_db_bdb_lookup_by_id	(const DMAPDb *db, guint id)
+/* NOTE: Every serialized record begins with a version string followed by
+ * its location; see dmapd_daap_record_to_blob and dmapd_dpap_record_to_blob.
+ * This allows the location index to be maintained without deserializing.
+ */
+static int
+location_from_blob (DB *secondary, const DBT *key, const DBT *data, DBT *result)
+{
+	const gchar *blob = data->data;
+	const gchar *version_end, *location_end;
+
+	version_end = memchr (blob, 0x00, data->size);
+	if (NULL == version_end) {
+		return DB_DONOTINDEX;
+	}
+
+	location_end = memchr (version_end + 1, 0x00, data->size - (version_end + 1 - blob));
+	if (NULL == location_end) {
+		return DB_DONOTINDEX;
+	}
+
+	memset (result, 0, sizeof (DBT));
+	result->data = (void *) (version_end + 1);
+	result->size = location_end - (version_end + 1);
+
+	return 0;
+}
+
+/* NOTE: Puts are grouped into transactions of batch_size records. Reads
+ * use a transaction of their own, committed once they are done, so that
+ * they hold locks only while they run; see begin_read.
+ */
+static DB_TXN *
+current_txn (DmapdDMAPDbBDBPrivate *priv)
+{
+	int ret;
+
+	if (NULL == priv->txn) {
+		if ((ret = priv->env->txn_begin (priv->env, NULL, &priv->txn, 0)) != 0) {
+			g_error ("Could not begin Berkeley Database transaction: %s", db_strerror (ret));
+		}
+		priv->txn_puts = 0;
+	}
+
+	return priv->txn;
+}
+
+static void
+commit_txn (DmapdDMAPDbBDBPrivate *priv)
+{
+	int ret;
+
+	if (NULL != priv->txn) {
+		if ((ret = priv->txn->commit (priv->txn, 0)) != 0) {
+			g_warning ("Could not commit Berkeley Database transaction: %s", db_strerror (ret));
+		}
+		priv->txn = NULL;
+		priv->txn_puts = 0;
+	}
+}
+
+/* NOTE: while a batch is open, a read is its child, sharing its locks
+ * instead of blocking on them, and seeing the records it has put.
+ */
+static DB_TXN *
+begin_read (DmapdDMAPDbBDBPrivate *priv)
+{
+	int ret;
+	DB_TXN *txn = NULL;
+
+	if ((ret = priv->env->txn_begin (priv->env, priv->txn, &txn, 0)) != 0) {
+		g_error ("Could not begin Berkeley Database transaction: %s", db_strerror (ret));
+	}
+
+	return txn;
+}
+
+static void
+end_read (DB_TXN *txn)
+{
+	int ret;
+
+	if ((ret = txn->commit (txn, 0)) != 0) {
+		g_warning ("Could not commit Berkeley Database transaction: %s", db_strerror (ret));
+	}
+}
+
+static void
+store_meta (DmapdDMAPDbBDBPrivate *priv, const gchar *name, guint value)
+{
+	int ret;
+	DBT key, data;
+
+	memset(&key, 0, sizeof(DBT));
+	memset(&data, 0, sizeof(DBT));
+
+	key.data = (void *) name;
+	key.size = strlen (name);
+	data.data = &value;
+	data.size = sizeof (value);
+
+	if ((ret = priv->meta_db->put (priv->meta_db, current_txn (priv), &key, &data, 0)) != 0) {
+		priv->env->err (priv->env, ret, NULL);
+		g_error ("Error storing %s in Berkeley Database", name);
+	}
+}
+
+static guint
+load_meta (DmapdDMAPDbBDBPrivate *priv, const gchar *name, guint fallback)
 {
 	DBT key, data;
+	DB_TXN *txn;
+	guint value = fallback;
+
+	memset(&key, 0, sizeof(DBT));
+	memset(&data, 0, sizeof(DBT));
+
+	key.data = (void *) name;
+	key.size = strlen (name);
+
+	txn = begin_read (priv);
+
+	if (priv->meta_db->get (priv->meta_db, txn, &key, &data, 0) == 0
+	 && data.size == sizeof (value)) {
+		memcpy (&value, data.data, sizeof (value));
+	}
+
+	end_read (txn);
+
+	return value;
+}
+
+static DMAPRecord *
+record_from_data (const DMAPDb *db, const DBT *data)
+{
 	GByteArray *blob;
 	DMAPRecord *record = NULL;
 	DMAPRecordFactory *factory = NULL;
+
+	g_object_get (DMAPD_DMAP_DB (db), "record-factory", &factory, NULL);
+	g_assert (factory);
+	record = dmap_record_factory_create (factory, NULL);
+
+	blob = g_byte_array_sized_new (data->size);
+	g_byte_array_append (blob, data->data, data->size);
+	dmap_record_set_from_blob (DMAP_RECORD (record), blob);
+
+	g_byte_array_unref (blob);
+
+	return record;
+}
+
+static DMAPRecord *
+dmapd_dmap_db_bdb_lookup_by_id	(const DMAPDb *db, guint id)
+{
+	DBT key, data;
+	DB_TXN *txn;
+	DMAPRecord *record = NULL;
 	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
 
 	if (! priv->db)
@@ -54,20 +215,15 @@ dmapd_dmap_db_bdb_lookup_by_id	(const DMAPDb *db, guint id)
 	key.data = &id;
 	key.size = sizeof (id);
 
-	if (priv->db->get (priv->db, NULL, &key, &data, 0) != 0) {
+	txn = begin_read (priv);
+
+	if (priv->db->get (priv->db, txn, &key, &data, 0) != 0) {
 		g_warning ("Error finding ID %u in Berkeley Database", id);
-		goto _return;
+	} else {
+		record = record_from_data (db, &data);
 	}
 
-	g_object_get (DMAPD_DMAP_DB (db), "record-factory", &factory, NULL);
-	g_assert (factory);
-	record = dmap_record_factory_create (factory, NULL);
-
-	blob = g_byte_array_sized_new (data.size);
-	g_byte_array_append (blob, data.data, data.size);
-	dmap_record_set_from_blob (DMAP_RECORD (record), blob);
-
-	g_byte_array_unref (blob);
+	end_read (txn);
 
 _return:
 	return record;
@@ -76,28 +232,40 @@ _return:
 static guint
 dmapd_dmap_db_bdb_lookup_id_by_location (const DMAPDb *db, const gchar *location)
 {
-	int id;
-	guint fnval = 0;
-	gboolean found = FALSE;
-	/* FIXME: this code is copied elsewhere in this class: */
-	/* id == 0 indicates rollover! */
-	// NOTE: this should be = G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
-	for (id = G_MAXINT; id > nextid && ! found; id--) {
-		gchar *_location = NULL;
-		DMAPRecord *record = dmapd_dmap_db_bdb_lookup_by_id (db, id);
-		if (record) {
-			g_object_get (record, "location", &_location, NULL);
-			g_assert (_location);
-			g_object_unref (record);
-			if (! strcmp (_location, location)) {
-				fnval = id;
-				found = TRUE;
-			}
-			g_free (_location);
-		}
+	guint id = 0;
+	DBT skey, pkey, data;
+	DB_TXN *txn;
+	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
+
+	if (! priv->location_db)
+		goto _return;
+
+	memset(&skey, 0, sizeof(DBT));
+	memset(&pkey, 0, sizeof(DBT));
+	memset(&data, 0, sizeof(DBT));
+
+	skey.data = (void *) location;
+	skey.size = strlen (location);
+
+	pkey.data = &id;
+	pkey.ulen = sizeof (id);
+	pkey.flags = DB_DBT_USERMEM;
+
+	/* Only the primary key is of interest; do not copy the record. */
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = 0;
+
+	txn = begin_read (priv);
+
+	if (priv->location_db->pget (priv->location_db, txn, &skey, &pkey, &data, 0) != 0) {
+		id = 0;
 	}
 
-	return fnval;
+	end_read (txn);
+
+_return:
+	return id;
 }
 
 static void
@@ -105,20 +273,96 @@ dmapd_dmap_db_bdb_foreach	(const DMAPDb *db,
 				 GHFunc func,
 				 gpointer data)
 {
-	guint id;
-	/* id == 0 indicates rollover! */
-	// NOTE: this should be = G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
-	for (id = G_MAXINT; id > nextid; id--) {
-		DMAPRecord *record = dmapd_dmap_db_bdb_lookup_by_id (db, id);
+	int ret;
+	DBC *cursor;
+	DBT key, value;
+	DB_TXN *txn;
+	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
+
+	txn = begin_read (priv);
+
+	if ((ret = priv->db->cursor (priv->db, txn, &cursor, 0)) != 0) {
+		g_warning ("Could not open Berkeley Database cursor: %s", db_strerror (ret));
+		goto _return;
+	}
+
+	memset(&key, 0, sizeof(DBT));
+	memset(&value, 0, sizeof(DBT));
+
+	while ((ret = cursor->get (cursor, &key, &value, DB_NEXT)) == 0) {
+		guint id;
+		DMAPRecord *record;
+
+		g_assert (key.size == sizeof (id));
+		memcpy (&id, key.data, sizeof (id));
+
+		record = record_from_data (db, &value);
 		func (GUINT_TO_POINTER (id), record, data);
 		g_object_unref (record);
 	}
+
+	if (ret != DB_NOTFOUND) {
+		g_warning ("Error iterating over Berkeley Database: %s", db_strerror (ret));
+	}
+
+	cursor->close (cursor);
+
+_return:
+	end_read (txn);
+
+	return;
 }
 
 static gint64
 dmapd_dmap_db_bdb_count (const DMAPDb *db)
 {
-	return G_MAXINT - nextid;
+	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
+
+	return priv->count;
+}
+
+/* NOTE: IDs may be chosen by the caller, or put again, so a put does not
+ * always add a record.
+ */
+static gboolean
+id_exists (DmapdDMAPDbBDBPrivate *priv, guint id)
+{
+	DBT key, data;
+
+	memset(&key, 0, sizeof(DBT));
+	memset(&data, 0, sizeof(DBT));
+
+	key.data = &id;
+	key.size = sizeof (id);
+
+	/* Only whether the key is present is of interest; do not copy the record. */
+	data.flags = DB_DBT_PARTIAL;
+	data.doff = 0;
+	data.dlen = 0;
+
+	return priv->db->get (priv->db, current_txn (priv), &key, &data, 0) == 0;
+}
+
+static gint64
+count_records (DmapdDMAPDbBDBPrivate *priv)
+{
+	int ret;
+	DB_TXN *txn;
+	gint64 fnval = 0;
+	DB_BTREE_STAT *stat = NULL;
+
+	txn = begin_read (priv);
+
+	if ((ret = priv->db->stat (priv->db, txn, &stat, 0)) != 0) {
+		g_warning ("Could not count records in Berkeley Database: %s", db_strerror (ret));
+	} else {
+		fnval = stat->bt_nkeys;
+		free (stat);
+	}
+
+	end_read (txn);
+
+	return fnval;
 }
 
 static guint
@@ -126,6 +370,7 @@ dmapd_dmap_db_bdb_add_with_id (DMAPDb *_db, DMAPRecord *record, guint id)
 {
 	int ret;
 	DBT key, data;
+	gboolean existed;
 	DmapdDMAPDbBDB *db = DMAPD_DMAP_DB_BDB (_db);
 	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
 
@@ -141,20 +386,74 @@ dmapd_dmap_db_bdb_add_with_id (DMAPDb *_db, DMAPRecord *record, guint id)
 	data.data = blob->data;
 	data.size = blob->len;
 
-	if ((ret = priv->db->put (priv->db, NULL, &key, &data, 0)) != 0) {
+	existed = id_exists (priv, id);
+
+	if ((ret = priv->db->put (priv->db, current_txn (priv), &key, &data, 0)) != 0) {
 		priv->env->err (priv->env, ret, NULL);
 		g_error ("Error inserting into Berkeley Database");
 	}
 
 	g_byte_array_unref (blob);
 
+	if (! existed) {
+		priv->count++;
+	}
+
+	if (id <= priv->nextid) {
+		priv->nextid = id - 1;
+		store_meta (priv, NEXTID_KEY, priv->nextid);
+	}
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_txn (priv);
+	}
+
 	return id;
 }
 
 static guint
 dmapd_dmap_db_bdb_add (DMAPDb *db, DMAPRecord *record)
 {
-	return dmapd_dmap_db_bdb_add_with_id (db, record, nextid--);
+	return dmapd_dmap_db_bdb_add_with_id (db, record, DMAPD_DMAP_DB_BDB (db)->priv->nextid);
+}
+
+static void
+dmapd_dmap_db_bdb_flush (DMAPDb *db)
+{
+	commit_txn (DMAPD_DMAP_DB_BDB (db)->priv);
+}
+
+static gboolean
+dmapd_dmap_db_bdb_remove (DMAPDb *db, guint id)
+{
+	int ret;
+	DBT key;
+	gboolean fnval = FALSE;
+	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (db)->priv;
+
+	memset(&key, 0, sizeof(DBT));
+
+	key.data = &id;
+	key.size = sizeof (id);
+
+	/* NOTE: Berkeley DB also deletes the location index entry. */
+	if ((ret = priv->db->del (priv->db, current_txn (priv), &key, 0)) != 0) {
+		if (ret != DB_NOTFOUND) {
+			g_warning ("Error removing ID %u from Berkeley Database: %s", id, db_strerror (ret));
+		}
+		goto _return;
+	}
+
+	priv->count--;
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_txn (priv);
+	}
+
+	fnval = TRUE;
+
+_return:
+	return fnval;
 }
 
 static guint
@@ -182,46 +481,97 @@ G_DEFINE_DYNAMIC_TYPE (DmapdDMAPDbBDB,
 		       dmapd_dmap_db_bdb,
 		       TYPE_DMAPD_DMAP_DB)
 
+static guint
+option_as_uint (GHashTable *options, const gchar *name, guint fallback)
+{
+	guint fnval = fallback;
+	const gchar *value = NULL;
+
+	if (NULL != options && NULL != (value = g_hash_table_lookup (options, name))) {
+		gchar *end = NULL;
+		guint64 parsed = g_ascii_strtoull (value, &end, 10);
+		if (end == value || *end != 0x00 || parsed > G_MAXUINT) {
+			g_warning ("Bad value for Berkeley Database option %s: %s", name, value);
+		} else {
+			fnval = parsed;
+		}
+	}
+
+	return fnval;
+}
+
+static DB *
+open_db (DmapdDMAPDbBDB *db, const gchar *db_dir, const gchar *filename, guint32 page_size)
+{
+	int ret;
+	DB *fnval = NULL;
+	gchar *db_path = NULL;
+
+	if (db_create(&fnval, db->priv->env, 0) != 0)
+		g_error ("Could not initialize Berkeley Database");
+
+	if (page_size > 0 && (ret = fnval->set_pagesize (fnval, page_size)) != 0)
+		g_warning ("Could not set Berkeley Database page size: %s", db_strerror(ret));
+
+	db_path = g_strdup_printf ("%s/%s", db_dir, filename);
+	if ((ret = fnval->open (fnval, NULL, db_path, NULL,
+	    DB_BTREE, DB_CREATE | DB_AUTO_COMMIT, 0)) != 0) {
+		g_free (db_path);
+		g_error ("Could not open Berkeley Database: %s", db_strerror(ret));
+	}
+
+	g_free (db_path);
+
+	return fnval;
+}
+
 static GObject*
 dmapd_dmap_db_bdb_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
 {
 	int ret;
         DmapdDMAPDbBDB *db;
 	gchar *db_dir = NULL;
+	GHashTable *options = NULL;
+	guint cache_size, page_size;
 
 	db = DMAPD_DMAP_DB_BDB(G_OBJECT_CLASS (dmapd_dmap_db_bdb_parent_class)->constructor (type, n_construct_params, construct_params));
 
 	gint64 numrec;
-	gchar *db_path = NULL;
 
 	db->priv = DMAPD_DMAP_DB_BDB_GET_PRIVATE (db);
 
-	g_object_get (db, "db-dir", &db_dir, NULL);
+	g_object_get (db, "db-dir", &db_dir, "options", &options, NULL);
 	g_assert (db_dir);
+
+	cache_size          = option_as_uint (options, "cache-size", DEFAULT_CACHE_SIZE);
+	page_size           = option_as_uint (options, "page-size", 0);
+	db->priv->batch_size = MAX (1, option_as_uint (options, "batch-size", DEFAULT_BATCH_SIZE));
+
+	g_debug ("Using %u byte Berkeley Database cache", cache_size);
+
 	db->priv->env->set_data_dir  (db->priv->env, db_dir);
-	db->priv->env->set_cachesize (db->priv->env, 0, 1 * 1024 * 1024, 1);
-	db->priv->env->set_cache_max (db->priv->env, 0, 1 * 1024 * 1024);
+	db->priv->env->set_cachesize (db->priv->env, 0, cache_size, 1);
+	db->priv->env->set_cache_max (db->priv->env, 0, cache_size);
 
-	if (db->priv->env->open (db->priv->env, db_dir, DB_CREATE | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_MPOOL, 0) != 0)
+	if (db->priv->env->open (db->priv->env, db_dir, DB_CREATE | DB_INIT_LOCK | DB_INIT_LOG | DB_INIT_MPOOL | DB_INIT_TXN | DB_RECOVER, 0) != 0)
 		g_error ("Could not open Berkeley Database environment");
 
-	if (db_create(&(db->priv->db), db->priv->env, 0) != 0)
-		g_error ("Could not initialize Berkeley Database");
+	db->priv->db          = open_db (db, db_dir, DB_FILENAME, page_size);
+	db->priv->location_db = open_db (db, db_dir, LOCATION_DB_FILENAME, page_size);
+	db->priv->meta_db     = open_db (db, db_dir, META_DB_FILENAME, 0);
 
-	db_path = g_strdup_printf ("%s/%s", db_dir, DB_FILENAME);
-	if ((ret = db->priv->db->open (db->priv->db, NULL, db_path, NULL,
-	    DB_BTREE, DB_CREATE, 0)) != 0) {
-		g_free (db_path);
-		g_error ("Could not open Berkeley Database: %s", db_strerror(ret));
-	}
+	/* NOTE: DB_CREATE indexes existing records if the secondary is empty. */
+	if ((ret = db->priv->db->associate (db->priv->db, NULL, db->priv->location_db, location_from_blob, DB_CREATE)) != 0)
+		g_error ("Could not associate Berkeley Database location index: %s", db_strerror(ret));
+
+	// NOTE: this should be G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
+	db->priv->nextid = load_meta (db->priv, NEXTID_KEY, G_MAXINT);
+	db->priv->count = count_records (db->priv);
 
 	numrec = dmapd_dmap_db_bdb_count (DMAP_DB (db));
 	g_debug ("Opened database with %" G_GINT64_FORMAT " records", numrec);
-	// NOTE: this should be G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
-	nextid = G_MAXINT - numrec;
 
 	g_free (db_dir);
-	g_free (db_path);
 
 	return G_OBJECT (db);
 }
@@ -243,14 +593,20 @@ dmapd_dmap_db_bdb_class_finalize (DmapdDMAPDbBDBClass *object)
 static void
 dmapd_dmap_db_bdb_finalize (GObject *object)
 {
-        DB_BTREE_STAT *statp;
 	DmapdDMAPDbBDBPrivate *priv = DMAPD_DMAP_DB_BDB (object)->priv;
 
-	priv->db->stat (priv->db, NULL, &statp, 0);
-	g_debug ("Finalizing DmapdDMAPDbBDB (%d records)", statp->bt_ndata);
-	free (statp);
+	commit_txn (priv);
+
+	g_debug ("Finalizing DmapdDMAPDbBDB (%" G_GINT64_FORMAT " records)",
+	         dmapd_dmap_db_bdb_count (DMAP_DB (object)));
+
+	/* Close the secondary before the primary it is associated with. */
+	priv->location_db->close (priv->location_db, 0);
 	priv->db->close (priv->db, 0);
+	priv->meta_db->close (priv->meta_db, 0);
 	priv->env->close (priv->env, 0);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_bdb_parent_class)->finalize (object);
 }
 
 static void dmapd_dmap_db_bdb_class_init (DmapdDMAPDbBDBClass *klass)
@@ -268,6 +624,8 @@ static void dmapd_dmap_db_bdb_class_init (DmapdDMAPDbBDBClass *klass)
 	dmap_db_class->lookup_id_by_location = dmapd_dmap_db_bdb_lookup_id_by_location;
 	dmap_db_class->foreach = dmapd_dmap_db_bdb_foreach;
 	dmap_db_class->count = dmapd_dmap_db_bdb_count;
+	dmap_db_class->remove = dmapd_dmap_db_bdb_remove;
+	dmap_db_class->flush = dmapd_dmap_db_bdb_flush;
 
 	g_type_class_add_private (klass, sizeof (DmapdDMAPDbBDBPrivate));
 }
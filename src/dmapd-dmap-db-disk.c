@@ -24,18 +24,12 @@
 #include <glib.h>
 
 #include "util.h"
+#include "dmapd-id-map.h"
 #include "dmapd-dmap-db-disk.h"
 
-/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
-static guint nextid = G_MAXINT; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
-
 struct DmapdDMAPDbDiskPrivate {
 	GHashTable *db;
-};
-
-struct hash_id_t {
-	const gchar *hash;
-	guint id;
+	DmapdIdMap *ids;
 };
 
 struct fn_data_t {
@@ -65,42 +59,91 @@ cache_read (const gchar *path)
 }
 
 static DMAPRecord *
-load_cached_record (const DMAPDb *db, const gchar *db_dir, guchar *hash, DMAPRecordFactory *factory)
+load_cached_record (const DMAPDb *db, const gchar *path, DMAPRecordFactory *factory)
 {
 	DMAPRecord *record = NULL;
-	gchar *path = g_strdup_printf ("%s/%s", db_dir, hash);
 	if (g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
 		GByteArray *blob = cache_read (path);
 		if (blob) {
 			g_debug ("Adding cache: %s", path);
 			record = dmap_record_factory_create (factory, NULL);
-			dmap_record_set_from_blob (record, blob);
+			if (NULL != record && ! dmap_record_set_from_blob (record, blob)) {
+				g_object_unref (record);
+				record = NULL;
+			}
 			g_byte_array_free (blob, TRUE);
 		}
 	}
-	g_free (path);
 	return record;
 }
 
+/* Finds the records stored by earlier runs, reading each once for its
+ * location, so that lookups read back what was written.
+ */
+static void
+load_cached_paths (DMAPDb *db, const gchar *db_dir, DMAPRecordFactory *factory)
+{
+	GDir *d;
+	const gchar *entry;
+	DmapdDMAPDbDiskPrivate *priv = DMAPD_DMAP_DB_DISK (db)->priv;
+
+	d = g_dir_open (db_dir, 0, NULL);
+	if (NULL == d) {
+		goto _done;
+	}
+
+	while ((entry = g_dir_read_name (d))) {
+		gchar *location = NULL;
+		gchar *path;
+		DMAPRecord *record;
+
+		if (! g_str_has_suffix (entry, ".record")) {
+			continue;
+		}
+
+		path = g_strdup_printf ("%s/%s", db_dir, entry);
+		record = load_cached_record (db, path, factory);
+		if (NULL == record) {
+			g_warning ("Removing stale cache entry %s", path);
+			g_unlink (path);
+			g_free (path);
+			continue;
+		}
+
+		g_object_get (record, "location", &location, NULL);
+		if (NULL != location) {
+			guint id = dmapd_id_map_assign (priv->ids, location);
+			g_hash_table_insert (priv->db, GUINT_TO_POINTER (id), path);
+		} else {
+			g_free (path);
+		}
+
+		g_free (location);
+		g_object_unref (record);
+	}
+
+	g_dir_close (d);
+
+_done:
+	return;
+}
+
 static DMAPRecord *
 dmapd_dmap_db_disk_lookup_by_id	(const DMAPDb *db, guint id)
 {
-	guchar *hash = NULL;
-	gchar *db_dir = NULL;
+	gchar *path = NULL;
 	DMAPRecord *record = NULL;
 	DMAPRecordFactory *factory = NULL;
 
 	g_object_get ((gpointer) db, "record-factory", &factory, NULL);
 	g_assert (factory);
-	g_object_get ((gpointer) db, "db-dir", &db_dir, NULL);
-	g_assert (db_dir);
 
-	hash = g_hash_table_lookup (DMAPD_DMAP_DB_DISK (db)->priv->db, GUINT_TO_POINTER (id));
-	if (hash) {
-		g_debug ("Hash for %d is %s", id, hash);
-		record = load_cached_record (db, db_dir, hash, factory);
+	path = g_hash_table_lookup (DMAPD_DMAP_DB_DISK (db)->priv->db, GUINT_TO_POINTER (id));
+	if (path) {
+		g_debug ("Path for %d is %s", id, path);
+		record = load_cached_record (db, path, factory);
 		if (! record) {
-			g_warning ("Record %s not found", hash);
+			g_warning ("Record %s not found", path);
 		}
 	} else {
 		g_warning ("Record %d not found", id);
@@ -109,36 +152,20 @@ dmapd_dmap_db_disk_lookup_by_id	(const DMAPDb *db, guint id)
         return record;
 }
 
-static gboolean
-hash_match (gpointer key, gpointer val, gpointer user_data)
-{
-	struct hash_id_t *hash_id = user_data;
-	hash_id->id = GPOINTER_TO_UINT (key);
-	return ! strcmp (val, hash_id->hash); 
-}
-
 static guint
 dmapd_dmap_db_disk_lookup_id_by_location (const DMAPDb *db, const gchar *location)
 {
-	guint fnval;
-	guchar hash[33];
-	struct hash_id_t user_data;
-
-	hash[32] = 0x00;
-	dmap_hash_generate (1, (const guchar*) location, 2, hash, 0);
+	guint id;
+	DmapdDMAPDbDiskPrivate *priv = DMAPD_DMAP_DB_DISK (db)->priv;
 
-	user_data.hash = location;
-	user_data.id = 0;
+	id = dmapd_id_map_lookup (priv->ids, location);
 
-	if (g_hash_table_find (DMAPD_DMAP_DB_DISK (db)->priv->db,
-		(GHRFunc) hash_match,
-		(gpointer) &user_data)) {
-		fnval = user_data.id;
-	} else {
-		fnval = 0;
+	/* The map also remembers records added during earlier runs. */
+	if (id && NULL == g_hash_table_lookup (priv->db, GUINT_TO_POINTER (id))) {
+		id = 0;
 	}
 
-	return fnval;
+	return id;
 }
 
 static void
@@ -180,28 +207,27 @@ dmapd_dmap_db_disk_count (const DMAPDb *db)
 static guint
 dmapd_dmap_db_disk_add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
 {
-	gchar *location;
 	GByteArray *blob;
 	gchar *db_dir = NULL;
-	guchar *hash;
+	gchar *path;
 
-	g_object_get (record, "location", &location, NULL);
-	g_assert (location);
 	g_object_get (db, "db-dir", &db_dir, NULL);
 	if (! db_dir) {
 		g_error ("Database directory not set");
 	}
 
-	hash = g_new (guchar, 33);
-	hash[32] = 0x00;
-
-        dmap_hash_generate (1, (const guchar*) location, 2, hash, 0);
-
+	/* NOTE: read back from where it was written. */
 	blob = dmap_record_to_blob (record);
-	cache_store (db_dir, location, blob);
-	g_free (location);
+	path = cache_store (db_dir, record, blob);
 	g_byte_array_free (blob, TRUE);
-	g_hash_table_insert (DMAPD_DMAP_DB_DISK (db)->priv->db, GUINT_TO_POINTER (id), hash);
+	g_free (db_dir);
+
+	if (NULL == path) {
+		g_warning ("Could not store record %u", id);
+		return 0;
+	}
+
+	g_hash_table_insert (DMAPD_DMAP_DB_DISK (db)->priv->db, GUINT_TO_POINTER (id), path);
 
 	return id;
 }
@@ -209,7 +235,22 @@ dmapd_dmap_db_disk_add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
 static guint
 dmapd_dmap_db_disk_add (DMAPDb *db, DMAPRecord *record)
 {
-	return dmapd_dmap_db_disk_add_with_id (db, record, nextid--);
+	guint id;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	g_assert (location);
+
+	id = dmapd_id_map_assign (DMAPD_DMAP_DB_DISK (db)->priv->ids, location);
+	g_free (location);
+
+	return dmapd_dmap_db_disk_add_with_id (db, record, id);
+}
+
+static gboolean
+dmapd_dmap_db_disk_remove (DMAPDb *db, guint id)
+{
+	return g_hash_table_remove (DMAPD_DMAP_DB_DISK (db)->priv->db, GUINT_TO_POINTER (id));
 }
 
 static guint
@@ -243,7 +284,34 @@ static void dmapd_dmap_db_disk_init (DmapdDMAPDbDisk *db)
 	db->priv->db = g_hash_table_new_full (g_direct_hash,
 					      g_direct_equal,
 					      NULL,
-					      g_object_unref);
+					      g_free);
+}
+
+static GObject *
+dmapd_dmap_db_disk_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
+{
+	GObject *object;
+	gchar *db_dir = NULL;
+	gchar *ids_path = NULL;
+	DMAPRecordFactory *factory = NULL;
+
+	object = G_OBJECT_CLASS (dmapd_dmap_db_disk_parent_class)->constructor (type, n_construct_params, construct_params);
+
+	g_object_get (object, "db-dir", &db_dir, "record-factory", &factory, NULL);
+	if (db_dir) {
+		ids_path = g_strdup_printf ("%s/ids", db_dir);
+	}
+
+	DMAPD_DMAP_DB_DISK (object)->priv->ids = dmapd_id_map_new (ids_path, DMAPD_ID_MAP_FIRST_MEDIA_ID, -1);
+
+	if (db_dir && factory) {
+		load_cached_paths (DMAP_DB (object), db_dir, factory);
+	}
+
+	g_free (ids_path);
+	g_free (db_dir);
+
+	return object;
 }
 
 static void
@@ -255,6 +323,9 @@ dmapd_dmap_db_disk_finalize (GObject *object)
 		 g_hash_table_size (db->priv->db));
 
 	g_hash_table_destroy (db->priv->db);
+	dmapd_id_map_free (db->priv->ids);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_disk_parent_class)->finalize (object);
 }
 
 static void
@@ -267,6 +338,7 @@ static void dmapd_dmap_db_disk_class_init (DmapdDMAPDbDiskClass *klass)
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
 	DmapdDMAPDbClass *dmap_db_class = DMAPD_DMAP_DB_CLASS (klass);
 
+	object_class->constructor = dmapd_dmap_db_disk_constructor;
 	object_class->finalize = dmapd_dmap_db_disk_finalize;
 
 	dmap_db_class->add = dmapd_dmap_db_disk_add;
@@ -276,6 +348,7 @@ static void dmapd_dmap_db_disk_class_init (DmapdDMAPDbDiskClass *klass)
 	dmap_db_class->lookup_id_by_location = dmapd_dmap_db_disk_lookup_id_by_location;
 	dmap_db_class->foreach = dmapd_dmap_db_disk_foreach;
 	dmap_db_class->count = dmapd_dmap_db_disk_count;
+	dmap_db_class->remove = dmapd_dmap_db_disk_remove;
 
 	g_type_class_add_private (klass, sizeof (DmapdDMAPDbDiskPrivate));
 }
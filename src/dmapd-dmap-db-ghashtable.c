@@ -24,64 +24,28 @@
 #include <glib.h>
 
 #include "util.h"
+#include "dmapd-id-map.h"
 #include "dmapd-dmap-db-ghashtable.h"
 
-/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
-static guint nextid = G_MAXINT; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
-
 struct DmapdDMAPDbGHashTablePrivate {
 	GHashTable *db;
-	gchar *db_dir;
-	DMAPRecordFactory *record_factory;
-	GSList *acceptable_formats;
-};
-
-enum {
-        PROP_0,
-	PROP_DB_DIR,
-	PROP_RECORD_FACTORY,
-	PROP_ACCEPTABLE_FORMATS
-};
-
-struct loc_id {
-	const gchar *location;
-	guint id;
+	DmapdIdMap *ids;
 };
 
-static gboolean
-path_match (gpointer key, gpointer val, gpointer user_data)
-{
-	gboolean fnval;
-	gchar *location;
-
-	((struct loc_id *) user_data)->id = GPOINTER_TO_UINT (key);
-	g_object_get (DMAP_RECORD (val), "location", &location, NULL);
-
-	fnval = ! strcmp (location, ((struct loc_id *) user_data)->location); 
-
-	g_free (location);
-
-	return fnval;
-}
-
 static guint
 dmapd_dmap_db_ghashtable_lookup_id_by_location (const DMAPDb *db, const gchar *location)
 {
-	guint fnval;
-	struct loc_id user_data;
+	guint id;
+	DmapdDMAPDbGHashTablePrivate *priv = DMAPD_DMAP_DB_GHASHTABLE (db)->priv;
 
-	user_data.location = location;
-	user_data.id = 0;
+	id = dmapd_id_map_lookup (priv->ids, location);
 
-	if (g_hash_table_find (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->db,
-		(GHRFunc) path_match,
-		(gpointer) &user_data)) {
-		fnval = user_data.id;
-	} else {
-		fnval = 0;
+	/* The map also remembers records that were not reloaded. */
+	if (id && NULL == g_hash_table_lookup (priv->db, GUINT_TO_POINTER (id))) {
+		id = 0;
 	}
 
-	return fnval;
+	return id;
 }
 
 static DMAPRecord *
@@ -109,6 +73,8 @@ dmapd_dmap_db_ghashtable_count (const DMAPDb *db)
 	return g_hash_table_size (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->db);
 }
 
+static guint dmapd_dmap_db_ghashtable_add (DMAPDb *db, DMAPRecord *record);
+
 static GByteArray *
 cache_read (const gchar *path)
 {
@@ -153,7 +119,8 @@ load_cached_records (DMAPDb *db, const gchar *db_dir, DMAPRecordFactory *factory
 						DMAPRecord *record = dmap_record_factory_create (factory, NULL);
 						if (NULL != record) {
 							if (dmap_record_set_from_blob (record, blob)) {
-								dmap_db_add (DMAP_DB (db), record);
+								/* NOTE: not dmap_db_add; reloading is not a change. */
+								dmapd_dmap_db_ghashtable_add (db, record);
 							} else {
 								g_warning ("Removing stale cache entry %s\n", path);
 								g_unlink (path);
@@ -173,32 +140,18 @@ load_cached_records (DMAPDb *db, const gchar *db_dir, DMAPRecordFactory *factory
 
 static guint
 dmapd_dmap_db_ghashtable_add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
-{
-	g_hash_table_insert (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->db, GUINT_TO_POINTER (id), record);
-	return id;
-}
-
-static guint
-dmapd_dmap_db_ghashtable_add (DMAPDb *db, DMAPRecord *record)
 {
 	gchar *db_dir    = NULL;
 	GByteArray *blob = NULL;
-	gchar *location  = NULL;;
-
-	g_object_ref (record);
 
-	g_object_get (record, "location", &location, NULL);
 	g_object_get (db, "db-dir", &db_dir, NULL);
 
 	if (db_dir != NULL) {
 		blob = dmap_record_to_blob (record);
-		cache_store (db_dir, location, blob);
+		g_free (cache_store (db_dir, record, blob));
 	}
 
-_done:
-	if (NULL != location) {
-		g_free (location);
-	}
+	g_hash_table_insert (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->db, GUINT_TO_POINTER (id), g_object_ref (record));
 
 	if (NULL != db_dir) {
 		g_free (db_dir);
@@ -208,7 +161,29 @@ _done:
 		g_byte_array_unref (blob);
 	}
 
-	return dmapd_dmap_db_ghashtable_add_with_id (db, record, nextid--);
+	return id;
+}
+
+static guint
+dmapd_dmap_db_ghashtable_add (DMAPDb *db, DMAPRecord *record)
+{
+	guint id;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	g_assert (location);
+
+	id = dmapd_id_map_assign (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->ids, location);
+	g_free (location);
+
+	return dmapd_dmap_db_ghashtable_add_with_id (db, record, id);
+}
+
+static gboolean
+dmapd_dmap_db_ghashtable_remove (DMAPDb *db, guint id)
+{
+	/* NOTE: a cached record whose file is gone is dropped on reload. */
+	return g_hash_table_remove (DMAPD_DMAP_DB_GHASHTABLE (db)->priv->db, GUINT_TO_POINTER (id));
 }
 
 static guint
@@ -243,35 +218,27 @@ dmapd_dmap_db_ghashtable_add_path (DMAPDb *db, const gchar *path)
 	return id;
 }
 
-static void dmapd_dmap_ghashtable_interface_init (gpointer iface, gpointer data)
-{
-        DMAPDbIface *dmap_db = iface;
-
-	g_assert (G_TYPE_FROM_INTERFACE (dmap_db) == DMAP_TYPE_DB);
-
-	dmap_db->add = dmapd_dmap_db_ghashtable_add;
-	dmap_db->add_with_id = dmapd_dmap_db_ghashtable_add_with_id;
-	dmap_db->add_path = dmapd_dmap_db_ghashtable_add_path;
-	dmap_db->lookup_by_id = dmapd_dmap_db_ghashtable_lookup_by_id;
-	dmap_db->lookup_id_by_location = dmapd_dmap_db_ghashtable_lookup_id_by_location;
-	dmap_db->foreach = dmapd_dmap_db_ghashtable_foreach;
-	dmap_db->count = dmapd_dmap_db_ghashtable_count;
-}
-
-G_DEFINE_TYPE_WITH_CODE (DmapdDMAPDbGHashTable, dmapd_dmap_db_ghashtable, G_TYPE_OBJECT,
-                         G_IMPLEMENT_INTERFACE (DMAP_TYPE_DB, dmapd_dmap_ghashtable_interface_init))
+G_DEFINE_TYPE (DmapdDMAPDbGHashTable, dmapd_dmap_db_ghashtable, TYPE_DMAPD_DMAP_DB)
 
 static GObject*
 dmapd_dmap_db_ghashtable_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
 {
 	GObject *object;
 	gchar *db_dir = NULL;
+	gchar *ids_path = NULL;
 	DMAPRecordFactory *factory = NULL;
   
 	object = G_OBJECT_CLASS (dmapd_dmap_db_ghashtable_parent_class)->constructor (type, n_construct_params, construct_params);
 
 	g_object_get (object, "db-dir", &db_dir, "record-factory", &factory, NULL);
-	/* NOTE: Don't load cache when used for DmapdDMAPContainerRecord: */
+
+	if (db_dir) {
+		ids_path = g_strdup_printf ("%s/ids", db_dir);
+	}
+	DMAPD_DMAP_DB_GHASHTABLE (object)->priv->ids = dmapd_id_map_new (ids_path, DMAPD_ID_MAP_FIRST_MEDIA_ID, -1);
+	g_free (ids_path);
+
+	/* NOTE: in-memory databases, e.g., for containers, have no db-dir. */
 	if (db_dir && factory) {
 		load_cached_records (DMAP_DB (object), db_dir, factory);
 	}
@@ -298,89 +265,27 @@ dmapd_dmap_db_ghashtable_finalize (GObject *object)
 		 g_hash_table_size (db->priv->db));
 
 	g_hash_table_destroy (db->priv->db);
-}
-
-static void
-dmapd_dmap_db_ghashtable_set_property (GObject *object,
-                            guint prop_id,
-			    const GValue *value,
-			    GParamSpec *pspec)
-{
-        DmapdDMAPDbGHashTable *db = DMAPD_DMAP_DB_GHASHTABLE (object);
-
-	switch (prop_id) {
-		case PROP_DB_DIR:
-			g_free (db->priv->db_dir);
-			db->priv->db_dir = g_value_dup_string (value);
-			break;
-		case PROP_RECORD_FACTORY:
-			if (db->priv->record_factory)
-				g_object_unref (db->priv->record_factory);
-			db->priv->record_factory = DMAP_RECORD_FACTORY (g_value_get_pointer (value));
-			break;	
-		case PROP_ACCEPTABLE_FORMATS:
-			db->priv->acceptable_formats = g_value_get_pointer (value);
-			break;
-		default:
-			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-			break;
-	}
-}
+	dmapd_id_map_free (db->priv->ids);
 
-static void
-dmapd_dmap_db_ghashtable_get_property (GObject *object,
-                            guint prop_id,
-			    GValue *value,
-			    GParamSpec *pspec)
-{
-        DmapdDMAPDbGHashTable *db = DMAPD_DMAP_DB_GHASHTABLE (object);
-
-	switch (prop_id) {
-		case PROP_DB_DIR:
-			g_value_set_static_string (value, db->priv->db_dir);
-			break;
-		case PROP_RECORD_FACTORY:
-			g_value_set_pointer (value, db->priv->record_factory);
-			break;	
-		case PROP_ACCEPTABLE_FORMATS:
-			g_value_set_pointer (value, db->priv->acceptable_formats);
-			break;
-		default:
-			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
-			break;
-	}
+	G_OBJECT_CLASS (dmapd_dmap_db_ghashtable_parent_class)->finalize (object);
 }
 
-
 static void dmapd_dmap_db_ghashtable_class_init (DmapdDMAPDbGHashTableClass *klass)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	DmapdDMAPDbClass *dmap_db_class = DMAPD_DMAP_DB_CLASS (klass);
 
 	g_type_class_add_private (klass, sizeof (DmapdDMAPDbGHashTablePrivate));
 
 	object_class->finalize = dmapd_dmap_db_ghashtable_finalize;
 	object_class->constructor = dmapd_dmap_db_ghashtable_constructor;
-	object_class->set_property = dmapd_dmap_db_ghashtable_set_property;
-	object_class->get_property = dmapd_dmap_db_ghashtable_get_property;
-
-	g_object_class_install_property (object_class,
-					 PROP_RECORD_FACTORY,
-					 g_param_spec_pointer ("record-factory",
-					 		       "Record factory",
-							       "Record factory",
-							        G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
-
-	g_object_class_install_property (object_class,
-					 PROP_DB_DIR,
-					 g_param_spec_string ("db-dir",
-					 		      "Directory for database cache",
-							      "Directory for database cache",
-							      NULL,
-							      G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
-
-	g_object_class_install_property (object_class, PROP_ACCEPTABLE_FORMATS,
-					 g_param_spec_pointer ("acceptable-formats",
-					                       "Acceptable formats",
-							       "Acceptable formats",
-							        G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+
+	dmap_db_class->add = dmapd_dmap_db_ghashtable_add;
+	dmap_db_class->add_with_id = dmapd_dmap_db_ghashtable_add_with_id;
+	dmap_db_class->add_path = dmapd_dmap_db_ghashtable_add_path;
+	dmap_db_class->lookup_by_id = dmapd_dmap_db_ghashtable_lookup_by_id;
+	dmap_db_class->lookup_id_by_location = dmapd_dmap_db_ghashtable_lookup_id_by_location;
+	dmap_db_class->foreach = dmapd_dmap_db_ghashtable_foreach;
+	dmap_db_class->count = dmapd_dmap_db_ghashtable_count;
+	dmap_db_class->remove = dmapd_dmap_db_ghashtable_remove;
 }
@@ -48,12 +48,12 @@ G_BEGIN_DECLS
 typedef struct DmapdDMAPDbGHashTablePrivate DmapdDMAPDbGHashTablePrivate;
 
 typedef struct {
-	GObject parent;
+	DmapdDMAPDb parent;
 	DmapdDMAPDbGHashTablePrivate *priv;
 } DmapdDMAPDbGHashTable;
 
 typedef struct {
-	GObjectClass parent;
+	DmapdDMAPDbClass parent;
 } DmapdDMAPDbGHashTableClass;
 
 GType dmapd_dmap_db_ghashtable_get_type (void);
@@ -0,0 +1,607 @@
+/*
+ *  Database class for DMAP sharing
+ *
+ *  Copyright (C) 2008 W. Michael Petullo <mike@flyn.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <lmdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libdmapsharing/dmap.h>
+
+#include "util.h"
+#include "dmapd-dmap-db-lmdb.h"
+
+static const gchar *RECORDS_DB_NAME = "records";
+static const gchar *LOCATIONS_DB_NAME = "locations";
+static const gchar *META_DB_NAME = "meta";
+static const gchar *NEXTID_KEY = "nextid";
+
+/* NOTE: The map is reserved address space, not memory; pages become
+ * resident only as they are touched.
+ */
+#if GLIB_SIZEOF_VOID_P == 8
+#define DEFAULT_MAP_SIZE (G_GUINT64_CONSTANT (4) * 1024 * 1024 * 1024)
+#else
+#define DEFAULT_MAP_SIZE (256 * 1024 * 1024)
+#endif
+#define DEFAULT_BATCH_SIZE 1000
+
+struct DmapdDMAPDbLMDBPrivate {
+	MDB_env *env;
+	MDB_dbi records;
+	MDB_dbi locations;
+	MDB_dbi meta;
+	MDB_txn *txn;
+	guint txn_puts;
+	guint batch_size;
+	/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
+	guint nextid; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
+};
+
+/* NOTE: Every serialized record begins with a version string followed by
+ * its location; see dmapd_daap_record_to_blob and dmapd_dpap_record_to_blob.
+ */
+static const gchar *
+blob_location (const MDB_val *value)
+{
+	const gchar *blob = value->mv_data;
+	const gchar *version_end;
+
+	version_end = memchr (blob, 0x00, value->mv_size);
+	if (NULL == version_end
+	 || NULL == memchr (version_end + 1, 0x00, value->mv_size - (version_end + 1 - blob))) {
+		return NULL;
+	}
+
+	return version_end + 1;
+}
+
+/* LMDB keys are limited in size, so long locations are indexed by digest. */
+static gchar *
+location_key (DmapdDMAPDbLMDBPrivate *priv, const gchar *location, MDB_val *key)
+{
+	gchar *digest = NULL;
+
+	if (strlen (location) <= (gsize) mdb_env_get_maxkeysize (priv->env)) {
+		key->mv_data = (void *) location;
+		key->mv_size = strlen (location);
+	} else {
+		digest = g_compute_checksum_for_string (G_CHECKSUM_SHA1, location, -1);
+		key->mv_data = digest;
+		key->mv_size = strlen (digest);
+	}
+
+	return digest;
+}
+
+/* NOTE: Puts are grouped into write transactions of batch_size records,
+ * the last committed by flush. Reads use a transaction of their own,
+ * ended once they are done; see read_txn_begin.
+ */
+static MDB_txn *
+write_txn (DmapdDMAPDbLMDBPrivate *priv)
+{
+	int ret;
+
+	if (NULL == priv->txn) {
+		if ((ret = mdb_txn_begin (priv->env, NULL, 0, &priv->txn)) != 0) {
+			g_error ("Could not begin LMDB transaction: %s", mdb_strerror (ret));
+		}
+		priv->txn_puts = 0;
+	}
+
+	return priv->txn;
+}
+
+static void
+commit_txn (DmapdDMAPDbLMDBPrivate *priv)
+{
+	int ret;
+
+	if (NULL != priv->txn) {
+		if ((ret = mdb_txn_commit (priv->txn)) != 0) {
+			g_warning ("Could not commit LMDB transaction: %s", mdb_strerror (ret));
+		}
+		priv->txn = NULL;
+		priv->txn_puts = 0;
+	}
+}
+
+/* NOTE: while a batch is open, a read is its nested transaction, so that
+ * it sees the records the batch has put; it is aborted, writing nothing.
+ */
+static MDB_txn *
+read_txn_begin (DmapdDMAPDbLMDBPrivate *priv)
+{
+	int ret;
+	MDB_txn *txn = NULL;
+
+	if (NULL != priv->txn) {
+		ret = mdb_txn_begin (priv->env, priv->txn, 0, &txn);
+	} else {
+		ret = mdb_txn_begin (priv->env, NULL, MDB_RDONLY, &txn);
+	}
+
+	if (ret != 0) {
+		g_warning ("Could not begin LMDB transaction: %s", mdb_strerror (ret));
+		txn = NULL;
+	}
+
+	return txn;
+}
+
+static void
+read_txn_end (MDB_txn *txn)
+{
+	mdb_txn_abort (txn);
+}
+
+static DMAPRecord *
+record_from_value (const DMAPDb *db, const MDB_val *value)
+{
+	GByteArray blob;
+	DMAPRecord *record = NULL;
+	DMAPRecordFactory *factory = NULL;
+
+	g_object_get (DMAPD_DMAP_DB (db), "record-factory", &factory, NULL);
+	g_assert (factory);
+	record = dmap_record_factory_create (factory, NULL);
+
+	/* NOTE: Decode straight from the memory map. The records' set_from_blob
+	 * methods only read blob->data and blob->len, so a GByteArray header
+	 * on the stack suffices; it must never be passed to g_byte_array_*.
+	 */
+	blob.data = value->mv_data;
+	blob.len  = value->mv_size;
+	dmap_record_set_from_blob (DMAP_RECORD (record), &blob);
+
+	return record;
+}
+
+static DMAPRecord *
+dmapd_dmap_db_lmdb_lookup_by_id	(const DMAPDb *db, guint id)
+{
+	MDB_txn *txn;
+	MDB_val key, value;
+	DMAPRecord *record = NULL;
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (db)->priv;
+
+	if (NULL == (txn = read_txn_begin (priv)))
+		goto _return;
+
+	key.mv_data = &id;
+	key.mv_size = sizeof (id);
+
+	if (mdb_get (txn, priv->records, &key, &value) != 0) {
+		g_warning ("Error finding ID %u in LMDB", id);
+		goto _done;
+	}
+
+	record = record_from_value (db, &value);
+
+_done:
+	read_txn_end (txn);
+
+_return:
+	return record;
+}
+
+static guint
+dmapd_dmap_db_lmdb_lookup_id_by_location (const DMAPDb *db, const gchar *location)
+{
+	guint id = 0;
+	MDB_txn *txn;
+	MDB_val key, value;
+	gchar *digest = NULL;
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (db)->priv;
+
+	if (NULL == (txn = read_txn_begin (priv)))
+		goto _return;
+
+	digest = location_key (priv, location, &key);
+
+	if (mdb_get (txn, priv->locations, &key, &value) == 0
+	 && value.mv_size == sizeof (id)) {
+		memcpy (&id, value.mv_data, sizeof (id));
+	}
+
+	read_txn_end (txn);
+
+_return:
+	g_free (digest);
+
+	return id;
+}
+
+static void
+dmapd_dmap_db_lmdb_foreach	(const DMAPDb *db,
+				 GHFunc func,
+				 gpointer data)
+{
+	int ret;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val key, value;
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (db)->priv;
+
+	/* Iterate over a snapshot, so that func may add records. */
+	commit_txn (priv);
+
+	if (NULL == (txn = read_txn_begin (priv)))
+		goto _return;
+
+	if ((ret = mdb_cursor_open (txn, priv->records, &cursor)) != 0) {
+		g_warning ("Could not open LMDB cursor: %s", mdb_strerror (ret));
+		goto _done;
+	}
+
+	while ((ret = mdb_cursor_get (cursor, &key, &value, MDB_NEXT)) == 0) {
+		guint id;
+		DMAPRecord *record;
+
+		g_assert (key.mv_size == sizeof (id));
+		memcpy (&id, key.mv_data, sizeof (id));
+
+		record = record_from_value (db, &value);
+		func (GUINT_TO_POINTER (id), record, data);
+		g_object_unref (record);
+	}
+
+	if (ret != MDB_NOTFOUND) {
+		g_warning ("Error iterating over LMDB: %s", mdb_strerror (ret));
+	}
+
+	mdb_cursor_close (cursor);
+
+_done:
+	read_txn_end (txn);
+
+_return:
+	return;
+}
+
+static gint64
+dmapd_dmap_db_lmdb_count (const DMAPDb *db)
+{
+	MDB_txn *txn;
+	MDB_stat stat;
+	gint64 fnval = 0;
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (db)->priv;
+
+	if (NULL == (txn = read_txn_begin (priv)))
+		goto _return;
+
+	if (mdb_stat (txn, priv->records, &stat) == 0) {
+		fnval = stat.ms_entries;
+	}
+
+	read_txn_end (txn);
+
+_return:
+	return fnval;
+}
+
+static void
+store_nextid (DmapdDMAPDbLMDBPrivate *priv)
+{
+	int ret;
+	MDB_val key, value;
+
+	key.mv_data = (void *) NEXTID_KEY;
+	key.mv_size = strlen (NEXTID_KEY);
+	value.mv_data = &priv->nextid;
+	value.mv_size = sizeof (priv->nextid);
+
+	if ((ret = mdb_put (write_txn (priv), priv->meta, &key, &value, 0)) != 0) {
+		g_error ("Error storing next ID in LMDB: %s", mdb_strerror (ret));
+	}
+}
+
+static void
+load_nextid (DmapdDMAPDbLMDBPrivate *priv)
+{
+	MDB_val key, value;
+
+	key.mv_data = (void *) NEXTID_KEY;
+	key.mv_size = strlen (NEXTID_KEY);
+
+	if (mdb_get (write_txn (priv), priv->meta, &key, &value) == 0
+	 && value.mv_size == sizeof (priv->nextid)) {
+		memcpy (&priv->nextid, value.mv_data, sizeof (priv->nextid));
+	} else {
+		// NOTE: this should be G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
+		priv->nextid = G_MAXINT;
+	}
+}
+
+static guint
+dmapd_dmap_db_lmdb_add_with_id (DMAPDb *_db, DMAPRecord *record, guint id)
+{
+	int ret;
+	MDB_txn *txn;
+	MDB_val key, value, old_value, loc_key;
+	const gchar *location;
+	gchar *digest = NULL;
+	DmapdDMAPDbLMDB *db = DMAPD_DMAP_DB_LMDB (_db);
+	DmapdDMAPDbLMDBPrivate *priv = db->priv;
+
+	g_debug ("Adding record with ID %u", id);
+
+	txn = write_txn (priv);
+
+	key.mv_data = &id;
+	key.mv_size = sizeof (id);
+
+	/* Drop the index entry of a record that is being replaced. */
+	if (mdb_get (txn, priv->records, &key, &old_value) == 0
+	 && NULL != (location = blob_location (&old_value))) {
+		digest = location_key (priv, location, &loc_key);
+		mdb_del (txn, priv->locations, &loc_key, NULL);
+		g_free (digest);
+	}
+
+	GByteArray *blob = dmap_record_to_blob (record);
+	value.mv_data = blob->data;
+	value.mv_size = blob->len;
+
+	if ((ret = mdb_put (txn, priv->records, &key, &value, 0)) != 0) {
+		g_error ("Error inserting into LMDB: %s", mdb_strerror (ret));
+	}
+
+	if (NULL != (location = blob_location (&value))) {
+		digest = location_key (priv, location, &loc_key);
+		if ((ret = mdb_put (txn, priv->locations, &loc_key, &key, 0)) != 0) {
+			g_error ("Error indexing LMDB record: %s", mdb_strerror (ret));
+		}
+		g_free (digest);
+	}
+
+	g_byte_array_unref (blob);
+
+	if (id <= priv->nextid) {
+		priv->nextid = id - 1;
+		store_nextid (priv);
+	}
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_txn (priv);
+	}
+
+	return id;
+}
+
+static guint
+dmapd_dmap_db_lmdb_add (DMAPDb *db, DMAPRecord *record)
+{
+	return dmapd_dmap_db_lmdb_add_with_id (db, record, DMAPD_DMAP_DB_LMDB (db)->priv->nextid);
+}
+
+static gboolean
+dmapd_dmap_db_lmdb_remove (DMAPDb *db, guint id)
+{
+	MDB_txn *txn;
+	MDB_val key, value, loc_key;
+	const gchar *location;
+	gchar *digest = NULL;
+	gboolean fnval = FALSE;
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (db)->priv;
+
+	txn = write_txn (priv);
+
+	key.mv_data = &id;
+	key.mv_size = sizeof (id);
+
+	if (mdb_get (txn, priv->records, &key, &value) != 0) {
+		goto _return;
+	}
+
+	if (NULL != (location = blob_location (&value))) {
+		digest = location_key (priv, location, &loc_key);
+		mdb_del (txn, priv->locations, &loc_key, NULL);
+		g_free (digest);
+	}
+
+	if (mdb_del (txn, priv->records, &key, NULL) != 0) {
+		g_warning ("Error removing ID %u from LMDB", id);
+		goto _return;
+	}
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_txn (priv);
+	}
+
+	fnval = TRUE;
+
+_return:
+	return fnval;
+}
+
+static void
+dmapd_dmap_db_lmdb_flush (DMAPDb *db)
+{
+	commit_txn (DMAPD_DMAP_DB_LMDB (db)->priv);
+}
+
+static guint
+dmapd_dmap_db_lmdb_add_path (DMAPDb *db, const gchar *path)
+{
+	guint id = 0;
+	DMAPRecord *record;
+	DMAPRecordFactory *factory = NULL;
+
+	g_object_get (db, "record-factory", &factory, NULL);
+	g_assert (factory);
+	record = dmap_record_factory_create (factory, (gpointer) path);
+
+	if (record) {
+		id = dmapd_dmap_db_lmdb_add (db, record);
+		g_object_unref (record);
+	} else {
+		id = 0;
+	}
+
+	return id;
+}
+
+G_DEFINE_DYNAMIC_TYPE (DmapdDMAPDbLMDB,
+		       dmapd_dmap_db_lmdb,
+		       TYPE_DMAPD_DMAP_DB)
+
+static guint64
+option_as_uint64 (GHashTable *options, const gchar *name, guint64 fallback)
+{
+	guint64 fnval = fallback;
+	const gchar *value = NULL;
+
+	if (NULL != options && NULL != (value = g_hash_table_lookup (options, name))) {
+		gchar *end = NULL;
+		guint64 parsed = g_ascii_strtoull (value, &end, 10);
+		if (end == value || *end != 0x00) {
+			g_warning ("Bad value for LMDB option %s: %s", name, value);
+		} else {
+			fnval = parsed;
+		}
+	}
+
+	return fnval;
+}
+
+static MDB_dbi
+open_dbi (MDB_txn *txn, const gchar *name, unsigned int flags)
+{
+	int ret;
+	MDB_dbi dbi;
+
+	if ((ret = mdb_dbi_open (txn, name, flags | MDB_CREATE, &dbi)) != 0)
+		g_error ("Could not open LMDB database %s: %s", name, mdb_strerror (ret));
+
+	return dbi;
+}
+
+static GObject*
+dmapd_dmap_db_lmdb_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
+{
+	int ret;
+        DmapdDMAPDbLMDB *db;
+	gchar *db_dir = NULL;
+	GHashTable *options = NULL;
+	guint64 map_size;
+	MDB_txn *txn;
+
+	db = DMAPD_DMAP_DB_LMDB(G_OBJECT_CLASS (dmapd_dmap_db_lmdb_parent_class)->constructor (type, n_construct_params, construct_params));
+
+	db->priv = DMAPD_DMAP_DB_LMDB_GET_PRIVATE (db);
+
+	g_object_get (db, "db-dir", &db_dir, "options", &options, NULL);
+	g_assert (db_dir);
+
+	map_size             = option_as_uint64 (options, "map-size", DEFAULT_MAP_SIZE);
+	db->priv->batch_size = MAX (1, option_as_uint64 (options, "batch-size", DEFAULT_BATCH_SIZE));
+
+	if ((ret = mdb_env_set_mapsize (db->priv->env, map_size)) != 0)
+		g_error ("Could not set LMDB map size: %s", mdb_strerror (ret));
+
+	if ((ret = mdb_env_set_maxdbs (db->priv->env, 3)) != 0)
+		g_error ("Could not set LMDB database count: %s", mdb_strerror (ret));
+
+	/* NOTE: MDB_NOTLS permits the nested read transactions that occur
+	 * when a foreach callback looks up records; MDB_NORDAHEAD keeps pages
+	 * that are not read out of the page cache.
+	 */
+	if ((ret = mdb_env_open (db->priv->env, db_dir, MDB_NOTLS | MDB_NORDAHEAD, 0664)) != 0)
+		g_error ("Could not open LMDB environment in %s: %s", db_dir, mdb_strerror (ret));
+
+	txn = write_txn (db->priv);
+	db->priv->records   = open_dbi (txn, RECORDS_DB_NAME, MDB_INTEGERKEY);
+	db->priv->locations = open_dbi (txn, LOCATIONS_DB_NAME, 0);
+	db->priv->meta      = open_dbi (txn, META_DB_NAME, 0);
+
+	load_nextid (db->priv);
+	commit_txn (db->priv);
+
+	g_debug ("Opened database with %" G_GINT64_FORMAT " records",
+	          dmapd_dmap_db_lmdb_count (DMAP_DB (db)));
+
+	g_free (db_dir);
+
+	return G_OBJECT (db);
+}
+
+static void dmapd_dmap_db_lmdb_init (DmapdDMAPDbLMDB *db)
+{
+	db->priv = DMAPD_DMAP_DB_LMDB_GET_PRIVATE (db);
+
+	if (mdb_env_create (&(db->priv->env)) != 0)
+		g_error ("Could not create LMDB environment");
+}
+
+static void
+dmapd_dmap_db_lmdb_class_finalize (DmapdDMAPDbLMDBClass *object)
+{
+}
+
+static void
+dmapd_dmap_db_lmdb_finalize (GObject *object)
+{
+	DmapdDMAPDbLMDBPrivate *priv = DMAPD_DMAP_DB_LMDB (object)->priv;
+
+	commit_txn (priv);
+
+	g_debug ("Finalizing DmapdDMAPDbLMDB (%" G_GINT64_FORMAT " records)",
+	         dmapd_dmap_db_lmdb_count (DMAP_DB (object)));
+
+	mdb_env_close (priv->env);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_lmdb_parent_class)->finalize (object);
+}
+
+static void dmapd_dmap_db_lmdb_class_init (DmapdDMAPDbLMDBClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	DmapdDMAPDbClass *dmap_db_class = DMAPD_DMAP_DB_CLASS (klass);
+
+	object_class->finalize = dmapd_dmap_db_lmdb_finalize;
+	object_class->constructor = dmapd_dmap_db_lmdb_constructor;
+
+	dmap_db_class->add = dmapd_dmap_db_lmdb_add;
+	dmap_db_class->add_with_id = dmapd_dmap_db_lmdb_add_with_id;
+	dmap_db_class->add_path = dmapd_dmap_db_lmdb_add_path;
+	dmap_db_class->lookup_by_id = dmapd_dmap_db_lmdb_lookup_by_id;
+	dmap_db_class->lookup_id_by_location = dmapd_dmap_db_lmdb_lookup_id_by_location;
+	dmap_db_class->foreach = dmapd_dmap_db_lmdb_foreach;
+	dmap_db_class->count = dmapd_dmap_db_lmdb_count;
+	dmap_db_class->remove = dmapd_dmap_db_lmdb_remove;
+	dmap_db_class->flush = dmapd_dmap_db_lmdb_flush;
+
+	g_type_class_add_private (klass, sizeof (DmapdDMAPDbLMDBPrivate));
+}
+
+static void dmapd_dmap_db_lmdb_register_type (GTypeModule *module);
+
+G_MODULE_EXPORT gboolean
+dmapd_module_load (GTypeModule *module)
+{
+	dmapd_dmap_db_lmdb_register_type (module);
+	return TRUE;
+}
+
+G_MODULE_EXPORT gboolean
+dmapd_module_unload (GTypeModule *module)
+{
+	return TRUE;
+}
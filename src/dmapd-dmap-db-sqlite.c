@@ -0,0 +1,787 @@
+/*
+ *  Database class for DMAP sharing
+ *
+ *  Copyright (C) 2008 W. Michael Petullo <mike@flyn.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <sqlite3.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libdmapsharing/dmap.h>
+
+#include "util.h"
+#include "dmapd-dmap-db-sqlite.h"
+
+static const gchar *DB_FILENAME = "dmapd.sqlite";
+
+#define DEFAULT_BATCH_SIZE 1000
+
+/* Record properties stored as columns, and those that are indexed in
+ * addition to location.
+ */
+static const gchar *daap_properties[] = {
+	"location", "hash", "title", "songalbum", "sort-album", "songartist",
+	"sort-artist", "songgenre", "format", "mediakind", "rating",
+	"filesize", "duration", "track", "year", "firstseen", "mtime",
+	"disc", "bitrate", "has-video", NULL
+};
+
+static const gchar *daap_indexed[] = {
+	"songartist", "songalbum", "songgenre", "year", NULL
+};
+
+static const gchar *dpap_properties[] = {
+	"location", "hash", "large-filesize", "creation-date", "rating",
+	"filename", "aspect-ratio", "pixel-height", "pixel-width", "format",
+	"comments", "thumbnail-offset", "thumbnail-length", NULL
+};
+
+static const gchar *dpap_indexed[] = {
+	"creation-date", NULL
+};
+
+struct DmapdDMAPDbSQLitePrivate {
+	sqlite3 *db;
+	const gchar **properties;
+	GParamSpec **pspecs;
+	gchar **columns;
+	guint n_properties;
+	gchar *select_columns;
+	sqlite3_stmt *insert_stmt;
+	sqlite3_stmt *lookup_stmt;
+	sqlite3_stmt *location_stmt;
+	sqlite3_stmt *replaced_stmt;
+	sqlite3_stmt *delete_stmt;
+	gboolean in_txn;
+	guint txn_puts;
+	guint batch_size;
+	gint64 count;
+	/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
+	guint nextid; /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
+};
+
+static void
+exec_sql (DmapdDMAPDbSQLitePrivate *priv, const gchar *sql)
+{
+	gchar *errmsg = NULL;
+
+	if (sqlite3_exec (priv->db, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+		g_error ("Error executing \"%s\" in SQLite database: %s", sql, errmsg);
+	}
+}
+
+static sqlite3_stmt *
+prepare (DmapdDMAPDbSQLitePrivate *priv, const gchar *sql)
+{
+	sqlite3_stmt *stmt = NULL;
+
+	if (sqlite3_prepare_v2 (priv->db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+		g_error ("Error preparing \"%s\" for SQLite database: %s", sql, sqlite3_errmsg (priv->db));
+	}
+
+	return stmt;
+}
+
+/* NOTE: Puts are grouped into transactions of batch_size records, the
+ * last committed by flush. Reads on the same connection see the
+ * uncommitted records.
+ */
+static void
+begin_batch (DmapdDMAPDbSQLitePrivate *priv)
+{
+	if (! priv->in_txn) {
+		exec_sql (priv, "BEGIN");
+		priv->in_txn = TRUE;
+		priv->txn_puts = 0;
+	}
+}
+
+static void
+commit_batch (DmapdDMAPDbSQLitePrivate *priv)
+{
+	if (priv->in_txn) {
+		exec_sql (priv, "COMMIT");
+		priv->in_txn = FALSE;
+		priv->txn_puts = 0;
+	}
+}
+
+static const gchar *
+column_for_property (DmapdDMAPDbSQLitePrivate *priv, const gchar *property)
+{
+	guint i;
+	const gchar *fnval = NULL;
+
+	for (i = 0; i < priv->n_properties; i++) {
+		if (! strcmp (priv->properties[i], property)) {
+			fnval = priv->columns[i];
+			break;
+		}
+	}
+
+	return fnval;
+}
+
+static void
+bind_value (sqlite3_stmt *stmt, int col, const GValue *value)
+{
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+		const gchar *str;
+		GByteArray *array;
+		case G_TYPE_STRING:
+			str = g_value_get_string (value);
+			if (NULL != str) {
+				sqlite3_bind_text (stmt, col, str, -1, SQLITE_TRANSIENT);
+			} else {
+				sqlite3_bind_null (stmt, col);
+			}
+			break;
+		case G_TYPE_POINTER:
+			/* NOTE: Pointer properties of records hold GByteArrays. */
+			array = g_value_get_pointer (value);
+			if (NULL != array) {
+				sqlite3_bind_blob (stmt, col, array->data, array->len, SQLITE_TRANSIENT);
+			} else {
+				sqlite3_bind_null (stmt, col);
+			}
+			break;
+		case G_TYPE_BOOLEAN:
+			sqlite3_bind_int (stmt, col, g_value_get_boolean (value));
+			break;
+		case G_TYPE_INT:
+			sqlite3_bind_int (stmt, col, g_value_get_int (value));
+			break;
+		case G_TYPE_UINT:
+			sqlite3_bind_int64 (stmt, col, g_value_get_uint (value));
+			break;
+		case G_TYPE_INT64:
+			sqlite3_bind_int64 (stmt, col, g_value_get_int64 (value));
+			break;
+		case G_TYPE_UINT64:
+			sqlite3_bind_int64 (stmt, col, (sqlite3_int64) g_value_get_uint64 (value));
+			break;
+		case G_TYPE_ENUM:
+			sqlite3_bind_int (stmt, col, g_value_get_enum (value));
+			break;
+		default:
+			g_warning ("Cannot store values of type %s", G_VALUE_TYPE_NAME (value));
+			sqlite3_bind_null (stmt, col);
+			break;
+	}
+}
+
+/* Sets value from a column; returns FALSE if the column is NULL. */
+static gboolean
+column_value (sqlite3_stmt *stmt, int col, GValue *value)
+{
+	gboolean fnval = TRUE;
+
+	if (sqlite3_column_type (stmt, col) == SQLITE_NULL) {
+		fnval = FALSE;
+		goto _done;
+	}
+
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+		GByteArray *array;
+		case G_TYPE_STRING:
+			g_value_set_string (value, (const gchar *) sqlite3_column_text (stmt, col));
+			break;
+		case G_TYPE_POINTER:
+			array = g_byte_array_sized_new (sqlite3_column_bytes (stmt, col));
+			g_byte_array_append (array, sqlite3_column_blob (stmt, col), sqlite3_column_bytes (stmt, col));
+			g_value_set_pointer (value, array);
+			break;
+		case G_TYPE_BOOLEAN:
+			g_value_set_boolean (value, sqlite3_column_int (stmt, col));
+			break;
+		case G_TYPE_INT:
+			g_value_set_int (value, sqlite3_column_int (stmt, col));
+			break;
+		case G_TYPE_UINT:
+			g_value_set_uint (value, sqlite3_column_int64 (stmt, col));
+			break;
+		case G_TYPE_INT64:
+			g_value_set_int64 (value, sqlite3_column_int64 (stmt, col));
+			break;
+		case G_TYPE_UINT64:
+			g_value_set_uint64 (value, sqlite3_column_int64 (stmt, col));
+			break;
+		case G_TYPE_ENUM:
+			g_value_set_enum (value, sqlite3_column_int (stmt, col));
+			break;
+		default:
+			fnval = FALSE;
+			break;
+	}
+
+_done:
+	return fnval;
+}
+
+/* NOTE: Rows select the ID followed by priv->columns. Unlike records read
+ * from a blob, records read from columns are not checked against the
+ * media file's hash.
+ */
+static DMAPRecord *
+record_from_row (const DMAPDb *db, sqlite3_stmt *stmt)
+{
+	guint i;
+	DMAPRecord *record = NULL;
+	DMAPRecordFactory *factory = NULL;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	g_object_get (DMAPD_DMAP_DB (db), "record-factory", &factory, NULL);
+	g_assert (factory);
+	record = dmap_record_factory_create (factory, NULL);
+
+	for (i = 0; i < priv->n_properties; i++) {
+		GValue value = { 0, };
+
+		g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (priv->pspecs[i]));
+
+		if (column_value (stmt, i + 1, &value)) {
+			g_object_set_property (G_OBJECT (record), priv->properties[i], &value);
+			if (G_VALUE_HOLDS_POINTER (&value)) {
+				/* The record holds its own reference. */
+				g_byte_array_unref (g_value_get_pointer (&value));
+			}
+		}
+
+		g_value_unset (&value);
+	}
+
+	return record;
+}
+
+static DMAPRecord *
+dmapd_dmap_db_sqlite_lookup_by_id	(const DMAPDb *db, guint id)
+{
+	DMAPRecord *record = NULL;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	sqlite3_bind_int64 (priv->lookup_stmt, 1, id);
+
+	if (sqlite3_step (priv->lookup_stmt) != SQLITE_ROW) {
+		g_warning ("Error finding ID %u in SQLite database", id);
+		goto _done;
+	}
+
+	record = record_from_row (db, priv->lookup_stmt);
+
+_done:
+	sqlite3_reset (priv->lookup_stmt);
+
+	return record;
+}
+
+static guint
+dmapd_dmap_db_sqlite_lookup_id_by_location (const DMAPDb *db, const gchar *location)
+{
+	guint id = 0;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	sqlite3_bind_text (priv->location_stmt, 1, location, -1, SQLITE_STATIC);
+
+	if (sqlite3_step (priv->location_stmt) == SQLITE_ROW) {
+		id = sqlite3_column_int64 (priv->location_stmt, 0);
+	}
+
+	sqlite3_reset (priv->location_stmt);
+
+	return id;
+}
+
+static void
+foreach_row (const DMAPDb *db, sqlite3_stmt *stmt, GHFunc func, gpointer data)
+{
+	int ret;
+
+	while ((ret = sqlite3_step (stmt)) == SQLITE_ROW) {
+		guint id = sqlite3_column_int64 (stmt, 0);
+		DMAPRecord *record = record_from_row (db, stmt);
+		func (GUINT_TO_POINTER (id), record, data);
+		g_object_unref (record);
+	}
+
+	if (ret != SQLITE_DONE) {
+		g_warning ("Error reading SQLite database: %s",
+		           sqlite3_errmsg (DMAPD_DMAP_DB_SQLITE (db)->priv->db));
+	}
+}
+
+static void
+dmapd_dmap_db_sqlite_foreach	(const DMAPDb *db,
+				 GHFunc func,
+				 gpointer data)
+{
+	gchar *sql;
+	sqlite3_stmt *stmt;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	/* NOTE: A fresh statement, so that func may itself use the database. */
+	sql = g_strdup_printf ("SELECT %s FROM records", priv->select_columns);
+	stmt = prepare (priv, sql);
+
+	foreach_row (db, stmt, func, data);
+
+	sqlite3_finalize (stmt);
+	g_free (sql);
+}
+
+static void
+dmapd_dmap_db_sqlite_query (const DMAPDb *db,
+			    const DmapdDMAPDbQuery *query,
+			    GHFunc func,
+			    gpointer data)
+{
+	GString *sql;
+	sqlite3_stmt *stmt = NULL;
+	const gchar *column;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	sql = g_string_new (NULL);
+	g_string_append_printf (sql, "SELECT %s FROM records", priv->select_columns);
+
+	/* NOTE: Column names come from priv->columns, never from the caller. */
+	if (NULL != query->filter_property) {
+		if (NULL == (column = column_for_property (priv, query->filter_property))) {
+			g_warning ("Cannot filter on %s", query->filter_property);
+			goto _done;
+		}
+		g_string_append_printf (sql, " WHERE %s = ?", column);
+	}
+
+	if (NULL != query->sort_property) {
+		if (NULL == (column = column_for_property (priv, query->sort_property))) {
+			g_warning ("Cannot sort on %s", query->sort_property);
+			goto _done;
+		}
+		g_string_append_printf (sql, " ORDER BY %s %s", column, query->descending ? "DESC" : "ASC");
+	}
+
+	if (query->limit > 0) {
+		g_string_append_printf (sql, " LIMIT %u", query->limit);
+	}
+
+	stmt = prepare (priv, sql->str);
+
+	if (NULL != query->filter_property) {
+		sqlite3_bind_text (stmt, 1, query->filter_value, -1, SQLITE_STATIC);
+	}
+
+	foreach_row (db, stmt, func, data);
+
+_done:
+	if (NULL != stmt) {
+		sqlite3_finalize (stmt);
+	}
+
+	g_string_free (sql, TRUE);
+}
+
+static gint64
+dmapd_dmap_db_sqlite_count (const DMAPDb *db)
+{
+	return DMAPD_DMAP_DB_SQLITE (db)->priv->count;
+}
+
+static guint
+dmapd_dmap_db_sqlite_add_with_id (DMAPDb *_db, DMAPRecord *record, guint id)
+{
+	guint i;
+	gchar *location = NULL;
+	DmapdDMAPDbSQLite *db = DMAPD_DMAP_DB_SQLITE (_db);
+	DmapdDMAPDbSQLitePrivate *priv = db->priv;
+
+	g_debug ("Adding record with ID %u", id);
+
+	begin_batch (priv);
+
+	/* Count the rows that INSERT OR REPLACE will displace. */
+	g_object_get (record, "location", &location, NULL);
+	sqlite3_bind_int64 (priv->replaced_stmt, 1, id);
+	sqlite3_bind_text (priv->replaced_stmt, 2, location, -1, SQLITE_STATIC);
+	if (sqlite3_step (priv->replaced_stmt) == SQLITE_ROW) {
+		priv->count -= sqlite3_column_int64 (priv->replaced_stmt, 0);
+	}
+	sqlite3_reset (priv->replaced_stmt);
+
+	sqlite3_bind_int64 (priv->insert_stmt, 1, id);
+	for (i = 0; i < priv->n_properties; i++) {
+		GValue value = { 0, };
+
+		g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (priv->pspecs[i]));
+		g_object_get_property (G_OBJECT (record), priv->properties[i], &value);
+		bind_value (priv->insert_stmt, i + 2, &value);
+		g_value_unset (&value);
+	}
+
+	if (sqlite3_step (priv->insert_stmt) != SQLITE_DONE) {
+		g_error ("Error inserting into SQLite database: %s", sqlite3_errmsg (priv->db));
+	}
+	sqlite3_reset (priv->insert_stmt);
+	sqlite3_clear_bindings (priv->insert_stmt);
+
+	priv->count++;
+
+	if (id <= priv->nextid) {
+		priv->nextid = id - 1;
+	}
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_batch (priv);
+	}
+
+	g_free (location);
+
+	return id;
+}
+
+static guint
+dmapd_dmap_db_sqlite_add (DMAPDb *db, DMAPRecord *record)
+{
+	return dmapd_dmap_db_sqlite_add_with_id (db, record, DMAPD_DMAP_DB_SQLITE (db)->priv->nextid);
+}
+
+static gboolean
+dmapd_dmap_db_sqlite_remove (DMAPDb *db, guint id)
+{
+	gboolean fnval = FALSE;
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (db)->priv;
+
+	begin_batch (priv);
+
+	sqlite3_bind_int64 (priv->delete_stmt, 1, id);
+	if (sqlite3_step (priv->delete_stmt) != SQLITE_DONE) {
+		g_warning ("Error removing ID %u from SQLite database: %s", id, sqlite3_errmsg (priv->db));
+	} else if (sqlite3_changes (priv->db) > 0) {
+		priv->count--;
+		fnval = TRUE;
+	}
+	sqlite3_reset (priv->delete_stmt);
+
+	if (++priv->txn_puts >= priv->batch_size) {
+		commit_batch (priv);
+	}
+
+	return fnval;
+}
+
+static void
+dmapd_dmap_db_sqlite_flush (DMAPDb *db)
+{
+	commit_batch (DMAPD_DMAP_DB_SQLITE (db)->priv);
+}
+
+static guint
+dmapd_dmap_db_sqlite_add_path (DMAPDb *db, const gchar *path)
+{
+	guint id = 0;
+	DMAPRecord *record;
+	DMAPRecordFactory *factory = NULL;
+
+	g_object_get (db, "record-factory", &factory, NULL);
+	g_assert (factory);
+	record = dmap_record_factory_create (factory, (gpointer) path);
+
+	if (record) {
+		id = dmapd_dmap_db_sqlite_add (db, record);
+		g_object_unref (record);
+	} else {
+		id = 0;
+	}
+
+	return id;
+}
+
+G_DEFINE_DYNAMIC_TYPE (DmapdDMAPDbSQLite,
+		       dmapd_dmap_db_sqlite,
+		       TYPE_DMAPD_DMAP_DB)
+
+static guint
+option_as_uint (GHashTable *options, const gchar *name, guint fallback)
+{
+	guint fnval = fallback;
+	const gchar *value = NULL;
+
+	if (NULL != options && NULL != (value = g_hash_table_lookup (options, name))) {
+		gchar *end = NULL;
+		guint64 parsed = g_ascii_strtoull (value, &end, 10);
+		if (end == value || *end != 0x00 || parsed > G_MAXUINT) {
+			g_warning ("Bad value for SQLite option %s: %s", name, value);
+		} else {
+			fnval = parsed;
+		}
+	}
+
+	return fnval;
+}
+
+static const gchar *
+column_type (GParamSpec *pspec)
+{
+	const gchar *fnval;
+
+	switch (G_TYPE_FUNDAMENTAL (G_PARAM_SPEC_VALUE_TYPE (pspec))) {
+		case G_TYPE_STRING:
+			fnval = "TEXT";
+			break;
+		case G_TYPE_POINTER:
+			fnval = "BLOB";
+			break;
+		default:
+			fnval = "INTEGER";
+			break;
+	}
+
+	return fnval;
+}
+
+/* Databases written by earlier versions of dmapd may lack some columns. */
+static void
+add_missing_columns (DmapdDMAPDbSQLitePrivate *priv)
+{
+	guint i;
+	sqlite3_stmt *stmt;
+	GHashTable *existing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	stmt = prepare (priv, "PRAGMA table_info (records)");
+	while (sqlite3_step (stmt) == SQLITE_ROW) {
+		g_hash_table_add (existing, g_strdup ((const gchar *) sqlite3_column_text (stmt, 1)));
+	}
+	sqlite3_finalize (stmt);
+
+	for (i = 0; i < priv->n_properties; i++) {
+		if (! g_hash_table_contains (existing, priv->columns[i])) {
+			gchar *sql = g_strdup_printf ("ALTER TABLE records ADD COLUMN %s %s",
+			                              priv->columns[i],
+			                              column_type (priv->pspecs[i]));
+			exec_sql (priv, sql);
+			g_free (sql);
+		}
+	}
+
+	g_hash_table_destroy (existing);
+}
+
+/* The columns depend on whether the factory creates DAAP or DPAP records. */
+static void
+create_schema (DmapdDMAPDbSQLite *db, DMAPRecordFactory *factory)
+{
+	guint i;
+	GString *sql;
+	GString *params;
+	gchar *columns;
+	DMAPRecord *record;
+	const gchar **indexed = NULL;
+	DmapdDMAPDbSQLitePrivate *priv = db->priv;
+
+	record = dmap_record_factory_create (factory, NULL);
+	g_assert (record);
+
+	if (IS_DAAP_RECORD (record)) {
+		priv->properties = daap_properties;
+		indexed = daap_indexed;
+	} else if (IS_DPAP_RECORD (record)) {
+		priv->properties = dpap_properties;
+		indexed = dpap_indexed;
+	} else {
+		g_error ("SQLite database supports only DAAP and DPAP records");
+	}
+
+	priv->n_properties = g_strv_length ((gchar **) priv->properties);
+	priv->pspecs = g_new0 (GParamSpec *, priv->n_properties);
+	priv->columns = g_new0 (gchar *, priv->n_properties + 1);
+
+	sql = g_string_new ("CREATE TABLE IF NOT EXISTS records (id INTEGER PRIMARY KEY");
+	params = g_string_new ("?");
+
+	for (i = 0; i < priv->n_properties; i++) {
+		priv->pspecs[i] = g_object_class_find_property (G_OBJECT_GET_CLASS (record), priv->properties[i]);
+		g_assert (priv->pspecs[i]);
+
+		priv->columns[i] = g_strdelimit (g_strdup (priv->properties[i]), "-", '_');
+
+		g_string_append_printf (sql, ", %s %s%s",
+		                        priv->columns[i],
+		                        column_type (priv->pspecs[i]),
+		                        strcmp (priv->properties[i], "location") ? "" : " UNIQUE NOT NULL");
+		g_string_append (params, ", ?");
+	}
+
+	g_string_append (sql, ")");
+	exec_sql (priv, sql->str);
+	add_missing_columns (priv);
+
+	for (i = 0; indexed[i]; i++) {
+		const gchar *column = column_for_property (priv, indexed[i]);
+		gchar *index_sql = g_strdup_printf ("CREATE INDEX IF NOT EXISTS records_%s ON records (%s)", column, column);
+		exec_sql (priv, index_sql);
+		g_free (index_sql);
+	}
+
+	columns = g_strjoinv (", ", priv->columns);
+	priv->select_columns = g_strconcat ("id, ", columns, NULL);
+	g_free (columns);
+
+	g_string_printf (sql, "INSERT OR REPLACE INTO records (%s) VALUES (%s)", priv->select_columns, params->str);
+	priv->insert_stmt = prepare (priv, sql->str);
+
+	g_string_printf (sql, "SELECT %s FROM records WHERE id = ?", priv->select_columns);
+	priv->lookup_stmt = prepare (priv, sql->str);
+
+	priv->location_stmt = prepare (priv, "SELECT id FROM records WHERE location = ?");
+	priv->replaced_stmt = prepare (priv, "SELECT COUNT(*) FROM records WHERE id = ? OR location = ?");
+	priv->delete_stmt = prepare (priv, "DELETE FROM records WHERE id = ?");
+
+	g_string_free (sql, TRUE);
+	g_string_free (params, TRUE);
+	g_object_unref (record);
+}
+
+static GObject*
+dmapd_dmap_db_sqlite_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
+{
+        DmapdDMAPDbSQLite *db;
+	gchar *db_dir = NULL;
+	gchar *db_path = NULL;
+	gchar *pragma = NULL;
+	GHashTable *options = NULL;
+	DMAPRecordFactory *factory = NULL;
+	sqlite3_stmt *stmt;
+	guint cache_size;
+
+	db = DMAPD_DMAP_DB_SQLITE(G_OBJECT_CLASS (dmapd_dmap_db_sqlite_parent_class)->constructor (type, n_construct_params, construct_params));
+
+	db->priv = DMAPD_DMAP_DB_SQLITE_GET_PRIVATE (db);
+
+	g_object_get (db, "db-dir", &db_dir, "record-factory", &factory, "options", &options, NULL);
+	g_assert (db_dir);
+	g_assert (factory);
+
+	cache_size           = option_as_uint (options, "cache-size", 0);
+	db->priv->batch_size = MAX (1, option_as_uint (options, "batch-size", DEFAULT_BATCH_SIZE));
+
+	db_path = g_strdup_printf ("%s/%s", db_dir, DB_FILENAME);
+	if (sqlite3_open (db_path, &db->priv->db) != SQLITE_OK) {
+		g_error ("Could not open SQLite database %s: %s", db_path, sqlite3_errmsg (db->priv->db));
+	}
+
+	/* NOTE: WAL lets readers proceed while a batch is written, and
+	 * synchronous=NORMAL is safe in WAL mode.
+	 */
+	exec_sql (db->priv, "PRAGMA journal_mode=WAL");
+	exec_sql (db->priv, "PRAGMA synchronous=NORMAL");
+
+	if (cache_size > 0) {
+		/* A negative cache_size is in KiB rather than pages. */
+		pragma = g_strdup_printf ("PRAGMA cache_size=-%u", cache_size / 1024);
+		exec_sql (db->priv, pragma);
+	}
+
+	create_schema (db, factory);
+
+	stmt = prepare (db->priv, "SELECT COUNT(*), MIN(id) FROM records");
+	if (sqlite3_step (stmt) == SQLITE_ROW) {
+		db->priv->count = sqlite3_column_int64 (stmt, 0);
+	}
+	if (sqlite3_column_type (stmt, 1) != SQLITE_NULL) {
+		db->priv->nextid = sqlite3_column_int64 (stmt, 1) - 1;
+	} else {
+		// NOTE: this should be G_MAXUINT, not G_MAXINT, but iPhoto can't handle full range of guint:
+		db->priv->nextid = G_MAXINT;
+	}
+	sqlite3_finalize (stmt);
+
+	g_debug ("Opened database with %" G_GINT64_FORMAT " records", db->priv->count);
+
+	g_free (db_dir);
+	g_free (db_path);
+	g_free (pragma);
+
+	return G_OBJECT (db);
+}
+
+static void dmapd_dmap_db_sqlite_init (DmapdDMAPDbSQLite *db)
+{
+	db->priv = DMAPD_DMAP_DB_SQLITE_GET_PRIVATE (db);
+}
+
+static void
+dmapd_dmap_db_sqlite_class_finalize (DmapdDMAPDbSQLiteClass *object)
+{
+}
+
+static void
+dmapd_dmap_db_sqlite_finalize (GObject *object)
+{
+	DmapdDMAPDbSQLitePrivate *priv = DMAPD_DMAP_DB_SQLITE (object)->priv;
+
+	commit_batch (priv);
+
+	g_debug ("Finalizing DmapdDMAPDbSQLite (%" G_GINT64_FORMAT " records)", priv->count);
+
+	sqlite3_finalize (priv->insert_stmt);
+	sqlite3_finalize (priv->lookup_stmt);
+	sqlite3_finalize (priv->location_stmt);
+	sqlite3_finalize (priv->replaced_stmt);
+	sqlite3_finalize (priv->delete_stmt);
+	sqlite3_close (priv->db);
+
+	g_free (priv->pspecs);
+	g_strfreev (priv->columns);
+	g_free (priv->select_columns);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_sqlite_parent_class)->finalize (object);
+}
+
+static void dmapd_dmap_db_sqlite_class_init (DmapdDMAPDbSQLiteClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	DmapdDMAPDbClass *dmap_db_class = DMAPD_DMAP_DB_CLASS (klass);
+
+	object_class->finalize = dmapd_dmap_db_sqlite_finalize;
+	object_class->constructor = dmapd_dmap_db_sqlite_constructor;
+
+	dmap_db_class->add = dmapd_dmap_db_sqlite_add;
+	dmap_db_class->add_with_id = dmapd_dmap_db_sqlite_add_with_id;
+	dmap_db_class->add_path = dmapd_dmap_db_sqlite_add_path;
+	dmap_db_class->lookup_by_id = dmapd_dmap_db_sqlite_lookup_by_id;
+	dmap_db_class->lookup_id_by_location = dmapd_dmap_db_sqlite_lookup_id_by_location;
+	dmap_db_class->foreach = dmapd_dmap_db_sqlite_foreach;
+	dmap_db_class->count = dmapd_dmap_db_sqlite_count;
+	dmap_db_class->query = dmapd_dmap_db_sqlite_query;
+	dmap_db_class->remove = dmapd_dmap_db_sqlite_remove;
+	dmap_db_class->flush = dmapd_dmap_db_sqlite_flush;
+
+	g_type_class_add_private (klass, sizeof (DmapdDMAPDbSQLitePrivate));
+}
+
+static void dmapd_dmap_db_sqlite_register_type (GTypeModule *module);
+
+G_MODULE_EXPORT gboolean
+dmapd_module_load (GTypeModule *module)
+{
+	dmapd_dmap_db_sqlite_register_type (module);
+	return TRUE;
+}
+
+G_MODULE_EXPORT gboolean
+dmapd_module_unload (GTypeModule *module)
+{
+	return TRUE;
+}
@@ -0,0 +1,63 @@
+/*
+ *  Database class for DMAP sharing
+ *
+ *  Copyright (C) 2008 W. Michael Petullo <mike@flyn.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __DMAPD_DMAP_DB_SQLITE
+#define __DMAPD_DMAP_DB_SQLITE
+
+#include <libdmapsharing/dmap.h>
+
+#include "dmapd-dmap-db.h"
+
+G_BEGIN_DECLS
+
+#define TYPE_DMAPD_DMAP_DB_SQLITE           (dmapd_dmap_db_sqlite_get_type ())
+#define DMAPD_DMAP_DB_SQLITE(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE, \
+                                      DmapdDMAPDbSQLite))
+#define DMAPD_DMAP_DB_SQLITE_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE, \
+                                      DmapdDMAPDbSQLiteClass))
+#define IS_DMAPD_DMAP_DB_SQLITE(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE))
+#define IS_DMAPD_DMAP_DB_SQLITE_CLASS (k)   (G_TYPE_CHECK_CLASS_TYPE ((k), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE_CLASS))
+#define DMAPD_DMAP_DB_SQLITE_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE, \
+                                      DmapdDMAPDbSQLiteClass))
+#define DMAPD_DMAP_DB_SQLITE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), \
+                                      TYPE_DMAPD_DMAP_DB_SQLITE, \
+                                      DmapdDMAPDbSQLitePrivate))
+
+typedef struct DmapdDMAPDbSQLitePrivate DmapdDMAPDbSQLitePrivate;
+
+typedef struct {
+	DmapdDMAPDb parent;
+	DmapdDMAPDbSQLitePrivate *priv;
+} DmapdDMAPDbSQLite;
+
+typedef struct {
+	DmapdDMAPDbClass parent;
+} DmapdDMAPDbSQLiteClass;
+
+GType dmapd_dmap_db_sqlite_get_type (void);
+
+#endif /* __DMAPD_DMAP_DB_SQLITE */
+
+G_END_DECLS
@@ -0,0 +1,163 @@
+/*
+ *  Read-only view of part of a DMAP database
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <libdmapsharing/dmap.h>
+
+#include "dmapd-dmap-db-view.h"
+
+struct DmapdDMAPDbViewPrivate {
+	DMAPDb *db;
+	GArray *ids;
+	GObject *owner;
+};
+
+static guint
+dmapd_dmap_db_view_add (DMAPDb *db, DMAPRecord *record)
+{
+	g_warning ("Cannot add to a read-only database view");
+	return 0;
+}
+
+static guint
+dmapd_dmap_db_view_add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
+{
+	g_warning ("Cannot add to a read-only database view");
+	return 0;
+}
+
+static guint
+dmapd_dmap_db_view_add_path (DMAPDb *db, const gchar *path)
+{
+	g_warning ("Cannot add to a read-only database view");
+	return 0;
+}
+
+static DMAPRecord *
+dmapd_dmap_db_view_lookup_by_id (const DMAPDb *db, guint id)
+{
+	return dmap_db_lookup_by_id (DMAPD_DMAP_DB_VIEW (db)->priv->db, id);
+}
+
+static guint
+dmapd_dmap_db_view_lookup_id_by_location (const DMAPDb *db, const gchar *location)
+{
+	guint i, id;
+	DmapdDMAPDbViewPrivate *priv = DMAPD_DMAP_DB_VIEW (db)->priv;
+
+	id = dmap_db_lookup_id_by_location (priv->db, location);
+
+	for (i = 0; id && i < priv->ids->len; i++) {
+		if (g_array_index (priv->ids, guint32, i) == id) {
+			goto _done;
+		}
+	}
+
+	id = 0;
+
+_done:
+	return id;
+}
+
+static void
+dmapd_dmap_db_view_foreach (const DMAPDb *db, GHFunc func, gpointer data)
+{
+	guint i;
+	DmapdDMAPDbViewPrivate *priv = DMAPD_DMAP_DB_VIEW (db)->priv;
+
+	for (i = 0; i < priv->ids->len; i++) {
+		guint id = g_array_index (priv->ids, guint32, i);
+		DMAPRecord *record = dmap_db_lookup_by_id (priv->db, id);
+		if (NULL == record) {
+			g_warning ("Record %u not found", id);
+			continue;
+		}
+
+		func (GUINT_TO_POINTER (id), record, data);
+		g_object_unref (record);
+	}
+}
+
+static gint64
+dmapd_dmap_db_view_count (const DMAPDb *db)
+{
+	return DMAPD_DMAP_DB_VIEW (db)->priv->ids->len;
+}
+
+static void
+dmapd_dmap_db_view_interface_init (gpointer iface, gpointer data)
+{
+	DMAPDbIface *dmap_db = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_db) == DMAP_TYPE_DB);
+
+	dmap_db->add = dmapd_dmap_db_view_add;
+	dmap_db->add_with_id = dmapd_dmap_db_view_add_with_id;
+	dmap_db->add_path = dmapd_dmap_db_view_add_path;
+	dmap_db->lookup_by_id = dmapd_dmap_db_view_lookup_by_id;
+	dmap_db->lookup_id_by_location = dmapd_dmap_db_view_lookup_id_by_location;
+	dmap_db->foreach = dmapd_dmap_db_view_foreach;
+	dmap_db->count = dmapd_dmap_db_view_count;
+}
+
+G_DEFINE_TYPE_WITH_CODE (DmapdDMAPDbView, dmapd_dmap_db_view, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (DMAP_TYPE_DB, dmapd_dmap_db_view_interface_init))
+
+static void
+dmapd_dmap_db_view_init (DmapdDMAPDbView *view)
+{
+	view->priv = DMAPD_DMAP_DB_VIEW_GET_PRIVATE (view);
+}
+
+static void
+dmapd_dmap_db_view_finalize (GObject *object)
+{
+	DmapdDMAPDbView *view = DMAPD_DMAP_DB_VIEW (object);
+
+	g_object_unref (view->priv->db);
+	g_array_unref (view->priv->ids);
+	g_object_unref (view->priv->owner);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_view_parent_class)->finalize (object);
+}
+
+static void
+dmapd_dmap_db_view_class_init (DmapdDMAPDbViewClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DmapdDMAPDbViewPrivate));
+
+	object_class->finalize = dmapd_dmap_db_view_finalize;
+}
+
+DMAPDb *
+dmapd_dmap_db_view_new (DMAPDb *db, GArray *ids, GObject *owner)
+{
+	DmapdDMAPDbView *view;
+
+	view = DMAPD_DMAP_DB_VIEW (g_object_new (TYPE_DMAPD_DMAP_DB_VIEW, NULL));
+
+	view->priv->db = g_object_ref (db);
+	view->priv->ids = g_array_ref (ids);
+	view->priv->owner = g_object_ref (owner);
+
+	return DMAP_DB (view);
+}
@@ -0,0 +1,67 @@
+/*
+ *  Read-only view of part of a DMAP database
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_DMAP_DB_VIEW
+#define __DMAPD_DMAP_DB_VIEW
+
+#include <libdmapsharing/dmap.h>
+
+G_BEGIN_DECLS
+
+#define TYPE_DMAPD_DMAP_DB_VIEW           (dmapd_dmap_db_view_get_type ())
+#define DMAPD_DMAP_DB_VIEW(o)             (G_TYPE_CHECK_INSTANCE_CAST ((o), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW, \
+                                      DmapdDMAPDbView))
+#define DMAPD_DMAP_DB_VIEW_CLASS(k)       (G_TYPE_CHECK_CLASS_CAST((k), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW, \
+                                      DmapdDMAPDbViewClass))
+#define IS_DMAPD_DMAP_DB_VIEW(o)          (G_TYPE_CHECK_INSTANCE_TYPE ((o), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW))
+#define IS_DMAPD_DMAP_DB_VIEW_CLASS (k)   (G_TYPE_CHECK_CLASS_TYPE ((k), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW_CLASS))
+#define DMAPD_DMAP_DB_VIEW_GET_CLASS(o)   (G_TYPE_INSTANCE_GET_CLASS ((o), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW, \
+                                      DmapdDMAPDbViewClass))
+#define DMAPD_DMAP_DB_VIEW_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), \
+                                      TYPE_DMAPD_DMAP_DB_VIEW, \
+                                      DmapdDMAPDbViewPrivate))
+
+typedef struct DmapdDMAPDbViewPrivate DmapdDMAPDbViewPrivate;
+
+typedef struct {
+	GObject parent;
+	DmapdDMAPDbViewPrivate *priv;
+} DmapdDMAPDbView;
+
+typedef struct {
+	GObjectClass parent;
+} DmapdDMAPDbViewClass;
+
+GType dmapd_dmap_db_view_get_type (void);
+
+/* Presents the records of db whose IDs are in ids (of guint32), in that
+ * order. The view references ids and owner.
+ */
+DMAPDb *dmapd_dmap_db_view_new (DMAPDb *db, GArray *ids, GObject *owner);
+
+#endif /* __DMAPD_DMAP_DB_VIEW */
+
+G_END_DECLS
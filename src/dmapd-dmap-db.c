@@ -19,26 +19,168 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
 #include <libdmapsharing/dmap.h>
 
 #include "dmapd-dmap-db.h"
 
+#define DEFAULT_CHANGE_LOG_SIZE 10000
+
+typedef struct {
+	guint revision;
+	guint id;
+	DmapdDMAPDbChange change;
+} change_t;
+
 struct DmapdDMAPDbPrivate {
 	gchar *db_dir;
 	DMAPRecordFactory *record_factory;
 	GSList *acceptable_formats;
+	GHashTable *options;
+
+	guint revision;       /* Last committed revision.                 */
+	guint floor;          /* Oldest revision changes are logged since. */
+	GArray *changes;      /* Of change_t, oldest first.                */
+	guint pending;        /* Trailing changes not yet committed.       */
+	guint max_changes;
+	gchar *change_path;
+	FILE *change_file;
+	guint change_file_lines;
 };
 
 enum {
 	PROP_0,
 	PROP_DB_DIR,
 	PROP_RECORD_FACTORY,
-	PROP_ACCEPTABLE_FORMATS
+	PROP_ACCEPTABLE_FORMATS,
+	PROP_OPTIONS
 };
 
+enum {
+	CHANGED,
+	LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static void
+note_change (DMAPDb *db, guint id, DmapdDMAPDbChange change)
+{
+	change_t entry;
+	DmapdDMAPDbPrivate *priv = DMAPD_DMAP_DB (db)->priv;
+
+	entry.revision = priv->revision + 1;
+	entry.id = id;
+	entry.change = change;
+
+	g_array_append_val (priv->changes, entry);
+	priv->pending++;
+
+	g_signal_emit (db, signals[CHANGED], 0, id, change);
+}
+
+static guint add (DMAPDb *db, DMAPRecord *record)
+{
+	guint id, old_id = 0;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL != location) {
+		old_id = DMAPD_DMAP_DB_GET_CLASS (db)->lookup_id_by_location (db, location);
+	}
+
+	id = DMAPD_DMAP_DB_GET_CLASS (db)->add (db, record);
+	if (id) {
+		note_change (db, id, id == old_id ? DMAPD_DMAP_DB_CHANGE_UPDATED
+		                                  : DMAPD_DMAP_DB_CHANGE_ADDED);
+	}
+
+	g_free (location);
+
+	return id;
+}
+
+static guint add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
+{
+	guint old_id = 0;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL != location) {
+		old_id = DMAPD_DMAP_DB_GET_CLASS (db)->lookup_id_by_location (db, location);
+	}
+
+	id = DMAPD_DMAP_DB_GET_CLASS (db)->add_with_id (db, record, id);
+	if (id) {
+		note_change (db, id, id == old_id ? DMAPD_DMAP_DB_CHANGE_UPDATED
+		                                  : DMAPD_DMAP_DB_CHANGE_ADDED);
+	}
+
+	g_free (location);
+
+	return id;
+}
+
+static guint add_path (DMAPDb *db, const gchar *path)
+{
+	guint id;
+
+	/* NOTE: callers check lookup_id_by_location first; see DbBuilder. */
+	id = DMAPD_DMAP_DB_GET_CLASS (db)->add_path (db, path);
+	if (id) {
+		note_change (db, id, DMAPD_DMAP_DB_CHANGE_ADDED);
+	}
+
+	return id;
+}
+
+DMAPRecord *lookup_by_id (const DMAPDb *db, guint id)
+{
+	return DMAPD_DMAP_DB_GET_CLASS (db)->lookup_by_id (db, id);
+}
+
+static guint lookup_id_by_location (const DMAPDb *db, const gchar *location)
+{
+	return DMAPD_DMAP_DB_GET_CLASS (db)->lookup_id_by_location (db, location);
+}
+
+static void foreach (const DMAPDb *db, GHFunc func, gpointer data)
+{
+	return DMAPD_DMAP_DB_GET_CLASS (db)->foreach (db, func, data);
+}
+
+static gint64 count (const DMAPDb *db)
+{
+	return DMAPD_DMAP_DB_GET_CLASS (db)->count (db);
+}
+
+static void dmapd_dmap_db_interface_init (gpointer iface, gpointer data)
+{
+	DMAPDbIface *dmap_db = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_db) == DMAP_TYPE_DB);
+
+	dmap_db->add = add;
+	dmap_db->add_with_id = add_with_id;
+	dmap_db->add_path = add_path;
+	dmap_db->lookup_by_id = lookup_by_id;
+	dmap_db->lookup_id_by_location = lookup_id_by_location;
+	dmap_db->foreach = foreach;
+	dmap_db->count = count;
+}
+
+G_DEFINE_TYPE_WITH_CODE (DmapdDMAPDb, dmapd_dmap_db, G_TYPE_OBJECT, 
+			 G_IMPLEMENT_INTERFACE (DMAP_TYPE_DB, dmapd_dmap_db_interface_init))
+
 static void dmapd_dmap_db_init (DmapdDMAPDb *db)
 {
 	db->priv = DMAPD_DMAP_DB_GET_PRIVATE (db);
+	db->priv->revision = 1;
+	db->priv->floor = 1;
+	db->priv->changes = g_array_new (FALSE, FALSE, sizeof (change_t));
+	db->priv->max_changes = DEFAULT_CHANGE_LOG_SIZE;
 }
 
 static void
@@ -62,6 +204,9 @@ dmapd_dmap_db_set_property (GObject *object,
 		case PROP_ACCEPTABLE_FORMATS:
 			db->priv->acceptable_formats = g_value_get_pointer (value);
 			break;	
+		case PROP_OPTIONS:
+			db->priv->options = g_value_get_pointer (value);
+			break;	
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -86,21 +231,364 @@ dmapd_dmap_db_get_property (GObject *object,
 		case PROP_ACCEPTABLE_FORMATS:
 			g_value_set_pointer (value, db->priv->acceptable_formats);
 			break;	
+		case PROP_OPTIONS:
+			g_value_set_pointer (value, db->priv->options);
+			break;	
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
 	}
 }
 
+/* Drops the oldest revisions until at most max_changes committed changes
+ * remain. Revisions are dropped whole.
+ */
+static void
+trim_changes (DmapdDMAPDbPrivate *priv)
+{
+	guint n, committed = priv->changes->len - priv->pending;
+
+	if (committed <= priv->max_changes) {
+		goto _done;
+	}
+
+	n = committed - priv->max_changes;
+	priv->floor = g_array_index (priv->changes, change_t, n - 1).revision;
+	while (n < committed && g_array_index (priv->changes, change_t, n).revision == priv->floor) {
+		n++;
+	}
+
+	g_array_remove_range (priv->changes, 0, n);
+
+_done:
+	return;
+}
+
+static gchar
+change_char (DmapdDMAPDbChange change)
+{
+	switch (change) {
+	case DMAPD_DMAP_DB_CHANGE_ADDED:
+		return 'a';
+	case DMAPD_DMAP_DB_CHANGE_UPDATED:
+		return 'u';
+	default:
+		return 'd';
+	}
+}
+
+/* The change log file begins with "revision R floor F" and continues with
+ * one "R C ID" line per change, where C is a, u or d. Lines are appended
+ * as revisions are committed and the file is rewritten when it grows to
+ * twice the size of the log.
+ */
+static void
+load_changes (DmapdDMAPDbPrivate *priv)
+{
+	guint i;
+	gchar **lines = NULL;
+	gchar *contents = NULL;
+
+	if (! g_file_get_contents (priv->change_path, &contents, NULL, NULL)) {
+		g_debug ("No change log at %s", priv->change_path);
+		goto _done;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+	for (i = 0; lines[i] && lines[i + 1]; i++) {
+		guint revision, floor, id;
+		gchar c;
+		change_t entry;
+
+		if (sscanf (lines[i], "revision %u floor %u", &revision, &floor) == 2) {
+			priv->revision = MAX (priv->revision, revision);
+			priv->floor = MAX (priv->floor, floor);
+		} else if (sscanf (lines[i], "%u %c %u", &revision, &c, &id) == 3
+		        && (c == 'a' || c == 'u' || c == 'd')
+		        && revision > priv->floor) {
+			entry.revision = revision;
+			entry.id = id;
+			entry.change = c == 'a' ? DMAPD_DMAP_DB_CHANGE_ADDED
+			             : c == 'u' ? DMAPD_DMAP_DB_CHANGE_UPDATED
+			             : DMAPD_DMAP_DB_CHANGE_DELETED;
+			g_array_append_val (priv->changes, entry);
+			priv->revision = MAX (priv->revision, revision);
+		} else {
+			g_warning ("Bad line %u in change log %s", i + 1, priv->change_path);
+		}
+	}
+
+	trim_changes (priv);
+
+_done:
+	g_strfreev (lines);
+	g_free (contents);
+}
+
+static void
+save_changes (DmapdDMAPDbPrivate *priv)
+{
+	guint i;
+	GString *str;
+	GError *error = NULL;
+
+	if (NULL != priv->change_file) {
+		fclose (priv->change_file);
+		priv->change_file = NULL;
+	}
+
+	str = g_string_new (NULL);
+	g_string_append_printf (str, "revision %u floor %u\n", priv->revision, priv->floor);
+	for (i = 0; i < priv->changes->len - priv->pending; i++) {
+		change_t *entry = &g_array_index (priv->changes, change_t, i);
+		g_string_append_printf (str, "%u %c %u\n", entry->revision, change_char (entry->change), entry->id);
+	}
+
+	if (! g_file_set_contents (priv->change_path, str->str, str->len, &error)) {
+		g_warning ("Error writing %s: %s", priv->change_path, error->message);
+		g_error_free (error);
+	}
+
+	priv->change_file_lines = i;
+	priv->change_file = g_fopen (priv->change_path, "a");
+
+	g_string_free (str, TRUE);
+}
+
+guint
+dmapd_dmap_db_get_revision (const DMAPDb *db)
+{
+	return DMAPD_DMAP_DB (db)->priv->revision;
+}
+
+guint
+dmapd_dmap_db_commit_revision (DMAPDb *db)
+{
+	guint i;
+	DmapdDMAPDbPrivate *priv = DMAPD_DMAP_DB (db)->priv;
+
+	/* NOTE: the records first, so that the change log never names a
+	 * revision whose writes are still in a backend's batch.
+	 */
+	dmapd_dmap_db_flush (db);
+
+	if (0 == priv->pending) {
+		goto _done;
+	}
+
+	priv->revision++;
+
+	if (NULL != priv->change_file) {
+		for (i = priv->changes->len - priv->pending; i < priv->changes->len; i++) {
+			change_t *entry = &g_array_index (priv->changes, change_t, i);
+			fprintf (priv->change_file, "%u %c %u\n", entry->revision, change_char (entry->change), entry->id);
+		}
+		if (fflush (priv->change_file) != 0) {
+			g_warning ("Error writing %s", priv->change_path);
+		}
+		priv->change_file_lines += priv->pending;
+	}
+
+	priv->pending = 0;
+	trim_changes (priv);
+
+	if (NULL != priv->change_path && priv->change_file_lines > 2 * priv->max_changes) {
+		save_changes (priv);
+	}
+
+	g_debug ("Database is at revision %u", priv->revision);
+
+_done:
+	return priv->revision;
+}
+
+/* Per-ID state while coalescing changes: */
+#define CHANGE_EXISTED 0x04 /* ID existed before the first change. */
+#define CHANGE_LAST    0x03 /* Mask for the last DmapdDMAPDbChange.  */
+
+gboolean
+dmapd_dmap_db_get_changes (const DMAPDb *db,
+			   guint since,
+			   GArray *added,
+			   GArray *updated,
+			   GArray *deleted)
+{
+	guint i;
+	gboolean fnval = FALSE;
+	GHashTable *state = NULL;
+	DmapdDMAPDbPrivate *priv = DMAPD_DMAP_DB (db)->priv;
+	guint committed = priv->changes->len - priv->pending;
+
+	if (since < priv->floor || since > priv->revision) {
+		goto _done;
+	}
+
+	fnval = TRUE;
+
+	if (since >= priv->revision) {
+		goto _done;
+	}
+
+	state = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	for (i = 0; i < committed; i++) {
+		guint flags;
+		gpointer value;
+		change_t *entry = &g_array_index (priv->changes, change_t, i);
+
+		if (entry->revision <= since) {
+			continue;
+		}
+
+		if (g_hash_table_lookup_extended (state, GUINT_TO_POINTER (entry->id), NULL, &value)) {
+			flags = GPOINTER_TO_UINT (value) & CHANGE_EXISTED;
+		} else {
+			flags = entry->change == DMAPD_DMAP_DB_CHANGE_ADDED ? 0 : CHANGE_EXISTED;
+		}
+
+		g_hash_table_insert (state, GUINT_TO_POINTER (entry->id), GUINT_TO_POINTER (flags | entry->change));
+	}
+
+	/* Report each ID once, in the order of its first change. */
+	for (i = 0; i < committed; i++) {
+		guint flags;
+		gpointer value;
+		change_t *entry = &g_array_index (priv->changes, change_t, i);
+
+		if (entry->revision <= since
+		 || ! g_hash_table_lookup_extended (state, GUINT_TO_POINTER (entry->id), NULL, &value)) {
+			continue;
+		}
+
+		flags = GPOINTER_TO_UINT (value);
+		if ((flags & CHANGE_LAST) == DMAPD_DMAP_DB_CHANGE_DELETED) {
+			if ((flags & CHANGE_EXISTED) && NULL != deleted) {
+				g_array_append_val (deleted, entry->id);
+			}
+		} else if (flags & CHANGE_EXISTED) {
+			if (NULL != updated) {
+				g_array_append_val (updated, entry->id);
+			}
+		} else if (NULL != added) {
+			g_array_append_val (added, entry->id);
+		}
+
+		g_hash_table_remove (state, GUINT_TO_POINTER (entry->id));
+	}
+
+_done:
+	if (NULL != state) {
+		g_hash_table_destroy (state);
+	}
+
+	return fnval;
+}
+
+gboolean
+dmapd_dmap_db_remove (DMAPDb *db, guint id)
+{
+	gboolean fnval = FALSE;
+
+	if (NULL == DMAPD_DMAP_DB_GET_CLASS (db)->remove) {
+		g_warning ("%s cannot remove records", G_OBJECT_TYPE_NAME (db));
+		goto _done;
+	}
+
+	fnval = DMAPD_DMAP_DB_GET_CLASS (db)->remove (db, id);
+	if (fnval) {
+		note_change (db, id, DMAPD_DMAP_DB_CHANGE_DELETED);
+	}
+
+_done:
+	return fnval;
+}
+
+void
+dmapd_dmap_db_flush (DMAPDb *db)
+{
+	if (NULL != DMAPD_DMAP_DB_GET_CLASS (db)->flush) {
+		DMAPD_DMAP_DB_GET_CLASS (db)->flush (db);
+	}
+}
+
+static guint
+option_as_uint (GHashTable *options, const gchar *name, guint fallback)
+{
+	guint fnval = fallback;
+	const gchar *value = NULL;
+
+	if (NULL != options && NULL != (value = g_hash_table_lookup (options, name))) {
+		gchar *end = NULL;
+		guint64 parsed = g_ascii_strtoull (value, &end, 10);
+		if (end == value || *end != 0x00 || parsed > G_MAXUINT) {
+			g_warning ("Bad value for database option %s: %s", name, value);
+		} else {
+			fnval = parsed;
+		}
+	}
+
+	return fnval;
+}
+
+static GObject *
+dmapd_dmap_db_constructor (GType type, guint n_construct_params, GObjectConstructParam *construct_params)
+{
+	GObject *object;
+	DmapdDMAPDbPrivate *priv;
+
+	object = G_OBJECT_CLASS (dmapd_dmap_db_parent_class)->constructor (type, n_construct_params, construct_params);
+	priv = DMAPD_DMAP_DB (object)->priv;
+
+	priv->max_changes = MAX (1, option_as_uint (priv->options, "change-log-size", DEFAULT_CHANGE_LOG_SIZE));
+
+	if (NULL != priv->db_dir) {
+		priv->change_path = g_strdup_printf ("%s/changes", priv->db_dir);
+		load_changes (priv);
+		save_changes (priv);
+	}
+
+	return object;
+}
+
+static void
+dmapd_dmap_db_finalize (GObject *object)
+{
+	DmapdDMAPDbPrivate *priv = DMAPD_DMAP_DB (object)->priv;
+
+	if (NULL != priv->change_file) {
+		fclose (priv->change_file);
+	}
+
+	g_array_free (priv->changes, TRUE);
+	g_free (priv->change_path);
+	g_free (priv->db_dir);
+
+	G_OBJECT_CLASS (dmapd_dmap_db_parent_class)->finalize (object);
+}
+
 static void dmapd_dmap_db_class_init (DmapdDMAPDbClass *klass)
 {
 	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
 	g_type_class_add_private (klass, sizeof (DmapdDMAPDbPrivate));
 
+	gobject_class->constructor = dmapd_dmap_db_constructor;
+	gobject_class->finalize = dmapd_dmap_db_finalize;
 	gobject_class->set_property = dmapd_dmap_db_set_property;
 	gobject_class->get_property = dmapd_dmap_db_get_property;
-	/* FIXME: implement finalize */
+
+	/* NOTE: emitted after the change, so a deleted record is gone. */
+	signals[CHANGED] = g_signal_new ("changed",
+					 G_TYPE_FROM_CLASS (klass),
+					 G_SIGNAL_RUN_LAST,
+					 0,
+					 NULL,
+					 NULL,
+					 g_cclosure_marshal_generic,
+					 G_TYPE_NONE,
+					 2,
+					 G_TYPE_UINT,
+					 G_TYPE_UINT);
 
 	g_object_class_install_property (gobject_class, PROP_RECORD_FACTORY,
 					 g_param_spec_pointer ("record-factory",
@@ -120,57 +608,176 @@ static void dmapd_dmap_db_class_init (DmapdDMAPDbClass *klass)
 							      "Directory for database cache",
 				 	 		       NULL,
 					 		       G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
-	}
 
-static guint add (DMAPDb *db, DMAPRecord *record)
-{
-	return DMAPD_DMAP_DB_GET_CLASS (db)->add (db, record);
+	/* NOTE: options maps plugin option names to values, e.g., from
+	 * DMAPD_DB_MODULE="bdb:cache-size=8388608". The hash table belongs
+	 * to the caller; backends should only consult it while constructing.
+	 */
+	g_object_class_install_property (gobject_class, PROP_OPTIONS,
+					 g_param_spec_pointer ("options",
+							       "Module options",
+							       "Module options",
+					 		        G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 }
 
-static guint add_with_id (DMAPDb *db, DMAPRecord *record, guint id)
-{
-	return DMAPD_DMAP_DB_GET_CLASS (db)->add_with_id (db, record, id);
-}
+typedef struct {
+	guint id;
+	DMAPRecord *record;
+	GValue sort_value;
+} query_match_t;
 
-static guint add_path (DMAPDb *db, const gchar *path)
-{
-	return DMAPD_DMAP_DB_GET_CLASS (db)->add_path (db, path);
-}
+typedef struct {
+	const DmapdDMAPDbQuery *query;
+	GPtrArray *matches;
+	guint count;
+	GHFunc func;
+	gpointer data;
+} query_scan_t;
 
-DMAPRecord *lookup_by_id (const DMAPDb *db, guint id)
+static gboolean
+get_record_value (DMAPRecord *record, const gchar *property, GValue *value)
 {
-	return DMAPD_DMAP_DB_GET_CLASS (db)->lookup_by_id (db, id);
+	gboolean fnval = FALSE;
+	GParamSpec *pspec;
+
+	pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (record), property);
+	if (NULL == pspec) {
+		g_warning ("Records have no property named %s", property);
+		goto _done;
+	}
+
+	g_value_init (value, G_PARAM_SPEC_VALUE_TYPE (pspec));
+	g_object_get_property (G_OBJECT (record), property, value);
+
+	fnval = TRUE;
+
+_done:
+	return fnval;
 }
 
-static guint lookup_id_by_location (const DMAPDb *db, const gchar *location)
+static gboolean
+record_matches (DMAPRecord *record, const DmapdDMAPDbQuery *query)
 {
-	return DMAPD_DMAP_DB_GET_CLASS (db)->lookup_id_by_location (db, location);
+	gboolean fnval = FALSE;
+	GValue value = { 0, };
+	GValue str = { 0, };
+
+	if (NULL == query->filter_property) {
+		fnval = TRUE;
+		goto _done;
+	}
+
+	if (! get_record_value (record, query->filter_property, &value)) {
+		goto _done;
+	}
+
+	g_value_init (&str, G_TYPE_STRING);
+	if (g_value_transform (&value, &str) && NULL != g_value_get_string (&str)) {
+		fnval = ! strcmp (g_value_get_string (&str), query->filter_value);
+	}
+
+	g_value_unset (&str);
+	g_value_unset (&value);
+
+_done:
+	return fnval;
 }
 
-static void foreach (const DMAPDb *db, GHFunc func, gpointer data)
+static gint
+compare_matches (gconstpointer a, gconstpointer b, gpointer user_data)
 {
-	return DMAPD_DMAP_DB_GET_CLASS (db)->foreach (db, func, data);
+	gint fnval;
+	const GValue *va = &(*(query_match_t **) a)->sort_value;
+	const GValue *vb = &(*(query_match_t **) b)->sort_value;
+	const DmapdDMAPDbQuery *query = user_data;
+
+	if (! G_IS_VALUE (va) || ! G_IS_VALUE (vb)) {
+		fnval = 0;
+	} else if (G_VALUE_HOLDS_STRING (va)) {
+		const gchar *sa = g_value_get_string (va);
+		const gchar *sb = g_value_get_string (vb);
+		fnval = g_utf8_collate (sa ? sa : "", sb ? sb : "");
+	} else if (g_value_type_transformable (G_VALUE_TYPE (va), G_TYPE_INT64)) {
+		GValue ia = { 0, }, ib = { 0, };
+		g_value_init (&ia, G_TYPE_INT64);
+		g_value_init (&ib, G_TYPE_INT64);
+		g_value_transform (va, &ia);
+		g_value_transform (vb, &ib);
+		fnval = (g_value_get_int64 (&ia) > g_value_get_int64 (&ib))
+		      - (g_value_get_int64 (&ia) < g_value_get_int64 (&ib));
+	} else {
+		fnval = 0;
+	}
+
+	return query->descending ? -fnval : fnval;
 }
 
-static gint64 count (const DMAPDb *db)
+static void
+query_scan (gpointer id, DMAPRecord *record, query_scan_t *scan)
 {
-	return DMAPD_DMAP_DB_GET_CLASS (db)->count (db);
+	query_match_t *match;
+
+	if (! record_matches (record, scan->query)) {
+		goto _done;
+	}
+
+	if (NULL == scan->matches) {
+		/* Unordered: stream the matches, honoring the limit. */
+		if (0 == scan->query->limit || scan->count < scan->query->limit) {
+			scan->func (id, record, scan->data);
+			scan->count++;
+		}
+		goto _done;
+	}
+
+	match = g_new0 (query_match_t, 1);
+	match->id = GPOINTER_TO_UINT (id);
+	match->record = g_object_ref (record);
+	get_record_value (record, scan->query->sort_property, &match->sort_value);
+	g_ptr_array_add (scan->matches, match);
+
+_done:
+	return;
 }
 
-static void dmapd_dmap_db_interface_init (gpointer iface, gpointer data)
+void
+dmapd_dmap_db_query (const DMAPDb *db,
+		     const DmapdDMAPDbQuery *query,
+		     GHFunc func,
+		     gpointer data)
 {
-	DMAPDbIface *dmap_db = iface;
+	guint i;
+	query_scan_t scan = { query, NULL, 0, func, data };
 
-	g_assert (G_TYPE_FROM_INTERFACE (dmap_db) == DMAP_TYPE_DB);
+	if (IS_DMAPD_DMAP_DB (db) && NULL != DMAPD_DMAP_DB_GET_CLASS (db)->query) {
+		DMAPD_DMAP_DB_GET_CLASS (db)->query (db, query, func, data);
+		goto _done;
+	}
 
-	dmap_db->add = add;
-	dmap_db->add_with_id = add_with_id;
-	dmap_db->add_path = add_path;
-	dmap_db->lookup_by_id = lookup_by_id;
-	dmap_db->lookup_id_by_location = lookup_id_by_location;
-	dmap_db->foreach = foreach;
-	dmap_db->count = count;
-}
+	if (NULL != query->sort_property) {
+		scan.matches = g_ptr_array_new ();
+	}
 
-G_DEFINE_TYPE_WITH_CODE (DmapdDMAPDb, dmapd_dmap_db, G_TYPE_OBJECT, 
-			 G_IMPLEMENT_INTERFACE (DMAP_TYPE_DB, dmapd_dmap_db_interface_init))
+	dmap_db_foreach (db, (GHFunc) query_scan, &scan);
+
+	if (NULL != scan.matches) {
+		g_ptr_array_sort_with_data (scan.matches, compare_matches, (gpointer) query);
+
+		for (i = 0; i < scan.matches->len; i++) {
+			query_match_t *match = g_ptr_array_index (scan.matches, i);
+			if (0 == query->limit || i < query->limit) {
+				func (GUINT_TO_POINTER (match->id), match->record, data);
+			}
+			if (G_IS_VALUE (&match->sort_value)) {
+				g_value_unset (&match->sort_value);
+			}
+			g_object_unref (match->record);
+			g_free (match);
+		}
+
+		g_ptr_array_free (scan.matches, TRUE);
+	}
+
+_done:
+	return;
+}
@@ -46,6 +46,23 @@ G_BEGIN_DECLS
 
 typedef struct DmapdDMAPDbPrivate DmapdDMAPDbPrivate;
 
+/* A filtered and sorted lookup. Property names are record property names,
+ * e.g., "songgenre" or "year".
+ */
+typedef struct {
+	const gchar *filter_property; /* NULL matches every record. */
+	const gchar *filter_value;    /* Compared as a string.      */
+	const gchar *sort_property;   /* NULL leaves order unset.   */
+	gboolean     descending;
+	guint        limit;           /* 0 means no limit.          */
+} DmapdDMAPDbQuery;
+
+typedef enum {
+	DMAPD_DMAP_DB_CHANGE_ADDED,
+	DMAPD_DMAP_DB_CHANGE_UPDATED,
+	DMAPD_DMAP_DB_CHANGE_DELETED
+} DmapdDMAPDbChange;
+
 typedef struct {
 	GObject parent;
 	DmapdDMAPDbPrivate *priv;
@@ -66,10 +83,63 @@ typedef struct {
 					GHFunc func,
 					gpointer data);
 	gint64 (*count)                (const DMAPDb *db);
+
+	/* Optional; backends that can index records should implement. */
+	void (*query)                  (const DMAPDb *db,
+					const DmapdDMAPDbQuery *query,
+					GHFunc func,
+					gpointer data);
+	gboolean (*remove)             (DMAPDb *db, guint id);
+
+	/* Optional; backends that group writes into batches should implement. */
+	void (*flush)                  (DMAPDb *db);
 } DmapdDMAPDbClass;
 
 GType dmapd_dmap_db_get_type (void);
 
+/* Calls func for each record matching query, in order. Databases without
+ * a query method are scanned using dmap_db_foreach ().
+ */
+void dmapd_dmap_db_query (const DMAPDb *db,
+			  const DmapdDMAPDbQuery *query,
+			  GHFunc func,
+			  gpointer data);
+
+/* Returns FALSE if id was not in the database. */
+gboolean dmapd_dmap_db_remove (DMAPDb *db, guint id);
+
+/* Makes every change made so far durable, committing any batch of writes
+ * still open. Call once a scan is done and before exiting.
+ */
+void dmapd_dmap_db_flush (DMAPDb *db);
+
+/* Changes made through dmap_db_add, dmap_db_add_with_id, dmap_db_add_path
+ * and dmapd_dmap_db_remove are logged. They become visible as a new
+ * revision once committed. The log is saved in the database directory and
+ * is bounded by the change-log-size option.
+ *
+ * Each change also emits the "changed" signal at once:
+ * void (*changed) (DmapdDMAPDb *db, guint id, DmapdDMAPDbChange change,
+ *                  gpointer user_data);
+ */
+guint dmapd_dmap_db_get_revision (const DMAPDb *db);
+
+/* Flushes the database, then saves the logged changes as a new revision.
+ * Returns the new revision; unchanged if nothing was logged.
+ */
+guint dmapd_dmap_db_commit_revision (DMAPDb *db);
+
+/* Appends the IDs added, updated and deleted after revision since to the
+ * given arrays of guint, any of which may be NULL. Returns FALSE if the
+ * changes since that revision are no longer logged; the client must then
+ * fetch everything again.
+ */
+gboolean dmapd_dmap_db_get_changes (const DMAPDb *db,
+				    guint since,
+				    GArray *added,
+				    GArray *updated,
+				    GArray *deleted);
+
 #endif /* __DMAPD_DMAP_DB */
 
 G_END_DECLS
@@ -0,0 +1,220 @@
+/*
+ * Smart container record class for DMAP sharing
+ *
+ * Copyright (C) 2013 W. Michael Petullo <mike@flyn.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <time.h>
+#include <libdmapsharing/dmap.h>
+
+#include "dmapd-dmap-smart-container-record.h"
+#include "dmapd-dmap-db-view.h"
+
+enum {
+	PROP_0,
+	PROP_NAME
+};
+
+struct DmapdDMAPSmartContainerRecordPrivate {
+	guint id;
+	char *name;
+	DmapdSmartRule rule;
+	DmapdSmartIndex *index;
+	DMAPDb *full_db;
+
+	GArray *entries;   /* Of guint32; NULL until first requested. */
+	guint generation;  /* Of index when entries was computed.     */
+	gint expires;      /* When entries is stale regardless.       */
+};
+
+static void
+dmapd_dmap_smart_container_record_set_property (GObject *object,
+						guint prop_id,
+						const GValue *value,
+						GParamSpec *pspec)
+{
+	DmapdDMAPSmartContainerRecord *record = DMAPD_DMAP_SMART_CONTAINER_RECORD (object);
+
+	switch (prop_id) {
+		case PROP_NAME:
+			g_free (record->priv->name);
+			record->priv->name = g_value_dup_string (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+dmapd_dmap_smart_container_record_get_property (GObject *object,
+						guint prop_id,
+						GValue *value,
+						GParamSpec *pspec)
+{
+	DmapdDMAPSmartContainerRecord *record = DMAPD_DMAP_SMART_CONTAINER_RECORD (object);
+
+	switch (prop_id) {
+		case PROP_NAME:
+			g_value_set_static_string (value, record->priv->name);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static void
+refresh (DmapdDMAPSmartContainerRecordPrivate *priv)
+{
+	gint now = time (NULL);
+
+	if (NULL != priv->entries
+	 && priv->generation == dmapd_smart_index_get_generation (priv->index)
+	 && now < priv->expires) {
+		goto _done;
+	}
+
+	/* NOTE: views hold their own reference to the old entries. */
+	if (NULL != priv->entries) {
+		g_array_unref (priv->entries);
+	}
+
+	priv->entries = g_array_new (FALSE, FALSE, sizeof (guint32));
+	priv->expires = dmapd_smart_index_query (priv->index, &priv->rule, now, priv->entries);
+	priv->generation = dmapd_smart_index_get_generation (priv->index);
+
+	g_debug ("Smart container %s has %u records", priv->name, priv->entries->len);
+
+_done:
+	return;
+}
+
+static guint
+dmapd_dmap_smart_container_record_get_id (DMAPContainerRecord *record)
+{
+	return DMAPD_DMAP_SMART_CONTAINER_RECORD (record)->priv->id;
+}
+
+static void
+dmapd_dmap_smart_container_record_add_entry (DMAPContainerRecord *container_record,
+					     DMAPRecord *record, gint id)
+{
+	g_warning ("Cannot add to a smart container");
+}
+
+static guint64
+dmapd_dmap_smart_container_record_get_entry_count (DMAPContainerRecord *record)
+{
+	DmapdDMAPSmartContainerRecordPrivate *priv = DMAPD_DMAP_SMART_CONTAINER_RECORD (record)->priv;
+
+	refresh (priv);
+
+	return priv->entries->len;
+}
+
+static DMAPDb *
+dmapd_dmap_smart_container_record_get_entries (DMAPContainerRecord *record)
+{
+	DmapdDMAPSmartContainerRecordPrivate *priv = DMAPD_DMAP_SMART_CONTAINER_RECORD (record)->priv;
+
+	refresh (priv);
+
+	return dmapd_dmap_db_view_new (priv->full_db, priv->entries, G_OBJECT (record));
+}
+
+DMAPContainerRecord *
+dmapd_dmap_smart_container_record_new (guint id,
+				       const gchar *name,
+				       const DmapdSmartRule *rule,
+				       DmapdSmartIndex *index,
+				       DMAPDb *full_db)
+{
+	DmapdDMAPSmartContainerRecord *record;
+
+	record = DMAPD_DMAP_SMART_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD,
+	                                                          "name", name,
+	                                                          NULL));
+
+	record->priv->id = id;
+	record->priv->rule = *rule;
+	record->priv->rule.genre = g_strdup (rule->genre);
+	record->priv->rule.artist = g_strdup (rule->artist);
+	record->priv->index = index;
+	record->priv->full_db = g_object_ref (full_db);
+
+	return DMAP_CONTAINER_RECORD (record);
+}
+
+static void
+dmapd_dmap_smart_container_record_init (DmapdDMAPSmartContainerRecord *record)
+{
+	record->priv = DMAPD_DMAP_SMART_CONTAINER_RECORD_GET_PRIVATE (record);
+}
+
+static void
+dmapd_dmap_smart_container_record_interface_init (gpointer iface, gpointer data)
+{
+	DMAPContainerRecordIface *dmap_container_record = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_container_record) == DMAP_TYPE_CONTAINER_RECORD);
+
+	dmap_container_record->get_id = dmapd_dmap_smart_container_record_get_id;
+	dmap_container_record->add_entry = dmapd_dmap_smart_container_record_add_entry;
+	dmap_container_record->get_entry_count = dmapd_dmap_smart_container_record_get_entry_count;
+	dmap_container_record->get_entries = dmapd_dmap_smart_container_record_get_entries;
+}
+
+G_DEFINE_TYPE_WITH_CODE (DmapdDMAPSmartContainerRecord, dmapd_dmap_smart_container_record, G_TYPE_OBJECT, 
+			G_IMPLEMENT_INTERFACE (DMAP_TYPE_CONTAINER_RECORD,
+					       dmapd_dmap_smart_container_record_interface_init))
+
+static void
+dmapd_dmap_smart_container_record_finalize (GObject *object)
+{
+	DmapdDMAPSmartContainerRecordPrivate *priv = DMAPD_DMAP_SMART_CONTAINER_RECORD (object)->priv;
+
+	g_debug ("Finalizing DmapdDMAPSmartContainerRecord %s", priv->name);
+
+	g_free (priv->name);
+	g_free (priv->rule.genre);
+	g_free (priv->rule.artist);
+
+	if (NULL != priv->entries) {
+		g_array_unref (priv->entries);
+	}
+
+	if (NULL != priv->full_db) {
+		g_object_unref (priv->full_db);
+	}
+
+	G_OBJECT_CLASS (dmapd_dmap_smart_container_record_parent_class)->finalize (object);
+}
+
+static void
+dmapd_dmap_smart_container_record_class_init (DmapdDMAPSmartContainerRecordClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DmapdDMAPSmartContainerRecordPrivate));
+
+	gobject_class->set_property = dmapd_dmap_smart_container_record_set_property;
+	gobject_class->get_property = dmapd_dmap_smart_container_record_get_property;
+	gobject_class->finalize = dmapd_dmap_smart_container_record_finalize;
+
+	g_object_class_override_property (gobject_class, PROP_NAME, "name");
+}
@@ -0,0 +1,73 @@
+/*
+ * Smart container record class for DMAP sharing
+ *
+ * Copyright (C) 2013 W. Michael Petullo <mike@flyn.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __DMAPD_DMAP_SMART_CONTAINER_RECORD
+#define __DMAPD_DMAP_SMART_CONTAINER_RECORD
+
+#include <libdmapsharing/dmap.h>
+
+#include "dmapd-smart-index.h"
+
+G_BEGIN_DECLS
+
+#define TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD         (dmapd_dmap_smart_container_record_get_type ())
+#define DMAPD_DMAP_SMART_CONTAINER_RECORD(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), \
+				       TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD, DmapdDMAPSmartContainerRecord))
+#define DMAPD_DMAP_SMART_CONTAINER_RECORD_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), \
+			               TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD, \
+				       DmapdDMAPSmartContainerRecordClass))
+#define IS_DMAPD_DMAP_SMART_CONTAINER_RECORD(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), \
+				       TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD))
+#define IS_DMAPD_DMAP_SMART_CONTAINER_RECORD_CLASS (k) (G_TYPE_CHECK_CLASS_TYPE ((k), \
+				       TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD_CLASS))
+#define DMAPD_DMAP_SMART_CONTAINER_RECORD_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), \
+				       TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD, \
+				       DmapdDMAPSmartContainerRecordClass))
+#define DMAPD_DMAP_SMART_CONTAINER_RECORD_GET_PRIVATE(o)	     (G_TYPE_INSTANCE_GET_PRIVATE ((o), \
+					      TYPE_DMAPD_DMAP_SMART_CONTAINER_RECORD, \
+					      DmapdDMAPSmartContainerRecordPrivate))
+
+typedef struct DmapdDMAPSmartContainerRecordPrivate DmapdDMAPSmartContainerRecordPrivate;
+
+typedef struct {
+	GObject parent;
+	DmapdDMAPSmartContainerRecordPrivate *priv;
+} DmapdDMAPSmartContainerRecord;
+
+typedef struct {
+	GObjectClass parent;
+} DmapdDMAPSmartContainerRecordClass;
+
+GType dmapd_dmap_smart_container_record_get_type (void);
+
+/* A read-only container of the records in full_db that match rule,
+ * according to index. Membership is computed when the container is
+ * requested and kept until index changes. The rule is copied; index must
+ * outlive the container.
+ */
+DMAPContainerRecord *dmapd_dmap_smart_container_record_new (guint id,
+							    const gchar *name,
+							    const DmapdSmartRule *rule,
+							    DmapdSmartIndex *index,
+							    DMAPDb *full_db);
+
+#endif /* __DMAPD_DMAP_SMART_CONTAINER_RECORD */
+
+G_END_DECLS
@@ -27,11 +27,13 @@ static DmapdDPAPRecordFactory *factory_singleton;
 
 struct DmapdDPAPRecordFactoryPrivate {
         PhotoMetaReader *photo_meta_reader;
+	DmapdThumbnailStore *thumbnail_store;
 };
 
 enum {
         PROP_0,
-	PROP_META_READER
+	PROP_META_READER,
+	PROP_THUMBNAIL_STORE
 };
 
 static void
@@ -48,6 +50,9 @@ dmapd_dpap_record_factory_set_property (GObject *object,
 				g_object_unref (factory->priv->photo_meta_reader);
                         factory->priv->photo_meta_reader = PHOTO_META_READER (g_value_get_pointer (value));
                         break;
+                case PROP_THUMBNAIL_STORE:
+                        factory->priv->thumbnail_store = g_value_get_pointer (value);
+                        break;
                 default:
                         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                         break;
@@ -66,6 +71,9 @@ dmapd_dpap_record_factory_get_property (GObject *object,
                 case PROP_META_READER:
                         g_value_set_pointer (value, factory->priv->photo_meta_reader);
                         break;
+                case PROP_THUMBNAIL_STORE:
+                        g_value_set_pointer (value, factory->priv->thumbnail_store);
+                        break;
                 default:
                         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
                         break;
@@ -75,7 +83,9 @@ dmapd_dpap_record_factory_get_property (GObject *object,
 DMAPRecord *
 dmapd_dpap_record_factory_create  (DMAPRecordFactory *factory, gpointer user_data)
 {
-	return DMAP_RECORD (dmapd_dpap_record_new ((const char *) user_data, DMAPD_DPAP_RECORD_FACTORY (factory)->priv->photo_meta_reader));
+	DmapdDPAPRecordFactoryPrivate *priv = DMAPD_DPAP_RECORD_FACTORY (factory)->priv;
+
+	return DMAP_RECORD (dmapd_dpap_record_new ((const char *) user_data, priv->photo_meta_reader, priv->thumbnail_store));
 }
 
 static GObject *dmapd_dpap_record_factory_constructor (GType type,
@@ -124,6 +134,13 @@ dmapd_dpap_record_factory_class_init (DmapdDPAPRecordFactoryClass *klass)
                                                               "Meta Reader",
                                                               G_PARAM_READWRITE |
                                                               G_PARAM_CONSTRUCT_ONLY));
+
+        g_object_class_install_property (gobject_class, PROP_THUMBNAIL_STORE,
+                                         g_param_spec_pointer ("thumbnail-store",
+                                                              "Thumbnail store",
+                                                              "Thumbnail store",
+                                                              G_PARAM_READWRITE |
+                                                              G_PARAM_CONSTRUCT_ONLY));
 }
 
 static void
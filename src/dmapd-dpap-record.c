@@ -23,8 +23,17 @@
 
 #include "util.h"
 #include "dmapd-dpap-record.h"
+#include "dmapd-chunk-stream.h"
+#include "dmapd-file-stream.h"
 #include "photo-meta-reader.h"
 
+/* Thumbnails live in the thumbnail store. A record loads its thumbnail
+ * when it is asked for and keeps it, so that the array handed out stays
+ * valid for as long as the record does.
+ */
+
+static gsize chunk_size = 0;
+
 struct DmapdDPAPRecordPrivate {
 	char *location;
 	GByteArray *hash;
@@ -32,7 +41,11 @@ struct DmapdDPAPRecordPrivate {
 	gint creationdate;
 	gint rating;
 	char *filename;
-	GByteArray *thumbnail;
+	GByteArray *thumbnail;       /* NULL until loaded.           */
+	guint64 thumbnail_offset;
+	guint thumbnail_length;
+	DmapdThumbnailStore *thumbnail_store;
+	PhotoMetaReader *reader;     /* Resizes photographs sent.    */
 	const char *aspectratio;
 	gint height;
 	gint width;
@@ -53,9 +66,63 @@ enum {
 	PROP_PIXEL_WIDTH,
 	PROP_FORMAT,
 	PROP_COMMENTS,
-	PROP_THUMBNAIL
+	PROP_THUMBNAIL,
+	PROP_THUMBNAIL_OFFSET,
+	PROP_THUMBNAIL_LENGTH,
+	PROP_THUMBNAIL_STORE,
+	PROP_META_READER
 };
 
+static void
+drop_thumbnail (DmapdDPAPRecord *record)
+{
+	if (NULL != record->priv->thumbnail) {
+		g_byte_array_unref (record->priv->thumbnail);
+		record->priv->thumbnail = NULL;
+	}
+}
+
+static void
+load_thumbnail (DmapdDPAPRecord *record)
+{
+	DmapdDPAPRecordPrivate *priv = record->priv;
+
+	priv->thumbnail = dmapd_thumbnail_store_get (priv->thumbnail_store,
+	                                             priv->thumbnail_offset,
+	                                             priv->thumbnail_length);
+	if (NULL == priv->thumbnail) {
+		g_warning ("Thumbnail for %s is missing", priv->location);
+		priv->thumbnail = g_byte_array_new ();
+	}
+}
+
+static void
+set_thumbnail (DmapdDPAPRecord *record, GByteArray *thumbnail)
+{
+	DmapdDPAPRecordPrivate *priv = record->priv;
+
+	drop_thumbnail (record);
+	priv->thumbnail_length = 0;
+
+	if (NULL == thumbnail) {
+		goto _done;
+	}
+
+	if (NULL == priv->thumbnail_store) {
+		priv->thumbnail = g_byte_array_ref (thumbnail);
+	} else if (thumbnail->len > 0) {
+		if (dmapd_thumbnail_store_add (priv->thumbnail_store,
+		                               thumbnail->data,
+		                               thumbnail->len,
+		                              &priv->thumbnail_offset)) {
+			priv->thumbnail_length = thumbnail->len;
+		}
+	}
+
+_done:
+	return;
+}
+
 static void
 dmapd_dpap_record_set_property (GObject *object,
 				guint prop_id,
@@ -107,10 +174,21 @@ dmapd_dpap_record_set_property (GObject *object,
 			record->priv->comments = g_value_dup_string (value);
 			break;
 		case PROP_THUMBNAIL:
-			if (record->priv->thumbnail) {
-				g_byte_array_unref (record->priv->thumbnail);
-			}
-			record->priv->thumbnail = g_byte_array_ref (g_value_get_pointer (value));
+			set_thumbnail (record, g_value_get_pointer (value));
+			break;
+		case PROP_THUMBNAIL_OFFSET:
+			drop_thumbnail (record);
+			record->priv->thumbnail_offset = g_value_get_uint64 (value);
+			break;
+		case PROP_THUMBNAIL_LENGTH:
+			drop_thumbnail (record);
+			record->priv->thumbnail_length = g_value_get_uint (value);
+			break;
+		case PROP_THUMBNAIL_STORE:
+			record->priv->thumbnail_store = g_value_get_pointer (value);
+			break;
+		case PROP_META_READER:
+			record->priv->reader = g_value_get_pointer (value);
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -162,8 +240,26 @@ dmapd_dpap_record_get_property (GObject *object,
 			g_value_set_static_string (value, record->priv->comments);
 			break;
 		case PROP_THUMBNAIL:
+			/* NOTE: owned by, and valid as long as, the record. */
+			if (NULL == record->priv->thumbnail
+			 && NULL != record->priv->thumbnail_store
+			 && record->priv->thumbnail_length > 0) {
+				load_thumbnail (record);
+			}
 			g_value_set_pointer (value, record->priv->thumbnail);
 			break;
+		case PROP_THUMBNAIL_OFFSET:
+			g_value_set_uint64 (value, record->priv->thumbnail_offset);
+			break;
+		case PROP_THUMBNAIL_LENGTH:
+			g_value_set_uint (value, record->priv->thumbnail_length);
+			break;
+		case PROP_THUMBNAIL_STORE:
+			g_value_set_pointer (value, record->priv->thumbnail_store);
+			break;
+		case PROP_META_READER:
+			g_value_set_pointer (value, record->priv->reader);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 			break;
@@ -171,17 +267,141 @@ dmapd_dpap_record_get_property (GObject *object,
 	}
 }
 
+/* Returns the photograph resized to the reader's hires-width, or NULL if
+ * the original should be sent. Resized copies are kept in the thumbnail
+ * store, so each is made once.
+ */
+static GByteArray *
+read_resized (DmapdDPAPRecord *record)
+{
+	guint width = 0;
+	gchar *path = NULL;
+	GByteArray *fnval = NULL;
+	DmapdDPAPRecordPrivate *priv = record->priv;
+
+	if (NULL == priv->reader) {
+		goto _done;
+	}
+
+	g_object_get (priv->reader, "hires-width", &width, NULL);
+	if (0 == width || (guint) MAX (priv->width, priv->height) <= width) {
+		goto _done;
+	}
+
+	fnval = dmapd_dpap_record_get_sized (record, width, NULL);
+	if (NULL != fnval) {
+		goto _done;
+	}
+
+	path = g_filename_from_uri (priv->location, NULL, NULL);
+	if (NULL == path) {
+		goto _done;
+	}
+
+	fnval = photo_meta_reader_resize (priv->reader, path, width);
+	if (NULL != fnval) {
+		dmapd_dpap_record_add_sized (record, width, fnval->data, fnval->len);
+	}
+
+_done:
+	g_free (path);
+
+	return fnval;
+}
+
+void dmapd_dpap_record_set_chunk_size (gsize size)
+{
+	chunk_size = size;
+}
+
 GInputStream *dmapd_dpap_record_read (DPAPRecord *record, GError **error)
 {
-        GFile *file;
-        GInputStream *stream;
+	GByteArray *resized;
+	GInputStream *stream;
+
+	resized = read_resized (DMAPD_DPAP_RECORD (record));
+	if (NULL != resized) {
+		gsize size = resized->len;
+		return g_memory_input_stream_new_from_data (g_byte_array_free (resized, FALSE), size, g_free);
+	}
+
+	stream = dmapd_file_stream_open (DMAPD_DPAP_RECORD (record)->priv->location, error);
+
+	if (NULL != stream && chunk_size > 0) {
+		GInputStream *file = stream;
+		stream = dmapd_chunk_stream_new (file, chunk_size);
+		g_object_unref (file);
+	}
+
+	return stream;
+}
+
+/* Sized copies are kept by the hexadecimal form of the record's hash. */
+static gchar *
+hash_string (DmapdDPAPRecord *record)
+{
+	guint i;
+	GString *str = g_string_new ("");
+
+	for (i = 0; NULL != record->priv->hash && i < record->priv->hash->len; i++) {
+		g_string_append_printf (str, "%02x", record->priv->hash->data[i]);
+	}
+
+	return g_string_free (str, FALSE);
+}
+
+gboolean
+dmapd_dpap_record_add_sized (DmapdDPAPRecord *record, guint width, const guint8 *data, gsize length)
+{
+	gchar *hash;
+	gboolean fnval = FALSE;
+
+	if (NULL == record->priv->thumbnail_store || length > G_MAXUINT32) {
+		goto _done;
+	}
+
+	hash = hash_string (record);
+	fnval = dmapd_thumbnail_store_add_sized (record->priv->thumbnail_store, hash, width, data, length);
+	g_free (hash);
+
+_done:
+	return fnval;
+}
+
+gboolean
+dmapd_dpap_record_has_sized (DmapdDPAPRecord *record, guint width)
+{
+	gchar *hash;
+	gboolean fnval = FALSE;
+
+	if (NULL == record->priv->thumbnail_store) {
+		goto _done;
+	}
+
+	hash = hash_string (record);
+	fnval = dmapd_thumbnail_store_has_sized (record->priv->thumbnail_store, hash, width);
+	g_free (hash);
+
+_done:
+	return fnval;
+}
+
+GByteArray *
+dmapd_dpap_record_get_sized (DmapdDPAPRecord *record, guint width, guint *actual)
+{
+	gchar *hash;
+	GByteArray *fnval = NULL;
 
-        file = g_file_new_for_uri (DMAPD_DPAP_RECORD (record)->priv->location);
-        stream = G_INPUT_STREAM (g_file_read (file, NULL, error));
+	if (NULL == record->priv->thumbnail_store) {
+		goto _done;
+	}
 
-        g_object_unref (file);
+	hash = hash_string (record);
+	fnval = dmapd_thumbnail_store_get_sized (record->priv->thumbnail_store, hash, width, actual);
+	g_free (hash);
 
-        return stream;
+_done:
+	return fnval;
 }
 
 static GByteArray *
@@ -209,18 +429,14 @@ dmapd_dpap_record_to_blob (DMAPRecord *record)
 	blob_add_atomic (blob, (const guint8 *) &(priv->rating),
 			 sizeof (priv->rating));
         blob_add_string (blob, priv->filename);
-	if (priv->thumbnail) {
-		blob_add_atomic (blob, (const guint8 *) &(priv->thumbnail->len),
-				 sizeof (priv->thumbnail->len));
 
-		g_byte_array_append (blob,
-				     priv->thumbnail->data,
-				     priv->thumbnail->len);
-	} else {
-		gsize zero = 0;
-		blob_add_atomic (blob, (const guint8 *) &zero,
-				 sizeof (priv->thumbnail->len));
-	}
+	/* NOTE: only the thumbnail's place in the store; without a store,
+	 * the thumbnail is not saved.
+	 */
+	blob_add_atomic (blob, (const guint8 *) &(priv->thumbnail_offset),
+			 sizeof (priv->thumbnail_offset));
+	blob_add_atomic (blob, (const guint8 *) &(priv->thumbnail_length),
+			 sizeof (priv->thumbnail_length));
 
         blob_add_string (blob, priv->aspectratio);
 	blob_add_atomic (blob, (const guint8 *) &(priv->height),
@@ -252,7 +468,8 @@ dmapd_dpap_record_set_from_blob (DMAPRecord *_record, GByteArray *blob)
 	gint creation_date;
 	gint rating;
 	char *filename;
-	GByteArray *thumbnail = NULL;
+	guint64 thumbnail_offset;
+	guint thumbnail_length;
 	char *aspect_ratio;
 	gint pixel_height;
 	gint pixel_width;
@@ -296,17 +513,20 @@ dmapd_dpap_record_set_from_blob (DMAPRecord *_record, GByteArray *blob)
 	filename = (char *) ptr;
 	ptr += strlen ((char *) ptr) + 1;
 
-	size = *((guint *) ptr);
-	ptr += sizeof (size);
+	thumbnail_offset = *(guint64 *) ptr;
+	ptr += sizeof (thumbnail_offset);
 
-	if (size) {
-		thumbnail = g_byte_array_sized_new (size);
-		if (NULL == hash) {
-			g_warning ("Error allocating array for thumbnail\n");
-			goto _done;
-		}
-		g_byte_array_append (thumbnail, ptr, size);
-		ptr += size;
+	thumbnail_length = *(guint *) ptr;
+	ptr += sizeof (thumbnail_length);
+
+	/* A lost thumbnail store means reading the photograph again. */
+	if (thumbnail_length > 0
+	 && (NULL == DMAPD_DPAP_RECORD (_record)->priv->thumbnail_store
+	  || ! dmapd_thumbnail_store_has (DMAPD_DPAP_RECORD (_record)->priv->thumbnail_store,
+	                                  thumbnail_offset,
+	                                  thumbnail_length))) {
+		g_warning ("Thumbnail for %s is missing from store\n", location);
+		goto _done;
 	}
 
 	aspect_ratio = (char *) ptr;
@@ -354,13 +574,9 @@ dmapd_dpap_record_set_from_blob (DMAPRecord *_record, GByteArray *blob)
 	                      "pixel-height", pixel_height,
 	                      "pixel-width", pixel_width,
 	                      "format", format,
-	                      "comments", comments, NULL);
-
-	if (NULL != thumbnail) {
-		g_object_set (record, "thumbnail", thumbnail, NULL);
-	} else {
-		g_object_set (record, "thumbnail",  g_byte_array_sized_new (0), NULL);
-	}
+	                      "comments", comments,
+	                      "thumbnail-offset", thumbnail_offset,
+	                      "thumbnail-length", thumbnail_length, NULL);
 
 	fnval = TRUE;	
 
@@ -377,10 +593,6 @@ _done:
 		g_byte_array_unref (hash);
 	}
 
-	if (NULL != thumbnail) {
-		g_byte_array_unref (thumbnail);
-	}
-
 	return fnval;
 }
 
@@ -413,6 +625,38 @@ static void dmapd_dpap_record_class_init (DmapdDPAPRecordClass *klass)
 	g_object_class_override_property (gobject_class, PROP_FORMAT, "format");
 	g_object_class_override_property (gobject_class, PROP_COMMENTS, "comments");
 	g_object_class_override_property (gobject_class, PROP_THUMBNAIL, "thumbnail");
+
+	g_object_class_install_property (gobject_class, PROP_THUMBNAIL_OFFSET,
+					 g_param_spec_uint64 ("thumbnail-offset",
+							      "Thumbnail offset",
+							      "Offset of the thumbnail in the thumbnail store",
+							      0,
+							      G_MAXUINT64,
+							      0,
+							      G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PROP_THUMBNAIL_LENGTH,
+					 g_param_spec_uint ("thumbnail-length",
+							    "Thumbnail length",
+							    "Length of the thumbnail in the thumbnail store",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READWRITE));
+
+	/* NOTE: NULL keeps thumbnails in the records. */
+	g_object_class_install_property (gobject_class, PROP_THUMBNAIL_STORE,
+					 g_param_spec_pointer ("thumbnail-store",
+							       "Thumbnail store",
+							       "Thumbnail store",
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+
+	/* NOTE: NULL sends originals. */
+	g_object_class_install_property (gobject_class, PROP_META_READER,
+					 g_param_spec_pointer ("meta-reader",
+							       "Meta Reader",
+							       "Meta Reader",
+							       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
 
 static void dmapd_dpap_record_dpap_iface_init (gpointer iface, gpointer data)
@@ -453,14 +697,12 @@ dmapd_dpap_record_finalize (GObject *object)
 	g_free (record->priv->filename);
 	g_free (record->priv->comments);
 
-	if (record->priv->thumbnail) {
-		g_byte_array_unref (record->priv->thumbnail);
-	}
+	drop_thumbnail (record);
 
 	G_OBJECT_CLASS (dmapd_dpap_record_parent_class)->finalize (object);
 }
 
-DmapdDPAPRecord *dmapd_dpap_record_new (const char *path, gpointer reader)
+DmapdDPAPRecord *dmapd_dpap_record_new (const char *path, gpointer reader, DmapdThumbnailStore *store)
 {
 	DmapdDPAPRecord *record = NULL;
 	guchar hash_buf[DMAP_HASH_SIZE];
@@ -487,7 +729,7 @@ DmapdDPAPRecord *dmapd_dpap_record_new (const char *path, gpointer reader)
 
 		g_byte_array_append (hash, hash_buf, DMAP_HASH_SIZE);
 
-		record = DMAPD_DPAP_RECORD (g_object_new (TYPE_DMAPD_DPAP_RECORD, NULL));
+		record = DMAPD_DPAP_RECORD (g_object_new (TYPE_DMAPD_DPAP_RECORD, "thumbnail-store", store, "meta-reader", reader, NULL));
 		if (NULL == record) {
                         g_warning ("Error allocating memory for record\n");
                         goto _done;
@@ -502,7 +744,7 @@ DmapdDPAPRecord *dmapd_dpap_record_new (const char *path, gpointer reader)
 			goto _done;
 		}
 	} else {
-		record = DMAPD_DPAP_RECORD (g_object_new (TYPE_DMAPD_DPAP_RECORD, NULL));
+		record = DMAPD_DPAP_RECORD (g_object_new (TYPE_DMAPD_DPAP_RECORD, "thumbnail-store", store, "meta-reader", reader, NULL));
 		if (NULL == record) {
                         g_warning ("Error allocating memory for record\n");
                         goto _done;
@@ -23,6 +23,8 @@
 
 #include <libdmapsharing/dmap.h>
 
+#include "dmapd-thumbnail-store.h"
+
 G_BEGIN_DECLS
 
 #define TYPE_DMAPD_DPAP_RECORD         (dmapd_dpap_record_get_type ())
@@ -46,11 +48,33 @@ typedef struct {
 
 GType dmapd_dpap_record_get_type (void);
 
-DmapdDPAPRecord *dmapd_dpap_record_new (const char *location, gpointer reader);
+/* Thumbnails go to store if it is not NULL. */
+DmapdDPAPRecord *dmapd_dpap_record_new (const char *location, gpointer reader, DmapdThumbnailStore *store);
 
 GInputStream  *dmapd_dpap_record_read              (DPAPRecord *record,
 						    GError **err);
 
+/* As dmapd_daap_record_set_chunk_size, for photographs sent as they are. */
+void           dmapd_dpap_record_set_chunk_size    (gsize chunk_size);
+
+/* Copies of the photograph at widths other than the thumbnail's, kept in
+ * the thumbnail store by the photograph's hash.
+ */
+gboolean       dmapd_dpap_record_add_sized         (DmapdDPAPRecord *record,
+						    guint width,
+						    const guint8 *data,
+						    gsize length);
+
+gboolean       dmapd_dpap_record_has_sized         (DmapdDPAPRecord *record,
+						    guint width);
+
+/* Returns the narrowest copy at least width wide, setting actual to its
+ * width, or NULL.
+ */
+GByteArray    *dmapd_dpap_record_get_sized         (DmapdDPAPRecord *record,
+						    guint width,
+						    guint *actual);
+
 #endif /* __DMAPD_DPAP_RECORD */
 
 G_END_DECLS
@@ -0,0 +1,453 @@
+/*   FILE: dmapd-faststart.c -- move QuickTime movie headers to the front
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-faststart.h"
+
+/* A QuickTime file is a sequence of atoms: a 32-bit size, which may be 1
+ * to follow the type with a 64-bit size or 0 to run to the end of the
+ * file, and a four-character type. The moov atom describes the tracks;
+ * within it, each trak's stco or co64 atom lists the absolute offsets of
+ * its chunks of media data, which must change when moov moves ahead.
+ */
+#define FOURCC(a, b, c, d) (((guint32) (a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+#define ATOM_FTYP FOURCC ('f', 't', 'y', 'p')
+#define ATOM_MOOV FOURCC ('m', 'o', 'o', 'v')
+#define ATOM_MDAT FOURCC ('m', 'd', 'a', 't')
+#define ATOM_CMOV FOURCC ('c', 'm', 'o', 'v')
+#define ATOM_TRAK FOURCC ('t', 'r', 'a', 'k')
+#define ATOM_MDIA FOURCC ('m', 'd', 'i', 'a')
+#define ATOM_MINF FOURCC ('m', 'i', 'n', 'f')
+#define ATOM_STBL FOURCC ('s', 't', 'b', 'l')
+#define ATOM_STCO FOURCC ('s', 't', 'c', 'o')
+#define ATOM_CO64 FOURCC ('c', 'o', '6', '4')
+
+#define MAX_MOOV  (64 * 1024 * 1024) /* Beyond which a file is refused. */
+#define COPY_SIZE (1024 * 1024)
+
+typedef struct {
+	goffset offset;
+	goffset size;
+	guint32 type;
+	goffset new_offset;
+} atom_t;
+
+static guint32
+get32 (const guint8 *p)
+{
+	return ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static guint64
+get64 (const guint8 *p)
+{
+	return ((guint64) get32 (p) << 32) | get32 (p + 4);
+}
+
+static void
+put32 (guint8 *p, guint32 v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+put64 (guint8 *p, guint64 v)
+{
+	put32 (p, v >> 32);
+	put32 (p + 4, v);
+}
+
+gboolean
+dmapd_faststart_format (const gchar *format)
+{
+	return NULL != format
+	    && (! strcmp (format, "mp4")
+	     || ! strcmp (format, "m4v")
+	     || ! strcmp (format, "mov"));
+}
+
+/* Returns the top-level atoms of f, or NULL if it is not made of atoms. */
+static GArray *
+read_atoms (FILE *f)
+{
+	goffset offset = 0, filesize;
+	guint8 header[16];
+	GArray *fnval = g_array_new (FALSE, FALSE, sizeof (atom_t));
+
+	if (0 != fseeko (f, 0, SEEK_END) || (filesize = ftello (f)) < 0) {
+		goto _error;
+	}
+
+	while (offset < filesize) {
+		atom_t atom;
+		goffset header_size = 8;
+
+		if (filesize - offset < 8
+		 || 0 != fseeko (f, offset, SEEK_SET)
+		 || 1 != fread (header, 8, 1, f)) {
+			goto _error;
+		}
+
+		atom.offset = offset;
+		atom.size = get32 (header);
+		atom.type = get32 (header + 4);
+		atom.new_offset = offset;
+
+		if (1 == atom.size) {
+			if (1 != fread (header + 8, 8, 1, f) || get64 (header + 8) > G_MAXINT64) {
+				goto _error;
+			}
+			atom.size = get64 (header + 8);
+			header_size = 16;
+		} else if (0 == atom.size) {
+			atom.size = filesize - offset;
+		}
+
+		if (atom.size < header_size || atom.size > filesize - offset) {
+			goto _error;
+		}
+
+		g_array_append_val (fnval, atom);
+		offset += atom.size;
+	}
+
+	return fnval;
+
+_error:
+	g_array_free (fnval, TRUE);
+	return NULL;
+}
+
+/* Returns the index of the moov atom if it follows an mdat atom, or -1. */
+static gint
+find_late_moov (GArray *atoms)
+{
+	guint i;
+	gint fnval = -1;
+	gboolean seen_mdat = FALSE;
+
+	for (i = 0; i < atoms->len; i++) {
+		atom_t *atom = &g_array_index (atoms, atom_t, i);
+
+		if (ATOM_MDAT == atom->type) {
+			seen_mdat = TRUE;
+		} else if (ATOM_MOOV == atom->type) {
+			if (-1 != fnval) {
+				return -1; /* NOTE: more than one is not a file we know. */
+			}
+			fnval = seen_mdat ? (gint) i : -2;
+		}
+	}
+
+	return fnval < 0 ? -1 : fnval;
+}
+
+gboolean
+dmapd_faststart_needed (const gchar *path)
+{
+	FILE *f;
+	GArray *atoms = NULL;
+	gboolean fnval = FALSE;
+
+	f = g_fopen (path, "rb");
+	if (NULL == f) {
+		goto _done;
+	}
+
+	atoms = read_atoms (f);
+	if (NULL == atoms) {
+		goto _done;
+	}
+
+	fnval = -1 != find_late_moov (atoms);
+
+_done:
+	if (NULL != atoms) {
+		g_array_free (atoms, TRUE);
+	}
+
+	if (NULL != f) {
+		fclose (f);
+	}
+
+	return fnval;
+}
+
+/* Moves an offset in the file as the atom holding it moves. */
+static gboolean
+relocate (GArray *atoms, guint64 *offset)
+{
+	guint i;
+
+	for (i = 0; i < atoms->len; i++) {
+		atom_t *atom = &g_array_index (atoms, atom_t, i);
+
+		if ((guint64) atom->offset <= *offset && *offset - atom->offset < (guint64) atom->size) {
+			*offset = *offset - atom->offset + atom->new_offset;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static gboolean
+patch_chunk_offsets (GArray *atoms, guint8 *data, gsize size)
+{
+	gsize pos = 0;
+
+	while (pos + 8 <= size) {
+		guint64 atom_size = get32 (data + pos);
+		guint32 type = get32 (data + pos + 4);
+		gsize header_size = 8;
+
+		if (1 == atom_size) {
+			if (pos + 16 > size) {
+				return FALSE;
+			}
+			atom_size = get64 (data + pos + 8);
+			header_size = 16;
+		} else if (0 == atom_size) {
+			atom_size = size - pos;
+		}
+
+		if (atom_size < header_size || atom_size > size - pos) {
+			return FALSE;
+		}
+
+		if (ATOM_TRAK == type || ATOM_MDIA == type || ATOM_MINF == type || ATOM_STBL == type) {
+			if (! patch_chunk_offsets (atoms, data + pos + header_size, atom_size - header_size)) {
+				return FALSE;
+			}
+		} else if (ATOM_STCO == type || ATOM_CO64 == type) {
+			guint32 i, count;
+			gsize width = ATOM_STCO == type ? 4 : 8;
+			guint8 *entry = data + pos + header_size + 8;
+
+			/* NOTE: after the header come a version, flags and the count. */
+			if (atom_size - header_size < 8) {
+				return FALSE;
+			}
+
+			count = get32 (data + pos + header_size + 4);
+			if (count > (atom_size - header_size - 8) / width) {
+				return FALSE;
+			}
+
+			for (i = 0; i < count; i++, entry += width) {
+				guint64 offset = 4 == width ? get32 (entry) : get64 (entry);
+
+				if (! relocate (atoms, &offset)) {
+					g_debug ("Chunk offset outside of file");
+					return FALSE;
+				} else if (4 == width && offset > G_MAXUINT32) {
+					g_debug ("Chunk offset would need 64 bits");
+					return FALSE;
+				} else if (4 == width) {
+					put32 (entry, offset);
+				} else {
+					put64 (entry, offset);
+				}
+			}
+		} else if (ATOM_CMOV == type) {
+			g_debug ("Compressed movie header");
+			return FALSE;
+		}
+
+		pos += atom_size;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+copy_range (FILE *in, FILE *out, goffset offset, goffset size, guint8 *buf)
+{
+	if (0 != fseeko (in, offset, SEEK_SET)) {
+		return FALSE;
+	}
+
+	while (size > 0) {
+		gsize n = MIN (size, COPY_SIZE);
+
+		if (1 != fread (buf, n, 1, in) || 1 != fwrite (buf, n, 1, out)) {
+			return FALSE;
+		}
+
+		size -= n;
+	}
+
+	return TRUE;
+}
+
+/* NOTE: writes to a temporary file renamed into place, like transcoding. */
+gboolean
+dmapd_faststart_remux (const gchar *path, const gchar *outpath)
+{
+	int fd;
+	guint i, pass;
+	gint moov_index;
+	goffset offset = 0;
+	atom_t *moov;
+	FILE *in = NULL, *out = NULL;
+	GArray *atoms = NULL;
+	GArray *order = NULL;
+	guint8 *moov_data = NULL;
+	guint8 *buf = NULL;
+	gchar *tmppath = NULL;
+	gboolean fnval = FALSE;
+
+	in = g_fopen (path, "rb");
+	if (NULL == in) {
+		g_warning ("Error opening %s", path);
+		goto _done;
+	}
+
+	atoms = read_atoms (in);
+	if (NULL == atoms) {
+		g_debug ("%s is not a QuickTime file", path);
+		goto _done;
+	}
+
+	moov_index = find_late_moov (atoms);
+	if (-1 == moov_index) {
+		g_debug ("%s does not need its movie header moved", path);
+		goto _done;
+	}
+
+	moov = &g_array_index (atoms, atom_t, moov_index);
+	if (moov->size > MAX_MOOV) {
+		g_warning ("Movie header of %s is too large", path);
+		goto _done;
+	}
+
+	/* NOTE: ftyp stays first; moov follows it, then the rest in order. */
+	order = g_array_new (FALSE, FALSE, sizeof (guint));
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < atoms->len; i++) {
+			atom_t *atom = &g_array_index (atoms, atom_t, i);
+			guint which = ATOM_FTYP == atom->type ? 0 : (gint) i == moov_index ? 1 : 2;
+
+			if (which == pass) {
+				atom->new_offset = offset;
+				offset += atom->size;
+				g_array_append_val (order, i);
+			}
+		}
+	}
+
+	moov_data = g_malloc (moov->size);
+	if (0 != fseeko (in, moov->offset, SEEK_SET) || 1 != fread (moov_data, moov->size, 1, in)) {
+		g_warning ("Error reading movie header of %s", path);
+		goto _done;
+	}
+
+	/* NOTE: a size of 0 ran to the end of the file, which moov no longer does. */
+	if (0 == get32 (moov_data)) {
+		put32 (moov_data, moov->size);
+	}
+
+	/* NOTE: the children of moov follow its header. */
+	if (! patch_chunk_offsets (atoms,
+	                           moov_data + (1 == get32 (moov_data) ? 16 : 8),
+	                           moov->size - (1 == get32 (moov_data) ? 16 : 8))) {
+		g_warning ("Could not adjust the movie header of %s", path);
+		goto _done;
+	}
+
+	tmppath = g_strdup_printf ("%s.XXXXXX", outpath);
+	fd = g_mkstemp (tmppath);
+	if (-1 == fd || NULL == (out = fdopen (fd, "wb"))) {
+		g_warning ("Error opening: %s", tmppath);
+		if (-1 != fd) {
+			close (fd);
+			g_unlink (tmppath);
+		}
+		g_free (tmppath);
+		tmppath = NULL;
+		goto _done;
+	}
+
+	buf = g_malloc (COPY_SIZE);
+
+	for (i = 0; i < order->len; i++) {
+		guint index = g_array_index (order, guint, i);
+		atom_t *atom = &g_array_index (atoms, atom_t, index);
+
+		if ((gint) index == moov_index) {
+			if (1 != fwrite (moov_data, moov->size, 1, out)) {
+				g_warning ("Error writing remuxed data");
+				goto _done;
+			}
+		} else if (! copy_range (in, out, atom->offset, atom->size, buf)) {
+			g_warning ("Error copying %s", path);
+			goto _done;
+		}
+	}
+
+	fnval = TRUE;
+
+_done:
+	if (NULL != out) {
+		if (0 != fclose (out)) {
+			g_warning ("Error writing remuxed data");
+			fnval = FALSE;
+		}
+
+		if (fnval && 0 != g_rename (tmppath, outpath)) {
+			g_warning ("Error renaming %s to %s", tmppath, outpath);
+			fnval = FALSE;
+		}
+
+		if (! fnval) {
+			g_unlink (tmppath);
+		}
+	}
+
+	if (NULL != in) {
+		fclose (in);
+	}
+
+	if (NULL != atoms) {
+		g_array_free (atoms, TRUE);
+	}
+
+	if (NULL != order) {
+		g_array_free (order, TRUE);
+	}
+
+	g_free (moov_data);
+	g_free (buf);
+	g_free (tmppath);
+
+	return fnval;
+}
@@ -0,0 +1,50 @@
+/*   FILE: dmapd-faststart.h -- move QuickTime movie headers to the front
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_FASTSTART
+#define __DMAPD_FASTSTART
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Returns TRUE if format names a QuickTime-based container: MP4, M4V or
+ * MOV.
+ */
+gboolean dmapd_faststart_format (const gchar *format);
+
+/* Returns TRUE if the file at path is a QuickTime-based file whose moov
+ * atom, which a client needs before it can play anything, follows the
+ * media data.
+ */
+gboolean dmapd_faststart_needed (const gchar *path);
+
+/* Writes a copy of the file at path to outpath with its moov atom moved
+ * to the front, adjusting the chunk offsets within it to match. Media
+ * data are copied as they are. Returns FALSE, leaving nothing at
+ * outpath, if the file does not need this or cannot be remuxed.
+ */
+gboolean dmapd_faststart_remux  (const gchar *path, const gchar *outpath);
+
+#endif /* __DMAPD_FASTSTART */
+
+G_END_DECLS
@@ -0,0 +1,70 @@
+/*   FILE: dmapd-file-stream.c -- open media files for serving
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+#include <fcntl.h>
+#include <gio/gfiledescriptorbased.h>
+
+#include "dmapd-file-stream.h"
+
+#define READ_AHEAD    (2 * 1024 * 1024) /* Hinted when a file is opened. */
+
+/* NOTE: hints only; failure costs nothing but the read-ahead. */
+static void
+advise_sequential (int fd)
+{
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+static void
+advise_willneed (int fd, goffset offset, goffset length)
+{
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise (fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+GInputStream *
+dmapd_file_stream_open (const gchar *uri, GError **error)
+{
+	int fd;
+	GFile *file;
+	GInputStream *fnval;
+
+	file = g_file_new_for_uri (uri);
+	fnval = G_INPUT_STREAM (g_file_read (file, NULL, error));
+	g_object_unref (file);
+
+	if (NULL == fnval || ! G_IS_FILE_DESCRIPTOR_BASED (fnval)) {
+		goto _done;
+	}
+
+	fd = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (fnval));
+
+	advise_sequential (fd);
+	advise_willneed (fd, 0, READ_AHEAD);
+
+_done:
+	return fnval;
+}
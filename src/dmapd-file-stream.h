@@ -0,0 +1,37 @@
+/*   FILE: dmapd-file-stream.h -- open media files for serving
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_FILE_STREAM
+#define __DMAPD_FILE_STREAM
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Opens the file at uri for reading from start to end. For local files,
+ * the kernel is told to read ahead, as media are served sequentially.
+ */
+GInputStream *dmapd_file_stream_open (const gchar *uri, GError **error);
+
+#endif /* __DMAPD_FILE_STREAM */
+
+G_END_DECLS
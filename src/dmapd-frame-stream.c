@@ -0,0 +1,462 @@
+/*   FILE: dmapd-frame-stream.c -- audio streams that seek to frame boundaries
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+
+#include "dmapd-frame-stream.h"
+
+#define MAX_HEADER  (1024 * 1024) /* Beyond which a header is refused. */
+#define MAX_BLOCKS  1024
+#define SCAN_LIMIT  (64 * 1024)   /* To look for a frame after a seek. */
+#define STREAMINFO  34
+
+typedef enum {
+	FORMAT_FLAC,
+	FORMAT_MP3,
+	FORMAT_WAV
+} frame_format_t;
+
+struct DmapdFrameStreamPrivate {
+	frame_format_t format;
+	gboolean parsed;
+	GByteArray *header;   /* Sent after a seek; NULL for none. */
+	goffset data_start;   /* Offset of the first frame. */
+	guint block_align;    /* Of WAV samples. */
+	guint header_pending; /* Bytes of header still to send. */
+	goffset position;
+};
+
+static void dmapd_frame_stream_seekable_iface_init (GSeekableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (DmapdFrameStream, dmapd_frame_stream, G_TYPE_FILTER_INPUT_STREAM,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE, dmapd_frame_stream_seekable_iface_init))
+
+static GInputStream *
+base_stream (DmapdFrameStream *stream)
+{
+	return g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (stream));
+}
+
+static gboolean
+read_exactly (GInputStream *base, void *buf, gsize count, GCancellable *cancellable, GError **error)
+{
+	gsize n = 0;
+
+	return g_input_stream_read_all (base, buf, count, &n, cancellable, error) && n == count;
+}
+
+static guint32
+get24be (const guint8 *p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static guint32
+get32le (const guint8 *p)
+{
+	return ((guint32) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/* The header replayed is "fLaC" and STREAMINFO alone, without the total
+ * samples and MD5 signature, which no longer hold for what follows.
+ */
+static gboolean
+parse_flac (DmapdFrameStream *stream, GCancellable *cancellable, GError **error)
+{
+	guint i;
+	guint8 buf[4];
+	guint8 info[STREAMINFO];
+	gboolean have_info = FALSE;
+	gboolean fnval = FALSE;
+	DmapdFrameStreamPrivate *priv = stream->priv;
+	GInputStream *base = base_stream (stream);
+	goffset offset = 4;
+
+	if (! read_exactly (base, buf, 4, cancellable, error) || memcmp (buf, "fLaC", 4)) {
+		goto _done;
+	}
+
+	for (i = 0; i < MAX_BLOCKS; i++) {
+		guint32 length;
+
+		if (! read_exactly (base, buf, 4, cancellable, error)) {
+			goto _done;
+		}
+
+		length = get24be (buf + 1);
+		offset += 4;
+
+		if (0 == (buf[0] & 0x7f) && STREAMINFO == length) {
+			if (! read_exactly (base, info, STREAMINFO, cancellable, error)) {
+				goto _done;
+			}
+			have_info = TRUE;
+		} else if (! g_seekable_seek (G_SEEKABLE (base), offset + length, G_SEEK_SET, cancellable, error)) {
+			goto _done;
+		}
+
+		offset += length;
+
+		if (buf[0] & 0x80) {
+			break;
+		}
+	}
+
+	if (! have_info || MAX_BLOCKS == i) {
+		goto _done;
+	}
+
+	info[13] &= 0xf0;
+	memset (info + 14, 0, STREAMINFO - 14);
+
+	priv->header = g_byte_array_sized_new (8 + STREAMINFO);
+	g_byte_array_append (priv->header, (const guint8 *) "fLaC\x80\x00\x00\x22", 8);
+	g_byte_array_append (priv->header, info, STREAMINFO);
+	priv->data_start = offset;
+
+	fnval = TRUE;
+
+_done:
+	return fnval;
+}
+
+/* The header replayed is everything before the samples. */
+static gboolean
+parse_wav (DmapdFrameStream *stream, GCancellable *cancellable, GError **error)
+{
+	guint i;
+	guint8 buf[16];
+	gboolean fnval = FALSE;
+	DmapdFrameStreamPrivate *priv = stream->priv;
+	GInputStream *base = base_stream (stream);
+	goffset offset = 12;
+
+	if (! read_exactly (base, buf, 12, cancellable, error)
+	 || memcmp (buf, "RIFF", 4)
+	 || memcmp (buf + 8, "WAVE", 4)) {
+		goto _done;
+	}
+
+	for (i = 0; i < MAX_BLOCKS && 0 == priv->data_start; i++) {
+		guint32 length;
+
+		if (! read_exactly (base, buf, 8, cancellable, error)) {
+			goto _done;
+		}
+
+		length = get32le (buf + 4);
+		offset += 8;
+
+		if (! memcmp (buf, "data", 4)) {
+			priv->data_start = offset;
+		} else if (! memcmp (buf, "fmt ", 4) && length >= 16) {
+			if (! read_exactly (base, buf, 16, cancellable, error)) {
+				goto _done;
+			}
+			priv->block_align = buf[12] | (buf[13] << 8);
+		}
+
+		/* NOTE: chunks are padded to an even length. */
+		offset += length + (length & 1);
+		if (0 == priv->data_start && ! g_seekable_seek (G_SEEKABLE (base), offset, G_SEEK_SET, cancellable, error)) {
+			goto _done;
+		}
+	}
+
+	if (0 == priv->data_start || 0 == priv->block_align || priv->data_start > MAX_HEADER) {
+		goto _done;
+	}
+
+	priv->header = g_byte_array_sized_new (priv->data_start);
+	g_byte_array_set_size (priv->header, priv->data_start);
+
+	if (! g_seekable_seek (G_SEEKABLE (base), 0, G_SEEK_SET, cancellable, error)
+	 || ! read_exactly (base, priv->header->data, priv->data_start, cancellable, error)) {
+		goto _done;
+	}
+
+	fnval = TRUE;
+
+_done:
+	return fnval;
+}
+
+/* Reads what is needed to seek. A file that does not parse is served as
+ * it is.
+ */
+static void
+parse (DmapdFrameStream *stream, GCancellable *cancellable)
+{
+	gboolean ok = TRUE;
+	GError *error = NULL;
+	DmapdFrameStreamPrivate *priv = stream->priv;
+
+	priv->parsed = TRUE;
+
+	if (! g_seekable_seek (G_SEEKABLE (base_stream (stream)), 0, G_SEEK_SET, cancellable, &error)) {
+		ok = FALSE;
+	} else if (FORMAT_FLAC == priv->format) {
+		ok = parse_flac (stream, cancellable, &error);
+	} else if (FORMAT_WAV == priv->format) {
+		ok = parse_wav (stream, cancellable, &error);
+	}
+
+	/* NOTE: MP3 frames stand alone and need no header. */
+
+	if (! ok) {
+		g_debug ("Seeking without regard to frames: %s", NULL != error ? error->message : "bad header");
+		g_clear_error (&error);
+		if (NULL != priv->header) {
+			g_byte_array_unref (priv->header);
+			priv->header = NULL;
+		}
+		priv->data_start = G_MAXINT64;
+	}
+}
+
+static gboolean
+is_frame (frame_format_t format, const guint8 *p)
+{
+	if (0xff != p[0]) {
+		return FALSE;
+	}
+
+	switch (format) {
+	case FORMAT_FLAC:
+		/* Sync code, a block size and a valid sample rate. */
+		return 0xf8 == (p[1] & 0xfe) && 0 != (p[2] >> 4) && 0x0f != (p[2] & 0x0f);
+	case FORMAT_MP3:
+		/* Sync, version, layer, bit rate and sample rate. */
+		return 0xe0 == (p[1] & 0xe0)
+		    && 1 != ((p[1] >> 3) & 3)
+		    && 0 != ((p[1] >> 1) & 3)
+		    && 0 != (p[2] >> 4)
+		    && 0x0f != (p[2] >> 4)
+		    && 3 != ((p[2] >> 2) & 3);
+	default:
+		return FALSE;
+	}
+}
+
+/* Returns the offset of the first frame at or after offset, or offset if
+ * none is found close by.
+ */
+static goffset
+find_frame (DmapdFrameStream *stream, goffset offset, GCancellable *cancellable, GError **error)
+{
+	gsize i, count = 0;
+	goffset fnval = offset;
+	guint8 *buf = g_malloc (SCAN_LIMIT);
+	GInputStream *base = base_stream (stream);
+
+	if (FORMAT_WAV == stream->priv->format) {
+		guint align = stream->priv->block_align;
+		goffset into = offset - stream->priv->data_start;
+		fnval = stream->priv->data_start + (into + align - 1) / align * align;
+		goto _done;
+	}
+
+	if (! g_seekable_seek (G_SEEKABLE (base), offset, G_SEEK_SET, cancellable, error)
+	 || ! g_input_stream_read_all (base, buf, SCAN_LIMIT, &count, cancellable, error)) {
+		goto _done;
+	}
+
+	for (i = 0; i + 3 <= count; i++) {
+		if (is_frame (stream->priv->format, buf + i)) {
+			fnval = offset + i;
+			break;
+		}
+	}
+
+_done:
+	g_free (buf);
+
+	return fnval;
+}
+
+static gssize
+dmapd_frame_stream_read (GInputStream *_stream,
+			 void *buffer,
+			 gsize count,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	gssize fnval;
+	DmapdFrameStreamPrivate *priv = DMAPD_FRAME_STREAM (_stream)->priv;
+
+	if (priv->header_pending > 0) {
+		fnval = MIN (count, priv->header_pending);
+		memcpy (buffer, priv->header->data + priv->header->len - priv->header_pending, fnval);
+		priv->header_pending -= fnval;
+	} else {
+		fnval = g_input_stream_read (base_stream (DMAPD_FRAME_STREAM (_stream)), buffer, count, cancellable, error);
+	}
+
+	if (fnval > 0) {
+		priv->position += fnval;
+	}
+
+	return fnval;
+}
+
+static goffset
+dmapd_frame_stream_tell (GSeekable *seekable)
+{
+	return DMAPD_FRAME_STREAM (seekable)->priv->position;
+}
+
+static gboolean
+dmapd_frame_stream_can_seek (GSeekable *seekable)
+{
+	return TRUE;
+}
+
+static gboolean
+dmapd_frame_stream_seek (GSeekable *seekable,
+			 goffset offset,
+			 GSeekType type,
+			 GCancellable *cancellable,
+			 GError **error)
+{
+	goffset target = offset;
+	gboolean fnval = FALSE;
+	DmapdFrameStream *stream = DMAPD_FRAME_STREAM (seekable);
+	DmapdFrameStreamPrivate *priv = stream->priv;
+
+	if (G_SEEK_SET != type || offset < 0) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Frame streams seek only from the start");
+		goto _done;
+	}
+
+	if (! priv->parsed) {
+		parse (stream, cancellable);
+	}
+
+	priv->header_pending = 0;
+
+	if (offset > priv->data_start) {
+		target = find_frame (stream, offset, cancellable, error);
+		if (NULL != error && NULL != *error) {
+			goto _done;
+		}
+
+		if (NULL != priv->header) {
+			priv->header_pending = priv->header->len;
+		}
+	}
+
+	if (! g_seekable_seek (G_SEEKABLE (base_stream (stream)), target, G_SEEK_SET, cancellable, error)) {
+		goto _done;
+	}
+
+	priv->position = offset;
+	fnval = TRUE;
+
+_done:
+	return fnval;
+}
+
+static gboolean
+dmapd_frame_stream_can_truncate (GSeekable *seekable)
+{
+	return FALSE;
+}
+
+static gboolean
+dmapd_frame_stream_truncate (GSeekable *seekable,
+			     goffset offset,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Frame streams cannot be truncated");
+
+	return FALSE;
+}
+
+GInputStream *
+dmapd_frame_stream_new (GInputStream *base, const gchar *format)
+{
+	frame_format_t frame_format;
+	GInputStream *fnval = NULL;
+
+	if (! G_IS_SEEKABLE (base) || ! g_seekable_can_seek (G_SEEKABLE (base)) || NULL == format) {
+		fnval = g_object_ref (base);
+		goto _done;
+	}
+
+	if (! strcmp (format, "flac")) {
+		frame_format = FORMAT_FLAC;
+	} else if (! strcmp (format, "mp3")) {
+		frame_format = FORMAT_MP3;
+	} else if (! strcmp (format, "wav")) {
+		frame_format = FORMAT_WAV;
+	} else {
+		fnval = g_object_ref (base);
+		goto _done;
+	}
+
+	fnval = G_INPUT_STREAM (g_object_new (TYPE_DMAPD_FRAME_STREAM, "base-stream", base, NULL));
+	DMAPD_FRAME_STREAM (fnval)->priv->format = frame_format;
+
+_done:
+	return fnval;
+}
+
+static void
+dmapd_frame_stream_init (DmapdFrameStream *stream)
+{
+	stream->priv = DMAPD_FRAME_STREAM_GET_PRIVATE (stream);
+}
+
+static void
+dmapd_frame_stream_finalize (GObject *object)
+{
+	DmapdFrameStream *stream = DMAPD_FRAME_STREAM (object);
+
+	if (NULL != stream->priv->header) {
+		g_byte_array_unref (stream->priv->header);
+	}
+
+	G_OBJECT_CLASS (dmapd_frame_stream_parent_class)->finalize (object);
+}
+
+static void
+dmapd_frame_stream_class_init (DmapdFrameStreamClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (klass);
+
+	g_type_class_add_private (klass, sizeof (DmapdFrameStreamPrivate));
+
+	gobject_class->finalize = dmapd_frame_stream_finalize;
+	input_stream_class->read_fn = dmapd_frame_stream_read;
+}
+
+static void
+dmapd_frame_stream_seekable_iface_init (GSeekableIface *iface)
+{
+	iface->tell         = dmapd_frame_stream_tell;
+	iface->can_seek     = dmapd_frame_stream_can_seek;
+	iface->seek         = dmapd_frame_stream_seek;
+	iface->can_truncate = dmapd_frame_stream_can_truncate;
+	iface->truncate_fn  = dmapd_frame_stream_truncate;
+}
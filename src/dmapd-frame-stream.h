@@ -0,0 +1,64 @@
+/*   FILE: dmapd-frame-stream.h -- audio streams that seek to frame boundaries
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_FRAME_STREAM
+#define __DMAPD_FRAME_STREAM
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define TYPE_DMAPD_FRAME_STREAM         (dmapd_frame_stream_get_type ())
+#define DMAPD_FRAME_STREAM(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), TYPE_DMAPD_FRAME_STREAM, DmapdFrameStream))
+#define DMAPD_FRAME_STREAM_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), TYPE_DMAPD_FRAME_STREAM, DmapdFrameStreamClass))
+#define IS_DMAPD_FRAME_STREAM(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), TYPE_DMAPD_FRAME_STREAM))
+#define IS_DMAPD_FRAME_STREAM_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), TYPE_DMAPD_FRAME_STREAM))
+#define DMAPD_FRAME_STREAM_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), TYPE_DMAPD_FRAME_STREAM, DmapdFrameStreamClass))
+#define DMAPD_FRAME_STREAM_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), TYPE_DMAPD_FRAME_STREAM, DmapdFrameStreamPrivate))
+
+typedef struct DmapdFrameStreamPrivate DmapdFrameStreamPrivate;
+
+typedef struct {
+	GFilterInputStream parent;
+	DmapdFrameStreamPrivate *priv;
+} DmapdFrameStream;
+
+typedef struct {
+	GFilterInputStreamClass parent;
+} DmapdFrameStreamClass;
+
+GType         dmapd_frame_stream_get_type (void);
+
+/* Returns a stream over base, an audio file of format, that a decoder
+ * can start on after any seek: seeking past the file's header moves to
+ * the next frame and replays a copy of the header first. Because byte
+ * offsets into such files are roughly proportional to time, a client
+ * seeking a track that is being transcoded lands about where it asked.
+ * If format is not FLAC, MP3 or WAV, or base cannot seek, returns a new
+ * reference to base instead.
+ */
+GInputStream *dmapd_frame_stream_new      (GInputStream *base,
+					   const gchar *format);
+
+#endif /* __DMAPD_FRAME_STREAM */
+
+G_END_DECLS
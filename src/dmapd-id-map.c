@@ -0,0 +1,161 @@
+/*   FILE: dmapd-id-map.c -- persistent location to ID map
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-id-map.h"
+
+/* The file holds one "ID<tab>key" line per assignment. Keys are URIs, so
+ * they never contain tabs or newlines. Lines are only ever appended.
+ */
+struct DmapdIdMap {
+	GHashTable *ids;
+	FILE *file;
+	guint next;
+	gint step;
+};
+
+static void
+load (DmapdIdMap *map, const gchar *path)
+{
+	gchar *contents = NULL;
+	gchar **lines = NULL;
+	GError *error = NULL;
+	guint i;
+
+	if (! g_file_get_contents (path, &contents, NULL, &error)) {
+		g_debug ("No ID map at %s: %s", path, error->message);
+		g_error_free (error);
+		goto _done;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	/* NOTE: the final element follows the last newline; it is either
+	 * empty or a line cut short by a crash, so skip it.
+	 */
+	for (i = 0; lines[i] && lines[i + 1]; i++) {
+		gchar *end;
+		guint64 id;
+
+		id = g_ascii_strtoull (lines[i], &end, 10);
+		if (end == lines[i] || *end != '\t' || id == 0 || id > G_MAXINT) {
+			g_warning ("Bad line %u in ID map %s", i + 1, path);
+			continue;
+		}
+
+		g_hash_table_insert (map->ids, g_strdup (end + 1), GUINT_TO_POINTER ((guint) id));
+
+		if (map->step < 0 && id <= map->next) {
+			map->next = id - 1;
+		} else if (map->step > 0 && id >= map->next) {
+			map->next = id + 1;
+		}
+	}
+
+	g_debug ("Loaded %u IDs from %s", g_hash_table_size (map->ids), path);
+
+_done:
+	g_strfreev (lines);
+	g_free (contents);
+}
+
+DmapdIdMap *
+dmapd_id_map_new (const gchar *path, guint first, gint step)
+{
+	DmapdIdMap *map;
+
+	g_assert (step == 1 || step == -1);
+
+	map = g_new0 (DmapdIdMap, 1);
+	map->ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	map->next = first;
+	map->step = step;
+
+	if (NULL != path) {
+		load (map, path);
+
+		map->file = g_fopen (path, "a");
+		if (NULL == map->file) {
+			g_warning ("Could not open %s; IDs will not persist", path);
+		}
+	}
+
+	return map;
+}
+
+guint
+dmapd_id_map_lookup (DmapdIdMap *map, const gchar *key)
+{
+	return GPOINTER_TO_UINT (g_hash_table_lookup (map->ids, key));
+}
+
+guint
+dmapd_id_map_assign (DmapdIdMap *map, const gchar *key)
+{
+	guint id;
+
+	id = dmapd_id_map_lookup (map, key);
+	if (0 != id) {
+		goto _done;
+	}
+
+	if (0 == map->next || map->next > G_MAXINT) {
+		g_error ("Out of IDs");
+	}
+
+	id = map->next;
+	map->next += map->step;
+	g_hash_table_insert (map->ids, g_strdup (key), GUINT_TO_POINTER (id));
+
+	if (NULL != map->file) {
+		/* NOTE: flush now; dmapd usually exits by signal. */
+		if (fprintf (map->file, "%u\t%s\n", id, key) < 0 || fflush (map->file) != 0) {
+			g_warning ("Could not save ID for %s", key);
+		}
+	}
+
+_done:
+	return id;
+}
+
+void
+dmapd_id_map_free (DmapdIdMap *map)
+{
+	if (NULL == map) {
+		goto _done;
+	}
+
+	if (NULL != map->file) {
+		fclose (map->file);
+	}
+
+	g_hash_table_destroy (map->ids);
+	g_free (map);
+
+_done:
+	return;
+}
@@ -0,0 +1,52 @@
+/*   FILE: dmapd-id-map.h -- persistent location to ID map
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_ID_MAP
+#define __DMAPD_ID_MAP
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Media ID's start at max and go down. Container ID's start at 1 and go up. */
+#define DMAPD_ID_MAP_FIRST_MEDIA_ID     G_MAXINT /* NOTE: this should be G_MAXUINT, but iPhoto can't handle it. */
+#define DMAPD_ID_MAP_FIRST_CONTAINER_ID 2        /* 1 is reserved for the primary container. */
+
+typedef struct DmapdIdMap DmapdIdMap;
+
+/* Maps keys (URIs) to the IDs they were first given, so that IDs survive
+ * restarts. IDs are allocated from first, moving by step (1 or -1). The
+ * map is kept in memory only if path is NULL.
+ */
+DmapdIdMap *dmapd_id_map_new    (const gchar *path, guint first, gint step);
+
+/* Returns 0 if key has no ID. */
+guint       dmapd_id_map_lookup (DmapdIdMap *map, const gchar *key);
+
+/* Returns key's ID, allocating and saving a new one if needed. */
+guint       dmapd_id_map_assign (DmapdIdMap *map, const gchar *key);
+
+void        dmapd_id_map_free   (DmapdIdMap *map);
+
+#endif /* __DMAPD_ID_MAP */
+
+G_END_DECLS
@@ -0,0 +1,310 @@
+/*   FILE: dmapd-playlist.c -- read playlist files
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "dmapd-playlist.h"
+
+#define UTF8_BOM "\xef\xbb\xbf"
+
+typedef enum {
+	PLAYLIST_NONE,
+	PLAYLIST_M3U,
+	PLAYLIST_PLS,
+	PLAYLIST_XSPF
+} playlist_type_t;
+
+typedef struct {
+	guint n;
+	gchar *uri;
+} pls_entry_t;
+
+typedef struct {
+	const gchar *dir;
+	GPtrArray *uris;
+	gboolean in_track;
+	GString *location; /* NULL unless in a track's location. */
+} xspf_data_t;
+
+static playlist_type_t
+playlist_type (const gchar *path)
+{
+	playlist_type_t fnval = PLAYLIST_NONE;
+	gchar *lower = g_ascii_strdown (path, -1);
+
+	if (g_str_has_suffix (lower, ".m3u") || g_str_has_suffix (lower, ".m3u8")) {
+		fnval = PLAYLIST_M3U;
+	} else if (g_str_has_suffix (lower, ".pls")) {
+		fnval = PLAYLIST_PLS;
+	} else if (g_str_has_suffix (lower, ".xspf")) {
+		fnval = PLAYLIST_XSPF;
+	}
+
+	g_free (lower);
+
+	return fnval;
+}
+
+gboolean
+dmapd_playlist_is_playlist (const gchar *path)
+{
+	return PLAYLIST_NONE != playlist_type (path);
+}
+
+/* Entries are URIs, absolute paths or paths relative to dir. The result
+ * is canonical, like the locations DbBuilder gives records.
+ */
+static gchar *
+entry_to_uri (const gchar *dir, const gchar *entry)
+{
+	GFile *file;
+	gchar *fnval = NULL;
+	gchar *path = NULL;
+	gchar *scheme = g_uri_parse_scheme (entry);
+
+	/* NOTE: a one-letter scheme is a Windows drive, e.g., "C:\". */
+	if (NULL != scheme && strlen (scheme) > 1) {
+		fnval = g_strdup (entry);
+		goto _done;
+	}
+
+	path = g_strdup (entry);
+	g_strdelimit (path, "\\", '/');
+
+	if (g_path_is_absolute (path)) {
+		file = g_file_new_for_path (path);
+	} else {
+		gchar *full = g_build_filename (dir, path, NULL);
+		file = g_file_new_for_path (full);
+		g_free (full);
+	}
+
+	fnval = g_file_get_uri (file);
+	g_object_unref (file);
+
+_done:
+	g_free (scheme);
+	g_free (path);
+
+	return fnval;
+}
+
+static void
+parse_m3u (gchar *contents, const gchar *dir, GPtrArray *uris)
+{
+	guint i;
+	gchar **lines;
+
+	if (g_str_has_prefix (contents, UTF8_BOM)) {
+		contents += strlen (UTF8_BOM);
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		gchar *line = g_strstrip (lines[i]);
+
+		/* Comments include #EXTM3U and #EXTINF. */
+		if (*line == 0x00 || *line == '#') {
+			continue;
+		}
+
+		g_ptr_array_add (uris, entry_to_uri (dir, line));
+	}
+
+	g_strfreev (lines);
+}
+
+static gint
+compare_pls_entries (gconstpointer a, gconstpointer b)
+{
+	const pls_entry_t *ea = a, *eb = b;
+
+	return ea->n < eb->n ? -1 : ea->n > eb->n ? 1 : 0;
+}
+
+/* Only the FileN keys of a PLS file matter. They may appear in any order. */
+static void
+parse_pls (gchar *contents, const gchar *dir, GPtrArray *uris)
+{
+	guint i;
+	gchar **lines;
+	GArray *entries = g_array_new (FALSE, FALSE, sizeof (pls_entry_t));
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		gchar *end;
+		pls_entry_t entry;
+		gchar *line = g_strstrip (lines[i]);
+
+		if (g_ascii_strncasecmp (line, "File", 4)) {
+			continue;
+		}
+
+		entry.n = strtoul (line + 4, &end, 10);
+		if (end == line + 4 || *end != '=') {
+			continue;
+		}
+
+		entry.uri = entry_to_uri (dir, g_strstrip (end + 1));
+		g_array_append_val (entries, entry);
+	}
+
+	g_array_sort (entries, compare_pls_entries);
+
+	for (i = 0; i < entries->len; i++) {
+		g_ptr_array_add (uris, g_array_index (entries, pls_entry_t, i).uri);
+	}
+
+	g_array_free (entries, TRUE);
+	g_strfreev (lines);
+}
+
+static void
+xspf_start_element (GMarkupParseContext *context,
+		    const gchar *element_name,
+		    const gchar **attribute_names,
+		    const gchar **attribute_values,
+		    gpointer user_data,
+		    GError **error)
+{
+	xspf_data_t *data = user_data;
+
+	if (! strcmp (element_name, "track")) {
+		data->in_track = TRUE;
+	} else if (data->in_track && ! strcmp (element_name, "location")) {
+		data->location = g_string_new (NULL);
+	}
+}
+
+static void
+xspf_end_element (GMarkupParseContext *context,
+		  const gchar *element_name,
+		  gpointer user_data,
+		  GError **error)
+{
+	xspf_data_t *data = user_data;
+
+	if (! strcmp (element_name, "track")) {
+		data->in_track = FALSE;
+	} else if (NULL != data->location && ! strcmp (element_name, "location")) {
+		gchar *location = g_strstrip (data->location->str);
+		gchar *scheme = g_uri_parse_scheme (location);
+
+		if (NULL != scheme) {
+			g_ptr_array_add (data->uris, g_strdup (location));
+		} else {
+			/* A relative URI reference. */
+			gchar *unescaped = g_uri_unescape_string (location, NULL);
+			if (NULL != unescaped) {
+				g_ptr_array_add (data->uris, entry_to_uri (data->dir, unescaped));
+			}
+			g_free (unescaped);
+		}
+
+		g_free (scheme);
+		g_string_free (data->location, TRUE);
+		data->location = NULL;
+	}
+}
+
+static void
+xspf_text (GMarkupParseContext *context,
+	   const gchar *text,
+	   gsize text_len,
+	   gpointer user_data,
+	   GError **error)
+{
+	xspf_data_t *data = user_data;
+
+	if (NULL != data->location) {
+		g_string_append_len (data->location, text, text_len);
+	}
+}
+
+static gboolean
+parse_xspf (gchar *contents, gsize length, const gchar *dir, GPtrArray *uris, GError **error)
+{
+	gboolean fnval;
+	GMarkupParseContext *context;
+	GMarkupParser parser = { xspf_start_element, xspf_end_element, xspf_text, NULL, NULL };
+	xspf_data_t data = { dir, uris, FALSE, NULL };
+
+	context = g_markup_parse_context_new (&parser, 0, &data, NULL);
+
+	fnval = g_markup_parse_context_parse (context, contents, length, error)
+	     && g_markup_parse_context_end_parse (context, error);
+
+	if (NULL != data.location) {
+		g_string_free (data.location, TRUE);
+	}
+
+	g_markup_parse_context_free (context);
+
+	return fnval;
+}
+
+GPtrArray *
+dmapd_playlist_parse (const gchar *path, GError **error)
+{
+	gsize length;
+	gchar *dir = NULL;
+	gchar *contents = NULL;
+	GPtrArray *uris = NULL;
+
+	if (! g_file_get_contents (path, &contents, &length, error)) {
+		goto _done;
+	}
+
+	dir = g_path_get_dirname (path);
+	uris = g_ptr_array_new_with_free_func (g_free);
+
+	switch (playlist_type (path)) {
+	case PLAYLIST_M3U:
+		parse_m3u (contents, dir, uris);
+		break;
+	case PLAYLIST_PLS:
+		parse_pls (contents, dir, uris);
+		break;
+	case PLAYLIST_XSPF:
+		if (! parse_xspf (contents, length, dir, uris, error)) {
+			g_ptr_array_free (uris, TRUE);
+			uris = NULL;
+		}
+		break;
+	default:
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a playlist", path);
+		g_ptr_array_free (uris, TRUE);
+		uris = NULL;
+		break;
+	}
+
+_done:
+	g_free (contents);
+	g_free (dir);
+
+	return uris;
+}
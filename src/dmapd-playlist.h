@@ -0,0 +1,40 @@
+/*   FILE: dmapd-playlist.h -- read playlist files
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_PLAYLIST
+#define __DMAPD_PLAYLIST
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Returns TRUE if path names an M3U, M3U8, PLS or XSPF playlist. */
+gboolean   dmapd_playlist_is_playlist (const gchar *path);
+
+/* Returns the URIs listed in the playlist at path, in order, or NULL on
+ * error. Relative entries are taken to be relative to the playlist.
+ */
+GPtrArray *dmapd_playlist_parse       (const gchar *path, GError **error);
+
+#endif /* __DMAPD_PLAYLIST */
+
+G_END_DECLS
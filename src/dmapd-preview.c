@@ -0,0 +1,292 @@
+/*   FILE: dmapd-preview.c -- find JPEG previews embedded in RAW photographs
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "dmapd-preview.h"
+
+/* Cameras put previews in IFD0 (CR2), in the IFD chain, or in SubIFDs
+ * (NEF, DNG), either as JPEGInterchangeFormat or as a single JPEG strip.
+ * Raw sensor data is often lossless JPEG too; only baseline and
+ * progressive JPEGs, which libjpeg can shrink on load, are candidates.
+ */
+#define TAG_COMPRESSION       0x0103
+#define TAG_STRIP_OFFSETS     0x0111
+#define TAG_STRIP_BYTE_COUNTS 0x0117
+#define TAG_SUB_IFDS          0x014a
+#define TAG_JPEG_OFFSET       0x0201
+#define TAG_JPEG_LENGTH       0x0202
+
+#define TYPE_SHORT            3
+
+#define MAX_IFDS              32 /* Guards against loops. */
+#define MAX_DEPTH             2
+
+typedef struct {
+	const guint8 *data;
+	gsize size;
+	gboolean big_endian;
+	guint visited;
+	GArray *candidates;
+} tiff_t;
+
+typedef struct {
+	gsize offset;
+	gsize length;
+	guint width;
+	guint height;
+} candidate_t;
+
+static guint16
+get16 (tiff_t *tiff, gsize offset)
+{
+	const guint8 *p = tiff->data + offset;
+
+	return tiff->big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static guint32
+get32 (tiff_t *tiff, gsize offset)
+{
+	const guint8 *p = tiff->data + offset;
+
+	return tiff->big_endian
+	     ? ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+	     : ((guint32) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/* Returns TRUE if data holds a baseline or progressive JPEG, setting its
+ * dimensions from the frame header.
+ */
+static gboolean
+jpeg_dimensions (const guint8 *data, gsize size, guint *width, guint *height)
+{
+	gsize i = 2;
+	gboolean fnval = FALSE;
+
+	if (size < 4 || 0xff != data[0] || 0xd8 != data[1]) {
+		goto _done;
+	}
+
+	while (i + 4 <= size && 0xff == data[i]) {
+		guint8 marker = data[i + 1];
+
+		if (0xff == marker) {
+			i++;
+			continue;
+		}
+
+		if (0xc0 == marker || 0xc1 == marker || 0xc2 == marker) {
+			if (i + 9 <= size) {
+				*height = (data[i + 5] << 8) | data[i + 6];
+				*width  = (data[i + 7] << 8) | data[i + 8];
+				fnval = *width > 0 && *height > 0;
+			}
+			break;
+		}
+
+		/* Other frame types, such as lossless, or a scan before any frame. */
+		if ((marker >= 0xc3 && marker <= 0xcf && 0xc4 != marker && 0xc8 != marker && 0xcc != marker)
+		 || 0xda == marker
+		 || 0xd9 == marker) {
+			break;
+		}
+
+		i += 2 + ((data[i + 2] << 8) | data[i + 3]);
+	}
+
+_done:
+	return fnval;
+}
+
+static void
+consider (tiff_t *tiff, guint32 offset, guint32 length)
+{
+	candidate_t candidate;
+
+	if (0 == length || offset >= tiff->size || length > tiff->size - offset) {
+		goto _done;
+	}
+
+	if (jpeg_dimensions (tiff->data + offset, length, &candidate.width, &candidate.height)) {
+		candidate.offset = offset;
+		candidate.length = length;
+		g_array_append_val (tiff->candidates, candidate);
+	}
+
+_done:
+	return;
+}
+
+static void
+walk (tiff_t *tiff, guint32 ifd, guint depth)
+{
+	while (0 != ifd && tiff->visited < MAX_IFDS) {
+		guint16 i, count;
+		guint16 compression = 0;
+		guint32 strip_count = 0;
+		guint32 strip_offset = 0, strip_length = 0;
+		guint32 jpeg_offset = 0, jpeg_length = 0;
+
+		tiff->visited++;
+
+		if ((gsize) ifd + 2 > tiff->size) {
+			break;
+		}
+
+		count = get16 (tiff, ifd);
+		if ((gsize) ifd + 2 + (gsize) count * 12 + 4 > tiff->size) {
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			gsize entry = (gsize) ifd + 2 + (gsize) i * 12;
+			guint16 tag = get16 (tiff, entry);
+			guint32 n = get32 (tiff, entry + 4);
+			guint32 value = TYPE_SHORT == get16 (tiff, entry + 2)
+			              ? get16 (tiff, entry + 8)
+			              : get32 (tiff, entry + 8);
+
+			switch (tag) {
+			case TAG_COMPRESSION:
+				compression = value;
+				break;
+			case TAG_STRIP_OFFSETS:
+				strip_offset = value;
+				strip_count = n;
+				break;
+			case TAG_STRIP_BYTE_COUNTS:
+				strip_length = value;
+				break;
+			case TAG_JPEG_OFFSET:
+				jpeg_offset = value;
+				break;
+			case TAG_JPEG_LENGTH:
+				jpeg_length = value;
+				break;
+			case TAG_SUB_IFDS:
+				if (depth >= MAX_DEPTH) {
+					break;
+				} else if (1 == n) {
+					walk (tiff, value, depth + 1);
+				} else if ((gsize) value + (gsize) n * 4 <= tiff->size) {
+					guint32 j;
+					for (j = 0; j < n; j++) {
+						walk (tiff, get32 (tiff, (gsize) value + j * 4), depth + 1);
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		consider (tiff, jpeg_offset, jpeg_length);
+
+		/* NOTE: 6 is old-style JPEG, 7 JPEG; a preview is one strip. */
+		if ((6 == compression || 7 == compression) && 1 == strip_count) {
+			consider (tiff, strip_offset, strip_length);
+		}
+
+		ifd = get32 (tiff, (gsize) ifd + 2 + (gsize) count * 12);
+	}
+}
+
+GByteArray *
+dmapd_preview_extract (const gchar *path, guint width, guint *preview_width, guint *preview_height)
+{
+	guint i;
+	guint16 magic;
+	tiff_t tiff;
+	GMappedFile *map;
+	candidate_t *best = NULL;
+	GByteArray *fnval = NULL;
+
+	map = g_mapped_file_new (path, FALSE, NULL);
+	if (NULL == map) {
+		goto _done;
+	}
+
+	tiff.data = (const guint8 *) g_mapped_file_get_contents (map);
+	tiff.size = g_mapped_file_get_length (map);
+	tiff.visited = 0;
+	tiff.candidates = g_array_new (FALSE, FALSE, sizeof (candidate_t));
+
+	if (tiff.size < 8) {
+		goto _done;
+	} else if (! memcmp (tiff.data, "II", 2)) {
+		tiff.big_endian = FALSE;
+	} else if (! memcmp (tiff.data, "MM", 2)) {
+		tiff.big_endian = TRUE;
+	} else {
+		goto _done;
+	}
+
+	/* TIFF, then Olympus ORF and Panasonic RW2, which vary the magic. */
+	magic = get16 (&tiff, 2);
+	if (42 != magic && 0x4f52 != magic && 0x5352 != magic && 0x55 != magic) {
+		goto _done;
+	}
+
+	walk (&tiff, get32 (&tiff, 4), 0);
+
+	for (i = 0; i < tiff.candidates->len; i++) {
+		candidate_t *candidate = &g_array_index (tiff.candidates, candidate_t, i);
+		guint side = MAX (candidate->width, candidate->height);
+
+		if (NULL == best) {
+			best = candidate;
+		} else {
+			guint best_side = MAX (best->width, best->height);
+
+			/* Narrower but still wide enough, or wider when best is not. */
+			if ((side >= width && side < best_side)
+			 || (best_side < width && side > best_side)) {
+				best = candidate;
+			}
+		}
+	}
+
+	if (NULL == best) {
+		goto _done;
+	}
+
+	fnval = g_byte_array_sized_new (best->length);
+	g_byte_array_append (fnval, tiff.data + best->offset, best->length);
+
+	if (NULL != preview_width) {
+		*preview_width = best->width;
+	}
+
+	if (NULL != preview_height) {
+		*preview_height = best->height;
+	}
+
+_done:
+	if (NULL != map) {
+		g_array_free (tiff.candidates, TRUE);
+		g_mapped_file_unref (map);
+	}
+
+	return fnval;
+}
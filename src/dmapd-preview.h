@@ -0,0 +1,43 @@
+/*   FILE: dmapd-preview.h -- find JPEG previews embedded in RAW photographs
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_PREVIEW
+#define __DMAPD_PREVIEW
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Returns a copy of a JPEG preview embedded in the TIFF-based RAW file
+ * (CR2, NEF, ARW, DNG and the like) at path: the narrowest whose largest
+ * side is at least width, or else the largest. Sets preview_width and
+ * preview_height, either of which may be NULL. Returns NULL if path is
+ * not such a file or has no preview that libjpeg can shrink on load.
+ */
+GByteArray *dmapd_preview_extract (const gchar *path,
+				   guint width,
+				   guint *preview_width,
+				   guint *preview_height);
+
+#endif /* __DMAPD_PREVIEW */
+
+G_END_DECLS
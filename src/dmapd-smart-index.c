@@ -0,0 +1,328 @@
+/*   FILE: dmapd-smart-index.c -- attribute indexes for smart containers
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "dmapd-smart-index.h"
+
+/* What the index knows of each record. */
+typedef struct {
+	const gchar *genre;  /* A key of genres.                  */
+	const gchar *artist; /* A key of artists.                 */
+	gint year;
+	gboolean has_video;
+	gint added;          /* firstseen, or mtime if never set. */
+} entry_t;
+
+typedef struct {
+	gint added;
+	guint id;
+} recent_t;
+
+/* Each posting table maps an attribute value to the set of IDs having
+ * that value; sets are hash tables whose keys and values are the IDs.
+ */
+struct DmapdSmartIndex {
+	GHashTable *entries; /* ID -> entry_t.                  */
+	GHashTable *genres;
+	GHashTable *artists;
+	GHashTable *years;
+	GHashTable *videos;  /* Set of IDs of videos.           */
+	GArray *recent;      /* Of recent_t, by added then ID. */
+	guint generation;
+};
+
+static gpointer
+posting_add (GHashTable *postings, gconstpointer key, gboolean copy_key, guint id)
+{
+	gpointer orig_key, set;
+
+	if (! g_hash_table_lookup_extended (postings, key, &orig_key, &set)) {
+		orig_key = copy_key ? g_strdup (key) : (gpointer) key;
+		set = g_hash_table_new (g_direct_hash, g_direct_equal);
+		g_hash_table_insert (postings, orig_key, set);
+	}
+
+	g_hash_table_insert (set, GUINT_TO_POINTER (id), GUINT_TO_POINTER (id));
+
+	return orig_key;
+}
+
+static void
+posting_remove (GHashTable *postings, gconstpointer key, guint id)
+{
+	GHashTable *set = g_hash_table_lookup (postings, key);
+
+	if (NULL != set) {
+		g_hash_table_remove (set, GUINT_TO_POINTER (id));
+		if (0 == g_hash_table_size (set)) {
+			/* NOTE: may free key. */
+			g_hash_table_remove (postings, key);
+		}
+	}
+}
+
+/* Returns the position of the first element not less than (added, id). */
+static guint
+recent_find (DmapdSmartIndex *index, gint added, guint id)
+{
+	guint low = 0, high = index->recent->len;
+
+	while (low < high) {
+		guint mid = low + (high - low) / 2;
+		recent_t *r = &g_array_index (index->recent, recent_t, mid);
+
+		if (r->added < added || (r->added == added && r->id < id)) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+DmapdSmartIndex *
+dmapd_smart_index_new (void)
+{
+	DmapdSmartIndex *index = g_new0 (DmapdSmartIndex, 1);
+
+	index->entries = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	index->genres  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	index->artists = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_hash_table_destroy);
+	index->years   = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_hash_table_destroy);
+	index->videos  = g_hash_table_new (g_direct_hash, g_direct_equal);
+	index->recent  = g_array_new (FALSE, FALSE, sizeof (recent_t));
+
+	return index;
+}
+
+void
+dmapd_smart_index_remove (DmapdSmartIndex *index, guint id)
+{
+	guint pos;
+	entry_t *entry = g_hash_table_lookup (index->entries, GUINT_TO_POINTER (id));
+
+	if (NULL == entry) {
+		goto _done;
+	}
+
+	posting_remove (index->genres, entry->genre, id);
+	posting_remove (index->artists, entry->artist, id);
+	posting_remove (index->years, GINT_TO_POINTER (entry->year), id);
+	g_hash_table_remove (index->videos, GUINT_TO_POINTER (id));
+
+	pos = recent_find (index, entry->added, id);
+	if (pos < index->recent->len && g_array_index (index->recent, recent_t, pos).id == id) {
+		g_array_remove_index (index->recent, pos);
+	}
+
+	g_hash_table_remove (index->entries, GUINT_TO_POINTER (id));
+	index->generation++;
+
+_done:
+	return;
+}
+
+void
+dmapd_smart_index_update (DmapdSmartIndex *index, guint id, DMAPRecord *record)
+{
+	guint pos;
+	entry_t *entry;
+	recent_t recent;
+	gchar *genre = NULL, *artist = NULL;
+	gint year = 0, firstseen = 0, mtime = 0;
+	gboolean has_video = FALSE;
+
+	g_object_get (record,
+	              "songgenre", &genre,
+	              "songartist", &artist,
+	              "year", &year,
+	              "has-video", &has_video,
+	              "firstseen", &firstseen,
+	              "mtime", &mtime,
+	              NULL);
+
+	dmapd_smart_index_remove (index, id);
+
+	entry = g_new (entry_t, 1);
+	entry->genre     = posting_add (index->genres, genre ? genre : "", TRUE, id);
+	entry->artist    = posting_add (index->artists, artist ? artist : "", TRUE, id);
+	entry->year      = year;
+	entry->has_video = has_video;
+	entry->added     = firstseen ? firstseen : mtime;
+
+	posting_add (index->years, GINT_TO_POINTER (year), FALSE, id);
+	if (has_video) {
+		g_hash_table_insert (index->videos, GUINT_TO_POINTER (id), GUINT_TO_POINTER (id));
+	}
+
+	/* NOTE: new records usually sort last, so this seldom moves much. */
+	recent.added = entry->added;
+	recent.id = id;
+	pos = recent_find (index, recent.added, id);
+	g_array_insert_val (index->recent, pos, recent);
+
+	g_hash_table_insert (index->entries, GUINT_TO_POINTER (id), entry);
+	index->generation++;
+
+	g_free (genre);
+	g_free (artist);
+}
+
+guint
+dmapd_smart_index_get_generation (DmapdSmartIndex *index)
+{
+	return index->generation;
+}
+
+static gboolean
+in_year_range (const DmapdSmartRule *rule, gint year)
+{
+	return (0 == rule->year_min || year >= rule->year_min)
+	    && (0 == rule->year_max || year <= rule->year_max);
+}
+
+static gboolean
+matches (const entry_t *entry, const DmapdSmartRule *rule, gint now)
+{
+	return (NULL == rule->genre || ! strcmp (entry->genre, rule->genre))
+	    && (NULL == rule->artist || ! strcmp (entry->artist, rule->artist))
+	    && in_year_range (rule, entry->year)
+	    && (-1 == rule->has_video || ! entry->has_video == ! rule->has_video)
+	    && (0 == rule->added_within || (gint64) entry->added + rule->added_within >= now);
+}
+
+typedef struct {
+	DmapdSmartIndex *index;
+	const DmapdSmartRule *rule;
+	gint now;
+	GArray *ids;
+	gint64 expires;
+} query_t;
+
+static void
+consider (gpointer key, gpointer value, query_t *query)
+{
+	guint32 id = GPOINTER_TO_UINT (key);
+	entry_t *entry = g_hash_table_lookup (query->index->entries, key);
+
+	if (NULL != entry && matches (entry, query->rule, query->now)) {
+		g_array_append_val (query->ids, id);
+		if (0 != query->rule->added_within) {
+			query->expires = MIN (query->expires, (gint64) entry->added + query->rule->added_within + 1);
+		}
+	}
+}
+
+static void
+consider_year (gpointer key, GHashTable *set, query_t *query)
+{
+	if (in_year_range (query->rule, GPOINTER_TO_INT (key))) {
+		g_hash_table_foreach (set, (GHFunc) consider, query);
+	}
+}
+
+/* Keeps the smaller of *best and set; returns FALSE if set is NULL. */
+static gboolean
+narrow (GHashTable **best, GHashTable *set)
+{
+	if (NULL != set && (NULL == *best || g_hash_table_size (set) < g_hash_table_size (*best))) {
+		*best = set;
+	}
+
+	return NULL != set;
+}
+
+static gint
+compare_ids (gconstpointer a, gconstpointer b)
+{
+	guint32 ia = *(const guint32 *) a, ib = *(const guint32 *) b;
+
+	/* Media IDs count down, so the oldest record has the largest ID. */
+	return ia > ib ? -1 : ia < ib ? 1 : 0;
+}
+
+gint
+dmapd_smart_index_query (DmapdSmartIndex *index,
+                         const DmapdSmartRule *rule,
+                         gint now,
+                         GArray *ids)
+{
+	guint i, first_recent = 0;
+	GHashTable *best = NULL;
+	query_t query = { index, rule, now, ids, G_MAXINT };
+	guint start = ids->len;
+
+	/* Start from the smallest posting the rule requires. */
+	if ((NULL != rule->genre && ! narrow (&best, g_hash_table_lookup (index->genres, rule->genre)))
+	 || (NULL != rule->artist && ! narrow (&best, g_hash_table_lookup (index->artists, rule->artist)))
+	 || (TRUE == rule->has_video && ! narrow (&best, index->videos))) {
+		goto _done;
+	}
+
+	if (0 != rule->added_within) {
+		gint64 cutoff = (gint64) now - rule->added_within;
+		first_recent = recent_find (index, (gint) MAX (cutoff, G_MININT), 0);
+	}
+
+	if (0 != rule->added_within
+	 && (NULL == best || index->recent->len - first_recent < g_hash_table_size (best))) {
+		for (i = first_recent; i < index->recent->len; i++) {
+			consider (GUINT_TO_POINTER (g_array_index (index->recent, recent_t, i).id), NULL, &query);
+		}
+	} else if (NULL != best) {
+		g_hash_table_foreach (best, (GHFunc) consider, &query);
+	} else if (0 != rule->year_min || 0 != rule->year_max) {
+		g_hash_table_foreach (index->years, (GHFunc) consider_year, &query);
+	} else {
+		g_hash_table_foreach (index->entries, (GHFunc) consider, &query);
+	}
+
+	if (ids->len > start) {
+		qsort (&g_array_index (ids, guint32, start), ids->len - start, sizeof (guint32), compare_ids);
+	}
+
+_done:
+	return (gint) query.expires;
+}
+
+void
+dmapd_smart_index_free (DmapdSmartIndex *index)
+{
+	if (NULL == index) {
+		goto _done;
+	}
+
+	g_hash_table_destroy (index->entries);
+	g_hash_table_destroy (index->genres);
+	g_hash_table_destroy (index->artists);
+	g_hash_table_destroy (index->years);
+	g_hash_table_destroy (index->videos);
+	g_array_free (index->recent, TRUE);
+	g_free (index);
+
+_done:
+	return;
+}
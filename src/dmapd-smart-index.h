@@ -0,0 +1,72 @@
+/*   FILE: dmapd-smart-index.h -- attribute indexes for smart containers
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_SMART_INDEX
+#define __DMAPD_SMART_INDEX
+
+#include <glib.h>
+#include <libdmapsharing/dmap.h>
+
+G_BEGIN_DECLS
+
+/* A record matches a rule if it matches every condition that is set. */
+typedef struct {
+	gchar *genre;        /* NULL matches any genre.                 */
+	gchar *artist;       /* NULL matches any artist.                */
+	gint   year_min;     /* 0 means no lower bound.                 */
+	gint   year_max;     /* 0 means no upper bound.                 */
+	guint  added_within; /* Seconds since added; 0 means any time.  */
+	gint   has_video;    /* TRUE, FALSE or -1 for either.           */
+} DmapdSmartRule;
+
+typedef struct DmapdSmartIndex DmapdSmartIndex;
+
+/* Inverted indexes over the attributes smart rules test, kept current
+ * one record at a time.
+ */
+DmapdSmartIndex *dmapd_smart_index_new            (void);
+
+/* Adds a DAAP record, or replaces the one indexed under id. */
+void             dmapd_smart_index_update         (DmapdSmartIndex *index,
+                                                   guint id,
+                                                   DMAPRecord *record);
+
+void             dmapd_smart_index_remove         (DmapdSmartIndex *index,
+                                                   guint id);
+
+/* Changes every time a record is updated or removed. */
+guint            dmapd_smart_index_get_generation (DmapdSmartIndex *index);
+
+/* Appends the IDs (of guint32) matching rule at time now, oldest record
+ * first. Returns the time at which the result would next change if the
+ * index did not, or G_MAXINT.
+ */
+gint             dmapd_smart_index_query          (DmapdSmartIndex *index,
+                                                   const DmapdSmartRule *rule,
+                                                   gint now,
+                                                   GArray *ids);
+
+void             dmapd_smart_index_free           (DmapdSmartIndex *index);
+
+#endif /* __DMAPD_SMART_INDEX */
+
+G_END_DECLS
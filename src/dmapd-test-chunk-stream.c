@@ -0,0 +1,106 @@
+#include <check.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include "dmapd-chunk-stream.h"
+
+#define SIZE 100000
+
+/* Several chunks of the smallest size, the last one short. */
+static GInputStream *
+chunked_stream (guint8 **data)
+{
+	guint i;
+	GInputStream *base;
+	GInputStream *fnval;
+
+	*data = g_malloc (SIZE);
+	for (i = 0; i < SIZE; i++) {
+		(*data)[i] = i * 7 + i / 256;
+	}
+
+	base = g_memory_input_stream_new_from_data (*data, SIZE, NULL);
+	fnval = dmapd_chunk_stream_new (base, 1);
+	g_object_unref (base);
+
+	return fnval;
+}
+
+/* Reads the rest of stream in pieces that straddle chunks. */
+static GByteArray *
+read_rest (GInputStream *stream)
+{
+	gssize n;
+	guint8 buf[1000];
+	GByteArray *fnval = g_byte_array_new ();
+
+	while ((n = g_input_stream_read (stream, buf, sizeof buf, NULL, NULL)) > 0) {
+		g_byte_array_append (fnval, buf, n);
+	}
+
+	fail_unless (0 == n);
+
+	return fnval;
+}
+
+START_TEST(test_dmapd_chunk_stream_read)
+{
+	guint8 *data;
+	GByteArray *read;
+	GInputStream *stream = chunked_stream (&data);
+
+	read = read_rest (stream);
+	fail_unless (SIZE == read->len);
+	fail_unless (! memcmp (read->data, data, SIZE));
+	fail_unless (SIZE == g_seekable_tell (G_SEEKABLE (stream)));
+
+	g_byte_array_free (read, TRUE);
+	g_object_unref (stream);
+	g_free (data);
+}
+END_TEST
+
+START_TEST(test_dmapd_chunk_stream_seek)
+{
+	guint8 buf[10];
+	guint8 *data;
+	GByteArray *read;
+	GInputStream *stream = chunked_stream (&data);
+
+	/* Seeking discards what was read ahead. */
+	fail_unless (sizeof buf == g_input_stream_read (stream, buf, sizeof buf, NULL, NULL));
+	fail_unless (g_seekable_seek (G_SEEKABLE (stream), 50000, G_SEEK_SET, NULL, NULL));
+	fail_unless (50000 == g_seekable_tell (G_SEEKABLE (stream)));
+
+	fail_unless (sizeof buf == g_input_stream_read (stream, buf, sizeof buf, NULL, NULL));
+	fail_unless (! memcmp (buf, data + 50000, sizeof buf));
+
+	fail_unless (100 == g_input_stream_skip (stream, 100, NULL, NULL));
+	fail_unless (g_seekable_seek (G_SEEKABLE (stream), -10, G_SEEK_CUR, NULL, NULL));
+
+	read = read_rest (stream);
+	fail_unless (SIZE - 50100 == read->len);
+	fail_unless (! memcmp (read->data, data + 50100, read->len));
+
+	g_byte_array_free (read, TRUE);
+	g_object_unref (stream);
+	g_free (data);
+}
+END_TEST
+
+Suite *dmapd_test_chunk_stream_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-chunk-stream-suite");
+
+	tc = tcase_create("test_dmapd_chunk_stream_read");
+	tcase_add_test(tc, test_dmapd_chunk_stream_read);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_chunk_stream_seek");
+	tcase_add_test(tc, test_dmapd_chunk_stream_seek);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
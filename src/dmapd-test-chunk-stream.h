@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_CHUNK_STREAM
+#define __DMAPD_TEST_CHUNK_STREAM
+
+Suite *dmapd_test_chunk_stream_suite (void);
+
+#endif
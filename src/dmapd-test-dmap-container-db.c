@@ -0,0 +1,102 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-dmap-container-db.h"
+#include "dmapd-dmap-container-record.h"
+#include "dmapd-dmap-container-record-factory.h"
+#include "dmapd-dmap-db-ghashtable.h"
+
+static DMAPContainerDb *
+open_container_db (const gchar *dir, DMAPDb *full_db)
+{
+	DMAPDb *store;
+	DMAPContainerDb *container_db;
+	DMAPRecordFactory *factory;
+	gchar *containers_dir = g_strdup_printf ("%s/containers", dir);
+
+	g_mkdir_with_parents (containers_dir, 0755);
+
+	factory = DMAP_RECORD_FACTORY (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD_FACTORY, "full-db", full_db, NULL));
+	store = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE,
+	                               "db-dir", containers_dir,
+	                               "record-factory", factory,
+	                               NULL));
+	container_db = DMAP_CONTAINER_DB (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_DB,
+	                                                "db-dir", dir,
+	                                                "store", store,
+	                                                NULL));
+
+	g_object_unref (store);
+	g_free (containers_dir);
+
+	return container_db;
+}
+
+START_TEST(test_dmapd_dmap_container_db_persist)
+{
+	guint id;
+	gboolean ordered = FALSE;
+	DMAPDb *full_db;
+	DMAPContainerDb *container_db;
+	DMAPContainerRecord *record;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-dmap-container-db-XXXXXX", NULL);
+	gchar *album = g_strdup_printf ("%s/album", dir);
+	gchar *location;
+
+	g_mkdir (album, 0755);
+	location = g_filename_to_uri (album, NULL, NULL);
+
+	full_db = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+
+	container_db = open_container_db (dir, full_db);
+	id = dmapd_dmap_container_db_assign_id (DMAPD_DMAP_CONTAINER_DB (container_db), location);
+	record = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD,
+	                                              "id", id,
+	                                              "name", "album",
+	                                              "location", location,
+	                                              "full-db", full_db,
+	                                              "ordered", TRUE,
+	                                              NULL));
+	dmap_container_record_add_entry (record, NULL, 30);
+	dmap_container_record_add_entry (record, NULL, 10);
+	dmap_container_record_add_entry (record, NULL, 20);
+	dmap_container_db_add (container_db, record);
+	g_object_unref (record);
+	g_object_unref (container_db);
+
+	/* The container is back after a restart, without a directory walk. */
+	container_db = open_container_db (dir, full_db);
+	fail_unless (dmap_container_db_count (container_db) == 1);
+	record = dmap_container_db_lookup_by_id (container_db, id);
+	fail_unless (NULL != record);
+	fail_unless (dmap_container_record_get_entry_count (record) == 3);
+	g_object_get (record, "ordered", &ordered, NULL);
+	fail_unless (ordered);
+	g_object_unref (record);
+	g_object_unref (container_db);
+
+	/* Containers whose directory is gone are dropped. */
+	g_rmdir (album);
+	container_db = open_container_db (dir, full_db);
+	fail_unless (dmap_container_db_count (container_db) == 0);
+	g_object_unref (container_db);
+
+	g_object_unref (full_db);
+	g_free (location);
+	g_free (album);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_dmap_container_db_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-dmap-container-db-suite");
+
+	tc = tcase_create("test_dmapd_dmap_container_db_persist");
+	tcase_add_test(tc, test_dmapd_dmap_container_db_persist);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
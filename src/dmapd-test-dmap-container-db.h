@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_DMAP_CONTAINER_DB
+#define __DMAPD_TEST_DMAP_CONTAINER_DB
+
+Suite *dmapd_test_dmap_container_db_suite (void);
+
+#endif
@@ -0,0 +1,136 @@
+#include <check.h>
+#include <glib.h>
+
+#include "util.h"
+#include "dmapd-daap-record.h"
+#include "dmapd-dmap-db-ghashtable.h"
+
+static DMAPRecord *
+new_record (const gchar *location)
+{
+	return DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD,
+	                                  "location", location,
+	                                  NULL));
+}
+
+static gboolean
+array_is (GArray *array, guint n, ...)
+{
+	va_list ap;
+	guint i;
+	gboolean fnval = array->len == n;
+
+	va_start (ap, n);
+	for (i = 0; fnval && i < n; i++) {
+		fnval = g_array_index (array, guint, i) == va_arg (ap, guint);
+	}
+	va_end (ap);
+
+	return fnval;
+}
+
+START_TEST(test_dmapd_dmap_db_changes)
+{
+	guint a, b;
+	DMAPDb *db;
+	DMAPRecord *record1, *record2;
+	GArray *added   = g_array_new (FALSE, FALSE, sizeof (guint));
+	GArray *updated = g_array_new (FALSE, FALSE, sizeof (guint));
+	GArray *deleted = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	db = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+	record1 = new_record ("file:///a.mp3");
+	record2 = new_record ("file:///b.mp3");
+
+	fail_unless (dmapd_dmap_db_get_revision (db) == 1);
+
+	a = dmap_db_add (db, record1);
+	b = dmap_db_add (db, record2);
+
+	/* Uncommitted changes are not visible. */
+	fail_unless (dmapd_dmap_db_get_changes (db, 1, added, updated, deleted));
+	fail_unless (added->len == 0);
+
+	fail_unless (dmapd_dmap_db_commit_revision (db) == 2);
+	fail_unless (dmapd_dmap_db_commit_revision (db) == 2);
+
+	fail_unless (dmapd_dmap_db_get_changes (db, 1, added, updated, deleted));
+	fail_unless (array_is (added, 2, a, b));
+	fail_unless (updated->len == 0 && deleted->len == 0);
+
+	dmap_db_add (db, record1);
+	fail_unless (dmapd_dmap_db_remove (db, b));
+	fail_unless (! dmapd_dmap_db_remove (db, b));
+	fail_unless (dmapd_dmap_db_commit_revision (db) == 3);
+
+	g_array_set_size (added, 0);
+	fail_unless (dmapd_dmap_db_get_changes (db, 2, added, updated, deleted));
+	fail_unless (added->len == 0);
+	fail_unless (array_is (updated, 1, a));
+	fail_unless (array_is (deleted, 1, b));
+
+	/* Added then deleted within the window: never seen by the client. */
+	g_array_set_size (updated, 0);
+	g_array_set_size (deleted, 0);
+	fail_unless (dmapd_dmap_db_get_changes (db, 1, added, updated, deleted));
+	fail_unless (array_is (added, 1, a));
+	fail_unless (updated->len == 0 && deleted->len == 0);
+
+	fail_unless (! dmapd_dmap_db_get_changes (db, 0, NULL, NULL, NULL));
+	fail_unless (! dmapd_dmap_db_get_changes (db, 4, NULL, NULL, NULL));
+
+	g_object_unref (record1);
+	g_object_unref (record2);
+	g_object_unref (db);
+	g_array_free (added, TRUE);
+	g_array_free (updated, TRUE);
+	g_array_free (deleted, TRUE);
+}
+END_TEST
+
+START_TEST(test_dmapd_dmap_db_changes_bounded)
+{
+	guint b;
+	DMAPDb *db;
+	DMAPRecord *record1, *record2;
+	GHashTable *options = g_hash_table_new (g_str_hash, g_str_equal);
+	GArray *added = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	g_hash_table_insert (options, "change-log-size", "1");
+
+	db = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, "options", options, NULL));
+	record1 = new_record ("file:///a.mp3");
+	record2 = new_record ("file:///b.mp3");
+
+	dmap_db_add (db, record1);
+	dmapd_dmap_db_commit_revision (db);
+	b = dmap_db_add (db, record2);
+	dmapd_dmap_db_commit_revision (db);
+
+	fail_unless (! dmapd_dmap_db_get_changes (db, 1, added, NULL, NULL));
+	fail_unless (dmapd_dmap_db_get_changes (db, 2, added, NULL, NULL));
+	fail_unless (array_is (added, 1, b));
+
+	g_object_unref (record1);
+	g_object_unref (record2);
+	g_object_unref (db);
+	g_array_free (added, TRUE);
+	g_hash_table_destroy (options);
+}
+END_TEST
+
+Suite *dmapd_test_dmap_db_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-dmap-db-suite");
+
+	tc = tcase_create("test_dmapd_dmap_db_changes");
+	tcase_add_test(tc, test_dmapd_dmap_db_changes);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_dmap_db_changes_bounded");
+	tcase_add_test(tc, test_dmapd_dmap_db_changes_bounded);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
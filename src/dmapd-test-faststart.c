@@ -0,0 +1,165 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "dmapd-faststart.h"
+
+#define FTYP_SIZE 16
+#define MDAT_SIZE 24
+
+static guint32
+get32 (const guint8 *p)
+{
+	return ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Returns an atom of type holding body, which it frees. */
+static GByteArray *
+wrap (const gchar *type, GByteArray *body)
+{
+	guint8 header[8];
+	guint32 size = 8 + body->len;
+	GByteArray *fnval = g_byte_array_new ();
+
+	header[0] = size >> 24;
+	header[1] = size >> 16;
+	header[2] = size >> 8;
+	header[3] = size;
+	memcpy (header + 4, type, 4);
+
+	g_byte_array_append (fnval, header, sizeof header);
+	g_byte_array_append (fnval, body->data, body->len);
+	g_byte_array_free (body, TRUE);
+
+	return fnval;
+}
+
+static GByteArray *
+bytes (const gchar *data, gsize len)
+{
+	GByteArray *fnval = g_byte_array_new ();
+
+	g_byte_array_append (fnval, (const guint8 *) data, len);
+
+	return fnval;
+}
+
+/* A movie whose one track has two chunks, at the start and middle of mdat. */
+static GByteArray *
+moov (void)
+{
+	GByteArray *stco = bytes ("\x00\x00\x00\x00" "\x00\x00\x00\x02"
+	                          "\x00\x00\x00\x18" "\x00\x00\x00\x20", 16);
+
+	return wrap ("moov", wrap ("trak", wrap ("mdia", wrap ("minf", wrap ("stbl", wrap ("stco", stco))))));
+}
+
+static gchar *
+write_movie (const gchar *dir, gboolean moov_first)
+{
+	gchar *path = g_build_filename (dir, "movie.mp4", NULL);
+	GByteArray *movie = wrap ("ftyp", bytes ("isom\x00\x00\x02\x00", 8));
+	GByteArray *mdat = wrap ("mdat", bytes ("AAAAAAAABBBBBBBB", 16));
+	GByteArray *header = moov ();
+
+	fail_unless (FTYP_SIZE == movie->len);
+	fail_unless (MDAT_SIZE == mdat->len);
+
+	if (moov_first) {
+		g_byte_array_append (movie, header->data, header->len);
+		g_byte_array_append (movie, mdat->data, mdat->len);
+	} else {
+		g_byte_array_append (movie, mdat->data, mdat->len);
+		g_byte_array_append (movie, header->data, header->len);
+	}
+
+	fail_unless (g_file_set_contents (path, (const gchar *) movie->data, movie->len, NULL));
+
+	g_byte_array_free (movie, TRUE);
+	g_byte_array_free (mdat, TRUE);
+	g_byte_array_free (header, TRUE);
+
+	return path;
+}
+
+START_TEST(test_dmapd_faststart_remux)
+{
+	gchar *dir, *path, *outpath, *data;
+	gsize size, moov_size, stco;
+	guint32 first, second;
+	GByteArray *header = moov ();
+
+	moov_size = header->len;
+	g_byte_array_free (header, TRUE);
+
+	dir = g_dir_make_tmp ("dmapd-test-faststart-XXXXXX", NULL);
+	fail_unless (NULL != dir);
+
+	path = write_movie (dir, FALSE);
+	outpath = g_build_filename (dir, "faststart.mp4", NULL);
+
+	fail_unless (dmapd_faststart_needed (path));
+	fail_unless (dmapd_faststart_remux (path, outpath));
+	fail_unless (! dmapd_faststart_needed (outpath));
+
+	fail_unless (g_file_get_contents (outpath, &data, &size, NULL));
+	fail_unless (FTYP_SIZE + moov_size + MDAT_SIZE == size);
+	fail_unless (! memcmp (data + 4, "ftyp", 4));
+	fail_unless (! memcmp (data + FTYP_SIZE + 4, "moov", 4));
+	fail_unless (! memcmp (data + FTYP_SIZE + moov_size + 4, "mdat", 4));
+
+	/* The chunk offsets follow the media data. */
+	stco = FTYP_SIZE + moov_size - 8;
+	first  = get32 ((guint8 *) data + stco);
+	second = get32 ((guint8 *) data + stco + 4);
+	fail_unless (! memcmp (data + first, "AAAAAAAA", 8));
+	fail_unless (! memcmp (data + second, "BBBBBBBB", 8));
+
+	g_free (data);
+	g_unlink (path);
+	g_unlink (outpath);
+	g_rmdir (dir);
+	g_free (path);
+	g_free (outpath);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST(test_dmapd_faststart_not_needed)
+{
+	gchar *dir, *path, *outpath;
+
+	dir = g_dir_make_tmp ("dmapd-test-faststart-XXXXXX", NULL);
+	fail_unless (NULL != dir);
+
+	path = write_movie (dir, TRUE);
+	outpath = g_build_filename (dir, "faststart.mp4", NULL);
+
+	fail_unless (! dmapd_faststart_needed (path));
+	fail_unless (! dmapd_faststart_remux (path, outpath));
+	fail_unless (! g_file_test (outpath, G_FILE_TEST_EXISTS));
+
+	g_unlink (path);
+	g_rmdir (dir);
+	g_free (path);
+	g_free (outpath);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_faststart_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-faststart-suite");
+
+	tc = tcase_create("test_dmapd_faststart_remux");
+	tcase_add_test(tc, test_dmapd_faststart_remux);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_faststart_not_needed");
+	tcase_add_test(tc, test_dmapd_faststart_not_needed);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
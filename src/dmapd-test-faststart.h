@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_FASTSTART
+#define __DMAPD_TEST_FASTSTART
+
+Suite *dmapd_test_faststart_suite (void);
+
+#endif
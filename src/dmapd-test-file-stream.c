@@ -0,0 +1,66 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dmapd-file-stream.h"
+
+#define CONTENTS "0123456789abcdefghijklmnopqrstuvwxyz"
+
+/* The read-ahead hints leave what is read unchanged. */
+START_TEST(test_dmapd_file_stream_open)
+{
+	int fd;
+	gsize count;
+	gchar *path, *uri;
+	guint8 buf[sizeof CONTENTS];
+	GInputStream *stream;
+
+	fd = g_file_open_tmp ("dmapd-test-file-stream-XXXXXX", &path, NULL);
+	fail_unless (-1 != fd);
+	close (fd);
+	fail_unless (g_file_set_contents (path, CONTENTS, -1, NULL));
+
+	uri = g_filename_to_uri (path, NULL, NULL);
+	stream = dmapd_file_stream_open (uri, NULL);
+	fail_unless (NULL != stream);
+
+	fail_unless (g_input_stream_read_all (stream, buf, sizeof buf, &count, NULL, NULL));
+	fail_unless (strlen (CONTENTS) == count);
+	fail_unless (! memcmp (buf, CONTENTS, count));
+
+	g_object_unref (stream);
+	g_unlink (path);
+	g_free (uri);
+	g_free (path);
+}
+END_TEST
+
+START_TEST(test_dmapd_file_stream_open_missing)
+{
+	GError *error = NULL;
+
+	fail_unless (NULL == dmapd_file_stream_open ("file:///nonexistent/dmapd-test-file-stream", &error));
+	fail_unless (NULL != error);
+
+	g_error_free (error);
+}
+END_TEST
+
+Suite *dmapd_test_file_stream_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-file-stream-suite");
+
+	tc = tcase_create("test_dmapd_file_stream_open");
+	tcase_add_test(tc, test_dmapd_file_stream_open);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_file_stream_open_missing");
+	tcase_add_test(tc, test_dmapd_file_stream_open_missing);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_FILE_STREAM
+#define __DMAPD_TEST_FILE_STREAM
+
+Suite *dmapd_test_file_stream_suite (void);
+
+#endif
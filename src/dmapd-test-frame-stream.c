@@ -0,0 +1,104 @@
+#include <check.h>
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include "dmapd-frame-stream.h"
+
+#define SECOND_FRAME 62
+
+/* STREAMINFO, padding and two frames, with junk between the frames. */
+static GInputStream *
+flac_stream (void)
+{
+	GByteArray *flac = g_byte_array_new ();
+	guint8 info[34];
+
+	memset (info, 0x11, sizeof info);
+
+	g_byte_array_append (flac, (const guint8 *) "fLaC\x00\x00\x00\x22", 8);
+	g_byte_array_append (flac, info, sizeof info);
+	g_byte_array_append (flac, (const guint8 *) "\x81\x00\x00\x04\x00\x00\x00\x00", 8);
+	g_byte_array_append (flac, (const guint8 *) "\xff\xf8\x69\x08" "aaaaaa", 10);
+	g_byte_array_append (flac, (const guint8 *) "zz", 2);
+	g_byte_array_append (flac, (const guint8 *) "\xff\xf8\x69\x08" "bbbbbb", 10);
+
+	fail_unless (SECOND_FRAME + 10 == flac->len);
+
+	return g_memory_input_stream_new_from_data (g_byte_array_free (flac, FALSE), SECOND_FRAME + 10, g_free);
+}
+
+static GByteArray *
+read_rest (GInputStream *stream)
+{
+	gssize n;
+	guint8 buf[16];
+	GByteArray *fnval = g_byte_array_new ();
+
+	while ((n = g_input_stream_read (stream, buf, sizeof buf, NULL, NULL)) > 0) {
+		g_byte_array_append (fnval, buf, n);
+	}
+
+	return fnval;
+}
+
+START_TEST(test_dmapd_frame_stream_flac)
+{
+	guint i;
+	GByteArray *data;
+	GInputStream *base = flac_stream ();
+	GInputStream *stream = dmapd_frame_stream_new (base, "flac");
+
+	fail_unless (IS_DMAPD_FRAME_STREAM (stream));
+
+	/* Seeking within a frame moves to the next, behind a header. */
+	fail_unless (g_seekable_seek (G_SEEKABLE (stream), SECOND_FRAME - 7, G_SEEK_SET, NULL, NULL));
+	data = read_rest (stream);
+	fail_unless (42 + 10 == data->len);
+	fail_unless (! memcmp (data->data, "fLaC\x80\x00\x00\x22", 8));
+	fail_unless (0x10 == data->data[8 + 13]);
+	for (i = 8 + 14; i < 42; i++) {
+		fail_unless (0 == data->data[i]);
+	}
+	fail_unless (! memcmp (data->data + 42, "\xff\xf8\x69\x08" "bbbbbb", 10));
+	g_byte_array_unref (data);
+
+	/* From the start, the file is as it is. */
+	fail_unless (g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_SET, NULL, NULL));
+	data = read_rest (stream);
+	fail_unless (SECOND_FRAME + 10 == data->len);
+	fail_unless (! memcmp (data->data, "fLaC\x00\x00\x00\x22", 8));
+	g_byte_array_unref (data);
+
+	g_object_unref (stream);
+	g_object_unref (base);
+}
+END_TEST
+
+START_TEST(test_dmapd_frame_stream_other)
+{
+	GInputStream *base = flac_stream ();
+	GInputStream *stream = dmapd_frame_stream_new (base, "ogg");
+
+	fail_unless (stream == base);
+
+	g_object_unref (stream);
+	g_object_unref (base);
+}
+END_TEST
+
+Suite *dmapd_test_frame_stream_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-frame-stream-suite");
+
+	tc = tcase_create("test_dmapd_frame_stream_flac");
+	tcase_add_test(tc, test_dmapd_frame_stream_flac);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_frame_stream_other");
+	tcase_add_test(tc, test_dmapd_frame_stream_other);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_FRAME_STREAM
+#define __DMAPD_TEST_FRAME_STREAM
+
+Suite *dmapd_test_frame_stream_suite (void);
+
+#endif
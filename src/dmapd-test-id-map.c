@@ -0,0 +1,60 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-id-map.h"
+
+START_TEST(test_dmapd_id_map_memory)
+{
+	DmapdIdMap *map = dmapd_id_map_new (NULL, DMAPD_ID_MAP_FIRST_MEDIA_ID, -1);
+
+	fail_unless (dmapd_id_map_lookup (map, "file:///a.mp3") == 0);
+	fail_unless (dmapd_id_map_assign (map, "file:///a.mp3") == G_MAXINT);
+	fail_unless (dmapd_id_map_assign (map, "file:///b.mp3") == G_MAXINT - 1);
+	fail_unless (dmapd_id_map_assign (map, "file:///a.mp3") == G_MAXINT);
+	fail_unless (dmapd_id_map_lookup (map, "file:///b.mp3") == G_MAXINT - 1);
+
+	dmapd_id_map_free (map);
+}
+END_TEST
+
+START_TEST(test_dmapd_id_map_persist)
+{
+	DmapdIdMap *map;
+	gchar *dir  = g_dir_make_tmp ("dmapd-test-id-map-XXXXXX", NULL);
+	gchar *path = g_strdup_printf ("%s/container-ids", dir);
+
+	map = dmapd_id_map_new (path, DMAPD_ID_MAP_FIRST_CONTAINER_ID, 1);
+	fail_unless (dmapd_id_map_assign (map, "file:///music/b") == 2);
+	fail_unless (dmapd_id_map_assign (map, "file:///music/a") == 3);
+	dmapd_id_map_free (map);
+
+	/* Reloaded in a different order, the IDs must not change. */
+	map = dmapd_id_map_new (path, DMAPD_ID_MAP_FIRST_CONTAINER_ID, 1);
+	fail_unless (dmapd_id_map_lookup (map, "file:///music/a") == 3);
+	fail_unless (dmapd_id_map_assign (map, "file:///music/c") == 4);
+	fail_unless (dmapd_id_map_assign (map, "file:///music/b") == 2);
+	dmapd_id_map_free (map);
+
+	g_unlink (path);
+	g_rmdir (dir);
+	g_free (path);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_id_map_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-id-map-suite");
+
+	tc = tcase_create("test_dmapd_id_map_memory");
+	tcase_add_test(tc, test_dmapd_id_map_memory);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_id_map_persist");
+	tcase_add_test(tc, test_dmapd_id_map_persist);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_ID_MAP
+#define __DMAPD_TEST_ID_MAP
+
+Suite *dmapd_test_id_map_suite (void);
+
+#endif
@@ -0,0 +1,147 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "dmapd-playlist.h"
+#include "dmapd-daap-record.h"
+#include "dmapd-dmap-container-record.h"
+#include "dmapd-dmap-db-ghashtable.h"
+
+static GPtrArray *
+parse (const gchar *dir, const gchar *name, const gchar *contents)
+{
+	GPtrArray *uris;
+	gchar *path = g_build_filename (dir, name, NULL);
+
+	g_file_set_contents (path, contents, -1, NULL);
+	uris = dmapd_playlist_parse (path, NULL);
+
+	g_unlink (path);
+	g_free (path);
+
+	return uris;
+}
+
+static void
+check_uri (GPtrArray *uris, guint i, const gchar *dir, const gchar *path)
+{
+	gchar *full = g_build_filename (dir, path, NULL);
+	gchar *expected = g_filename_to_uri (full, NULL, NULL);
+
+	fail_unless (i < uris->len);
+	fail_unless (! strcmp (g_ptr_array_index (uris, i), expected));
+
+	g_free (expected);
+	g_free (full);
+}
+
+START_TEST(test_dmapd_playlist_parse)
+{
+	GPtrArray *uris;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-playlist-XXXXXX", NULL);
+
+	fail_unless (dmapd_playlist_is_playlist ("/music/Mix.M3U"));
+	fail_unless (dmapd_playlist_is_playlist ("/music/mix.xspf"));
+	fail_unless (! dmapd_playlist_is_playlist ("/music/song.mp3"));
+
+	uris = parse (dir, "mix.m3u8", "\xef\xbb\xbf#EXTM3U\r\n"
+	                               "#EXTINF:180,Artist - Title\r\n"
+	                               "a.mp3\r\n"
+	                               "\r\n"
+	                               "sub/../b.mp3\r\n"
+	                               "sub\\c.mp3\r\n"
+	                               "http://example.com/stream\r\n");
+	fail_unless (uris->len == 4);
+	check_uri (uris, 0, dir, "a.mp3");
+	check_uri (uris, 1, dir, "b.mp3");
+	check_uri (uris, 2, dir, "sub/c.mp3");
+	fail_unless (! strcmp (g_ptr_array_index (uris, 3), "http://example.com/stream"));
+	g_ptr_array_free (uris, TRUE);
+
+	uris = parse (dir, "mix.pls", "[playlist]\n"
+	                              "File2=b.mp3\n"
+	                              "Title2=B\n"
+	                              "File1=a.mp3\n"
+	                              "NumberOfEntries=2\n");
+	fail_unless (uris->len == 2);
+	check_uri (uris, 0, dir, "a.mp3");
+	check_uri (uris, 1, dir, "b.mp3");
+	g_ptr_array_free (uris, TRUE);
+
+	uris = parse (dir, "mix.xspf", "<?xml version=\"1.0\"?>\n"
+	                               "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+	                               " <location>ignored.mp3</location>\n"
+	                               " <trackList>\n"
+	                               "  <track><location>a%20b.mp3</location></track>\n"
+	                               "  <track><title>C</title><location>file:///music/c.mp3</location></track>\n"
+	                               " </trackList>\n"
+	                               "</playlist>\n");
+	fail_unless (uris->len == 2);
+	check_uri (uris, 0, dir, "a b.mp3");
+	fail_unless (! strcmp (g_ptr_array_index (uris, 1), "file:///music/c.mp3"));
+	g_ptr_array_free (uris, TRUE);
+
+	fail_unless (NULL == parse (dir, "bad.xspf", "<playlist><trackList>"));
+
+	g_rmdir (dir);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST(test_dmapd_playlist_pending)
+{
+	guint id;
+	DMAPDb *db, *entries;
+	DMAPRecord *record;
+	DMAPContainerRecord *container;
+
+	db = DMAP_DB (g_object_new (TYPE_DMAPD_DMAP_DB_GHASHTABLE, NULL));
+	container = DMAP_CONTAINER_RECORD (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD,
+	                                                 "name", "mix",
+	                                                 "location", "file:///music/mix.m3u",
+	                                                 "ordered", TRUE,
+	                                                 "full-db", db,
+	                                                 NULL));
+
+	record = DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD, "location", "file:///music/a.mp3", NULL));
+	id = dmap_db_add (db, record);
+	g_object_unref (record);
+
+	dmapd_dmap_container_record_add_pending (DMAPD_DMAP_CONTAINER_RECORD (container), "file:///music/b.mp3");
+	dmap_container_record_add_entry (container, NULL, id);
+	dmapd_dmap_container_record_add_pending (DMAPD_DMAP_CONTAINER_RECORD (container), "file:///music/missing.mp3");
+	fail_unless (dmapd_dmap_container_record_get_pending_count (DMAPD_DMAP_CONTAINER_RECORD (container)) == 2);
+
+	/* b.mp3 arrives after the playlist was read. */
+	record = DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD, "location", "file:///music/b.mp3", NULL));
+	dmap_db_add (db, record);
+	g_object_unref (record);
+
+	fail_unless (dmap_container_record_get_entry_count (container) == 2);
+	fail_unless (dmapd_dmap_container_record_get_pending_count (DMAPD_DMAP_CONTAINER_RECORD (container)) == 0);
+
+	entries = dmap_container_record_get_entries (container);
+	fail_unless (dmap_db_count (entries) == 2);
+	g_object_unref (entries);
+
+	g_object_unref (container);
+	g_object_unref (db);
+}
+END_TEST
+
+Suite *dmapd_test_playlist_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-playlist-suite");
+
+	tc = tcase_create("test_dmapd_playlist_parse");
+	tcase_add_test(tc, test_dmapd_playlist_parse);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_playlist_pending");
+	tcase_add_test(tc, test_dmapd_playlist_pending);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_PLAYLIST
+#define __DMAPD_TEST_PLAYLIST
+
+Suite *dmapd_test_playlist_suite (void);
+
+#endif
@@ -0,0 +1,170 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "dmapd-preview.h"
+
+/* IFD0 holds a small JPEGInterchangeFormat preview and points to a
+ * SubIFD with a larger JPEG strip; the IFD after IFD0 holds lossless
+ * JPEG raw data, which is no preview.
+ */
+#define IFD0      8
+#define IFD1      50
+#define IFD2      92
+#define SMALL     134
+#define LARGE     151
+#define LOSSLESS  168
+#define JPEG_SIZE 17
+#define TIFF_SIZE 185
+
+static void
+put16 (guint8 *p, gboolean big_endian, guint16 value)
+{
+	p[big_endian ? 0 : 1] = value >> 8;
+	p[big_endian ? 1 : 0] = value & 0xff;
+}
+
+static void
+put32 (guint8 *p, gboolean big_endian, guint32 value)
+{
+	put16 (p + (big_endian ? 0 : 2), big_endian, value >> 16);
+	put16 (p + (big_endian ? 2 : 0), big_endian, value & 0xffff);
+}
+
+static void
+put_entry (guint8 *p, gboolean big_endian, guint16 tag, guint16 type, guint32 value)
+{
+	put16 (p, big_endian, tag);
+	put16 (p + 2, big_endian, type);
+	put32 (p + 4, big_endian, 1);
+	if (3 == type) {
+		put16 (p + 8, big_endian, value);
+	} else {
+		put32 (p + 8, big_endian, value);
+	}
+}
+
+/* Enough of a JPEG to hold a frame header. */
+static void
+put_jpeg (guint8 *p, guint8 frame, guint16 width, guint16 height)
+{
+	const guint8 jpeg[JPEG_SIZE] = { 0xff, 0xd8, 0xff, frame, 0x00, 0x0b, 0x08,
+	                                 height >> 8, height & 0xff, width >> 8, width & 0xff,
+	                                 0x01, 0x01, 0x11, 0x00, 0xff, 0xd9 };
+
+	memcpy (p, jpeg, JPEG_SIZE);
+}
+
+static gchar *
+write_tiff (const gchar *dir, gboolean big_endian)
+{
+	guint8 tiff[TIFF_SIZE];
+	gchar *path = g_build_filename (dir, big_endian ? "be.nef" : "le.nef", NULL);
+
+	memset (tiff, 0, sizeof (tiff));
+	memcpy (tiff, big_endian ? "MM" : "II", 2);
+	put16 (tiff + 2, big_endian, 42);
+	put32 (tiff + 4, big_endian, IFD0);
+
+	put16 (tiff + IFD0, big_endian, 3);
+	put_entry (tiff + IFD0 + 2,  big_endian, 0x014a, 4, IFD1);
+	put_entry (tiff + IFD0 + 14, big_endian, 0x0201, 4, SMALL);
+	put_entry (tiff + IFD0 + 26, big_endian, 0x0202, 4, JPEG_SIZE);
+	put32 (tiff + IFD0 + 38, big_endian, IFD2);
+
+	put16 (tiff + IFD1, big_endian, 3);
+	put_entry (tiff + IFD1 + 2,  big_endian, 0x0103, 3, 7);
+	put_entry (tiff + IFD1 + 14, big_endian, 0x0111, 4, LARGE);
+	put_entry (tiff + IFD1 + 26, big_endian, 0x0117, 4, JPEG_SIZE);
+
+	put16 (tiff + IFD2, big_endian, 3);
+	put_entry (tiff + IFD2 + 2,  big_endian, 0x0103, 3, 6);
+	put_entry (tiff + IFD2 + 14, big_endian, 0x0111, 4, LOSSLESS);
+	put_entry (tiff + IFD2 + 26, big_endian, 0x0117, 4, JPEG_SIZE);
+
+	put_jpeg (tiff + SMALL, 0xc0, 160, 120);
+	put_jpeg (tiff + LARGE, 0xc0, 1620, 1080);
+	put_jpeg (tiff + LOSSLESS, 0xc3, 6000, 4000);
+
+	g_file_set_contents (path, (const gchar *) tiff, sizeof (tiff), NULL);
+
+	return path;
+}
+
+static void
+check_preview (const gchar *path, guint width, guint expected_width, guint expected_height)
+{
+	guint preview_width = 0, preview_height = 0;
+	GByteArray *preview = dmapd_preview_extract (path, width, &preview_width, &preview_height);
+
+	fail_unless (NULL != preview);
+	fail_unless (JPEG_SIZE == preview->len);
+	fail_unless (0xff == preview->data[0] && 0xd8 == preview->data[1]);
+	fail_unless (expected_width == preview_width);
+	fail_unless (expected_height == preview_height);
+
+	g_byte_array_unref (preview);
+}
+
+START_TEST(test_dmapd_preview_extract)
+{
+	int i;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-preview-XXXXXX", NULL);
+
+	for (i = 0; i < 2; i++) {
+		gchar *path = write_tiff (dir, i);
+
+		check_preview (path, 128, 160, 120);
+		check_preview (path, 1024, 1620, 1080);
+
+		/* The lossless raw data is larger, but is no preview. */
+		check_preview (path, 4000, 1620, 1080);
+
+		g_unlink (path);
+		g_free (path);
+	}
+
+	g_rmdir (dir);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST(test_dmapd_preview_extract_none)
+{
+	gchar *dir = g_dir_make_tmp ("dmapd-test-preview-XXXXXX", NULL);
+	gchar *path = g_build_filename (dir, "photo.jpg", NULL);
+	guint8 jpeg[JPEG_SIZE];
+
+	put_jpeg (jpeg, 0xc0, 160, 120);
+	g_file_set_contents (path, (const gchar *) jpeg, sizeof (jpeg), NULL);
+	fail_unless (NULL == dmapd_preview_extract (path, 128, NULL, NULL));
+
+	/* An IFD offset past the end of the file. */
+	g_file_set_contents (path, "II*\0\xff\xff\0\0", 8, NULL);
+	fail_unless (NULL == dmapd_preview_extract (path, 128, NULL, NULL));
+
+	g_unlink (path);
+	fail_unless (NULL == dmapd_preview_extract (path, 128, NULL, NULL));
+
+	g_rmdir (dir);
+	g_free (path);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_preview_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-preview-suite");
+
+	tc = tcase_create("test_dmapd_preview_extract");
+	tcase_add_test(tc, test_dmapd_preview_extract);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_preview_extract_none");
+	tcase_add_test(tc, test_dmapd_preview_extract_none);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
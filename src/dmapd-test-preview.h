@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_PREVIEW
+#define __DMAPD_TEST_PREVIEW
+
+Suite *dmapd_test_preview_suite (void);
+
+#endif
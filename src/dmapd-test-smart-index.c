@@ -0,0 +1,115 @@
+#include <check.h>
+#include <glib.h>
+
+#include "dmapd-daap-record.h"
+#include "dmapd-smart-index.h"
+
+#define NOW 1000000
+
+static DMAPRecord *
+make_record (const gchar *genre, gint year, gint firstseen)
+{
+	return DMAP_RECORD (g_object_new (TYPE_DMAPD_DAAP_RECORD,
+	                                  "songgenre", genre,
+	                                  "songartist", "Artist",
+	                                  "year", year,
+	                                  "firstseen", firstseen,
+	                                  NULL));
+}
+
+static void
+update (DmapdSmartIndex *index, guint id, const gchar *genre, gint year, gint firstseen)
+{
+	DMAPRecord *record = make_record (genre, year, firstseen);
+	dmapd_smart_index_update (index, id, record);
+	g_object_unref (record);
+}
+
+static guint
+count (DmapdSmartIndex *index, const DmapdSmartRule *rule)
+{
+	guint n;
+	GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	dmapd_smart_index_query (index, rule, NOW, ids);
+	n = ids->len;
+	g_array_free (ids, TRUE);
+
+	return n;
+}
+
+START_TEST(test_dmapd_smart_index_rules)
+{
+	DmapdSmartIndex *index = dmapd_smart_index_new ();
+	DmapdSmartRule rock = { "Rock", NULL, 0, 0, 0, -1 };
+	DmapdSmartRule seventies = { NULL, NULL, 1970, 1979, 0, -1 };
+	DmapdSmartRule rock_seventies = { "Rock", NULL, 1970, 1979, 0, -1 };
+	DmapdSmartRule jazz = { "Jazz", NULL, 0, 0, 0, -1 };
+
+	update (index, 10, "Rock", 1975, NOW);
+	update (index, 9, "Rock", 1985, NOW);
+	update (index, 8, "Pop", 1972, NOW);
+
+	fail_unless (count (index, &rock) == 2);
+	fail_unless (count (index, &seventies) == 2);
+	fail_unless (count (index, &rock_seventies) == 1);
+	fail_unless (count (index, &jazz) == 0);
+
+	/* An update moves a record between postings. */
+	update (index, 9, "Jazz", 1985, NOW);
+	fail_unless (count (index, &rock) == 1);
+	fail_unless (count (index, &jazz) == 1);
+
+	dmapd_smart_index_remove (index, 10);
+	fail_unless (count (index, &rock) == 0);
+	fail_unless (count (index, &seventies) == 1);
+
+	dmapd_smart_index_free (index);
+}
+END_TEST
+
+START_TEST(test_dmapd_smart_index_recent)
+{
+	gint expires;
+	guint generation;
+	GArray *ids = g_array_new (FALSE, FALSE, sizeof (guint32));
+	DmapdSmartIndex *index = dmapd_smart_index_new ();
+	DmapdSmartRule recent = { NULL, NULL, 0, 0, 100, -1 };
+
+	update (index, 10, "Rock", 1975, NOW - 500);
+	update (index, 9, "Rock", 1975, NOW - 50);
+	update (index, 8, "Rock", 1975, NOW - 10);
+
+	generation = dmapd_smart_index_get_generation (index);
+
+	expires = dmapd_smart_index_query (index, &recent, NOW, ids);
+	fail_unless (ids->len == 2);
+	fail_unless (g_array_index (ids, guint32, 0) == 9);
+	fail_unless (g_array_index (ids, guint32, 1) == 8);
+
+	/* Record 9 is the first to age out. */
+	fail_unless (expires == NOW - 50 + 100 + 1);
+
+	dmapd_smart_index_remove (index, 9);
+	fail_unless (dmapd_smart_index_get_generation (index) != generation);
+
+	g_array_free (ids, TRUE);
+	dmapd_smart_index_free (index);
+}
+END_TEST
+
+Suite *dmapd_test_smart_index_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-smart-index-suite");
+
+	tc = tcase_create("test_dmapd_smart_index_rules");
+	tcase_add_test(tc, test_dmapd_smart_index_rules);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_smart_index_recent");
+	tcase_add_test(tc, test_dmapd_smart_index_recent);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_SMART_INDEX
+#define __DMAPD_TEST_SMART_INDEX
+
+Suite *dmapd_test_smart_index_suite (void);
+
+#endif
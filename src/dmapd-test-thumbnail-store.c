@@ -0,0 +1,194 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "dmapd-thumbnail-store.h"
+
+static void
+check_thumbnail (DmapdThumbnailStore *store, guint64 offset, const gchar *expected)
+{
+	GByteArray *thumbnail = dmapd_thumbnail_store_get (store, offset, strlen (expected));
+
+	fail_unless (NULL != thumbnail);
+	fail_unless (thumbnail->len == strlen (expected));
+	fail_unless (! memcmp (thumbnail->data, expected, thumbnail->len));
+
+	g_byte_array_unref (thumbnail);
+}
+
+START_TEST(test_dmapd_thumbnail_store_persist)
+{
+	guint64 a, b;
+	DmapdThumbnailStore *store;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-thumbnail-store-XXXXXX", NULL);
+	gchar *path = g_build_filename (dir, "thumbnails", NULL);
+	gchar *index_path = g_strconcat (path, ".sizes", NULL);
+
+	store = dmapd_thumbnail_store_new (path);
+	fail_unless (dmapd_thumbnail_store_add (store, (const guint8 *) "first", 5, &a));
+	check_thumbnail (store, a, "first");
+
+	/* The pack is mapped again after it grows. */
+	fail_unless (dmapd_thumbnail_store_add (store, (const guint8 *) "second", 6, &b));
+	check_thumbnail (store, b, "second");
+	dmapd_thumbnail_store_free (store);
+
+	store = dmapd_thumbnail_store_new (path);
+	check_thumbnail (store, a, "first");
+	check_thumbnail (store, b, "second");
+
+	/* Offsets or lengths that do not match a thumbnail are refused. */
+	fail_unless (dmapd_thumbnail_store_has (store, b, 6));
+	fail_unless (! dmapd_thumbnail_store_has (store, b, 5));
+	fail_unless (! dmapd_thumbnail_store_has (store, b + 1, 5));
+	fail_unless (! dmapd_thumbnail_store_has (store, b, 600));
+	fail_unless (NULL == dmapd_thumbnail_store_get (store, a + 1, 4));
+	dmapd_thumbnail_store_free (store);
+
+	/* A new, empty pack has none of them. */
+	g_unlink (path);
+	store = dmapd_thumbnail_store_new (path);
+	fail_unless (! dmapd_thumbnail_store_has (store, a, 5));
+	dmapd_thumbnail_store_free (store);
+
+	g_unlink (index_path);
+	g_unlink (path);
+	g_rmdir (dir);
+	g_free (index_path);
+	g_free (path);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST(test_dmapd_thumbnail_store_memory)
+{
+	guint64 offset;
+	DmapdThumbnailStore *store = dmapd_thumbnail_store_new (NULL);
+
+	fail_unless (dmapd_thumbnail_store_add (store, (const guint8 *) "thumbnail", 9, &offset));
+	check_thumbnail (store, offset, "thumbnail");
+
+	dmapd_thumbnail_store_free (store);
+}
+END_TEST
+
+START_TEST(test_dmapd_thumbnail_store_sized)
+{
+	guint actual = 0;
+	GByteArray *copy;
+	DmapdThumbnailStore *store;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-thumbnail-store-XXXXXX", NULL);
+	gchar *path = g_build_filename (dir, "thumbnails", NULL);
+	gchar *index_path = g_strconcat (path, ".sizes", NULL);
+
+	store = dmapd_thumbnail_store_new (path);
+	fail_unless (dmapd_thumbnail_store_add_sized (store, "aa", 1024, (const guint8 *) "large", 5));
+	fail_unless (dmapd_thumbnail_store_add_sized (store, "aa", 480, (const guint8 *) "medium", 6));
+	dmapd_thumbnail_store_free (store);
+
+	store = dmapd_thumbnail_store_new (path);
+	fail_unless (dmapd_thumbnail_store_has_sized (store, "aa", 480));
+	fail_unless (! dmapd_thumbnail_store_has_sized (store, "aa", 500));
+	fail_unless (! dmapd_thumbnail_store_has_sized (store, "bb", 480));
+
+	/* The narrowest copy that is wide enough. */
+	copy = dmapd_thumbnail_store_get_sized (store, "aa", 500, &actual);
+	fail_unless (NULL != copy);
+	fail_unless (1024 == actual);
+	fail_unless (copy->len == 5 && ! memcmp (copy->data, "large", 5));
+	g_byte_array_unref (copy);
+
+	copy = dmapd_thumbnail_store_get_sized (store, "aa", 128, &actual);
+	fail_unless (NULL != copy);
+	fail_unless (480 == actual);
+	g_byte_array_unref (copy);
+
+	fail_unless (NULL == dmapd_thumbnail_store_get_sized (store, "aa", 2048, NULL));
+	dmapd_thumbnail_store_free (store);
+
+	g_unlink (index_path);
+	g_unlink (path);
+	g_rmdir (dir);
+	g_free (index_path);
+	g_free (path);
+	g_free (dir);
+}
+END_TEST
+
+START_TEST(test_dmapd_thumbnail_store_compact)
+{
+	guint64 dead, kept;
+	GArray *refs;
+	GHashTable *hashes;
+	DmapdThumbnailRef ref;
+	DmapdThumbnailStore *store;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-thumbnail-store-XXXXXX", NULL);
+	gchar *path = g_build_filename (dir, "thumbnails", NULL);
+	gchar *index_path = g_strconcat (path, ".sizes", NULL);
+
+	store = dmapd_thumbnail_store_new (path);
+	fail_unless (dmapd_thumbnail_store_add (store, (const guint8 *) "dead thumbnail", 14, &dead));
+	fail_unless (dmapd_thumbnail_store_add (store, (const guint8 *) "kept", 4, &kept));
+	fail_unless (dmapd_thumbnail_store_add_sized (store, "aa", 480, (const guint8 *) "dead copy", 9));
+	fail_unless (dmapd_thumbnail_store_add_sized (store, "bb", 480, (const guint8 *) "copy", 4));
+
+	refs = g_array_new (FALSE, FALSE, sizeof (DmapdThumbnailRef));
+	hashes = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_add (hashes, "bb");
+
+	ref.offset = kept;
+	ref.length = 4;
+	g_array_append_val (refs, ref);
+	ref.offset = kept + 1;
+	g_array_append_val (refs, ref);
+
+	fail_unless (dmapd_thumbnail_store_compact (store, refs, hashes));
+	fail_unless (g_array_index (refs, DmapdThumbnailRef, 0).offset != kept);
+	fail_unless (0 == g_array_index (refs, DmapdThumbnailRef, 1).length);
+	dmapd_thumbnail_store_free (store);
+
+	/* What remains survives a restart; what was dropped is gone. */
+	store = dmapd_thumbnail_store_new (path);
+	check_thumbnail (store, g_array_index (refs, DmapdThumbnailRef, 0).offset, "kept");
+	fail_unless (dmapd_thumbnail_store_has_sized (store, "bb", 480));
+	fail_unless (! dmapd_thumbnail_store_has_sized (store, "aa", 480));
+
+	/* Nothing is left to drop. */
+	fail_unless (! dmapd_thumbnail_store_compact (store, refs, hashes));
+	dmapd_thumbnail_store_free (store);
+
+	g_hash_table_destroy (hashes);
+	g_array_free (refs, TRUE);
+	g_unlink (index_path);
+	g_unlink (path);
+	g_rmdir (dir);
+	g_free (index_path);
+	g_free (path);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_thumbnail_store_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-thumbnail-store-suite");
+
+	tc = tcase_create("test_dmapd_thumbnail_store_persist");
+	tcase_add_test(tc, test_dmapd_thumbnail_store_persist);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_thumbnail_store_sized");
+	tcase_add_test(tc, test_dmapd_thumbnail_store_sized);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_thumbnail_store_compact");
+	tcase_add_test(tc, test_dmapd_thumbnail_store_compact);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("test_dmapd_thumbnail_store_memory");
+	tcase_add_test(tc, test_dmapd_thumbnail_store_memory);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
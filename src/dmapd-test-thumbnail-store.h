@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_THUMBNAIL_STORE
+#define __DMAPD_TEST_THUMBNAIL_STORE
+
+Suite *dmapd_test_thumbnail_store_suite (void);
+
+#endif
@@ -0,0 +1,85 @@
+#include <check.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "dmapd-transcode-cache.h"
+
+#define FILE_SIZE 100
+
+static gchar *
+write_file (const gchar *dir, const gchar *name)
+{
+	gchar data[FILE_SIZE] = { 0 };
+	gchar *path = g_build_filename (dir, name, NULL);
+
+	fail_unless (g_file_set_contents (path, data, sizeof data, NULL));
+
+	return path;
+}
+
+static void
+check_evicted (GSList *evicted, const gchar *expected)
+{
+	fail_unless (1 == g_slist_length (evicted));
+	fail_unless (! strcmp (evicted->data, expected));
+	fail_unless (! g_file_test (expected, G_FILE_TEST_EXISTS));
+
+	g_slist_free_full (evicted, g_free);
+}
+
+START_TEST(test_dmapd_transcode_cache_lru)
+{
+	DmapdTranscodeCache *cache;
+	gchar *dir = g_dir_make_tmp ("dmapd-test-transcode-cache-XXXXXX", NULL);
+	gchar *a = write_file (dir, "a.data");
+	gchar *b = write_file (dir, "b.data");
+	gchar *c, *d, *index_path;
+
+	cache = dmapd_transcode_cache_new (dir, FILE_SIZE * 5 / 2);
+	fail_unless (NULL == dmapd_transcode_cache_add (cache, a));
+	fail_unless (NULL == dmapd_transcode_cache_add (cache, b));
+	fail_unless (! dmapd_transcode_cache_is_full (cache));
+
+	/* Using a makes b the least recently used. */
+	dmapd_transcode_cache_touch (cache, a);
+	c = write_file (dir, "c.data");
+	check_evicted (dmapd_transcode_cache_add (cache, c), b);
+	fail_unless (g_file_test (a, G_FILE_TEST_EXISTS));
+	dmapd_transcode_cache_free (cache);
+
+	/* The order of use persists. */
+	cache = dmapd_transcode_cache_new (dir, FILE_SIZE * 5 / 2);
+	d = write_file (dir, "d.data");
+	check_evicted (dmapd_transcode_cache_add (cache, d), a);
+	dmapd_transcode_cache_free (cache);
+
+	cache = dmapd_transcode_cache_new (dir, FILE_SIZE * 2);
+	fail_unless (dmapd_transcode_cache_is_full (cache));
+	dmapd_transcode_cache_free (cache);
+
+	index_path = g_build_filename (dir, "transcode-cache", NULL);
+	g_unlink (index_path);
+	g_unlink (c);
+	g_unlink (d);
+	g_rmdir (dir);
+	g_free (index_path);
+	g_free (a);
+	g_free (b);
+	g_free (c);
+	g_free (d);
+	g_free (dir);
+}
+END_TEST
+
+Suite *dmapd_test_transcode_cache_suite(void)
+{
+	TCase *tc;
+        Suite *s = suite_create("dmapd-test-transcode-cache-suite");
+
+	tc = tcase_create("test_dmapd_transcode_cache_lru");
+	tcase_add_test(tc, test_dmapd_transcode_cache_lru);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
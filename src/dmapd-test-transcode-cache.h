@@ -0,0 +1,6 @@
+#ifndef __DMAPD_TEST_TRANSCODE_CACHE
+#define __DMAPD_TEST_TRANSCODE_CACHE
+
+Suite *dmapd_test_transcode_cache_suite (void);
+
+#endif
@@ -0,0 +1,660 @@
+/*   FILE: dmapd-thumbnail-store.c -- packed store of photograph thumbnails
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-thumbnail-store.h"
+
+/* Each thumbnail is preceded by its length, so an offset that does not
+ * belong to this pack, say after the pack was deleted, is detected.
+ *
+ * Sized copies are found through an index, kept beside the pack, of
+ * "hash<tab>width<tab>offset<tab>length" lines. Like the pack, the index
+ * is only appended to, a later line for the same copy winning, until the
+ * store is compacted.
+ */
+struct DmapdThumbnailStore {
+	GMutex lock;
+	gchar *path;
+	int fd;             /* -1 if the pack is in memory. */
+	guint64 size;
+	GMappedFile *map;   /* NULL until the first read. */
+	GByteArray *memory; /* The pack, when it is not in a file. */
+	GHashTable *sized;  /* Hash -> GArray of sized_t, narrowest first. */
+	FILE *index;        /* NULL if the index is in memory. */
+};
+
+typedef struct {
+	guint width;
+	guint length;
+	guint64 offset;
+} sized_t;
+
+/* Compact once a quarter of the pack is no longer used. */
+#define DEAD_FRACTION 4
+
+static GHashTable *
+index_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_array_unref);
+}
+
+static void
+index_insert (GHashTable *sized, const gchar *hash, guint width, guint64 offset, guint length)
+{
+	guint i;
+	sized_t copy = { width, length, offset };
+	GArray *copies = g_hash_table_lookup (sized, hash);
+
+	if (NULL == copies) {
+		copies = g_array_new (FALSE, FALSE, sizeof (sized_t));
+		g_hash_table_insert (sized, g_strdup (hash), copies);
+	}
+
+	for (i = 0; i < copies->len && g_array_index (copies, sized_t, i).width < width; i++);
+
+	if (i < copies->len && g_array_index (copies, sized_t, i).width == width) {
+		g_array_index (copies, sized_t, i) = copy;
+	} else {
+		g_array_insert_val (copies, i, copy);
+	}
+}
+
+static void
+index_load (DmapdThumbnailStore *store, const gchar *path)
+{
+	guint i;
+	gchar *contents = NULL;
+	gchar **lines = NULL;
+
+	if (! g_file_get_contents (path, &contents, NULL, NULL)) {
+		goto _done;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	/* NOTE: as in the ID map, the final element is empty or cut short. */
+	for (i = 0; lines[i] && lines[i + 1]; i++) {
+		gchar **fields = g_strsplit (lines[i], "\t", 4);
+
+		if (g_strv_length (fields) != 4) {
+			g_warning ("Bad line %u in thumbnail index %s", i + 1, path);
+		} else {
+			index_insert (store->sized,
+			              fields[0],
+			              strtoul (fields[1], NULL, 10),
+			              g_ascii_strtoull (fields[2], NULL, 10),
+			              strtoul (fields[3], NULL, 10));
+		}
+
+		g_strfreev (fields);
+	}
+
+_done:
+	g_strfreev (lines);
+	g_free (contents);
+}
+
+static gboolean
+index_write (FILE *index, const gchar *hash, guint width, guint64 offset, guint length)
+{
+	return fprintf (index, "%s\t%u\t%" G_GUINT64_FORMAT "\t%u\n", hash, width, offset, length) >= 0
+	    && fflush (index) == 0;
+}
+
+DmapdThumbnailStore *
+dmapd_thumbnail_store_new (const gchar *path)
+{
+	struct stat st;
+	DmapdThumbnailStore *store = g_new0 (DmapdThumbnailStore, 1);
+
+	g_mutex_init (&store->lock);
+	store->fd = -1;
+	store->sized = index_new ();
+
+	if (NULL != path) {
+		store->fd = g_open (path, O_RDWR | O_CREAT, 0644);
+		if (-1 == store->fd || fstat (store->fd, &st) != 0) {
+			g_warning ("Could not open %s: %s; thumbnails will not persist", path, strerror (errno));
+			if (-1 != store->fd) {
+				close (store->fd);
+				store->fd = -1;
+			}
+		} else {
+			gchar *index_path = g_strconcat (path, ".sizes", NULL);
+
+			store->path = g_strdup (path);
+			store->size = st.st_size;
+
+			index_load (store, index_path);
+			store->index = g_fopen (index_path, "a");
+			if (NULL == store->index) {
+				g_warning ("Could not open %s; sized copies will not persist", index_path);
+			}
+
+			g_free (index_path);
+		}
+	}
+
+	if (-1 == store->fd) {
+		store->memory = g_byte_array_new ();
+	}
+
+	return store;
+}
+
+/* Appends to the pack in memory or, if memory is NULL, at size in the
+ * file open as fd.
+ */
+static gboolean
+pack_append (int fd, GByteArray *memory, const gchar *path, guint64 *size, const guint8 *data, guint length, guint64 *offset)
+{
+	gboolean fnval = FALSE;
+	guint32 prefix = length;
+
+	if (NULL != memory) {
+		g_byte_array_append (memory, (const guint8 *) &prefix, sizeof (prefix));
+		g_byte_array_append (memory, data, length);
+	} else if (pwrite (fd, &prefix, sizeof (prefix), *size) != (ssize_t) sizeof (prefix)
+	        || pwrite (fd, data, length, *size + sizeof (prefix)) != (ssize_t) length) {
+		/* NOTE: the next append overwrites what was written. */
+		g_warning ("Could not write thumbnail to %s: %s", path, strerror (errno));
+		goto _done;
+	}
+
+	*offset = *size + sizeof (prefix);
+	*size += sizeof (prefix) + length;
+
+	fnval = TRUE;
+
+_done:
+	return fnval;
+}
+
+/* Called with the lock held. */
+static gboolean
+append (DmapdThumbnailStore *store, const guint8 *data, guint length, guint64 *offset)
+{
+	return pack_append (store->fd, store->memory, store->path, &store->size, data, length, offset);
+}
+
+gboolean
+dmapd_thumbnail_store_add (DmapdThumbnailStore *store,
+			   const guint8 *data,
+			   guint length,
+			   guint64 *offset)
+{
+	gboolean fnval;
+
+	g_mutex_lock (&store->lock);
+	fnval = append (store, data, length, offset);
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+/* Returns the thumbnail at offset, which is valid until the lock is
+ * released. Called with the lock held.
+ */
+static const guint8 *
+lookup (DmapdThumbnailStore *store, guint64 offset, guint length)
+{
+	guint32 prefix;
+	const guint8 *pack;
+	const guint8 *fnval = NULL;
+	GError *error = NULL;
+
+	if (offset < sizeof (prefix) || offset + length > store->size) {
+		goto _done;
+	}
+
+	if (NULL != store->memory) {
+		pack = store->memory->data;
+	} else {
+		/* The pack grows as photographs are added; map it again. */
+		if (NULL == store->map || g_mapped_file_get_length (store->map) < offset + length) {
+			if (NULL != store->map) {
+				g_mapped_file_unref (store->map);
+			}
+
+			store->map = g_mapped_file_new (store->path, FALSE, &error);
+			if (NULL == store->map) {
+				g_warning ("Could not map %s: %s", store->path, error->message);
+				g_error_free (error);
+				goto _done;
+			}
+
+			if (g_mapped_file_get_length (store->map) < offset + length) {
+				goto _done;
+			}
+		}
+
+		pack = (const guint8 *) g_mapped_file_get_contents (store->map);
+	}
+
+	memcpy (&prefix, pack + offset - sizeof (prefix), sizeof (prefix));
+	if (prefix == length) {
+		fnval = pack + offset;
+	}
+
+_done:
+	return fnval;
+}
+
+gboolean
+dmapd_thumbnail_store_has (DmapdThumbnailStore *store, guint64 offset, guint length)
+{
+	gboolean fnval;
+
+	g_mutex_lock (&store->lock);
+	fnval = NULL != lookup (store, offset, length);
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+GByteArray *
+dmapd_thumbnail_store_get (DmapdThumbnailStore *store, guint64 offset, guint length)
+{
+	const guint8 *data;
+	GByteArray *fnval = NULL;
+
+	g_mutex_lock (&store->lock);
+
+	data = lookup (store, offset, length);
+	if (NULL != data) {
+		fnval = g_byte_array_sized_new (length);
+		g_byte_array_append (fnval, data, length);
+	}
+
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+/* Returns the narrowest of hash's copies at least width wide, or NULL.
+ * Called with the lock held.
+ */
+static const sized_t *
+lookup_sized (DmapdThumbnailStore *store, const gchar *hash, guint width)
+{
+	guint i;
+	const sized_t *fnval = NULL;
+	GArray *copies = g_hash_table_lookup (store->sized, hash);
+
+	for (i = 0; NULL != copies && i < copies->len; i++) {
+		const sized_t *copy = &g_array_index (copies, sized_t, i);
+		if (copy->width >= width) {
+			fnval = copy;
+			break;
+		}
+	}
+
+	return fnval;
+}
+
+gboolean
+dmapd_thumbnail_store_add_sized (DmapdThumbnailStore *store,
+				 const gchar *hash,
+				 guint width,
+				 const guint8 *data,
+				 guint length)
+{
+	guint64 offset;
+	const sized_t *copy;
+	gboolean fnval = FALSE;
+
+	g_mutex_lock (&store->lock);
+
+	/* An identical photograph may already have put this copy. */
+	copy = lookup_sized (store, hash, width);
+	if (NULL != copy && copy->width == width && NULL != lookup (store, copy->offset, copy->length)) {
+		fnval = TRUE;
+		goto _done;
+	}
+
+	if (! append (store, data, length, &offset)) {
+		goto _done;
+	}
+
+	index_insert (store->sized, hash, width, offset, length);
+
+	if (NULL != store->index && ! index_write (store->index, hash, width, offset, length)) {
+		g_warning ("Could not index thumbnail of %s", hash);
+	}
+
+	fnval = TRUE;
+
+_done:
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+gboolean
+dmapd_thumbnail_store_has_sized (DmapdThumbnailStore *store, const gchar *hash, guint width)
+{
+	const sized_t *copy;
+	gboolean fnval = FALSE;
+
+	g_mutex_lock (&store->lock);
+
+	copy = lookup_sized (store, hash, width);
+	fnval = NULL != copy && copy->width == width && NULL != lookup (store, copy->offset, copy->length);
+
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+GByteArray *
+dmapd_thumbnail_store_get_sized (DmapdThumbnailStore *store, const gchar *hash, guint width, guint *actual)
+{
+	const guint8 *data;
+	const sized_t *copy;
+	GByteArray *fnval = NULL;
+
+	g_mutex_lock (&store->lock);
+
+	copy = lookup_sized (store, hash, width);
+	if (NULL == copy) {
+		goto _done;
+	}
+
+	data = lookup (store, copy->offset, copy->length);
+	if (NULL == data) {
+		goto _done;
+	}
+
+	fnval = g_byte_array_sized_new (copy->length);
+	g_byte_array_append (fnval, data, copy->length);
+
+	if (NULL != actual) {
+		*actual = copy->width;
+	}
+
+_done:
+	g_mutex_unlock (&store->lock);
+
+	return fnval;
+}
+
+/* Returns the bytes the given thumbnails and the copies of hashes take up
+ * in the pack. Called with the lock held.
+ */
+static guint64
+live_size (DmapdThumbnailStore *store, GArray *refs, GHashTable *hashes)
+{
+	guint i;
+	gpointer key, value;
+	GHashTableIter iter;
+	guint64 fnval = 0;
+
+	for (i = 0; i < refs->len; i++) {
+		const DmapdThumbnailRef *ref = &g_array_index (refs, DmapdThumbnailRef, i);
+		if (NULL != lookup (store, ref->offset, ref->length)) {
+			fnval += sizeof (guint32) + ref->length;
+		}
+	}
+
+	g_hash_table_iter_init (&iter, store->sized);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GArray *copies = value;
+
+		if (! g_hash_table_contains (hashes, key)) {
+			continue;
+		}
+
+		for (i = 0; i < copies->len; i++) {
+			const sized_t *copy = &g_array_index (copies, sized_t, i);
+			if (NULL != lookup (store, copy->offset, copy->length)) {
+				fnval += sizeof (guint32) + copy->length;
+			}
+		}
+	}
+
+	return fnval;
+}
+
+gboolean
+dmapd_thumbnail_store_compact (DmapdThumbnailStore *store, GArray *refs, GHashTable *hashes)
+{
+	guint i;
+	guint64 live;
+	int fd = -1;
+	guint64 size = 0;
+	FILE *index = NULL;
+	gpointer key, value;
+	GHashTableIter iter;
+	gboolean fnval = FALSE;
+	GByteArray *memory = NULL;
+	gchar *pack_path = NULL;
+	gchar *index_path = NULL;
+	gchar *index_tmp = NULL;
+	GHashTable *sized = index_new ();
+	GArray *offsets = g_array_sized_new (FALSE, FALSE, sizeof (guint64), refs->len);
+
+	g_mutex_lock (&store->lock);
+
+	live = live_size (store, refs, hashes);
+	if (live + store->size / DEAD_FRACTION >= store->size) {
+		goto _done;
+	}
+
+	g_debug ("Compacting thumbnails from %" G_GUINT64_FORMAT " to %" G_GUINT64_FORMAT " bytes", store->size, live);
+
+	/* NOTE: the new pack and index are written beside the old ones and
+	 * renamed over them once complete.
+	 */
+	if (NULL != store->memory) {
+		memory = g_byte_array_sized_new (live);
+	} else {
+		pack_path = g_strconcat (store->path, ".new", NULL);
+		index_path = g_strconcat (store->path, ".sizes", NULL);
+		index_tmp = g_strconcat (index_path, ".new", NULL);
+
+		fd = g_open (pack_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (-1 == fd) {
+			g_warning ("Could not open %s: %s", pack_path, strerror (errno));
+			goto _done;
+		}
+
+		index = g_fopen (index_tmp, "w");
+		if (NULL == index) {
+			g_warning ("Could not open %s: %s", index_tmp, strerror (errno));
+			goto _done;
+		}
+	}
+
+	for (i = 0; i < refs->len; i++) {
+		const DmapdThumbnailRef *ref = &g_array_index (refs, DmapdThumbnailRef, i);
+		const guint8 *data = lookup (store, ref->offset, ref->length);
+		guint64 offset = 0;
+
+		if (NULL != data && ! pack_append (fd, memory, pack_path, &size, data, ref->length, &offset)) {
+			goto _done;
+		}
+
+		g_array_append_val (offsets, offset);
+	}
+
+	g_hash_table_iter_init (&iter, store->sized);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		GArray *copies = value;
+
+		if (! g_hash_table_contains (hashes, key)) {
+			continue;
+		}
+
+		for (i = 0; i < copies->len; i++) {
+			const sized_t *copy = &g_array_index (copies, sized_t, i);
+			const guint8 *data = lookup (store, copy->offset, copy->length);
+			guint64 offset;
+
+			if (NULL == data) {
+				continue;
+			}
+
+			if (! pack_append (fd, memory, pack_path, &size, data, copy->length, &offset)) {
+				goto _done;
+			}
+
+			if (NULL != index && ! index_write (index, key, copy->width, offset, copy->length)) {
+				g_warning ("Could not write %s", index_tmp);
+				goto _done;
+			}
+
+			index_insert (sized, key, copy->width, offset, copy->length);
+		}
+	}
+
+	if (NULL != memory) {
+		g_byte_array_free (store->memory, TRUE);
+		store->memory = memory;
+		memory = NULL;
+	} else {
+		int status = fclose (index);
+
+		index = NULL;
+		if (0 != status || 0 != fsync (fd)) {
+			g_warning ("Could not write %s", pack_path);
+			g_unlink (index_tmp);
+			goto _done;
+		}
+
+		/* NOTE: an old index left beside a new pack names copies that
+		 * fail the length check and are made again.
+		 */
+		if (0 != g_rename (pack_path, store->path)) {
+			g_warning ("Could not replace %s: %s", store->path, strerror (errno));
+			g_unlink (index_tmp);
+			goto _done;
+		}
+
+		if (0 != g_rename (index_tmp, index_path)) {
+			g_warning ("Could not replace %s: %s", index_path, strerror (errno));
+			g_unlink (index_tmp);
+		}
+
+		close (store->fd);
+		store->fd = fd;
+		fd = -1;
+
+		if (NULL != store->map) {
+			g_mapped_file_unref (store->map);
+			store->map = NULL;
+		}
+
+		if (NULL != store->index) {
+			fclose (store->index);
+		}
+
+		store->index = g_fopen (index_path, "a");
+		if (NULL == store->index) {
+			g_warning ("Could not open %s; sized copies will not persist", index_path);
+		}
+	}
+
+	g_hash_table_destroy (store->sized);
+	store->sized = sized;
+	sized = NULL;
+	store->size = size;
+
+	for (i = 0; i < refs->len; i++) {
+		DmapdThumbnailRef *ref = &g_array_index (refs, DmapdThumbnailRef, i);
+
+		ref->offset = g_array_index (offsets, guint64, i);
+		if (0 == ref->offset) {
+			ref->length = 0;
+		}
+	}
+
+	fnval = TRUE;
+
+_done:
+	g_mutex_unlock (&store->lock);
+
+	if (NULL != index) {
+		fclose (index);
+		g_unlink (index_tmp);
+	}
+
+	if (-1 != fd) {
+		close (fd);
+		g_unlink (pack_path);
+	}
+
+	if (NULL != memory) {
+		g_byte_array_free (memory, TRUE);
+	}
+
+	if (NULL != sized) {
+		g_hash_table_destroy (sized);
+	}
+
+	g_array_free (offsets, TRUE);
+	g_free (index_tmp);
+	g_free (index_path);
+	g_free (pack_path);
+
+	return fnval;
+}
+
+void
+dmapd_thumbnail_store_free (DmapdThumbnailStore *store)
+{
+	if (NULL == store) {
+		goto _done;
+	}
+
+	if (NULL != store->map) {
+		g_mapped_file_unref (store->map);
+	}
+
+	if (-1 != store->fd) {
+		close (store->fd);
+	}
+
+	if (NULL != store->memory) {
+		g_byte_array_free (store->memory, TRUE);
+	}
+
+	if (NULL != store->index) {
+		fclose (store->index);
+	}
+
+	g_hash_table_destroy (store->sized);
+	g_mutex_clear (&store->lock);
+	g_free (store->path);
+	g_free (store);
+
+_done:
+	return;
+}
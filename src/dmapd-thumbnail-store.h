@@ -0,0 +1,98 @@
+/*   FILE: dmapd-thumbnail-store.h -- packed store of photograph thumbnails
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_THUMBNAIL_STORE
+#define __DMAPD_THUMBNAIL_STORE
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct DmapdThumbnailStore DmapdThumbnailStore;
+
+/* Where a record's thumbnail is in the pack. */
+typedef struct {
+	guint64 offset;
+	guint length;
+} DmapdThumbnailRef;
+
+/* Thumbnails are appended to a single pack file, which is read through a
+ * memory map; records keep only each thumbnail's offset and length. The
+ * pack is kept in memory only if path is NULL. A store may be used by
+ * several threads.
+ */
+DmapdThumbnailStore *dmapd_thumbnail_store_new  (const gchar *path);
+
+/* Appends a thumbnail, setting offset to where it was stored. */
+gboolean    dmapd_thumbnail_store_add  (DmapdThumbnailStore *store,
+					const guint8 *data,
+					guint length,
+					guint64 *offset);
+
+/* Returns TRUE if the store holds a thumbnail of length at offset. */
+gboolean    dmapd_thumbnail_store_has  (DmapdThumbnailStore *store,
+					guint64 offset,
+					guint length);
+
+/* Returns a copy of the thumbnail at offset, or NULL. */
+GByteArray *dmapd_thumbnail_store_get  (DmapdThumbnailStore *store,
+					guint64 offset,
+					guint length);
+
+/* Copies of a photograph at other widths are kept by the photograph's
+ * hash, so identical photographs share them.
+ */
+gboolean    dmapd_thumbnail_store_add_sized (DmapdThumbnailStore *store,
+					     const gchar *hash,
+					     guint width,
+					     const guint8 *data,
+					     guint length);
+
+/* Returns TRUE if the store holds hash's copy of exactly width. */
+gboolean    dmapd_thumbnail_store_has_sized (DmapdThumbnailStore *store,
+					     const gchar *hash,
+					     guint width);
+
+/* Returns the narrowest of hash's copies that is at least width wide,
+ * setting actual to its width, or NULL.
+ */
+GByteArray *dmapd_thumbnail_store_get_sized (DmapdThumbnailStore *store,
+					     const gchar *hash,
+					     guint width,
+					     guint *actual);
+
+/* Rewrites the pack to hold only the thumbnails in refs, an array of
+ * DmapdThumbnailRef, and the copies of the photographs whose hashes are
+ * keys of hashes. Returns TRUE if it did so, having updated refs to the
+ * new offsets; a ref whose thumbnail was missing becomes 0, 0. Does
+ * nothing unless enough of the pack is unused. Thumbnails must not be
+ * read through any other offsets afterwards.
+ */
+gboolean    dmapd_thumbnail_store_compact (DmapdThumbnailStore *store,
+					   GArray *refs,
+					   GHashTable *hashes);
+
+void        dmapd_thumbnail_store_free (DmapdThumbnailStore *store);
+
+#endif /* __DMAPD_THUMBNAIL_STORE */
+
+G_END_DECLS
@@ -0,0 +1,293 @@
+/*   FILE: dmapd-transcode-cache.c -- size-limited cache of transcoded media
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "dmapd-transcode-cache.h"
+
+#define INDEX_NAME "transcode-cache"
+
+/* Files are ordered by a count of uses rather than by time, so that uses
+ * within the same second still order. The index holds "name<tab>use"
+ * lines; it is appended to as files are used, a later line for the same
+ * file wins, and it is rewritten each time the cache is opened.
+ */
+struct DmapdTranscodeCache {
+	gchar *dir;
+	guint64 budget;
+	guint64 size;
+	guint64 uses;        /* The latest use. */
+	GHashTable *entries; /* Name -> entry_t. */
+	FILE *index;
+};
+
+typedef struct {
+	guint64 size;
+	guint64 use;         /* 0 if never used since tracked. */
+} entry_t;
+
+static gboolean
+is_data_file (const gchar *name)
+{
+	return g_str_has_suffix (name, ".data");
+}
+
+static void
+scan (DmapdTranscodeCache *cache)
+{
+	GDir *dir;
+	const gchar *name;
+
+	dir = g_dir_open (cache->dir, 0, NULL);
+	if (NULL == dir) {
+		goto _done;
+	}
+
+	while (NULL != (name = g_dir_read_name (dir))) {
+		struct stat st;
+		gchar *path;
+
+		if (! is_data_file (name)) {
+			continue;
+		}
+
+		path = g_build_filename (cache->dir, name, NULL);
+		if (0 == g_stat (path, &st) && S_ISREG (st.st_mode)) {
+			entry_t *entry = g_new0 (entry_t, 1);
+			entry->size = st.st_size;
+			cache->size += entry->size;
+			g_hash_table_insert (cache->entries, g_strdup (name), entry);
+		}
+		g_free (path);
+	}
+
+	g_dir_close (dir);
+
+_done:
+	return;
+}
+
+static void
+index_load (DmapdTranscodeCache *cache, const gchar *path)
+{
+	guint i;
+	gchar *contents = NULL;
+	gchar **lines = NULL;
+
+	if (! g_file_get_contents (path, &contents, NULL, NULL)) {
+		goto _done;
+	}
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	/* NOTE: as in the ID map, the final element is empty or cut short. */
+	for (i = 0; lines[i] && lines[i + 1]; i++) {
+		entry_t *entry;
+		gchar **fields = g_strsplit (lines[i], "\t", 2);
+
+		if (g_strv_length (fields) != 2) {
+			g_warning ("Bad line %u in transcode cache index %s", i + 1, path);
+		} else if (NULL != (entry = g_hash_table_lookup (cache->entries, fields[0]))) {
+			entry->use = g_ascii_strtoull (fields[1], NULL, 10);
+			cache->uses = MAX (cache->uses, entry->use);
+		}
+
+		g_strfreev (fields);
+	}
+
+_done:
+	g_strfreev (lines);
+	g_free (contents);
+}
+
+/* NOTE: entries without a use are left out; they sort first either way. */
+static void
+index_rewrite (DmapdTranscodeCache *cache, const gchar *path)
+{
+	GHashTableIter iter;
+	gpointer name, value;
+	GString *contents = g_string_new ("");
+
+	g_hash_table_iter_init (&iter, cache->entries);
+	while (g_hash_table_iter_next (&iter, &name, &value)) {
+		entry_t *entry = value;
+		if (entry->use > 0) {
+			g_string_append_printf (contents, "%s\t%" G_GUINT64_FORMAT "\n", (gchar *) name, entry->use);
+		}
+	}
+
+	if (! g_file_set_contents (path, contents->str, contents->len, NULL)) {
+		g_warning ("Could not write transcode cache index %s", path);
+	}
+
+	g_string_free (contents, TRUE);
+}
+
+DmapdTranscodeCache *
+dmapd_transcode_cache_new (const gchar *dir, guint64 budget)
+{
+	gchar *index_path;
+	DmapdTranscodeCache *cache = g_new0 (DmapdTranscodeCache, 1);
+
+	cache->dir = g_strdup (dir);
+	cache->budget = budget;
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	index_path = g_build_filename (dir, INDEX_NAME, NULL);
+
+	scan (cache);
+	index_load (cache, index_path);
+	index_rewrite (cache, index_path);
+
+	cache->index = g_fopen (index_path, "a");
+	if (NULL == cache->index) {
+		g_warning ("Could not open %s; order of use will not persist", index_path);
+	}
+
+	g_free (index_path);
+
+	return cache;
+}
+
+static void
+use (DmapdTranscodeCache *cache, const gchar *name, entry_t *entry)
+{
+	entry->use = ++cache->uses;
+
+	if (NULL != cache->index) {
+		if (fprintf (cache->index, "%s\t%" G_GUINT64_FORMAT "\n", name, entry->use) < 0
+		 || fflush (cache->index) != 0) {
+			g_warning ("Could not record use of %s", name);
+		}
+	}
+}
+
+void
+dmapd_transcode_cache_touch (DmapdTranscodeCache *cache, const gchar *path)
+{
+	entry_t *entry;
+	gchar *name = g_path_get_basename (path);
+
+	entry = g_hash_table_lookup (cache->entries, name);
+	if (NULL != entry) {
+		use (cache, name, entry);
+	}
+
+	g_free (name);
+}
+
+/* Returns the name of the least recently used file other than except. */
+static const gchar *
+least_recently_used (DmapdTranscodeCache *cache, const gchar *except)
+{
+	GHashTableIter iter;
+	gpointer name, value;
+	const gchar *fnval = NULL;
+	guint64 oldest = G_MAXUINT64;
+
+	g_hash_table_iter_init (&iter, cache->entries);
+	while (g_hash_table_iter_next (&iter, &name, &value)) {
+		entry_t *entry = value;
+		if (entry->use < oldest && strcmp (name, except)) {
+			oldest = entry->use;
+			fnval = name;
+		}
+	}
+
+	return fnval;
+}
+
+GSList *
+dmapd_transcode_cache_add (DmapdTranscodeCache *cache, const gchar *path)
+{
+	struct stat st;
+	entry_t *entry;
+	GSList *fnval = NULL;
+	gchar *name = g_path_get_basename (path);
+
+	if (0 != g_stat (path, &st)) {
+		g_warning ("Could not determine size of %s", path);
+		goto _done;
+	}
+
+	entry = g_hash_table_lookup (cache->entries, name);
+	if (NULL == entry) {
+		entry = g_new0 (entry_t, 1);
+		g_hash_table_insert (cache->entries, g_strdup (name), entry);
+	} else {
+		cache->size -= entry->size;
+	}
+
+	entry->size = st.st_size;
+	cache->size += entry->size;
+	use (cache, name, entry);
+
+	while (cache->budget > 0 && cache->size > cache->budget) {
+		gchar *evicted;
+		const gchar *lru = least_recently_used (cache, name);
+
+		if (NULL == lru) {
+			break;
+		}
+
+		evicted = g_build_filename (cache->dir, lru, NULL);
+		g_debug ("Evicting %s from transcode cache", evicted);
+
+		if (0 != g_unlink (evicted)) {
+			g_warning ("Could not remove %s", evicted);
+		}
+
+		entry = g_hash_table_lookup (cache->entries, lru);
+		cache->size -= entry->size;
+		g_hash_table_remove (cache->entries, lru);
+
+		fnval = g_slist_prepend (fnval, evicted);
+	}
+
+_done:
+	g_free (name);
+
+	return fnval;
+}
+
+gboolean
+dmapd_transcode_cache_is_full (DmapdTranscodeCache *cache)
+{
+	return cache->budget > 0 && cache->size >= cache->budget;
+}
+
+void
+dmapd_transcode_cache_free (DmapdTranscodeCache *cache)
+{
+	if (NULL != cache->index) {
+		fclose (cache->index);
+	}
+
+	g_hash_table_destroy (cache->entries);
+	g_free (cache->dir);
+	g_free (cache);
+}
@@ -0,0 +1,58 @@
+/*   FILE: dmapd-transcode-cache.h -- size-limited cache of transcoded media
+ * AUTHOR: W. Michael Petullo <mike@flyn.org>
+ *   DATE: 19 October 2013
+ *
+ * Copyright (c) 2013 W. Michael Petullo <new@flyn.org>
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __DMAPD_TRANSCODE_CACHE
+#define __DMAPD_TRANSCODE_CACHE
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct DmapdTranscodeCache DmapdTranscodeCache;
+
+/* Tracks the transcoded (.data) files in dir, keeping their total size
+ * within budget bytes, or without limit if budget is 0, by removing those
+ * least recently used. The order of use persists in an index in dir.
+ * Callers must serialize their use of a cache.
+ */
+DmapdTranscodeCache *dmapd_transcode_cache_new (const gchar *dir,
+						guint64 budget);
+
+/* Records that path, a file in dir, was just used. */
+void     dmapd_transcode_cache_touch   (DmapdTranscodeCache *cache,
+					const gchar *path);
+
+/* Records path, a file just written to dir, then removes the least
+ * recently used files other than path until the cache fits its budget.
+ * Returns a list of the paths removed, which the caller frees.
+ */
+GSList  *dmapd_transcode_cache_add     (DmapdTranscodeCache *cache,
+					const gchar *path);
+
+/* Returns TRUE if no more may be added without removing something. */
+gboolean dmapd_transcode_cache_is_full (DmapdTranscodeCache *cache);
+
+void     dmapd_transcode_cache_free    (DmapdTranscodeCache *cache);
+
+#endif /* __DMAPD_TRANSCODE_CACHE */
+
+G_END_DECLS
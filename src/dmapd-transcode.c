@@ -43,6 +43,7 @@ static GSList  *music_formats            = NULL;
 static gchar   *module_dir               = NULL;
 static gchar   *output_dir               = NULL;
 static gchar   *transcode_mimetype       = NULL;
+static gint     jobs                     = 0;  /* 0: one per processor. */
 static gchar   *db_module                = NULL;
 static gchar   *av_meta_reader_module    = NULL;
 static gboolean enable_version           = FALSE;
@@ -80,6 +81,7 @@ static GOptionEntry entries[] = {
 	{ "music-format", 'M', 0, G_OPTION_ARG_CALLBACK, add_to_opt_list, "Acceptable music format", NULL },
 	{ "output-dir", 'o', 0, G_OPTION_ARG_STRING, &output_dir, "Output directory", NULL },
 	{ "transcode-mimetype", 't', 0, G_OPTION_ARG_STRING, &transcode_mimetype, "Target MIME type for transcoding", NULL },
+	{ "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Number of files to transcode at once; default is one per processor", NULL },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &enable_version, "Print version number and exit", NULL },
 	{ NULL }
 };
@@ -115,7 +117,9 @@ transcode (DMAPRecordFactory *factory,
 		db_builder_build_db_starting_at (builder, l->data, db, NULL, NULL);
 	}
 
-	dmap_db_foreach (db, (GHFunc) transcode_cache, &(db_dir_and_target_transcode_mimetype_t) { output_dir, transcode_mimetype });
+	transcode_cache_all (db,
+	                    &(db_dir_and_target_transcode_mimetype_t) { output_dir, transcode_mimetype },
+	                     jobs > 0 ? (guint) jobs : g_get_num_processors ());
 
 	if (NULL != db) {
 		g_object_unref (db);
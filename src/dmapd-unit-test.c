@@ -25,8 +25,20 @@
 #include <stdlib.h>
 #include <libdmapsharing/dmap.h>
 
+#include "dmapd-test-chunk-stream.h"
 #include "dmapd-test-daap-record.h"
+#include "dmapd-test-dmap-container-db.h"
+#include "dmapd-test-dmap-db.h"
+#include "dmapd-test-faststart.h"
+#include "dmapd-test-file-stream.h"
+#include "dmapd-test-frame-stream.h"
+#include "dmapd-test-id-map.h"
 #include "dmapd-test-parse-plugin-option.h"
+#include "dmapd-test-playlist.h"
+#include "dmapd-test-preview.h"
+#include "dmapd-test-smart-index.h"
+#include "dmapd-test-thumbnail-store.h"
+#include "dmapd-test-transcode-cache.h"
 #include "util.h"
 
 static void
@@ -57,6 +69,18 @@ int main(void)
 
 	run_suite (dmapd_test_parse_plugin_option_suite());
 	run_suite (dmapd_test_daap_record_suite());
+	run_suite (dmapd_test_id_map_suite());
+	run_suite (dmapd_test_dmap_db_suite());
+	run_suite (dmapd_test_dmap_container_db_suite());
+	run_suite (dmapd_test_faststart_suite());
+	run_suite (dmapd_test_file_stream_suite());
+	run_suite (dmapd_test_chunk_stream_suite());
+	run_suite (dmapd_test_frame_stream_suite());
+	run_suite (dmapd_test_playlist_suite());
+	run_suite (dmapd_test_preview_suite());
+	run_suite (dmapd_test_smart_index_suite());
+	run_suite (dmapd_test_thumbnail_store_suite());
+	run_suite (dmapd_test_transcode_cache_suite());
 
 	exit (EXIT_SUCCESS);
 }
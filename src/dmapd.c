@@ -36,11 +36,14 @@
 #include <libdmapsharing/dmap.h>
 
 #include "dmapd-dmap-container-record.h"
+#include "dmapd-dmap-container-record-factory.h"
 #include "dmapd-dmap-container-db.h"
 #include "dmapd-dpap-record.h"
 #include "dmapd-dpap-record-factory.h"
 #include "dmapd-daap-record.h"
 #include "dmapd-daap-record-factory.h"
+#include "dmapd-thumbnail-store.h"
+#include "dmapd-frame-stream.h"
 #include "dmapd-module.h"
 #include "db-builder.h"
 #include "av-meta-reader.h"
@@ -69,6 +72,12 @@ static char *protocol_map[] = {
 	NULL,
 };
 
+/* A [Smart:Name] section of the configuration file. */
+typedef struct smart_container_t {
+	gchar *name;
+	DmapdSmartRule rule;
+} smart_container_t;
+
 /* Consolidate these so they may be passed to callback, etc. */
 typedef struct workers_t {
 	DAAPShare *daap_share;
@@ -83,6 +92,7 @@ static GSList  *music_dirs               = NULL;
 static GSList  *picture_dirs             = NULL;
 static GSList  *music_formats            = NULL;
 static GSList  *picture_formats          = NULL;
+static GSList  *smart_containers         = NULL;
 static gchar   *module_dir               = NULL;
 static gchar   *config_file              = DEFAULT_CONFIG_FILE;
 static gchar   *db_dir                   = DEFAULT_DBDIR;
@@ -94,15 +104,27 @@ static gchar   *user                     = NULL;
 static gchar   *group                    = NULL;
 static gchar   *share_name               = NULL;
 static gchar   *transcode_mimetype       = NULL;
+static gint     transcode_jobs           = 0;  /* 0: one per processor. */
+static gint     transcode_cache_size     = 0;  /* MB; 0: no limit. */
+static transcode_scheduler_t *transcode_scheduler = NULL;
 static gchar   *db_module                = NULL;
+static GHashTable *db_module_options     = NULL;
 static gchar   *av_meta_reader_module    = NULL;
 static gchar   *av_render_module         = NULL;
 static gchar   *photo_meta_reader_module = NULL;
 static guint    max_thumbnail_width      = 128;
+static gint     thumbnail_jobs           = 0;  /* 0: one per processor. */
+static gint     thumbnail_memory         = 64; /* MB. */
+static gchar   *thumbnail_widths         = NULL;
+static gint     hires_width              = 0;
+static gint     music_chunk_size         = 0;  /* KB; 0: read directly. */
+static gint     picture_chunk_size       = 0;  /* KB; 0: read directly. */
 static gboolean enable_dir_containers    = FALSE;
+static gboolean enable_sort_containers   = FALSE;
 static gboolean enable_foreground        = FALSE;
 static gboolean enable_render            = FALSE;
 static gboolean enable_rt_transcode      = FALSE;
+static gboolean enable_rt_transcode_cache = FALSE;
 static gboolean enable_version           = FALSE;
 static gboolean exit_after_loading       = FALSE;
 
@@ -110,6 +132,15 @@ static gboolean exit_after_loading       = FALSE;
 // store persistently or set in config file?
 static gchar *_guid = NULL;
 
+static void
+free_smart_container (smart_container_t *smart)
+{
+	g_free (smart->name);
+	g_free (smart->rule.genre);
+	g_free (smart->rule.artist);
+	g_free (smart);
+}
+
 static void
 free_globals (void)
 {
@@ -119,6 +150,9 @@ free_globals (void)
 	slist_deep_free (picture_dirs);
 	slist_deep_free (music_formats);
 	slist_deep_free (picture_formats);
+
+	g_slist_foreach (smart_containers, (GFunc) free_smart_container, NULL);
+	g_slist_free (smart_containers);
 }
 
 static gboolean
@@ -157,8 +191,18 @@ static GOptionEntry entries[] = {
 	{ "render", 'o', 0, G_OPTION_ARG_NONE, &enable_render, "Render using AirPlay", NULL },
 	{ "transcode-mimetype", 't', 0, G_OPTION_ARG_STRING, &transcode_mimetype, "Target MIME type for transcoding", NULL },
 	{ "rt-transcode", 'r', 0, G_OPTION_ARG_NONE, &enable_rt_transcode, "Perform transcoding in real-time", NULL },
+	{ "rt-transcode-cache", 0, 0, G_OPTION_ARG_NONE, &enable_rt_transcode_cache, "Keep what is transcoded in real-time for later plays", NULL },
+	{ "transcode-jobs", 0, 0, G_OPTION_ARG_INT, &transcode_jobs, "Number of files to transcode at once; default is one per processor", NULL },
+	{ "transcode-cache-size", 0, 0, G_OPTION_ARG_INT, &transcode_cache_size, "Size in MB of the transcoded files to keep; default is no limit", NULL },
 	{ "max-thumbnail-width", 'w', 0, G_OPTION_ARG_INT, &max_thumbnail_width, "Maximum thumbnail size (may reduce memory use)", NULL },
+	{ "thumbnail-jobs", 0, 0, G_OPTION_ARG_INT, &thumbnail_jobs, "Number of pictures to read at once; default is one per processor", NULL },
+	{ "thumbnail-memory", 0, 0, G_OPTION_ARG_INT, &thumbnail_memory, "Memory in MB for pictures being read at once; default is 64", NULL },
+	{ "thumbnail-widths", 0, 0, G_OPTION_ARG_STRING, &thumbnail_widths, "Widths of additional picture sizes to keep, e.g., 480;1024", NULL },
+	{ "hires-width", 0, 0, G_OPTION_ARG_INT, &hires_width, "Resize pictures wider than this before sending them; default is to send originals", NULL },
+	{ "music-chunk-size", 0, 0, G_OPTION_ARG_INT, &music_chunk_size, "Size in KB of the chunks music is read ahead in as it is sent, e.g., 1024; default is to read directly", NULL },
+	{ "picture-chunk-size", 0, 0, G_OPTION_ARG_INT, &picture_chunk_size, "Size in KB of the chunks pictures are read ahead in as they are sent; default is to read directly", NULL },
 	{ "directory-containers", 'c', 0, G_OPTION_ARG_NONE, &enable_dir_containers, "Serve DMAP containers based on filesystem heirarchy", NULL },
+	{ "sort-containers", 's', 0, G_OPTION_ARG_NONE, &enable_sort_containers, "Order music containers by disc and track number", NULL },
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &enable_version, "Print version number and exit", NULL },
 	{ "exit-after-loading", 'x', 0, G_OPTION_ARG_NONE, &exit_after_loading, "Exit after loading database (do not serve)", NULL },
 	{ NULL }
@@ -276,6 +320,196 @@ debug_null (const char *log_domain,
 {
 }
 
+/* Containers are stored using the media database module, under db_dir. */
+static DMAPContainerDb *
+create_container_db (protocol_id_t protocol, DMAPDb *db, const gchar *db_protocol_dir)
+{
+	gchar *containers_dir;
+	const gchar *module = db_module;
+	DMAPDb *store;
+	DMAPContainerDb *container_db;
+	DMAPRecordFactory *factory;
+	gboolean sort_entries = protocol == DAAP && enable_sort_containers;
+
+	if (! enable_dir_containers) {
+		container_db = DMAP_CONTAINER_DB (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_DB, "db-dir", db_protocol_dir, NULL));
+		goto _done;
+	}
+
+	/* NOTE: the SQLite module's schema holds only media records. */
+	if (! strcmp (module, "sqlite")) {
+		module = DEFAULT_DB_MOD;
+	}
+
+	containers_dir = g_strconcat (db_protocol_dir, "/containers", NULL);
+	if (g_mkdir_with_parents (containers_dir, 0755) != 0) {
+		g_warning ("Could not create %s", containers_dir);
+	}
+
+	factory = DMAP_RECORD_FACTORY (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_RECORD_FACTORY, "full-db", db, NULL));
+	store = DMAP_DB (object_from_module (TYPE_DMAPD_DMAP_DB,
+	                                     module_dir,
+	                                     module,
+	                                     "db-dir",
+	                                     containers_dir,
+	                                     "record-factory",
+	                                     factory,
+	                                     "options",
+	                                     db_module_options,
+	                                     NULL));
+	g_assert (store);
+
+	container_db = DMAP_CONTAINER_DB (g_object_new (TYPE_DMAPD_DMAP_CONTAINER_DB,
+	                                                "db-dir", db_protocol_dir,
+	                                                "store", store,
+	                                                "sort-entries", sort_entries,
+	                                                NULL));
+
+	g_object_unref (store);
+	g_free (containers_dir);
+
+_done:
+	return container_db;
+}
+
+/* Tracks are played through here, so that the transcode scheduler hears of
+ * them and so that those transcoded in real-time may seek.
+ */
+static GInputStream *
+filter_read (DAAPRecord *record, GInputStream *stream, gpointer user_data)
+{
+	gchar *format = NULL;
+	gchar *format2 = NULL;
+	GInputStream *fnval = stream;
+
+	if (NULL != transcode_scheduler) {
+		if (enable_rt_transcode) {
+			transcode_scheduler_request (record, transcode_scheduler);
+		} else {
+			transcode_scheduler_prioritize (record, transcode_scheduler);
+		}
+	}
+
+	g_object_get (record, "format", &format, NULL);
+	if (NULL != transcode_mimetype) {
+		format2 = dmap_mime_to_format (transcode_mimetype);
+	}
+
+	if (NULL != format && NULL != format2 && strcmp (format, format2)) {
+		fnval = dmapd_frame_stream_new (stream, format);
+		g_object_unref (stream);
+	}
+
+	g_free (format);
+	g_free (format2);
+
+	return fnval;
+}
+
+static void
+add_hash (gpointer id, DMAPRecord *record, GHashTable *hashes)
+{
+	GByteArray *hash = NULL;
+	guchar hex[DMAP_HASH_SIZE * 2 + 1] = { 0 };
+
+	g_object_get (record, "hash", &hash, NULL);
+	if (NULL != hash && DMAP_HASH_SIZE == hash->len) {
+		dmap_hash_progressive_to_string (hash->data, hex);
+		g_hash_table_add (hashes, g_strdup ((gchar *) hex));
+	}
+}
+
+typedef struct {
+	GArray *ids;
+	GArray *refs;
+} thumbnail_refs_t;
+
+static void
+add_thumbnail_ref (gpointer id, DMAPRecord *record, thumbnail_refs_t *refs)
+{
+	guint i = GPOINTER_TO_UINT (id);
+	DmapdThumbnailRef ref = { 0, 0 };
+
+	g_object_get (record, "thumbnail-offset", &ref.offset, "thumbnail-length", &ref.length, NULL);
+	g_array_append_val (refs->ids, i);
+	g_array_append_val (refs->refs, ref);
+}
+
+/* Drops the thumbnails and sized copies no photograph in db still uses
+ * from the pack, once enough of it is unused, and saves the records
+ * whose thumbnails moved.
+ */
+static void
+compact_thumbnails (DMAPDb *db, DMAPRecordFactory *factory, GHashTable *hashes)
+{
+	guint i;
+	guint moved = 0;
+	DmapdThumbnailStore *store = NULL;
+	thumbnail_refs_t refs;
+
+	g_object_get (factory, "thumbnail-store", &store, NULL);
+	if (NULL == store) {
+		goto _done;
+	}
+
+	refs.ids = g_array_new (FALSE, FALSE, sizeof (guint));
+	refs.refs = g_array_new (FALSE, FALSE, sizeof (DmapdThumbnailRef));
+	dmap_db_foreach (db, (GHFunc) add_thumbnail_ref, &refs);
+
+	if (dmapd_thumbnail_store_compact (store, refs.refs, hashes)) {
+		for (i = 0; i < refs.ids->len; i++) {
+			guint id = g_array_index (refs.ids, guint, i);
+			DmapdThumbnailRef *ref = &g_array_index (refs.refs, DmapdThumbnailRef, i);
+			DMAPRecord *record = dmap_db_lookup_by_id (db, id);
+
+			if (NULL != record) {
+				g_object_set (record, "thumbnail-offset", ref->offset, "thumbnail-length", ref->length, NULL);
+				dmap_db_add_with_id (db, record, id);
+				g_object_unref (record);
+				moved++;
+			}
+		}
+
+		g_debug ("Moved %u thumbnails", moved);
+	}
+
+	g_array_free (refs.ids, TRUE);
+	g_array_free (refs.refs, TRUE);
+
+_done:
+	return;
+}
+
+/* Commits the writes a database module may still hold in a batch, media
+ * and containers alike.
+ */
+static void
+flush_dbs (DMAPDb *db, DMAPContainerDb *container_db)
+{
+	DMAPDb *store = NULL;
+
+	if (NULL != db) {
+		dmapd_dmap_db_flush (db);
+	}
+
+	if (NULL != container_db) {
+		g_object_get (container_db, "store", &store, NULL);
+		if (NULL != store) {
+			dmapd_dmap_db_flush (store);
+		}
+	}
+}
+
+static void
+flush_share (DMAPShare *share)
+{
+	DMAPDb *db = NULL;
+	DMAPContainerDb *container_db = NULL;
+
+	g_object_get (share, "db", &db, "container-db", &container_db, NULL);
+	flush_dbs (db, container_db);
+}
+
 static DMAPShare *
 serve (protocol_id_t protocol,
        DMAPRecordFactory *factory,
@@ -287,6 +521,7 @@ serve (protocol_id_t protocol,
 	DMAPShare *share;
 	DbBuilder *builder;
 	DMAPContainerDb *container_db;
+	GHashTable *hashes = NULL;
 
 	gchar *db_protocol_dir = g_strconcat (db_dir, "/", protocol_map[protocol], NULL);
 	g_assert (db_module);
@@ -298,6 +533,8 @@ serve (protocol_id_t protocol,
 					  db_protocol_dir,
 					  "record-factory",
 					  factory,
+					  "options",
+					  db_module_options,
 					  NULL));
 	g_assert (db);
 
@@ -305,9 +542,14 @@ serve (protocol_id_t protocol,
 		g_object_set (db, "acceptable-formats", acceptable_formats, NULL);
 	}
 
-	container_db = DMAP_CONTAINER_DB (dmapd_dmap_container_db_new ());
+	container_db = create_container_db (protocol, db, db_protocol_dir);
 	builder = DB_BUILDER (object_from_module (TYPE_DB_BUILDER, module_dir, "gdir", NULL));
 
+	/* NOTE: photographs are read in parallel; see also decode-budget. */
+	if (protocol == DPAP) {
+		g_object_set (builder, "jobs", thumbnail_jobs > 0 ? (guint) thumbnail_jobs : g_get_num_processors (), NULL);
+	}
+
 	for (l = media_dirs; l; l = l->next) {
 		if (enable_dir_containers) {
 			db_builder_build_db_starting_at (builder, l->data, db, container_db, NULL);
@@ -316,14 +558,63 @@ serve (protocol_id_t protocol,
 		}
 	}
 
-	if (protocol == DAAP && transcode_mimetype && ! enable_rt_transcode)
-		dmap_db_foreach (db,
-		                (GHFunc) transcode_cache,
-		               &(db_dir_and_target_transcode_mimetype_t) { db_protocol_dir, transcode_mimetype });
+	if (protocol == DAAP) {
+		for (l = smart_containers; l; l = l->next) {
+			smart_container_t *smart = l->data;
+			dmapd_dmap_container_db_add_smart (DMAPD_DMAP_CONTAINER_DB (container_db), db, smart->name, &smart->rule);
+		}
+	}
+
+	/* NOTE: an empty database may mean a missing disk; keep the cache
+	 * and the thumbnails.
+	 */
+	if (dmap_db_count (db) > 0) {
+		hashes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		dmap_db_foreach (db, (GHFunc) add_hash, hashes);
+
+		if (protocol == DPAP) {
+			compact_thumbnails (db, factory, hashes);
+		}
+	}
+
+	/* NOTE: the revision flushes db itself; containers are flushed here. */
+	flush_dbs (NULL, container_db);
+	dmapd_dmap_db_commit_revision (db);
+
+	if (NULL != hashes) {
+		g_debug ("Removed %u stale files from %s", cache_remove_stale (db_protocol_dir, hashes), db_protocol_dir);
+		g_hash_table_destroy (hashes);
+	}
+
+	/* NOTE: served files are read ahead in chunks; see dmapd-chunk-stream.h. */
+	if (protocol == DAAP) {
+		dmapd_daap_record_set_chunk_size ((gsize) MAX (0, music_chunk_size) * 1024);
+	} else if (protocol == DPAP) {
+		dmapd_dpap_record_set_chunk_size ((gsize) MAX (0, picture_chunk_size) * 1024);
+	}
 
 	loop = g_main_loop_new (NULL, FALSE);
 	share = create_share (protocol, DMAP_DB (db), DMAP_CONTAINER_DB (container_db));
 
+	/* NOTE: tracks are transcoded in real-time until their turn comes,
+	 * which for --rt-transcode-cache is when they are first played.
+	 * Videos are remuxed to start quickly whether or not tracks are
+	 * transcoded, and likewise in turn.
+	 */
+	if (protocol == DAAP) {
+		gboolean cache_transcodes = transcode_mimetype && (! enable_rt_transcode || enable_rt_transcode_cache);
+
+		transcode_scheduler = transcode_scheduler_new (&(db_dir_and_target_transcode_mimetype_t) { db_protocol_dir, cache_transcodes ? transcode_mimetype : NULL },
+		                                                transcode_jobs > 0 ? (guint) transcode_jobs : g_get_num_processors (),
+		                                                TRUE,
+		                                                (guint64) MAX (0, transcode_cache_size) * 1024 * 1024);
+		if (! enable_rt_transcode || ! cache_transcodes) {
+			transcode_scheduler_add_all (transcode_scheduler, db);
+		}
+
+		dmapd_daap_record_set_read_filter (filter_read, NULL);
+	}
+
 	/* FIXME:
 	g_object_unref (db);
 	g_object_unref (container_db);
@@ -346,11 +637,36 @@ key_file_b_or_default (GKeyFile *f, char *g, char *k, gboolean def)
 	return g_key_file_get_boolean (f, g, k, NULL) ? g_key_file_get_boolean (f, g, k, NULL) : def;
 }
 
+static gint
+key_file_i_or_default (GKeyFile *f, char *g, char *k, gint def)
+{
+	return g_key_file_has_key (f, g, k, NULL) ? g_key_file_get_integer (f, g, k, NULL) : def;
+}
+
+static void
+add_smart_container (GKeyFile *keyfile, const gchar *group)
+{
+	smart_container_t *smart = g_new0 (smart_container_t, 1);
+
+	smart->name              = g_strdup (group + strlen ("Smart:"));
+	smart->rule.genre        = g_key_file_get_string (keyfile, group, "Genre", NULL);
+	smart->rule.artist       = g_key_file_get_string (keyfile, group, "Artist", NULL);
+	smart->rule.year_min     = g_key_file_get_integer (keyfile, group, "Year-Min", NULL);
+	smart->rule.year_max     = g_key_file_get_integer (keyfile, group, "Year-Max", NULL);
+	smart->rule.added_within = MAX (0, g_key_file_get_integer (keyfile, group, "Added-Within-Days", NULL)) * 24 * 60 * 60;
+	smart->rule.has_video    = g_key_file_has_key (keyfile, group, "Has-Video", NULL)
+	                         ? g_key_file_get_boolean (keyfile, group, "Has-Video", NULL)
+	                         : -1;
+
+	smart_containers = g_slist_append (smart_containers, smart);
+}
+
 static void
 read_keyfile (void)
 {
 	GError *error = NULL;
 	GKeyFile *keyfile;
+	gchar **groups;
 	gchar **value;
 	gint i;
 	gsize len;
@@ -365,10 +681,20 @@ read_keyfile (void)
 		user                  = key_file_s_or_default (keyfile, "General", "User", user);
 		group                 = key_file_s_or_default (keyfile, "General", "Group", group);
 		enable_dir_containers = key_file_b_or_default (keyfile, "General", "Dir-Containers", enable_dir_containers);
+		enable_sort_containers = key_file_b_or_default (keyfile, "Music", "Sort-Containers", enable_sort_containers);
 		transcode_mimetype    = key_file_s_or_default (keyfile, "Music", "Transcode-Mimetype", transcode_mimetype);
 		enable_rt_transcode   = key_file_b_or_default (keyfile, "Music", "Realtime-Transcode", enable_rt_transcode);
+		enable_rt_transcode_cache = key_file_b_or_default (keyfile, "Music", "Realtime-Transcode-Cache", enable_rt_transcode_cache);
+		transcode_jobs        = key_file_i_or_default (keyfile, "Music", "Transcode-Jobs", transcode_jobs);
+		transcode_cache_size  = key_file_i_or_default (keyfile, "Music", "Transcode-Cache-Size", transcode_cache_size);
+		music_chunk_size      = key_file_i_or_default (keyfile, "Music", "Stream-Chunk-Size", music_chunk_size);
 		music_password        = key_file_s_or_default (keyfile, "Music", "Password", music_password);
 		picture_password      = key_file_s_or_default (keyfile, "Picture", "Password", picture_password);
+		thumbnail_jobs        = key_file_i_or_default (keyfile, "Picture", "Thumbnail-Jobs", thumbnail_jobs);
+		thumbnail_memory      = key_file_i_or_default (keyfile, "Picture", "Thumbnail-Memory", thumbnail_memory);
+		thumbnail_widths      = key_file_s_or_default (keyfile, "Picture", "Thumbnail-Widths", thumbnail_widths);
+		hires_width           = key_file_i_or_default (keyfile, "Picture", "Hires-Width", hires_width);
+		picture_chunk_size    = key_file_i_or_default (keyfile, "Picture", "Stream-Chunk-Size", picture_chunk_size);
 
 		value = g_key_file_get_string_list (keyfile, "Music", "Dirs", &len, NULL);
 		for (i = 0; i < len; i++)
@@ -385,6 +711,12 @@ read_keyfile (void)
 		value = g_key_file_get_string_list (keyfile, "Picture", "Acceptable-Formats", &len, NULL);
 		for (i = 0; i < len; i++)
 			add_to_opt_list ("-p", value[i], NULL, &error);
+
+		groups = g_key_file_get_groups (keyfile, NULL);
+		for (i = 0; groups[i]; i++)
+			if (g_str_has_prefix (groups[i], "Smart:"))
+				add_smart_container (keyfile, groups[i]);
+		g_strfreev (groups);
 	}
 
 	g_key_file_free (keyfile);
@@ -488,6 +820,7 @@ int main (int argc, char *argv[])
 	GOptionContext *context;
 	AVMetaReader *av_meta_reader = NULL;
 	PhotoMetaReader *photo_meta_reader = NULL;
+	DmapdThumbnailStore *thumbnail_store = NULL;
 
 	workers_t workers = { NULL, NULL, NULL, NULL };
 
@@ -522,6 +855,8 @@ int main (int argc, char *argv[])
 
 	db_module = getenv ("DMAPD_DB_MODULE");
 	db_module = db_module ? db_module : DEFAULT_DB_MOD;
+	db_module_options = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	db_module = parse_plugin_option (db_module, db_module_options);
 
 	// This must be before read_keyfile ().
 	config_file = getenv ("DMAPD_CONFIG_FILE");
@@ -585,6 +920,9 @@ int main (int argc, char *argv[])
 	}
 
 	g_object_set (photo_meta_reader, "max-thumbnail-width", max_thumbnail_width, NULL);
+	g_object_set (photo_meta_reader, "decode-budget", (guint64) MAX (thumbnail_memory, 0) * 1024 * 1024, NULL);
+	g_object_set (photo_meta_reader, "thumbnail-widths", thumbnail_widths, NULL);
+	g_object_set (photo_meta_reader, "hires-width", (guint) MAX (hires_width, 0), NULL);
 
 	if (! (av_meta_reader || photo_meta_reader)) {
 		g_error ("Neither an AV or photograph metadata reader plugin could be loaded");
@@ -642,11 +980,24 @@ int main (int argc, char *argv[])
 		if (photo_meta_reader == NULL)
 			g_error ("Photo directory specified but photo metadata reader module is 'null'");
 		DMAPRecordFactory *factory;
+		gchar *thumbnail_dir = g_strconcat (db_dir, "/", protocol_map[DPAP], NULL);
+		gchar *thumbnail_path = g_strconcat (thumbnail_dir, "/thumbnails", NULL);
+
+		/* NOTE: one pack holds every thumbnail; see dmapd-thumbnail-store.h. */
+		if (g_mkdir_with_parents (thumbnail_dir, 0755) != 0) {
+			g_warning ("Could not create %s", thumbnail_dir);
+		}
+		thumbnail_store = dmapd_thumbnail_store_new (thumbnail_path);
+		g_free (thumbnail_path);
+		g_free (thumbnail_dir);
+
 		factory = DMAP_RECORD_FACTORY (
 				g_object_new (
 					TYPE_DMAPD_DPAP_RECORD_FACTORY,
 					"meta-reader",
 					photo_meta_reader,
+					"thumbnail-store",
+					thumbnail_store,
 					NULL));
 		workers.dpap_share = DPAP_SHARE (serve (DPAP, factory, picture_dirs, picture_formats));
 #else
@@ -680,11 +1031,14 @@ _done:
 		g_main_loop_unref (loop);
 	}
 
+	/* NOTE: the databases are never finalized; see serve. */
 	if (NULL != workers.daap_share) {
+		flush_share (workers.daap_share);
 		g_object_unref (workers.daap_share);
 	}
 
 	if (NULL != workers.dpap_share) {
+		flush_share (workers.dpap_share);
 		g_object_unref (workers.dpap_share);
 	}
 
@@ -702,6 +1056,8 @@ _done:
 		g_object_unref (photo_meta_reader);
 	}
 
+	dmapd_thumbnail_store_free (thumbnail_store);
+
 	free_globals ();
 	stringleton_deinit ();
 	g_debug ("Parent Exiting");
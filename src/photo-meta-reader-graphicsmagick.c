@@ -29,6 +29,7 @@
 
 #include "photo-meta-reader-graphicsmagick.h"
 #include "dmapd-dpap-record.h"
+#include "dmapd-preview.h"
 
 const int DEFAULT_MAX_THUMBNAIL_WIDTH = 128;
 
@@ -59,108 +60,218 @@ photo_meta_reader_graphicsmagick_get_option_group (PhotoMetaReader *reader)
         return NULL;
 }
 
+/* Reads the picture at path and resizes it to fit in a square of size,
+ * returning it as a JPEG. width and height, from a ping, are the
+ * picture's; with a size hint, libjpeg scales while it decodes, so a
+ * JPEG is never held at full resolution. A RAW file is read from its
+ * embedded JPEG preview instead of through a RAW delegate.
+ */
+static GByteArray *
+read_resized (const gchar *path, gboolean is_jpeg, unsigned long width, unsigned long height, guint size)
+{
+	size_t blob_size;
+	guchar *blob;
+	MagickWand *wand;
+	unsigned long columns, rows;
+	GByteArray *preview;
+	GByteArray *fnval = NULL;
+
+	if (width > height) {
+		columns = size;
+		rows = MAX (1, height * size / width);
+	} else {
+		columns = MAX (1, width * size / MAX (1, height));
+		rows = size;
+	}
+
+	wand = NewMagickWand ();
+
+	preview = dmapd_preview_extract (path, size, NULL, NULL);
+	if (NULL != preview) {
+		MagickSetSize (wand, columns, rows);
+		if (! MagickReadImageBlob (wand, preview->data, preview->len)) {
+			g_warning ("Could not read embedded preview in %s", path);
+			g_byte_array_unref (preview);
+			goto _done;
+		}
+		g_byte_array_unref (preview);
+	} else {
+		if (is_jpeg) {
+			MagickSetSize (wand, columns, rows);
+		}
+
+		if (! MagickReadImage (wand, path)) {
+			g_warning ("Could not read %s", path);
+			goto _done;
+		}
+	}
+
+	MagickResetIterator (wand);
+	MagickResizeImage (wand, columns, rows, LanczosFilter, 1.0);
+	MagickSetImageFormat (wand, "JPEG");
+
+	blob = MagickWriteImageBlob (wand, &blob_size);
+	if (NULL == blob) {
+		g_warning ("Could not resize %s", path);
+		goto _done;
+	}
+
+	fnval = g_byte_array_sized_new (blob_size);
+	g_byte_array_append (fnval, blob, blob_size);
+	MagickRelinquishMemory (blob);
+
+_done:
+	DestroyMagickWand (wand);
+
+	return fnval;
+}
+
+/* A ping reads only the header. */
+static gboolean
+ping (const gchar *path, gchar **format, unsigned long *width, unsigned long *height)
+{
+	char *str;
+	gboolean fnval = FALSE;
+	MagickWand *wand = NewMagickWand ();
+
+	if (! MagickPingImage (wand, path)) {
+		guint preview_width, preview_height;
+		GByteArray *preview;
+
+		/* NOTE: a RAW file GraphicsMagick cannot read may have a preview. */
+		preview = dmapd_preview_extract (path, G_MAXUINT, &preview_width, &preview_height);
+		if (NULL == preview) {
+			g_warning ("Could not read %s", path);
+			goto _done;
+		}
+		g_byte_array_unref (preview);
+
+		*width  = preview_width;
+		*height = preview_height;
+		*format = g_strdup ("RAW");
+		fnval = TRUE;
+		goto _done;
+	}
+
+	MagickResetIterator (wand);
+
+	*width  = MagickGetImageWidth (wand);
+	*height = MagickGetImageHeight (wand);
+
+	str = MagickGetImageFormat (wand);
+	*format = g_strdup (NULL != str ? str : "");
+	if (NULL != str) {
+		MagickRelinquishMemory (str);
+	}
+
+	fnval = *width > 0 && *height > 0;
+
+_done:
+	DestroyMagickWand (wand);
+
+	return fnval;
+}
+
 static gboolean
 photo_meta_reader_graphicsmagick_read (PhotoMetaReader *reader,
 				       DPAPRecord *record,
 				       const gchar *path)
 {
 	gboolean fnval = FALSE;
-	MagickWand *wand;
-	wand = NewMagickWand ();
+	struct stat buf;
+	GByteArray *thumbnail_array;
+	float aspect_ratio;
+	gchar *aspect_ratio_str;
+	gchar *format = NULL;
+	unsigned long width, height;
+	guint max_thumbnail_width = 0;
 
-	if (! MagickReadImage (wand, path)) {
-		g_warning ("Could not read %s", path);
-	} else {
-		//ExifData *d;
-		struct stat buf;
-		size_t thumbnail_size;
-		guchar *thumbnail_data;
-		GByteArray *thumbnail_array;
-		float aspect_ratio;
-		gchar *aspect_ratio_str;
-		gchar *location;
-		guint max_thumbnail_width = 0;
-
-		if (stat (path, &buf) == -1) {
-			g_warning ("Unable to determine size of %s", path);
-		} else {
-			g_object_set (record, "large-filesize", buf.st_size, NULL);
-		}
+	if (! ping (path, &format, &width, &height)) {
+		goto _done;
+	}
 
+	if (stat (path, &buf) == -1) {
+		g_warning ("Unable to determine size of %s", path);
 		g_object_set (record, "creation-date", 1, NULL);
-		g_object_set (record, "rating", 5, NULL);
-		g_object_set (record, "filename", g_basename (path), NULL);
+	} else {
+		g_object_set (record, "large-filesize", buf.st_size, NULL);
+		g_object_set (record, "creation-date", (gint) buf.st_mtime, NULL);
+	}
 
-		location = g_strdup_printf ("file//%s", path);
-		g_object_set (record, "location", location, NULL);
-		g_free (location);
+	g_object_set (record, "rating", 5, NULL);
+	g_object_set (record, "filename", g_basename (path), NULL);
 
-		MagickResetIterator (wand);
+	g_object_set (record, "format", format, NULL);
+	g_object_set (record, "pixel-height", (gint) height, NULL);
+	g_object_set (record, "pixel-width", (gint) width, NULL);
+	g_object_set (record, "comments", "", NULL);
 
-		g_object_set (record, "format", MagickGetImageFormat (wand), NULL);
-		g_object_set (record, "pixel-height", MagickGetImageHeight (wand), NULL);
-		g_object_set (record, "pixel-width", MagickGetImageWidth (wand), NULL);
-		g_object_set (record, "comments", "", NULL);
+	aspect_ratio = width / (float) height;
+	aspect_ratio_str = g_strdup_printf ("%f", aspect_ratio);
+	g_object_set (record, "aspect-ratio", aspect_ratio_str, NULL);
+	g_free (aspect_ratio_str);
 
-		aspect_ratio = MagickGetImageWidth (wand) / (float) MagickGetImageHeight (wand);
-		aspect_ratio_str = g_strdup_printf ("%f", aspect_ratio);
-		g_object_set (record, "aspect-ratio", aspect_ratio_str, NULL);
-		g_free (aspect_ratio_str);
+	g_object_get (reader, "max-thumbnail-width", &max_thumbnail_width, NULL);
+	if (! max_thumbnail_width) {
+		max_thumbnail_width = DEFAULT_MAX_THUMBNAIL_WIDTH;
+	}
 
-		g_object_get (reader, "max-thumbnail-width", &max_thumbnail_width, NULL);
-		if (! max_thumbnail_width) {
-			max_thumbnail_width = DEFAULT_MAX_THUMBNAIL_WIDTH;
-		}
+	thumbnail_array = read_resized (path, ! strcmp (format, "JPEG"), width, height, max_thumbnail_width);
+	if (NULL == thumbnail_array) {
+		thumbnail_array = g_byte_array_new ();
+	}
 
-		if (MagickGetImageWidth (wand) > MagickGetImageHeight (wand)) {
-			MagickResizeImage (wand,
-					   max_thumbnail_width,
-					   (1 / aspect_ratio) * max_thumbnail_width,
-					   LanczosFilter,
-					   1.0);
-		} else {
-			MagickResizeImage (wand,
-					   aspect_ratio * max_thumbnail_width,
-					   max_thumbnail_width,
-					   LanczosFilter,
-					   1.0);
-		}
-		thumbnail_data = MagickWriteImageBlob (wand, &thumbnail_size);
-		thumbnail_array = g_byte_array_sized_new (thumbnail_size);
-		g_byte_array_append (thumbnail_array, thumbnail_data, thumbnail_size);
-		MagickRelinquishMemory (thumbnail_data);
-		g_object_set (record, "thumbnail", thumbnail_array, NULL);
-		g_byte_array_unref(thumbnail_array);
-
-		/* FIXME:
-		d = exif_data_new_from_file (path);
-		if (! d) {
-			g_warning ("Failed to EXIF data from %s", path);
-		} else {
-			int i;
-			for (i = 0; i < EXIF_IFD_COUNT; i++) {
-				ExifContent *c = d->ifd[i];
-				if (! c || ! c->count) {
-					g_warning ("Failed to find EXIF content in %s", path);
+	g_object_set (record, "thumbnail", thumbnail_array, NULL);
+	g_byte_array_unref (thumbnail_array);
+
+	/* FIXME:
+	d = exif_data_new_from_file (path);
+	if (! d) {
+		g_warning ("Failed to EXIF data from %s", path);
+	} else {
+		int i;
+		for (i = 0; i < EXIF_IFD_COUNT; i++) {
+			ExifContent *c = d->ifd[i];
+			if (! c || ! c->count) {
+				g_warning ("Failed to find EXIF content in %s", path);
+			} else {
+				ExifEntry *e = exif_content_get_entry (c, EXIF_TAG_USER_COMMENT);
+				if (! e) {
+					g_warning ("Failed to get comments EXIF entry in %s", path);
 				} else {
-					ExifEntry *e = exif_content_get_entry (c, EXIF_TAG_USER_COMMENT);
-					if (! e) {
-						g_warning ("Failed to get comments EXIF entry in %s", path);
-					} else {
-						gchar v[BUFSIZ + 1];
-						exif_entry_get_value (e, v, BUFSIZ);
-						g_object_set (record, "comments", v, NULL);
-					exif_content_unref (c);
-					}
+					gchar v[BUFSIZ + 1];
+					exif_entry_get_value (e, v, BUFSIZ);
+					g_object_set (record, "comments", v, NULL);
+				exif_content_unref (c);
 				}
-			exif_data_unref (d);
 			}
+		exif_data_unref (d);
 		}
-		*/
-		fnval = TRUE;
 	}
+	*/
+	fnval = TRUE;
+
+_done:
+	g_free (format);
+
+	return fnval;
+}
+
+static GByteArray *
+photo_meta_reader_graphicsmagick_resize (PhotoMetaReader *reader,
+					 const gchar *path,
+					 guint width)
+{
+	gchar *format = NULL;
+	GByteArray *fnval = NULL;
+	unsigned long image_width, image_height;
+
+	if (ping (path, &format, &image_width, &image_height)) {
+		fnval = read_resized (path, ! strcmp (format, "JPEG"), image_width, image_height, width);
+	}
+
+	g_free (format);
 
-	DestroyMagickWand (wand); 
 	return fnval;
 }
 
@@ -185,6 +296,7 @@ static void photo_meta_reader_graphicsmagick_class_init (PhotoMetaReaderGraphics
 	gobject_class->get_property = photo_meta_reader_graphicsmagick_get_property;
 
         photo_meta_reader->read = photo_meta_reader_graphicsmagick_read;
+	photo_meta_reader->resize = photo_meta_reader_graphicsmagick_resize;
 	photo_meta_reader->get_option_group = photo_meta_reader_graphicsmagick_get_option_group;
 }
 
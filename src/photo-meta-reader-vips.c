@@ -24,16 +24,40 @@
 #include <config.h>
 #include <errno.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_LIBEXIF
+#include <libexif/exif-data.h>
+#include <libexif/exif-loader.h>
+#endif
+
 #include "photo-meta-reader-vips.h"
 #include "dmapd-dpap-record.h"
+#include "dmapd-preview.h"
 
 const int DEFAULT_MAX_THUMBNAIL_WIDTH = 128;
 
 #define THUMBNAIL "jpeg-thumbnail-data"
 #define MULTISCAN "jpeg-multiscan"
+#define JPEG_LOADER "VipsForeignLoadJpegFile"
+#define HEIF_LOADER "VipsForeignLoadHeifFile"
+
+/* What is known of a photograph before it is opened with VIPS. */
+typedef struct {
+	int width;             /* 0 if unknown.                          */
+	int height;
+	int orientation;       /* EXIF orientation; 0 if unknown.        */
+	gint64 timestamp;      /* -1 if unknown.                         */
+	gchar *comments;       /* NULL if unknown.                       */
+	GByteArray *thumbnail; /* Embedded JPEG thumbnail, or NULL.      */
+} photo_meta_t;
+
+/* Bytes held by the images being decoded, across every thread. */
+static GMutex budget_lock;
+static GCond budget_cond;
+static guint64 budget_in_use = 0;
 
 static GOptionGroup *
 photo_meta_reader_vips_get_option_group (PhotoMetaReader * reader)
@@ -83,18 +107,8 @@ _done:
  * bilinear interpolation to get the exact size we want.
  */
 static int
-calculate_shrink (PhotoMetaReader *reader, int width, int height, double *residual)
+calculate_shrink (guint max_thumbnail_width, int width, int height, double *residual)
 {
-	g_assert (IS_PHOTO_META_READER (reader));
-
-	guint max_thumbnail_width = 0;
-
-	g_object_get (reader, "max-thumbnail-width", &max_thumbnail_width, NULL);
-
-	if (0 == max_thumbnail_width) {
-		max_thumbnail_width = DEFAULT_MAX_THUMBNAIL_WIDTH;
-	}
-
 	g_debug ("    Maximum thumbnail width is %d.", max_thumbnail_width);
 
 	/* We shrink to make the largest dimension equal to size. */
@@ -121,14 +135,71 @@ calculate_shrink (PhotoMetaReader *reader, int width, int height, double *residu
 	return shrink;
 }
 
+static guint
+get_max_thumbnail_width (PhotoMetaReader *reader)
+{
+	g_assert (IS_PHOTO_META_READER (reader));
+
+	guint max_thumbnail_width = 0;
+
+	g_object_get (reader, "max-thumbnail-width", &max_thumbnail_width, NULL);
+
+	if (0 == max_thumbnail_width) {
+		max_thumbnail_width = DEFAULT_MAX_THUMBNAIL_WIDTH;
+	}
+
+	return max_thumbnail_width;
+}
+
+/* Returns, narrowest first, the additional widths that a photograph whose
+ * largest side is dimension is wide enough for and that the thumbnail
+ * store does not already hold.
+ */
+static GArray *
+get_missing_widths (PhotoMetaReader *reader, DPAPRecord *record, int dimension)
+{
+	guint i;
+	gchar *str = NULL;
+	gchar **widths = NULL;
+	guint max_thumbnail_width = get_max_thumbnail_width (reader);
+	GArray *fnval = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	g_object_get (reader, "thumbnail-widths", &str, NULL);
+	if (NULL == str || ! IS_DMAPD_DPAP_RECORD (record)) {
+		goto _done;
+	}
+
+	widths = g_strsplit (str, ";", -1);
+	for (i = 0; widths[i]; i++) {
+		guint j;
+		guint width = strtoul (widths[i], NULL, 10);
+
+		if (width <= max_thumbnail_width
+		 || width >= (guint) dimension
+		 || dmapd_dpap_record_has_sized (DMAPD_DPAP_RECORD (record), width)) {
+			continue;
+		}
+
+		for (j = 0; j < fnval->len && g_array_index (fnval, guint, j) < width; j++);
+		if (j == fnval->len || g_array_index (fnval, guint, j) != width) {
+			g_array_insert_val (fnval, j, width);
+		}
+	}
+
+_done:
+	g_strfreev (widths);
+	g_free (str);
+
+	return fnval;
+}
+
 /* Find the best jpeg preload shrink. */
 static int
-thumbnail_find_jpegshrink (PhotoMetaReader *reader, VipsImage *im)
+thumbnail_find_jpegshrink (guint max_thumbnail_width, VipsImage *im)
 {
-	g_assert (IS_PHOTO_META_READER (reader));
 	g_assert (VIPS_IS_IMAGE (im));
 
-	int shrink = calculate_shrink (reader, im->Xsize, im->Ysize, NULL);
+	int shrink = calculate_shrink (max_thumbnail_width, im->Xsize, im->Ysize, NULL);
 
 	if (shrink >= 8) {
 		return 8;
@@ -141,9 +212,91 @@ thumbnail_find_jpegshrink (PhotoMetaReader *reader, VipsImage *im)
 	}
 }
 
+/* Estimates from its header the memory needed to decode im for a
+ * thumbnail of width. libjpeg keeps every two-byte DCT coefficient of a
+ * multiscan JPEG, whatever the shrink; other JPEGs decode at the preload
+ * shrink. A ladder of widths adds the copy kept in memory.
+ */
+static guint64
+estimate_decode_size (VipsImage *im, guint width, gboolean is_jpeg, gboolean ladder)
+{
+	guint64 fnval;
+	guint64 pixels = (guint64) im->Xsize * im->Ysize;
+
+	if (is_jpeg && jpeg_is_multiscan (im)) {
+		fnval = pixels * im->Bands * 2;
+	} else if (is_jpeg) {
+		int shrink = thumbnail_find_jpegshrink (width, im);
+		fnval = pixels / (shrink * shrink) * im->Bands;
+	} else {
+		fnval = pixels * VIPS_IMAGE_SIZEOF_PEL (im);
+	}
+
+	if (ladder) {
+		int shrink = calculate_shrink (width, im->Xsize, im->Ysize, NULL);
+		fnval += pixels / (shrink * shrink) * VIPS_IMAGE_SIZEOF_PEL (im);
+	}
+
+	return fnval;
+}
+
+/* Waits until size bytes fit in the budget. An image larger than the
+ * whole budget waits until it can be decoded alone.
+ */
+static void
+budget_acquire (guint64 budget, guint64 size)
+{
+	g_mutex_lock (&budget_lock);
+
+	while (budget_in_use > 0 && budget_in_use + size > budget) {
+		g_cond_wait (&budget_cond, &budget_lock);
+	}
+
+	budget_in_use += size;
+
+	g_mutex_unlock (&budget_lock);
+}
+
+static void
+budget_release (guint64 size)
+{
+	g_mutex_lock (&budget_lock);
+
+	budget_in_use -= size;
+	g_cond_broadcast (&budget_cond);
+
+	g_mutex_unlock (&budget_lock);
+}
+
+/* Waits for the memory to decode im at path for width, if the reader has
+ * a budget, setting decode_size to what must be released. Returns TRUE if
+ * a multiscan JPEG may be decoded.
+ */
+static gboolean
+budget_admit (PhotoMetaReader *reader, const gchar *path, VipsImage *im, guint width, gboolean ladder, guint64 *decode_size)
+{
+	guint64 budget = 0;
+	const char *loader;
+	gboolean fnval = FALSE;
+
+	*decode_size = 0;
+
+	g_object_get (reader, "decode-budget", &budget, NULL);
+	if (0 != budget) {
+		loader = vips_foreign_find_load (path);
+		*decode_size = estimate_decode_size (im, width, NULL != loader && ! strcmp (loader, JPEG_LOADER), ladder);
+		fnval = *decode_size <= budget;
+
+		g_debug ("    Estimated decode size is %" G_GUINT64_FORMAT " bytes.", *decode_size);
+		budget_acquire (budget, *decode_size);
+	}
+
+	return fnval;
+}
+
 /* Try to read an embedded thumbnail. */
 static VipsImage *
-thumbnail_get_thumbnail (PhotoMetaReader *reader, VipsImage *im)
+thumbnail_get_thumbnail (PhotoMetaReader *reader, VipsImage *im, guint width)
 {
 	void *ptr;
 	size_t size;
@@ -170,7 +323,7 @@ thumbnail_get_thumbnail (PhotoMetaReader *reader, VipsImage *im)
 	}
 	g_debug ("    Embedded JPEG thumbnail size is %d.", size);
 
-	(void) calculate_shrink (reader, thumb->Xsize, thumb->Ysize, &residual);
+	(void) calculate_shrink (width, thumb->Xsize, thumb->Ysize, &residual);
 	if (residual > 1.0) { 
 		g_warning ("    Embedded JPEG thumbnail too small.\n"); 
 		g_object_unref (thumb); 
@@ -179,7 +332,7 @@ thumbnail_get_thumbnail (PhotoMetaReader *reader, VipsImage *im)
 	}
 
 	/* Reload with the correct downshrink. */
-	jpegshrink = thumbnail_find_jpegshrink (reader, thumb);
+	jpegshrink = thumbnail_find_jpegshrink (width, thumb);
 	g_debug ("    Loading embedded JPEG thumbnail with factor %d preshrink.", jpegshrink);
 
 	g_object_unref (thumb);
@@ -194,6 +347,71 @@ _done:
 	return thumb;
 }
 
+/* Try the JPEG preview embedded in a RAW file. */
+static VipsImage *
+thumbnail_get_preview (VipsObject *process, const char *filename, guint width)
+{
+	int jpegshrink;
+	GByteArray *preview;
+	VipsImage *thumb = NULL;
+
+	preview = dmapd_preview_extract (filename, width, NULL, NULL);
+	if (NULL == preview) {
+		goto _done;
+	}
+
+	/* NOTE: the image reads from preview, so process keeps it. */
+	g_object_set_data_full (G_OBJECT (process), "preview", preview, (GDestroyNotify) g_byte_array_unref);
+
+	if (vips_jpegload_buffer (preview->data, preview->len, &thumb, NULL)) {
+		g_warning ("    Decoding embedded preview failed.");
+		vips_error_clear ();
+		thumb = NULL;
+		goto _done;
+	}
+
+	jpegshrink = thumbnail_find_jpegshrink (width, thumb);
+	g_debug ("    Loading %dx%d embedded preview with factor %d preshrink.", thumb->Xsize, thumb->Ysize, jpegshrink);
+
+	g_object_unref (thumb);
+	thumb = NULL;
+	if (vips_jpegload_buffer (preview->data, preview->len, &thumb, "shrink", jpegshrink, NULL)) {
+		g_warning ("    Reloading embedded preview failed.");
+		vips_error_clear ();
+		thumb = NULL;
+		goto _done;
+	}
+	vips_object_local (process, thumb);
+
+_done:
+	return thumb;
+}
+
+/* Try the thumbnail item of a HEIF file, which VIPS decodes for us. */
+static VipsImage *
+thumbnail_get_heif_thumbnail (VipsObject *process, const char *filename, guint width)
+{
+	double residual;
+	VipsImage *thumb = NULL;
+
+	if (vips_foreign_load (filename, &thumb, "thumbnail", TRUE, NULL)) {
+		g_debug ("    No HEIF thumbnail item found.");
+		vips_error_clear ();
+		thumb = NULL;
+		goto _done;
+	}
+	vips_object_local (process, thumb);
+
+	(void) calculate_shrink (width, thumb->Xsize, thumb->Ysize, &residual);
+	if (residual > 1.0) {
+		g_debug ("    HEIF thumbnail item too small.");
+		thumb = NULL;
+	}
+
+_done:
+	return thumb;
+}
+
 /* Open an image, returning the best version of that image for thumbnailing. 
  *
  * jpegs can have embedded thumbnails ... use that if it's large enough.
@@ -202,7 +420,7 @@ _done:
  * VIPS to load a lower resolution version.
  */
 static VipsImage *
-thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filename)
+thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filename, guint width, gboolean allow_multiscan)
 {
 	g_assert (IS_PHOTO_META_READER (reader));
 	g_assert (VIPS_IS_IMAGE (process));
@@ -214,6 +432,15 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 	g_debug ("    Thumbnailing %s.", filename);
 
 	loader = vips_foreign_find_load (filename);
+
+	/* RAW files carry JPEG previews; decoding the raw data takes seconds. */
+	if (NULL == loader || strcmp (loader, JPEG_LOADER)) {
+		im = thumbnail_get_preview (process, filename, width);
+		if (NULL != im) {
+			goto _done;
+		}
+	}
+
 	if (NULL == loader) {
 		g_warning ("    No image loader found.\n");
 		goto _done;
@@ -221,7 +448,7 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 
 	g_debug ("    Selected image loader is %s.", loader); 
 
-	if (0 == strcmp (loader, "VipsForeignLoadJpegFile")) {
+	if (0 == strcmp (loader, JPEG_LOADER)) {
 		VipsImage *thumb = NULL;
 
 		/* This will just read in the header and is quick. */
@@ -233,7 +460,7 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 		vips_object_local (process, im);
 
 		/* Try to read an embedded thumbnail. If we find one, use that instead. */
-		thumb = thumbnail_get_thumbnail (reader, im);
+		thumb = thumbnail_get_thumbnail (reader, im, width);
 		if (NULL != thumb) {
 			vips_object_local (process, thumb);
 
@@ -246,9 +473,10 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 			vips_object_local (VIPS_OBJECT (thumb), im);
 
 			im = thumb;
-		} else if (jpeg_is_multiscan (im)) {
+		} else if (jpeg_is_multiscan (im) && ! allow_multiscan) {
 			/* libjpeg handles multiscan JPEGs differently.
-			 * Avoid this because of memory use on small devices.
+			 * Avoid this because of memory use on small devices,
+			 * unless the decode budget accounts for it.
 			 */
 			g_warning ("    Will not try to thumbnail multiscan JPEG at %s.", im->filename);
 			goto _done;
@@ -257,7 +485,7 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 
 			g_debug ("    Processing main JPEG image.");
 
-			jpegshrink = thumbnail_find_jpegshrink (reader, im);
+			jpegshrink = thumbnail_find_jpegshrink (width, im);
 
 			g_debug ("    Loading JPEG with factor %d preshrink", jpegshrink);
 			if (vips_foreign_load (filename, &im,
@@ -271,6 +499,13 @@ thumbnail_open (PhotoMetaReader *reader, VipsObject *process, const char *filena
 		}
 	}
 	else {
+		if (0 == strcmp (loader, HEIF_LOADER)) {
+			im = thumbnail_get_heif_thumbnail (process, filename, width);
+			if (NULL != im) {
+				goto _done;
+			}
+		}
+
 		/* All other formats. */
 		if (vips_foreign_load (filename, &im,
 		                      "sequential", TRUE,
@@ -286,7 +521,7 @@ _done:
 }
 
 static gboolean
-thumbnail_shrink (PhotoMetaReader *reader, VipsObject *process, VipsImage *in, void **thumb, size_t *size)
+thumbnail_shrink (PhotoMetaReader *reader, VipsObject *process, VipsImage *in, guint width, void **thumb, size_t *size)
 {
 	g_assert (IS_PHOTO_META_READER (reader));
 	g_assert (VIPS_IS_IMAGE (process));
@@ -326,7 +561,7 @@ thumbnail_shrink (PhotoMetaReader *reader, VipsObject *process, VipsImage *in, v
 		in = t[1];
 	}
 
-	shrink = calculate_shrink (reader, in->Xsize, in->Ysize, &residual);
+	shrink = calculate_shrink (width, in->Xsize, in->Ysize, &residual);
 
 	g_debug ("    Integer shrink by %d.", shrink);
 
@@ -373,6 +608,55 @@ _done:
 	return fnval;
 }
 
+/* Makes the copies at widths from one decode of in, which is kept in
+ * memory at the integer shrink for the widest of them. Returns the copy,
+ * from which the thumbnail can be made too.
+ */
+static VipsImage *
+thumbnail_ladder (PhotoMetaReader *reader, VipsObject *process, DPAPRecord *record, VipsImage *in, GArray *widths)
+{
+	guint i;
+	int shrink;
+	VipsImage *shrunk = in;
+	VipsImage *memory = NULL;
+
+	/* NOTE: coded images are unpacked by thumbnail_shrink. */
+	shrink = calculate_shrink (g_array_index (widths, guint, widths->len - 1), in->Xsize, in->Ysize, NULL);
+	if (shrink > 1 && in->Coding == VIPS_CODING_NONE) {
+		if (vips_shrink (in, &shrunk, shrink, shrink, NULL)) {
+			g_warning ("    Could not shrink %s.", in->filename);
+			goto _done;
+		}
+		vips_object_local (process, shrunk);
+	}
+
+	memory = vips_image_new_memory ();
+	vips_object_local (process, memory);
+	if (vips_image_write (shrunk, memory)) {
+		g_warning ("    Could not decode %s.", in->filename);
+		memory = NULL;
+		goto _done;
+	}
+
+	for (i = 0; i < widths->len; i++) {
+		void *data = NULL;
+		size_t size = 0;
+		guint width = g_array_index (widths, guint, i);
+
+		if (thumbnail_shrink (reader, process, memory, width, &data, &size)) {
+			g_debug ("    Copy %u wide is %ld bytes.", width, size);
+			if (! dmapd_dpap_record_add_sized (DMAPD_DPAP_RECORD (record), width, data, size)) {
+				g_warning ("    Could not store copy %u wide.", width);
+			}
+		}
+
+		g_free (data);
+	}
+
+_done:
+	return memory;
+}
+
 static const char *
 photo_meta_reader_vips_get_str (VipsImage *im, const char *field)
 {
@@ -393,6 +677,168 @@ photo_meta_reader_vips_get_str (VipsImage *im, const char *field)
 	return str; 
 }
 
+/* Parses an EXIF timestamp, such as "2007:10:05 00:20:26", as local time.
+ * Returns -1 if str is not a timestamp.
+ */
+static gint64
+parse_timestamp (const char *str)
+{
+	GDateTime *date;
+	gint64 fnval = -1;
+	int year, month, day, hour, minute, second;
+
+	if (6 != sscanf (str, "%d:%d:%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second)) {
+		goto _done;
+	}
+
+	date = g_date_time_new_local (year, month, day, hour, minute, second);
+	if (NULL == date) {
+		goto _done;
+	}
+
+	fnval = g_date_time_to_unix (date);
+	g_date_time_unref (date);
+
+_done:
+	return fnval;
+}
+
+#ifdef HAVE_LIBEXIF
+static int
+exif_get_int (ExifData *d, ExifTag tag)
+{
+	int fnval = 0;
+	ExifEntry *e = exif_data_get_entry (d, tag);
+
+	if (NULL != e && EXIF_FORMAT_SHORT == e->format) {
+		fnval = exif_get_short (e->data, exif_data_get_byte_order (d));
+	} else if (NULL != e && EXIF_FORMAT_LONG == e->format) {
+		fnval = exif_get_long (e->data, exif_data_get_byte_order (d));
+	}
+
+	return fnval;
+}
+
+static gchar *
+exif_get_str (ExifData *d, ExifTag tag)
+{
+	char value[1024];
+	gchar *fnval = NULL;
+	ExifEntry *e = exif_data_get_entry (d, tag);
+
+	if (NULL != e && NULL != exif_entry_get_value (e, value, sizeof (value))) {
+		fnval = g_strstrip (g_strdup (value));
+	}
+
+	return fnval;
+}
+
+/* The loader stops reading at the end of the APP1 segment. */
+static void
+read_exif (const gchar *path, photo_meta_t *meta)
+{
+	gchar *str = NULL;
+	ExifData *d = NULL;
+	ExifLoader *loader = exif_loader_new ();
+
+	exif_loader_write_file (loader, path);
+
+	d = exif_loader_get_data (loader);
+	if (NULL == d) {
+		g_debug ("    No EXIF data found.");
+		goto _done;
+	}
+
+	meta->width       = exif_get_int (d, EXIF_TAG_PIXEL_X_DIMENSION);
+	meta->height      = exif_get_int (d, EXIF_TAG_PIXEL_Y_DIMENSION);
+	meta->orientation = exif_get_int (d, EXIF_TAG_ORIENTATION);
+	meta->comments    = exif_get_str (d, EXIF_TAG_USER_COMMENT);
+
+	str = exif_get_str (d, EXIF_TAG_DATE_TIME_ORIGINAL);
+	if (NULL == str) {
+		str = exif_get_str (d, EXIF_TAG_DATE_TIME);
+	}
+
+	if (NULL != str) {
+		meta->timestamp = parse_timestamp (str);
+		if (-1 == meta->timestamp) {
+			g_warning ("Bad timestamp string in %s: %s", path, str);
+		}
+	}
+
+	if (NULL != d->data && d->size > 0) {
+		meta->thumbnail = g_byte_array_sized_new (d->size);
+		g_byte_array_append (meta->thumbnail, d->data, d->size);
+	}
+
+_done:
+	g_free (str);
+
+	if (NULL != d) {
+		exif_data_unref (d);
+	}
+
+	exif_loader_unref (loader);
+}
+#endif
+
+/* Fills in what EXIF did not provide from im's header. */
+static void
+read_vips_header (VipsImage *im, photo_meta_t *meta)
+{
+	const gchar *str;
+
+	if (0 == meta->width || 0 == meta->height) {
+		meta->width  = im->Xsize;
+		meta->height = im->Ysize;
+	}
+
+	if (NULL == meta->comments && (str = photo_meta_reader_vips_get_str (im, "exif-User Comment"))) {
+		meta->comments = g_strdup (str);
+	}
+
+	if (-1 == meta->timestamp && (str = photo_meta_reader_vips_get_str (im, "exif-Date and Time"))) {
+		meta->timestamp = parse_timestamp (str);
+		if (-1 == meta->timestamp) {
+			g_warning ("Bad timestamp string in %s: %s", im->filename, str);
+		}
+	}
+}
+
+/* Makes the thumbnail from the embedded one, if that is large enough,
+ * without opening the photograph with VIPS.
+ */
+static gboolean
+thumbnail_from_embedded (PhotoMetaReader *reader, VipsObject *process, photo_meta_t *meta, void **thumb, size_t *size)
+{
+	double residual;
+	VipsImage *embedded = NULL;
+	gboolean fnval = FALSE;
+	guint width = get_max_thumbnail_width (reader);
+
+	if (NULL == meta->thumbnail) {
+		goto _done;
+	}
+
+	if (vips_jpegload_buffer (meta->thumbnail->data, meta->thumbnail->len, &embedded, NULL)) {
+		g_debug ("    Could not load embedded EXIF thumbnail.");
+		vips_error_clear ();
+		goto _done;
+	}
+	vips_object_local (process, embedded);
+
+	(void) calculate_shrink (width, embedded->Xsize, embedded->Ysize, &residual);
+	if (residual > 1.0) {
+		g_debug ("    Embedded EXIF thumbnail too small.");
+		goto _done;
+	}
+
+	fnval = thumbnail_shrink (reader, process, embedded, width, thumb, size);
+
+_done:
+	return fnval;
+}
+
 static gboolean
 photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const gchar *path)
 {
@@ -401,7 +847,6 @@ photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const
 	g_assert (NULL != path);
 
 	VipsObject *process;
-	const gchar *str            = NULL;
 	VipsImage *im               = NULL;
 	VipsImage *thumb            = NULL;
 	VipsFormatClass *format     = NULL;
@@ -412,6 +857,11 @@ photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const
 	gboolean fnval = FALSE;
 	struct stat buf;
 	gsize thumbnail_size = 0;
+	guint64 decode_size = 0;
+	gboolean allow_multiscan = FALSE;
+	GArray *widths = NULL;
+	guint width;
+	photo_meta_t meta = { 0, 0, 0, -1, NULL, NULL };
 
 	/* Allocate all vips objects locally to this ... unref this to unref 
 	 * everything we created during this operation.
@@ -426,12 +876,38 @@ photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const
                 goto _done;
         }
 
-	im = vips_image_new_from_file (path);
-	if (NULL == im) {
-		g_warning ("Could not open %s", path);
-		goto _done;
+#ifdef HAVE_LIBEXIF
+	read_exif (path, &meta);
+#endif
+
+	/* NOTE: VIPS reads the whole header; only needed without EXIF. */
+	if (0 == meta.width || 0 == meta.height) {
+		im = vips_image_new_from_file (path);
+		if (NULL != im) {
+			vips_object_local (process, im);
+			read_vips_header (im, &meta);
+		} else {
+			/* A RAW file VIPS cannot open may still have a preview. */
+			guint preview_width, preview_height;
+			GByteArray *preview = dmapd_preview_extract (path, G_MAXUINT, &preview_width, &preview_height);
+			if (NULL == preview) {
+				g_warning ("Could not open %s", path);
+				goto _done;
+			}
+
+			vips_error_clear ();
+			meta.width  = preview_width;
+			meta.height = preview_height;
+			g_byte_array_unref (preview);
+		}
+	}
+
+	/* NOTE: orientations 5 through 8 turn the photograph on its side. */
+	if (meta.orientation >= 5 && meta.orientation <= 8) {
+		int height = meta.height;
+		meta.height = meta.width;
+		meta.width = height;
 	}
-	vips_object_local (process, im);
 
 	if (0 != stat (path, &buf)) {
 		g_warning ("Unable to determine size of %s", path);
@@ -449,16 +925,18 @@ photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const
 	}
 
 	g_object_set (record, "format", VIPS_OBJECT_CLASS (format)->nickname, NULL);
-	g_object_set (record, "pixel-height", im->Ysize, NULL);
-	g_object_set (record, "pixel-width", im->Xsize, NULL);
-	g_object_set (record, "comments", "", NULL);
-	g_object_set (record, "creation-date", buf.st_mtime, NULL);
+	g_object_set (record, "pixel-height", meta.height, NULL);
+	g_object_set (record, "pixel-width", meta.width, NULL);
+	g_object_set (record, "comments", meta.comments ? meta.comments : "", NULL);
+	g_object_set (record, "creation-date", (gint) (-1 != meta.timestamp ? meta.timestamp : buf.st_mtime), NULL);
 	g_object_set (record, "rating", 5, NULL); /* FIXME: also read from meta-data: */
 
-	g_debug ("    Tag pixel width is %d.",  im->Xsize);
-	g_debug ("    Tag pixel height is %d.", im->Ysize);
+	g_debug ("    Tag pixel width is %d.",  meta.width);
+	g_debug ("    Tag pixel height is %d.", meta.height);
+	g_debug ("    Tag comments is %s.", meta.comments ? meta.comments : "");
+	g_debug ("    Tag creation date is %" G_GINT64_FORMAT ".", meta.timestamp);
 
-	aspect_ratio = g_strdup_printf ("%f", im->Xsize / (float) im->Ysize);
+	aspect_ratio = g_strdup_printf ("%f", meta.width / (float) meta.height);
 	if (NULL == aspect_ratio) {
 		g_warning ("Could not set aspect ratio\n");
 	} else {
@@ -466,40 +944,48 @@ photo_meta_reader_vips_read (PhotoMetaReader *reader, DPAPRecord *record, const
 		g_object_set (record, "aspect-ratio", aspect_ratio, NULL);
 	}
 
-	if ((str = photo_meta_reader_vips_get_str (im, "exif-User Comment"))) {
-		g_debug ("    Tag comments is %s.", str);
-		g_object_set (record, "comments", str, NULL);
-	}
+	widths = get_missing_widths (reader, record, VIPS_MAX (meta.width, meta.height));
 
-	if ((str = photo_meta_reader_vips_get_str (im, "exif-Date and Time"))) {
-		// Format is: "2007:10:05 00:20:26 (ASCII, 20 bytes)".
-		if (strlen (str) < 19) {
-			g_warning ("Bad timestamp string in %s: %s", im->filename, str);
-		} else {
-			char buf[10];
-
-			vips_strncpy (buf, str, 10);
-			buf[4] = 0x00;	// Cut off year.
-			errno = 0;
-			long l = strtol (buf, NULL, 10);
-			if (errno) {
-				g_warning ("Bad timestamp string in %s: %s", im->filename, buf);
+	if (0 == widths->len
+	 && thumbnail_from_embedded (reader, process, &meta, &thumbnail_data, &thumbnail_size)) {
+		g_debug ("    Using embedded EXIF thumbnail.");
+	} else {
+		if (NULL == im) {
+			im = vips_image_new_from_file (path);
+			if (NULL != im) {
+				vips_object_local (process, im);
 			} else {
-				// FIXME: Handle other than year!
-				long timestamp = (l - 1970) * 365 * 24 * 60 * 60;
-				g_debug ("    Tag creation date is %s.", buf);
-				g_object_set (record, "creation-date", timestamp, NULL);
+				vips_error_clear ();
 			}
 		}
-	}
 
-	thumb = thumbnail_open (reader, process, path);
-	if (NULL == thumb) {
-		g_warning ("Could not open thumbnail for %s", path);
-		goto _done;
+		/* NOTE: the widest copy needed sets the one decode's shrink. */
+		width = widths->len > 0 ? g_array_index (widths, guint, widths->len - 1) : get_max_thumbnail_width (reader);
+
+		/* NOTE: without a header, only a RAW preview will be decoded. */
+		if (NULL != im) {
+			allow_multiscan = budget_admit (reader, path, im, width, widths->len > 0, &decode_size);
+		}
+
+		thumb = thumbnail_open (reader, process, path, width, allow_multiscan);
+		if (NULL == thumb) {
+			g_warning ("Could not open thumbnail for %s", path);
+			goto _done;
+		}
+
+		if (widths->len > 0) {
+			VipsImage *memory = thumbnail_ladder (reader, process, record, thumb, widths);
+			if (NULL != memory) {
+				thumb = memory;
+			}
+		}
+
+		if (! thumbnail_shrink (reader, process, thumb, get_max_thumbnail_width (reader), &thumbnail_data, &thumbnail_size)) {
+			thumbnail_data = NULL;
+		}
 	}
 
-	if (thumbnail_shrink (reader, process, thumb, &thumbnail_data, &thumbnail_size)) {
+	if (NULL != thumbnail_data) {
 		g_debug ("    Thumbnail is %ld bytes.", thumbnail_size);
 		thumbnail_array = g_byte_array_sized_new (thumbnail_size);
 		if (NULL == thumbnail_array) {
@@ -526,6 +1012,11 @@ _done:
 		g_object_unref (process);
 	}
 
+	/* NOTE: after process, which holds the decoded images. */
+	if (0 != decode_size) {
+		budget_release (decode_size);
+	}
+
 	if (NULL != basename) {
 		g_free (basename);
 	}	
@@ -542,6 +1033,70 @@ _done:
 		g_byte_array_unref (thumbnail_array);
 	}
 
+	if (NULL != widths) {
+		g_array_unref (widths);
+	}
+
+	/* NOTE: after process, as the embedded thumbnail is loaded from it. */
+	if (NULL != meta.thumbnail) {
+		g_byte_array_unref (meta.thumbnail);
+	}
+	g_free (meta.comments);
+
+	return fnval;
+}
+
+/* Shrinks on load and reads sequentially, as for thumbnails. */
+static GByteArray *
+photo_meta_reader_vips_resize (PhotoMetaReader *reader, const gchar *path, guint width)
+{
+	g_assert (IS_PHOTO_META_READER (reader));
+	g_assert (NULL != path);
+
+	VipsObject *process;
+	VipsImage *im          = NULL;
+	void *data             = NULL;
+	size_t size            = 0;
+	guint64 decode_size    = 0;
+	GByteArray *fnval      = NULL;
+	gboolean allow_multiscan = FALSE;
+
+	process = (VipsObject *) vips_image_new ();
+
+	g_debug ("Resizing %s to %u...", path, width);
+
+	/* NOTE: without a header, only a RAW preview will be decoded. */
+	im = vips_image_new_from_file (path);
+	if (NULL != im) {
+		vips_object_local (process, im);
+		allow_multiscan = budget_admit (reader, path, im, width, FALSE, &decode_size);
+	} else {
+		vips_error_clear ();
+	}
+
+	im = thumbnail_open (reader, process, path, width, allow_multiscan);
+	if (NULL == im) {
+		g_warning ("Could not open %s to resize it", path);
+		goto _done;
+	}
+
+	if (! thumbnail_shrink (reader, process, im, width, &data, &size)) {
+		g_warning ("Could not resize %s", path);
+		goto _done;
+	}
+
+	fnval = g_byte_array_sized_new (size);
+	g_byte_array_append (fnval, data, size);
+
+_done:
+	g_object_unref (process);
+
+	if (0 != decode_size) {
+		budget_release (decode_size);
+	}
+
+	g_free (data);
+
 	return fnval;
 }
 
@@ -565,6 +1120,7 @@ photo_meta_reader_vips_class_init (PhotoMetaReaderVipsClass * klass)
 	/* g_type_class_add_private (klass, sizeof (PhotoMetaReaderVipsPrivate)); */
 
 	photo_meta_reader->read = photo_meta_reader_vips_read;
+	photo_meta_reader->resize = photo_meta_reader_vips_resize;
 	photo_meta_reader->get_option_group =
 		photo_meta_reader_vips_get_option_group;
 }
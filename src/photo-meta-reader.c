@@ -23,13 +23,21 @@
 
 struct PhotoMetaReaderPrivate {
 	guint max_thumbnail_width;	
+	guint64 decode_budget;
+	gchar *thumbnail_widths;
+	guint hires_width;
 };
 
 enum {
 	PROP_0,
-	PROP_MAX_THUMBNAIL_WIDTH
+	PROP_MAX_THUMBNAIL_WIDTH,
+	PROP_DECODE_BUDGET,
+	PROP_THUMBNAIL_WIDTHS,
+	PROP_HIRES_WIDTH
 };
 
+G_DEFINE_TYPE (PhotoMetaReader, photo_meta_reader, G_TYPE_OBJECT)
+
 static void
 photo_meta_reader_set_property (GObject * object,
                                 guint prop_id,
@@ -42,6 +50,16 @@ photo_meta_reader_set_property (GObject * object,
 	case PROP_MAX_THUMBNAIL_WIDTH:
 		reader->priv->max_thumbnail_width = g_value_get_uint (value);
 		break;
+	case PROP_DECODE_BUDGET:
+		reader->priv->decode_budget = g_value_get_uint64 (value);
+		break;
+	case PROP_THUMBNAIL_WIDTHS:
+		g_free (reader->priv->thumbnail_widths);
+		reader->priv->thumbnail_widths = g_value_dup_string (value);
+		break;
+	case PROP_HIRES_WIDTH:
+		reader->priv->hires_width = g_value_get_uint (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -60,6 +78,15 @@ photo_meta_reader_get_property (GObject *object,
 	case PROP_MAX_THUMBNAIL_WIDTH:
 		g_value_set_uint (value, reader->priv->max_thumbnail_width);
 		break;
+	case PROP_DECODE_BUDGET:
+		g_value_set_uint64 (value, reader->priv->decode_budget);
+		break;
+	case PROP_THUMBNAIL_WIDTHS:
+		g_value_set_string (value, reader->priv->thumbnail_widths);
+		break;
+	case PROP_HIRES_WIDTH:
+		g_value_set_uint (value, reader->priv->hires_width);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -72,6 +99,16 @@ photo_meta_reader_init (PhotoMetaReader *reader)
 	reader->priv = PHOTO_META_READER_GET_PRIVATE (reader);
 }
 
+static void
+photo_meta_reader_finalize (GObject *object)
+{
+	PhotoMetaReader *reader = PHOTO_META_READER (object);
+
+	g_free (reader->priv->thumbnail_widths);
+
+	G_OBJECT_CLASS (photo_meta_reader_parent_class)->finalize (object);
+}
+
 static void
 photo_meta_reader_class_init (PhotoMetaReaderClass *klass)
 {
@@ -81,6 +118,7 @@ photo_meta_reader_class_init (PhotoMetaReaderClass *klass)
 
 	gobject_class->set_property = photo_meta_reader_set_property;
 	gobject_class->get_property = photo_meta_reader_get_property;
+	gobject_class->finalize = photo_meta_reader_finalize;
 
 	g_object_class_install_property (gobject_class,
 	                                 PROP_MAX_THUMBNAIL_WIDTH,
@@ -91,9 +129,45 @@ photo_meta_reader_class_init (PhotoMetaReaderClass *klass)
 							     G_MAXUINT,
 							     128,
 							     G_PARAM_READWRITE));
-}
 
-G_DEFINE_TYPE (PhotoMetaReader, photo_meta_reader, G_TYPE_OBJECT)
+	/* NOTE: readers called from several threads keep the memory used
+	 * by the images they are decoding at once under this many bytes;
+	 * 0 means no limit.
+	 */
+	g_object_class_install_property (gobject_class,
+	                                 PROP_DECODE_BUDGET,
+					 g_param_spec_uint64 ("decode-budget",
+					                      "Decode memory budget",
+							      "Decode memory budget",
+							       0,
+							       G_MAXUINT64,
+							       0,
+							       G_PARAM_READWRITE));
+
+	/* NOTE: widths, separated by ';', of copies made along with the
+	 * thumbnail and kept in the thumbnail store, e.g., "480;1024".
+	 */
+	g_object_class_install_property (gobject_class,
+	                                 PROP_THUMBNAIL_WIDTHS,
+					 g_param_spec_string ("thumbnail-widths",
+					                      "Additional thumbnail widths",
+							      "Additional thumbnail widths",
+							       NULL,
+							       G_PARAM_READWRITE));
+
+	/* NOTE: photographs wider than this are sent to clients resized;
+	 * 0 means send the original.
+	 */
+	g_object_class_install_property (gobject_class,
+	                                 PROP_HIRES_WIDTH,
+					 g_param_spec_uint ("hires-width",
+					                    "Maximum width of photographs sent",
+							    "Maximum width of photographs sent",
+							     0,
+							     G_MAXUINT,
+							     0,
+							     G_PARAM_READWRITE));
+}
 
 gboolean photo_meta_reader_read (PhotoMetaReader *reader, DPAPRecord *record, const gchar *path)
 {
@@ -104,3 +178,14 @@ GOptionGroup *photo_meta_reader_get_option_group (PhotoMetaReader *reader)
 {
 	return PHOTO_META_READER_GET_CLASS (reader)->get_option_group (reader);
 }
+
+GByteArray *photo_meta_reader_resize (PhotoMetaReader *reader, const gchar *path, guint width)
+{
+	GByteArray *fnval = NULL;
+
+	if (NULL != PHOTO_META_READER_GET_CLASS (reader)->resize) {
+		fnval = PHOTO_META_READER_GET_CLASS (reader)->resize (reader, path, width);
+	}
+
+	return fnval;
+}
@@ -61,6 +61,9 @@ struct _PhotoMetaReaderClass {
                                DPAPRecord *record,
                                const gchar *path);
 	GOptionGroup *(*get_option_group) (PhotoMetaReader *reader);
+	GByteArray   *(*resize) (PhotoMetaReader *reader,
+	                         const gchar *path,
+	                         guint width);
 };
 
 GType       photo_meta_reader_get_type      (void);
@@ -71,6 +74,13 @@ gboolean photo_meta_reader_read (PhotoMetaReader *reader,
 
 GOptionGroup *photo_meta_reader_get_option_group (PhotoMetaReader *reader);
 
+/* Returns the picture at path as a JPEG no more than width wide, or NULL
+ * if the reader cannot resize pictures.
+ */
+GByteArray *photo_meta_reader_resize (PhotoMetaReader *reader,
+                                      const gchar *path,
+                                      guint width);
+
 #endif /* __PHOTO_META_READER */
 
 G_END_DECLS
@@ -28,6 +28,11 @@
 
 #include "util.h"
 #include "util-gst.h"
+#include "dmapd-faststart.h"
+#include "dmapd-file-stream.h"
+#include "dmapd-transcode-cache.h"
+
+#define TRANSCODE_REPORT_INTERVAL 10 /* Seconds. */
 
 /* FIXME: copied from libdmapsharing: */
 gboolean
@@ -87,38 +92,43 @@ transition_pipeline (GstElement *pipeline, GstState state)
 	return fnval;
 }
 
-static void
-do_transcode (DAAPRecord *record, gchar *cachepath, gchar* target_mimetype)
+/* NOTE: writes to a temporary file renamed into place, so that a
+ * transcode cut short never leaves a partial file at cachepath.
+ */
+static gboolean
+do_transcode (const gchar *location, gchar *cachepath, gchar* target_mimetype)
 {
+	int fd;
 	gssize read_size;
 	gchar buf[BUFSIZ];
+	gboolean fnval = FALSE;
 	GError *error = NULL;
+	FILE *outfile = NULL;
+	gchar *tmppath = NULL;
 	GInputStream *stream = NULL;
 	GInputStream *decoded_stream = NULL;
 	
-	stream = daap_record_read (record, &error);
+	/* NOTE: the source itself, not through the record's read filter. */
+	stream = dmapd_file_stream_open (location, &error);
 	if (NULL == stream) {
-		gchar *location = NULL;
-		g_object_get (record, "location", &location, NULL);
-		g_assert (NULL != location);
 		g_warning ("Error opening %s: %s", location, error->message);
 		g_error_free (error);
-		g_free (location);
 		goto _return;
 	}
 	decoded_stream = dmap_gst_input_stream_new (target_mimetype, stream);
 	if (NULL == decoded_stream) {
-		gchar *location;
-		g_object_get (record, "location", &location, NULL);
-		g_assert (NULL != location);
 		g_warning ("Error opening %s", location);
-		g_free (location);
 		goto _return;
 	}
 
-	FILE *outfile = fopen (cachepath, "w");
-	if (outfile == NULL) {
-		 g_warning ("Error opening: %s", cachepath);
+	tmppath = g_strdup_printf ("%s.XXXXXX", cachepath);
+	fd = g_mkstemp (tmppath);
+	if (-1 == fd || NULL == (outfile = fdopen (fd, "w"))) {
+		 g_warning ("Error opening: %s", tmppath);
+		 if (-1 != fd) {
+			close (fd);
+			unlink (tmppath);
+		 }
 		 goto _return;
 	}
 
@@ -141,9 +151,23 @@ do_transcode (DAAPRecord *record, gchar *cachepath, gchar* target_mimetype)
 		}
 	} while (read_size > 0);
 
+	fnval = TRUE;
+
 _return:
 	if (NULL != outfile) {
-		fclose (outfile);
+		if (0 != fclose (outfile)) {
+			g_warning ("Error writing transcoded data");
+			fnval = FALSE;
+		}
+
+		if (fnval && -1 == rename (tmppath, cachepath)) {
+			g_warning ("Error renaming %s to %s", tmppath, cachepath);
+			fnval = FALSE;
+		}
+
+		if (! fnval) {
+			unlink (tmppath);
+		}
 	}
 
 	if (NULL != decoded_stream) {
@@ -154,49 +178,221 @@ _return:
 		g_input_stream_close (stream, NULL, NULL); /* FIXME: should this be done in GGstMp3InputStream class? */
 	}
 
-	return;
+	g_free (tmppath);
+
+	return fnval;
 }
 
-/* NOTE: This is here and not in the individual DMAPRecords because records
- * have no knowledge of the database, db_dir, etc.
+struct transcode_scheduler_t {
+	db_dir_and_target_transcode_mimetype_t df;
+	gboolean deferred;
+	GThreadPool *pool;
+	GMutex lock;
+	GHashTable *pending;  /* Location to record, for those not yet started. */
+	GHashTable *seen;     /* Locations ever added, until switched back. */
+	guint64 requests;     /* Priority of the latest request. */
+	guint total;
+	guint done;
+	guint64 bytes;        /* Of source transcoded. */
+	GTimer *timer;
+	gdouble reported;
+	DmapdTranscodeCache *cache; /* NULL if the cache has no budget. */
+	GHashTable *switched; /* Cache path to transcoded_t of the source. */
+};
+
+typedef struct {
+	DAAPRecord *record;
+	gchar *path;
+	gchar *location;
+	gchar *format;
+	guint64 filesize;
+	gboolean fresh;       /* Just written, rather than found. */
+	transcode_scheduler_t *scheduler;
+} transcoded_t;
+
+static void
+transcoded_free (transcoded_t *transcoded)
+{
+	g_object_unref (transcoded->record);
+	g_free (transcoded->path);
+	g_free (transcoded->location);
+	g_free (transcoded->format);
+	g_free (transcoded);
+}
+
+/* Points the record of a file evicted from the cache back at its source,
+ * which is then transcoded in real-time or, if remuxed, served as it is.
  */
-void
-transcode_cache (gpointer id, DAAPRecord *record, db_dir_and_target_transcode_mimetype_t *df)
+static void
+switch_to_source (transcode_scheduler_t *scheduler, const gchar *path)
+{
+	transcoded_t *source = g_hash_table_lookup (scheduler->switched, path);
+
+	if (NULL != source) {
+		gchar *uri = g_filename_to_uri (path, NULL, NULL);
+
+		g_object_set (source->record, "location", source->location,
+		                              "format",   source->format,
+		                              "filesize", source->filesize,
+		                               NULL);
+		g_hash_table_remove (scheduler->seen, source->location);
+
+		if (NULL != uri) {
+			g_hash_table_remove (scheduler->seen, uri);
+			g_free (uri);
+		}
+
+		g_hash_table_remove (scheduler->switched, path);
+	}
+}
+
+/* Points record at its transcoded file, all three properties at once. */
+static gboolean
+switch_to_transcoded (transcoded_t *transcoded)
 {
+	transcode_scheduler_t *scheduler = transcoded->scheduler;
+
+	if (NULL != scheduler) {
+		g_mutex_lock (&scheduler->lock);
+	}
+
+	/* NOTE: the file may have been evicted since it was found; the record
+	 * then keeps its source.
+	 */
+	if (! g_file_test (transcoded->path, G_FILE_TEST_IS_REGULAR)) {
+		g_debug ("Transcoded file %s is gone", transcoded->path);
+		goto _done;
+	}
+
+	if (NULL != scheduler) {
+		/* NOTE: a remuxed video keeps its format; do not remux it again. */
+		g_hash_table_add (scheduler->seen, g_strdup (transcoded->location));
+
+		if (NULL != scheduler->cache) {
+			GSList *evicted, *l;
+			transcoded_t *source = g_new (transcoded_t, 1);
+
+			source->record = g_object_ref (transcoded->record);
+			source->path = NULL;
+			source->fresh = FALSE;
+			source->scheduler = NULL;
+			g_object_get (transcoded->record, "location", &source->location,
+			                                  "format",   &source->format,
+			                                  "filesize", &source->filesize,
+			                                   NULL);
+
+			g_hash_table_insert (scheduler->switched, g_strdup (transcoded->path), source);
+
+			/* NOTE: files found were tracked, in order of use, when opened. */
+			if (transcoded->fresh) {
+				evicted = dmapd_transcode_cache_add (scheduler->cache, transcoded->path);
+				for (l = evicted; l; l = l->next) {
+					switch_to_source (scheduler, l->data);
+				}
+				slist_deep_free (evicted);
+			}
+		}
+	}
+
+	g_object_set (transcoded->record, "location", transcoded->location,
+	                                  "format",   transcoded->format,
+	                                  "filesize", transcoded->filesize,
+	                                   NULL);
+
+_done:
+	if (NULL != scheduler) {
+		g_mutex_unlock (&scheduler->lock);
+	}
+
+	transcoded_free (transcoded);
+
+	return FALSE;
+}
+
+/* What is to be transcoded, copied from the record on the main loop:
+ * workers never read the properties of a record the main loop may be
+ * switching.
+ */
+typedef struct {
+	DAAPRecord *record;
+	gchar *location;
+	gchar *format;
+	gboolean has_video;
+	guint64 filesize;
+	guint64 priority;     /* 0 for background jobs. */
+} transcode_job_t;
+
+static transcode_job_t *
+job_new (DAAPRecord *record, guint64 priority)
+{
+	transcode_job_t *job = g_new0 (transcode_job_t, 1);
+
+	job->record = g_object_ref (record);
+	job->priority = priority;
+
+	g_object_get (record, "location",  &job->location,
+	                      "format",    &job->format,
+	                      "has-video", &job->has_video,
+	                      "filesize",  &job->filesize,
+	                       NULL);
+
+	return job;
+}
+
+static void
+job_free (transcode_job_t *job)
+{
+	g_object_unref (job->record);
+	g_free (job->location);
+	g_free (job->format);
+	g_free (job);
+}
+
+/* Returns the size of the source transcoded, or 0 if the record needed no
+ * transcoding, had been transcoded before, was not to be transcoded or
+ * failed. Videos are remuxed rather than transcoded. With a scheduler,
+ * the record is switched to its transcoded file from the main loop,
+ * which is serving it.
+ */
+static guint64
+transcode_record (transcode_job_t *job, db_dir_and_target_transcode_mimetype_t *df, transcode_scheduler_t *scheduler, gboolean may_transcode)
+{
+	transcoded_t *transcoded;
+	gboolean fresh = FALSE;
+	gboolean remux;
 	struct stat statbuf;
-	gboolean has_video = FALSE;
-	gchar *location = NULL;
-	gchar *format = NULL;
+	const gchar *location = job->location;
+	const gchar *format = job->format;
+	gchar *format2 = NULL;
 	gchar *cacheuri = NULL;
 	gchar *cachepath = NULL;
 	guint64 filesize;
+	guint64 fnval = 0;
 
 	g_assert (df->db_dir);
-	g_assert (df->target_transcode_mimetype);
-
-	g_object_get (record,
-		     "location",
-		     &location,
-		      "format",
-		     &format,
-		     "has-video",
-		     &has_video,
-		      NULL);
 
 	if (! (location && format)) {
 		g_warning ("Error reading record properties for transcoding");
 		goto _return;
 	}
 
-	gchar *format2 = dmap_mime_to_format (df->target_transcode_mimetype);
-	if (NULL == format2) {
-		g_warning ("Cannot transcode %s\n", df->target_transcode_mimetype);
+	/* NOTE: videos are only remuxed, keeping their format. */
+	remux = job->has_video && dmapd_faststart_format (format);
+	if (remux) {
+		format2 = g_strdup (format);
+	} else if (NULL == df->target_transcode_mimetype) {
 		goto _return;
-	}
+	} else {
+		format2 = dmap_mime_to_format (df->target_transcode_mimetype);
+		if (NULL == format2) {
+			g_warning ("Cannot transcode %s\n", df->target_transcode_mimetype);
+			goto _return;
+		}
 
-	if (! strcmp (format, format2)) {
-		g_debug ("Transcoding not necessary %s", location);
-		goto _return;
+		if (! strcmp (format, format2)) {
+			g_debug ("Transcoding not necessary %s", location);
+			goto _return;
+		}
 	}
 
 	cachepath = cache_path (CACHE_TYPE_TRANSCODED_DATA, df->db_dir, location);
@@ -206,9 +402,33 @@ transcode_cache (gpointer id, DAAPRecord *record, db_dir_and_target_transcode_mi
 	}
 
 	if (! g_file_test (cachepath, G_FILE_TEST_EXISTS)) {
-		/* FIXME: return value, not void: */
-		g_debug ("Transcoding %s to %s", location, cachepath);
-		do_transcode (record, cachepath, df->target_transcode_mimetype);
+		if (! may_transcode) {
+			g_debug ("Leaving %s to real-time transcoding", location);
+			goto _return;
+		}
+
+		if (remux) {
+			gchar *path = g_filename_from_uri (location, NULL, NULL);
+			gboolean remuxed = FALSE;
+
+			if (NULL != path && dmapd_faststart_needed (path)) {
+				g_debug ("Remuxing %s to %s", location, cachepath);
+				remuxed = dmapd_faststart_remux (path, cachepath);
+			}
+
+			g_free (path);
+
+			if (! remuxed) {
+				goto _return;
+			}
+		} else {
+			g_debug ("Transcoding %s to %s", location, cachepath);
+			if (! do_transcode (location, cachepath, df->target_transcode_mimetype)) {
+				goto _return;
+			}
+		}
+		fnval = job->filesize;
+		fresh = TRUE;
 	} else {
 		g_debug ("Found transcoded data at %s for %s", cachepath, location);
 	}
@@ -226,27 +446,271 @@ transcode_cache (gpointer id, DAAPRecord *record, db_dir_and_target_transcode_mi
 		goto _return;
 	}
 
-	g_object_set (record, "location", cacheuri,
-	                      "format",   format2,
-	                      "filesize", filesize,
-	                       NULL);
+	transcoded = g_new (transcoded_t, 1);
+	transcoded->record    = g_object_ref (job->record);
+	transcoded->path      = cachepath;
+	transcoded->location  = cacheuri;
+	transcoded->format    = format2;
+	transcoded->filesize  = filesize;
+	transcoded->fresh     = fresh;
+	transcoded->scheduler = scheduler;
+
+	cachepath = NULL;
+	cacheuri  = NULL;
+	format2   = NULL;
+
+	if (NULL != scheduler) {
+		g_idle_add ((GSourceFunc) switch_to_transcoded, transcoded);
+	} else {
+		switch_to_transcoded (transcoded);
+	}
 
 _return:
-	if (location) {
-		g_free (location);
+	g_free (cacheuri);
+	g_free (cachepath);
+	g_free (format2);
+
+	return fnval;
+}
+
+/* NOTE: This is here and not in the individual DMAPRecords because records
+ * have no knowledge of the database, db_dir, etc.
+ */
+void
+transcode_cache (gpointer id, DAAPRecord *record, db_dir_and_target_transcode_mimetype_t *df)
+{
+	transcode_job_t *job = job_new (record, 0);
+
+	transcode_record (job, df, NULL, TRUE);
+	job_free (job);
+}
+
+static gint
+compare_jobs (transcode_job_t *a, transcode_job_t *b, gpointer user_data)
+{
+	return a->priority > b->priority ? -1 : a->priority < b->priority ? 1 : 0;
+}
+
+/* NOTE: called from the main loop, which alone switches records. */
+static void
+push_job (transcode_scheduler_t *scheduler, DAAPRecord *record, guint64 priority)
+{
+	g_thread_pool_push (scheduler->pool, job_new (record, priority), NULL);
+}
+
+static void
+run_job (transcode_job_t *job, transcode_scheduler_t *scheduler)
+{
+	gboolean pending;
+	gboolean may_transcode;
+	guint64 bytes;
+	gdouble elapsed;
+
+	/* NOTE: a record is pushed again when requested; run it once. */
+	g_mutex_lock (&scheduler->lock);
+	pending = NULL != job->location && g_hash_table_remove (scheduler->pending, job->location);
+	g_mutex_unlock (&scheduler->lock);
+
+	if (! pending) {
+		goto _done;
 	}
-	if (format) {
-		g_free (format);
+
+	/* NOTE: once the cache is full, only requested tracks displace others. */
+	g_mutex_lock (&scheduler->lock);
+	may_transcode = 0 != job->priority || NULL == scheduler->cache || ! dmapd_transcode_cache_is_full (scheduler->cache);
+	g_mutex_unlock (&scheduler->lock);
+
+	bytes = transcode_record (job, &scheduler->df, scheduler->deferred ? scheduler : NULL, may_transcode);
+
+	g_mutex_lock (&scheduler->lock);
+
+	scheduler->done++;
+	scheduler->bytes += bytes;
+
+	elapsed = g_timer_elapsed (scheduler->timer, NULL);
+	if (elapsed - scheduler->reported >= TRANSCODE_REPORT_INTERVAL || scheduler->done == scheduler->total) {
+		g_message ("Transcoded %u of %u files; %.1f MB/s of source",
+		            scheduler->done,
+		            scheduler->total,
+		            elapsed > 0 ? scheduler->bytes / elapsed / (1024 * 1024) : 0);
+		scheduler->reported = elapsed;
 	}
-	if (cacheuri) {
-		g_free (cacheuri);
+
+	g_mutex_unlock (&scheduler->lock);
+
+_done:
+	job_free (job);
+}
+
+transcode_scheduler_t *
+transcode_scheduler_new (db_dir_and_target_transcode_mimetype_t *df, guint jobs, gboolean deferred, guint64 budget)
+{
+	transcode_scheduler_t *scheduler = g_new0 (transcode_scheduler_t, 1);
+
+	scheduler->df.db_dir = g_strdup (df->db_dir);
+	scheduler->df.target_transcode_mimetype = g_strdup (df->target_transcode_mimetype);
+	scheduler->deferred = deferred;
+	scheduler->pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	scheduler->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	scheduler->timer = g_timer_new ();
+	g_mutex_init (&scheduler->lock);
+
+	if (budget > 0) {
+		scheduler->cache = dmapd_transcode_cache_new (df->db_dir, budget);
+		scheduler->switched = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) transcoded_free);
 	}
-	if (cachepath) {
-		g_free (cachepath);
+
+	/* NOTE: each job runs its own GStreamer pipeline. */
+	scheduler->pool = g_thread_pool_new ((GFunc) run_job, scheduler, MAX (1, jobs), FALSE, NULL);
+	g_thread_pool_set_sort_function (scheduler->pool, (GCompareDataFunc) compare_jobs, NULL);
+
+	return scheduler;
+}
+
+/* NOTE: must hold scheduler->lock; takes location. */
+static void
+add_locked (transcode_scheduler_t *scheduler, DAAPRecord *record, gchar *location, guint64 priority)
+{
+	if (g_hash_table_contains (scheduler->seen, location)) {
+		g_free (location);
+	} else {
+		g_hash_table_add (scheduler->seen, g_strdup (location));
+		g_hash_table_insert (scheduler->pending, location, g_object_ref (record));
+		scheduler->total++;
+		push_job (scheduler, record, priority);
 	}
-	if (format2) {
-		g_free (format2);
+}
+
+void
+transcode_scheduler_add (transcode_scheduler_t *scheduler, DAAPRecord *record)
+{
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL == location) {
+		goto _done;
 	}
 
+	g_mutex_lock (&scheduler->lock);
+	add_locked (scheduler, record, location, 0);
+	g_mutex_unlock (&scheduler->lock);
+
+_done:
 	return;
 }
+
+void
+transcode_scheduler_prioritize (DAAPRecord *record, transcode_scheduler_t *scheduler)
+{
+	gchar *location = NULL;
+	DAAPRecord *pending;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL == location) {
+		goto _done;
+	}
+
+	g_mutex_lock (&scheduler->lock);
+
+	/* NOTE: push the record held, which may not be the one read. */
+	pending = g_hash_table_lookup (scheduler->pending, location);
+	if (NULL != pending) {
+		g_debug ("Moving transcode of %s ahead", location);
+		push_job (scheduler, pending, ++scheduler->requests);
+	} else if (NULL != scheduler->cache) {
+		gchar *path = g_filename_from_uri (location, NULL, NULL);
+		if (NULL != path && g_hash_table_contains (scheduler->switched, path)) {
+			dmapd_transcode_cache_touch (scheduler->cache, path);
+		}
+		g_free (path);
+	}
+
+	g_mutex_unlock (&scheduler->lock);
+
+_done:
+	g_free (location);
+}
+
+void
+transcode_scheduler_request (DAAPRecord *record, transcode_scheduler_t *scheduler)
+{
+	gchar *location = NULL;
+	gchar *format = NULL;
+	gchar *format2 = NULL;
+	gboolean has_video = FALSE;
+	gboolean wanted;
+
+	g_object_get (record, "location", &location, "format", &format, "has-video", &has_video, NULL);
+
+	if (NULL != scheduler->df.target_transcode_mimetype) {
+		format2 = dmap_mime_to_format (scheduler->df.target_transcode_mimetype);
+	}
+
+	wanted = NULL != format
+	      && ((has_video && dmapd_faststart_format (format))
+	       || (NULL != format2 && strcmp (format, format2)));
+
+	if (NULL == location || ! wanted) {
+		/* NOTE: includes records already switched to transcoded files. */
+		transcode_scheduler_prioritize (record, scheduler);
+		goto _done;
+	}
+
+	g_mutex_lock (&scheduler->lock);
+
+	if (g_hash_table_contains (scheduler->seen, location)) {
+		g_mutex_unlock (&scheduler->lock);
+		transcode_scheduler_prioritize (record, scheduler);
+	} else {
+		g_debug ("Caching transcode of %s", location);
+		add_locked (scheduler, record, location, ++scheduler->requests);
+		location = NULL;
+		g_mutex_unlock (&scheduler->lock);
+	}
+
+_done:
+	g_free (location);
+	g_free (format);
+	g_free (format2);
+}
+
+void
+transcode_scheduler_free (transcode_scheduler_t *scheduler)
+{
+	g_thread_pool_free (scheduler->pool, FALSE, TRUE);
+
+	if (NULL != scheduler->cache) {
+		dmapd_transcode_cache_free (scheduler->cache);
+		g_hash_table_destroy (scheduler->switched);
+	}
+
+	g_hash_table_destroy (scheduler->pending);
+	g_hash_table_destroy (scheduler->seen);
+	g_timer_destroy (scheduler->timer);
+	g_mutex_clear (&scheduler->lock);
+	g_free (scheduler->df.db_dir);
+	g_free (scheduler->df.target_transcode_mimetype);
+	g_free (scheduler);
+}
+
+static void
+add_to_scheduler (gpointer id, DAAPRecord *record, transcode_scheduler_t *scheduler)
+{
+	transcode_scheduler_add (scheduler, record);
+}
+
+void
+transcode_scheduler_add_all (transcode_scheduler_t *scheduler, DMAPDb *db)
+{
+	dmap_db_foreach (db, (GHFunc) add_to_scheduler, scheduler);
+}
+
+void
+transcode_cache_all (DMAPDb *db, db_dir_and_target_transcode_mimetype_t *df, guint jobs)
+{
+	transcode_scheduler_t *scheduler;
+
+	scheduler = transcode_scheduler_new (df, jobs, FALSE, 0);
+	transcode_scheduler_add_all (scheduler, db);
+	transcode_scheduler_free (scheduler);
+}
@@ -38,4 +38,31 @@ gboolean pads_compatible (GstPad *pad1, GstPad *pad2);
 gboolean transition_pipeline (GstElement *pipeline, GstState state);
 void     transcode_cache (gpointer id, DAAPRecord *record, db_dir_and_target_transcode_mimetype_t* df);
 
+/* Transcodes every record in db using jobs threads, reporting progress
+ * as it goes; returns when all are done.
+ */
+void     transcode_cache_all (DMAPDb *db, db_dir_and_target_transcode_mimetype_t *df, guint jobs);
+
+/* Transcodes records in the background using jobs threads. If deferred,
+ * each record switches to its transcoded file from the main loop, so the
+ * main loop may serve records meanwhile. Records requested while they
+ * wait are transcoded first, most recent first. With a budget in bytes,
+ * deferred records switch back to real-time transcoding when their files
+ * are evicted, least recently used first; once the cache is full, only
+ * requested records are transcoded. Videos whose moov atom follows their
+ * media data are remuxed instead, even if df has no target MIME type.
+ */
+typedef struct transcode_scheduler_t transcode_scheduler_t;
+
+transcode_scheduler_t *transcode_scheduler_new (db_dir_and_target_transcode_mimetype_t *df, guint jobs, gboolean deferred, guint64 budget);
+void     transcode_scheduler_add        (transcode_scheduler_t *scheduler, DAAPRecord *record);
+void     transcode_scheduler_add_all    (transcode_scheduler_t *scheduler, DMAPDb *db);
+void     transcode_scheduler_prioritize (DAAPRecord *record, transcode_scheduler_t *scheduler);
+/* As prioritize, but also adds the record if it was never added, so that
+ * what is transcoded in real-time is kept for the plays after.
+ */
+void     transcode_scheduler_request    (DAAPRecord *record, transcode_scheduler_t *scheduler);
+/* Waits for the transcoding to finish. */
+void     transcode_scheduler_free       (transcode_scheduler_t *scheduler);
+
 #endif
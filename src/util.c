@@ -24,6 +24,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "util.h"
 #include "dmapd-module.h"
@@ -36,6 +37,9 @@
 
 static GHashTable *stringleton;
 
+/* NOTE: records may be created by several DbBuilder threads at once. */
+G_LOCK_DEFINE_STATIC (stringleton);
+
 gchar *
 parse_plugin_option (gchar *str, GHashTable *hash_table)
 {
@@ -121,6 +125,8 @@ const gchar *stringleton_ref (const gchar *str)
 
 	g_assert (stringleton);
 
+	G_LOCK (stringleton);
+
 	/* NOTE: insert will free passed str if the key already exists,
 	 * not existing key in hash table.
 	 */
@@ -137,6 +143,8 @@ const gchar *stringleton_ref (const gchar *str)
 		                     val + 1);
 	}
 
+	G_UNLOCK (stringleton);
+
 	g_debug ("        Increment stringleton %s reference count to %u.", str, GPOINTER_TO_UINT (val));
 
 	return str;
@@ -149,6 +157,8 @@ void stringleton_unref (const gchar *str)
 	g_assert (stringleton);
 
 	if (str != NULL) {
+		G_LOCK (stringleton);
+
 		count = GPOINTER_TO_UINT (g_hash_table_lookup (stringleton,
 							      (gpointer) str));
 
@@ -164,6 +174,8 @@ void stringleton_unref (const gchar *str)
 		} else if (count == 1) {
 			g_hash_table_remove (stringleton, (gpointer) str);
 		}
+
+		G_UNLOCK (stringleton);
 	}
 }
 
@@ -222,12 +234,19 @@ object_from_module (GType type, const gchar *module_dir, const gchar *module_nam
 		if (module == NULL || ! g_type_module_use (G_TYPE_MODULE (module))) {
 			g_warning ("Error opening %s", module_path);
 		} else {
-			/* FIXME: free filters */
+			guint i;
+
+			/* Several modules may implement type; use this one's. */
 			filters = g_type_children (type, &n_filters);
-			g_assert (n_filters == 1);
-			g_assert (g_type_is_a (filters[0], type));
+			for (i = 0; i < n_filters; i++) {
+				if (g_type_get_plugin (filters[i]) == G_TYPE_PLUGIN (module)) {
+					child_type = filters[i];
+					break;
+				}
+			}
+			g_assert (child_type != G_TYPE_INVALID);
+			g_assert (g_type_is_a (child_type, type));
 
-			child_type = filters[0];
 			fnval = g_object_new_valist (child_type, first_property_name, ap);
 		}
 
@@ -328,8 +347,86 @@ _done:
         return cachepath;
 }
 
-void
-cache_store (const gchar *db_dir, const gchar *uri, GByteArray *blob)
+guint
+cache_remove_stale (const gchar *db_dir, GHashTable *hashes)
+{
+	GDir *dir;
+	const gchar *name;
+	guint fnval = 0;
+
+	dir = g_dir_open (db_dir, 0, NULL);
+	if (NULL == dir) {
+		goto _done;
+	}
+
+	while (NULL != (name = g_dir_read_name (dir))) {
+		gboolean stale;
+		const gchar *suffix = strchr (name, '.');
+
+		if (NULL == suffix || suffix - name != DMAP_HASH_SIZE * 2) {
+			continue;
+		}
+
+		if (! strcmp (suffix, ".record") || ! strcmp (suffix, ".data") || ! strcmp (suffix, ".thumb")) {
+			gchar *hash = g_strndup (name, suffix - name);
+			stale = ! g_hash_table_contains (hashes, hash);
+			g_free (hash);
+		} else if (g_str_has_prefix (suffix, ".data.")) {
+			/* NOTE: left by a transcode cut short. */
+			stale = TRUE;
+		} else {
+			continue;
+		}
+
+		if (stale) {
+			gchar *path = g_build_filename (db_dir, name, NULL);
+
+			g_debug ("Removing stale %s", path);
+			if (0 == g_unlink (path)) {
+				fnval++;
+			} else {
+				g_warning ("Could not remove %s", path);
+			}
+
+			g_free (path);
+		}
+	}
+
+	g_dir_close (dir);
+
+_done:
+	return fnval;
+}
+
+gchar *
+cache_record_path (const gchar *db_dir, DMAPRecord *record)
+{
+	gchar *hash;
+	gchar *location = NULL;
+	gchar *cachepath = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+	if (NULL == location) {
+		goto _done;
+	}
+
+	/* NOTE: containers are directories or playlists, which change. */
+	if (G_TYPE_CHECK_INSTANCE_TYPE (record, DMAP_TYPE_CONTAINER_RECORD)) {
+		hash = g_compute_checksum_for_string (G_CHECKSUM_MD5, location, -1);
+		cachepath = g_strdup_printf ("%s/%s.%s", db_dir, hash, "record");
+		g_free (hash);
+	} else {
+		cachepath = cache_path (CACHE_TYPE_RECORD, db_dir, location);
+	}
+
+_done:
+	g_free (location);
+
+	return cachepath;
+}
+
+gchar *
+cache_store (const gchar *db_dir, DMAPRecord *record, GByteArray *blob)
 {
         struct stat st;
         gchar *cachepath = NULL;
@@ -343,7 +440,7 @@ cache_store (const gchar *db_dir, const gchar *uri, GByteArray *blob)
                 g_warning ("%s is not a directory, will not cache", db_dir);
 		goto _done;
         }
-        cachepath = cache_path (CACHE_TYPE_RECORD, db_dir, uri);
+        cachepath = cache_record_path (db_dir, record);
 	if (NULL == cachepath) {
 		goto _done;
 	}
@@ -354,13 +451,12 @@ cache_store (const gchar *db_dir, const gchar *uri, GByteArray *blob)
 			     &error);
         if (error != NULL) {
                 g_warning ("Error writing %s: %s", cachepath, error->message);
+		g_error_free (error);
+		g_free (cachepath);
+		cachepath = NULL;
 		goto _done;
         }
 
 _done:
-	if (NULL != cachepath) {
-		g_free (cachepath);
-	}
-
-	return;
+	return cachepath;
 }
@@ -59,7 +59,22 @@ GObject *object_from_module (GType type,
 
 gchar *cache_path (cache_type_t type, const gchar *db_dir, const gchar *imagepath);
 
-void cache_store (const gchar *db_dir, const gchar *uri, GByteArray *blob);
+/* Returns the path under db_dir at which record is stored: by the hash
+ * of its file for media, whose transcoded data and thumbnails share the
+ * name, and by the hash of its location for containers.
+ */
+gchar *cache_record_path (const gchar *db_dir, DMAPRecord *record);
+
+/* Writes blob, serialized from record, to its path under db_dir, which
+ * is returned, or NULL on error.
+ */
+gchar *cache_store (const gchar *db_dir, DMAPRecord *record, GByteArray *blob);
+
+/* Removes the cached records, transcoded data and thumbnails in db_dir
+ * whose source's hash, as a hex string, is not in hashes, along with
+ * transcoded data never finished. Returns the number removed.
+ */
+guint cache_remove_stale (const gchar *db_dir, GHashTable *hashes);
 
 gboolean dmapd_util_hash_file (const gchar *uri, unsigned char hash[DMAP_HASH_SIZE]);
 